@@ -60,24 +60,27 @@ void DeliveryTxn::Prepare()
     // But for partitioning based system, the scan maybe staled and thus
     // non-serializable. Although this is unlikely to happen if the epoch size
     // is small enough.
-    for (auto no_it = mgr.Get<NewOrder>().IndexSearchIterator(
-             neworder_start.EncodeViewRoutine(), neworder_end.EncodeViewRoutine());
-         no_it->IsValid(); no_it->Next()) {
-      no_key = no_it->key().template ToType<NewOrder::Key>();
-
-      if (no_it->row()->ShouldScanSkip(serial_id())) {
-        logger->warn("TPCC Delivery: skipping w {} d {} oid {} (from node {}), first ver {}",
-                     warehouse_id, district_id, no_key.no_o_id >> 8, no_key.no_o_id & 0xFF,
-                     no_it->row()->first_version());
-        break;
-      }
-      goto found;
+    bool found = false;
+    mgr.Get<NewOrder>().Scan(
+        neworder_start.EncodeViewRoutine(), neworder_end.EncodeViewRoutine(),
+        [&](const VarStrView &k, VHandle *row) {
+          no_key = k.ToType<NewOrder::Key>();
+
+          if (row->ShouldScanSkip(serial_id())) {
+            logger->warn("TPCC Delivery: skipping w {} d {} oid {} (from node {}), first ver {}",
+                         warehouse_id, district_id, no_key.no_o_id >> 8, no_key.no_o_id & 0xFF,
+                         row->first_version());
+          } else {
+            found = true;
+          }
+          return false;
+        });
+    if (!found) {
+      state->nodes[i] = NodeBitmap();
+      logger->warn("TPCC Delivery: sid {} oid_min {}", serial_id(), oid_min >> 8);
+      // std::abort();
+      continue;
     }
-    state->nodes[i] = NodeBitmap();
-    logger->warn("TPCC Delivery: sid {} oid_min {}", serial_id(), oid_min >> 8);
-    // std::abort();
-    continue;
- found:
 
     auto oid = no_key.no_o_id;
     auto customer_id = no_key.no_c_id;
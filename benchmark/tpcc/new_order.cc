@@ -51,7 +51,6 @@ void NewOrderTxn::PrepareInsert()
 
   auto oorder_key = OOrder::Key::New(warehouse_id, district_id, oorder_id);
   auto neworder_key = NewOrder::Key::New(warehouse_id, district_id, oorder_id, customer_id);
-  auto cididx_key = OOrderCIdIdx::Key::New(warehouse_id, district_id, customer_id, oorder_id);
   OrderLine::Key orderline_keys[kNewOrderMaxItems];
   auto nr_items = detail.nr_items;
   bool all_local = true;
@@ -74,8 +73,10 @@ void NewOrderTxn::PrepareInsert()
   }
 
   auto args0 = Tuple<OrderDetail>(detail);
-  auto args1 = OOrder::Value::New(customer_id, 0, nr_items,
-                                  all_local, ts_now);
+  // The key goes along for OOrderCIdIdx, see OtherInsertCompletion.
+  auto args1 = Tuple<OOrder::Key, OOrder::Value>(
+      oorder_key,
+      OOrder::Value::New(customer_id, 0, nr_items, all_local, ts_now));
 
   if (g_tpcc_config.IsWarehousePinnable() || !VHandleSyncService::g_lock_elision) {
     if (g_tpcc_config.IsWarehousePinnable()) {
@@ -88,11 +89,10 @@ void NewOrderTxn::PrepareInsert()
             KeyParam<OrderLine>(orderline_keys, nr_items));
 
     state->other_inserts_nodes =
-        TxnIndexInsert<TpccSliceRouter, NewOrderState::OtherInsertCompletion, OOrder::Value>(
+        TxnIndexInsert<TpccSliceRouter, NewOrderState::OtherInsertCompletion, Tuple<OOrder::Key, OOrder::Value>>(
             &args1,
             KeyParam<OOrder>(oorder_key),
-            KeyParam<NewOrder>(neworder_key),
-            KeyParam<OOrderCIdIdx>(cididx_key));
+            KeyParam<NewOrder>(neworder_key));
 
 #if 0 // Hmm...I don't think we need to keep track of the inserts
     if (VHandleSyncService::g_lock_elision && Client::g_enable_pwv) {
@@ -122,11 +122,9 @@ void NewOrderTxn::PrepareInsert()
 
     // txn_indexop_affinity = parts[1];
     state->other_inserts_nodes =
-        TxnIndexInsert<TpccSliceRouter, NewOrderState::OtherInsertCompletion, OOrder::Value>(
+        TxnIndexInsert<TpccSliceRouter, NewOrderState::OtherInsertCompletion, Tuple<OOrder::Key, OOrder::Value>>(
             &args1,
-            KeyParam<OOrder>(oorder_key),
-            PlaceholderParam(),
-            KeyParam<OOrderCIdIdx>(cididx_key));
+            KeyParam<OOrder>(oorder_key));
 
     // txn_indexop_affinity = parts[2];
     state->other_inserts_nodes +=
@@ -293,11 +291,6 @@ void NewOrderTxn::Run()
           if (bitmap & 0x02) {
             state->neworder_future.Invoke(&state, index_handle);
           }
-
-          if (bitmap & 0x04) {
-            index_handle(state->cididx).WriteTryInline(OOrderCIdIdx::Value());
-            ClientBase::OnUpdateRow(state->cididx);
-          }
         });
   }
 
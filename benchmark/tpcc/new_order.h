@@ -4,6 +4,7 @@
 #include "tpcc.h"
 #include "txn_cc.h"
 #include "piece_cc.h"
+#include "secondary_index.h"
 #include <tuple>
 
 namespace tpcc {
@@ -62,21 +63,21 @@ struct NewOrderState {
 
   VHandle *oorder; // insert
   VHandle *neworder; // insert
-  VHandle *cididx; // insert
 
   struct OtherInsertCompletion : public TxnStateCompletion<NewOrderState> {
-    OOrder::Value args;
+    Tuple<OOrder::Key, OOrder::Value> args;
     void operator()(int id, VHandle *row) {
       handle(row).AppendNewVersion();
       if (id == 0) {
+        auto &[oorder_key, oorder_value] = args;
         state->oorder = row;
-        handle(row).WriteTryInline(args);
+        handle(row).WriteTryInline(oorder_value);
+        // OOrderCIdIdx goes next to the order.
+        util::Instance<SecondaryIndexManager>().OnInsert<OOrder>(
+            handle.serial_id(), oorder_key, oorder_value);
       } else if (id == 1) {
         state->neworder = row;
         handle(row).WriteTryInline(NewOrder::Value());
-      } else if (id == 2) {
-        state->cididx = row;
-        handle(row).WriteTryInline(OOrderCIdIdx::Value());
       }
       // handle(row).AppendNewVersion(id < 2);
     }
@@ -8,7 +8,7 @@ OrderStatusStruct ClientBase::GenerateTransactionInput<OrderStatusStruct>()
   OrderStatusStruct s;
   s.warehouse_id = PickWarehouse();
   s.district_id = PickDistrict();
-  s.customer_id = GetCustomerId();
+  s.customer_id = PickCustomer(s.warehouse_id, s.district_id);
   return s;
 }
 
@@ -40,13 +40,13 @@ static void ScanOrdersIndex(
                                            0);
   auto &mgr = util::Instance<TableManager>();
   int oid = -1;
-  for (auto it = mgr.Get<OOrderCIdIdx>().IndexReverseIterator(
-           cididx_start.EncodeViewRoutine(), cididx_end.EncodeViewRoutine()); it->IsValid(); it->Next()) {
-    if (it->row()->ShouldScanSkip(sid)) continue;
-    auto cididx_key = it->key().ToType<OOrderCIdIdx::Key>();
-    oid = cididx_key.o_o_id;
-    break;
-  }
+  mgr.Get<OOrderCIdIdx>().ReverseScan(
+      cididx_start.EncodeViewRoutine(), cididx_end.EncodeViewRoutine(),
+      [&oid, sid](const VarStrView &k, VHandle *row) {
+        if (row->ShouldScanSkip(sid)) return true;
+        oid = k.ToType<OOrderCIdIdx::Key>().o_o_id;
+        return false;
+      });
 
   abort_if(oid == -1, "OrderStatus cannot find oid for customer {} {} {}",
            warehouse_id, district_id, customer_id);
@@ -59,12 +59,13 @@ static void ScanOrdersIndex(
 
   int i = 0;
   std::fill(state->order_line, state->order_line + 15, nullptr);
-  for (auto it = mgr.Get<OrderLine>().IndexSearchIterator(
-           ol_start.EncodeViewRoutine(), ol_end.EncodeViewRoutine()); it->IsValid() && i < 15; it->Next()) {
-    if (it->row()->ShouldScanSkip(sid)) continue;
-    state->order_line[i] = it->row();
-    i++;
-  }
+  mgr.Get<OrderLine>().Scan(
+      ol_start.EncodeViewRoutine(), ol_end.EncodeViewRoutine(),
+      [&state, &i, sid](const VarStrView &k, VHandle *row) {
+        if (row->ShouldScanSkip(sid)) return true;
+        state->order_line[i++] = row;
+        return i < 15;
+      });
 }
 
 void OrderStatusTxn::Prepare()
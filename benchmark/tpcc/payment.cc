@@ -18,7 +18,7 @@ PaymentStruct ClientBase::GenerateTransactionInput<PaymentStruct>()
   s.payment_amount = RandomNumber(100, 500000);
   s.ts = GetCurrentTime();
 
-  s.customer_id = GetCustomerId();
+  s.customer_id = PickCustomer(s.customer_warehouse_id, s.customer_district_id);
   return s;
 }
 
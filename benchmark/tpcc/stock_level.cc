@@ -43,17 +43,19 @@ static void ScanOrderLineIndex(
   INIT_ROUTINE_BRK(4096);
 
   state->n = 0;
-  for (auto it = mgr.Get<OrderLine>().IndexSearchIterator(
-           ol_start.EncodeViewRoutine(), ol_end.EncodeViewRoutine()); it->IsValid(); it->Next()) {
-    if (it->row()->ShouldScanSkip(sid)) continue;
-    state->items.at(state->n++) = it->row();
-    auto ol_key = it->key().ToType<OrderLine::Key>();
-
-    // Collecting resources for PWV
-    if (state->res && ol_key.ol_number == 1) {
-      state->res[state->nr_res++] = PWVGraph::VHandleToResource(it->row());
-    }
-  }
+  mgr.Get<OrderLine>().Scan(
+      ol_start.EncodeViewRoutine(), ol_end.EncodeViewRoutine(),
+      [&state, sid](const VarStrView &k, VHandle *row) {
+        if (row->ShouldScanSkip(sid)) return true;
+        state->items.at(state->n++) = row;
+        auto ol_key = k.ToType<OrderLine::Key>();
+
+        // Collecting resources for PWV
+        if (state->res && ol_key.ol_number == 1) {
+          state->res[state->nr_res++] = PWVGraph::VHandleToResource(row);
+        }
+        return true;
+      });
 }
 
 void StockLevelTxn::Prepare()
@@ -20,11 +20,15 @@
 #include "opts.h"
 
 #include "felis_probes.h"
+#include "repartition.h"
+#include "slice_balancer.h"
+#include "secondary_index.h"
 
 namespace tpcc {
 
 using felis::Console;
 using felis::VHandle;
+using felis::Repartitioner;
 
 Config::Config()
 {
@@ -40,6 +44,7 @@ Config::Config()
   max_supported_warehouse = 64;
 
   shard_by_warehouse = true;
+  customer_by_name = false;
 }
 
 Config g_tpcc_config;
@@ -68,10 +73,18 @@ void InitializeSliceManager()
 
   manager.Initialize(g_tpcc_config.nr_warehouses);
 
+  if (felis::SliceCoreBalancer::g_enabled)
+    TpccSliceRouter::InitializeCoreBalancer();
+
   if (NodeConfiguration::g_data_migration) {
+    abort_if(Repartitioner::g_enabled && g_tpcc_config.max_slice_id() > felis::kNrMaxSlices,
+             "Cannot repartition more than {} slices", felis::kNrMaxSlices);
     for (int slc = 0; slc < g_tpcc_config.max_slice_id(); slc++) {
-      // You, as node_id, should not touch these slices at all!
+      // You, as node_id, should not touch these slices at all! Unless the
+      // Repartitioner moves them here later.
       if (TpccSliceRouter::SliceToNodeId(slc) != conf.node_id()) {
+        if (Repartitioner::g_enabled)
+          manager.InstallRowSlice(slc, nullptr);
         continue;
       }
 
@@ -81,7 +94,7 @@ void InitializeSliceManager()
       abort_if(!g_tpcc_config.shard_by_warehouse,
                "Shipping without shard_by_warehouse is not implemented!");
 
-      if (ClientBase::is_warehouse_hotspot(slc)) {
+      if (ClientBase::is_warehouse_hotspot(slc) && !Repartitioner::g_enabled) {
         auto &row_peer = conf.config(g_tpcc_config.offload_nodes[0]).row_shipper_peer;
         row_shipment = new felis::RowShipment(row_peer.host, row_peer.port, true);
       }
@@ -109,6 +122,14 @@ void InitializeTPCC()
   if (felis::Options::kTpccHashShard)
     g_tpcc_config.shard_by_warehouse = false;
 
+  if (felis::Options::kTpccCustomerByName) {
+    // A node only indexes its own customers. With the warehouses sharded, it
+    // has every customer of the warehouses it owns.
+    abort_if(!g_tpcc_config.shard_by_warehouse,
+             "TpccCustomerByName does not work with TpccHashShard");
+    g_tpcc_config.customer_by_name = true;
+  }
+
   logger->info("Warehouses {}, Pin? {}",
                g_tpcc_config.nr_warehouses,
                g_tpcc_config.IsWarehousePinnable());
@@ -144,8 +165,11 @@ void InitializeTPCC()
   logger->info("data migration mode {}", NodeConfiguration::g_data_migration);
 
   auto &mgr = Instance<felis::TableManager>();
-  mgr.Create<Customer, CustomerInfo, District, History, Item, NewOrder, OOrder, OOrderCIdIdx,
+  mgr.Create<Customer, CustomerInfo, District, History, Item, NewOrder, OOrder,
              OrderLine, Stock, Warehouse>();
+  Instance<felis::SecondaryIndexManager>().Create<OOrderCIdIdx>();
+  if (g_tpcc_config.customer_by_name)
+    Instance<felis::SecondaryIndexManager>().Create<CustomerNameIdx>();
 
   logger->info("TPCC Table schemas created");
 }
@@ -207,6 +231,37 @@ int ClientBase::GetCustomerId()
                                1, g_tpcc_config.customers_per_district);
 }
 
+int ClientBase::PickCustomer(int warehouse_id, int district_id)
+{
+  if (g_tpcc_config.customer_by_name && IsWarehouseLocal(warehouse_id)
+      && RandomNumber(1, 100) <= 60)
+    return GetCustomerIdByLastName(warehouse_id, district_id);
+  return GetCustomerId();
+}
+
+int ClientBase::GetCustomerIdByLastName(int warehouse_id, int district_id)
+{
+  auto last = GetNonUniformCustomerLastNameRun();
+  last.resize(16, '\0');
+  auto start = CustomerNameIdx::Key::New(warehouse_id, district_id, last, std::string(16, '\0'));
+  auto end = CustomerNameIdx::Key::New(warehouse_id, district_id, last, std::string(16, '\xff'));
+  uint8_t start_buf[64], end_buf[64];
+
+  std::vector<int> ids;
+  tables().Get<CustomerNameIdx>().Scan(
+      start.EncodeView(start_buf), end.EncodeView(end_buf),
+      [&ids](const felis::VarStrView &k, VHandle *row) {
+        ids.push_back(row->ReadExactVersion(0)->ToType<CustomerNameIdx::Value>().c_id);
+        return true;
+      });
+  // The first 1000 customers of a district take every last name once.
+  abort_if(ids.empty(), "No customer named {} in warehouse {} district {}",
+           last.c_str(), warehouse_id, district_id);
+
+  // Sorted by first name. The spec picks the one in the middle.
+  return ids[(ids.size() - 1) / 2];
+}
+
 size_t ClientBase::GetCustomerLastName(uint8_t *buf, int num)
 {
   static std::string NameTokens[] = {
@@ -269,6 +324,12 @@ size_t ClientBase::nr_warehouses() const
  * 1. Randomly generate a warehouse key, using the hotspot configuration.
  * 2. Is this key belong to this node according to our sharding plan, unless Spread is On.
  */
+bool ClientBase::IsWarehouseLocal(int warehouse_id)
+{
+  auto wk = Warehouse::Key::New(warehouse_id);
+  return TpccSliceRouter::SliceToNodeId(Instance<SliceLocator<Warehouse>>().Locate(wk)) == node_id;
+}
+
 uint ClientBase::PickWarehouse()
 {
   long selw = -1;
@@ -294,8 +355,7 @@ uint ClientBase::PickWarehouse()
 
     if (kWarehouseSpread == 0 || r.next_uniform() >= kWarehouseSpread) {
       // Do we own this warehouse?
-      auto wk = Warehouse::Key::New(selw);
-      if (TpccSliceRouter::SliceToNodeId(Instance<SliceLocator<Warehouse>>().Locate(wk)) != node_id)
+      if (!IsWarehouseLocal(selw))
         selw = -1;
     }
   } while (selw == -1);
@@ -309,8 +369,7 @@ unsigned int ClientBase::LoadPercentageByWarehouse()
   unsigned int load = 0;
   unsigned int n = 0;
   for (int w = 1; w <= g_tpcc_config.nr_warehouses; w++) {
-    auto wk = Warehouse::Key::New(w);
-    if (TpccSliceRouter::SliceToNodeId(Instance<SliceLocator<Warehouse>>().Locate(wk)) != node_id)
+    if (!IsWarehouseLocal(w))
       continue;
 
     n++;
@@ -662,22 +721,12 @@ void Loader<LoaderType::Customer>::DoLoad()
               auto info_handle = tables().Get<tpcc::CustomerInfo>().SearchOrCreate(k.EncodeView(large_buf));
               OnNewRow(slice_id, TableType::CustomerInfo, k, handle);
               felis::InitVersion(info_handle, info_v.Encode());
+
+              util::Instance<felis::SecondaryIndexManager>().OnInsert<tpcc::CustomerInfo>(k, info_v);
             });
 
         // I don't think we ever used this, I'll just disable this for now.
 #if 0
-        // customer name index
-        auto k_idx = CustomerNameIdx::Key::New(k.c_w_id, k.c_d_id, v.c_last.str(true), v.c_first.str(true));
-        auto v_idx = CustomerNameIdx::Value::New(k.c_id);
-
-        // index structure is:
-        // (c_w_id, c_d_id, c_last, c_first) -> (c_id)
-
-        handle = tables().Get<tpcc::CustomerNameIdx>().SearchOrCreate(k_idx.EncodeView(large_buf));
-        slice_id = util::Instance<SliceLocator<tpcc::CustomerNameIdx>>().Locate(k_idx);
-        OnNewRow(slice_id, TableType::CustomerNameIdx, k_idx, handle);
-        felis::InitVersion(handle, v_idx.Encode());
-
         History::Key k_hist;
 
         k_hist.h_c_id = c;
@@ -765,18 +814,8 @@ void Loader<LoaderType::Order>::DoLoad()
               OnNewRow(slice_id, TableType::OOrder, k_oo, oo_handle);
               auto p = oo_handle->AllocFromInline(v_oo.EncodeSize());
               felis::InitVersion(oo_handle, v_oo.EncodeToPtrOrDefault(p));
-            });
-
-        const auto k_oo_idx = OOrderCIdIdx::Key::New(k_oo.o_w_id, k_oo.o_d_id, c_ids[c - 1], k_oo.o_id);
-        const auto v_oo_idx = OOrderCIdIdx::Value::New(0);
 
-        DoOnSlice<tpcc::OOrderCIdIdx>(
-            k_oo_idx,
-            [=](auto slice_id, auto core_id) {
-              auto oo_idx_handle = tables().Get<tpcc::OOrderCIdIdx>().SearchOrCreate(k_oo_idx.EncodeView(large_buf));
-              OnNewRow(slice_id, TableType::OOrderCIdIdx, k_oo_idx, oo_idx_handle);
-              auto p = oo_idx_handle->AllocFromInline(v_oo_idx.EncodeSize());
-              felis::InitVersion(oo_idx_handle, v_oo_idx.EncodeToPtrOrDefault(p));
+              util::Instance<felis::SecondaryIndexManager>().OnInsert<tpcc::OOrder>(k_oo, v_oo);
             });
 
         if (c >= 2101) {
@@ -862,13 +901,28 @@ using namespace felis;
 int TpccSliceRouter::SliceToNodeId(int16_t slice_id)
 {
   auto &conf = util::Instance<NodeConfiguration>();
-  return 1 + slice_id * conf.nr_nodes() / g_tpcc_config.max_slice_id(); // Because node starts from 1
+  int node = 1 + slice_id * conf.nr_nodes() / g_tpcc_config.max_slice_id(); // Because node starts from 1
+  if (Repartitioner::g_enabled)
+    return util::Instance<Repartitioner>().Route(slice_id, node);
+  return node;
 }
 
-int TpccSliceRouter::SliceToCoreId(int16_t slice_id)
+static int StaticSliceToCoreId(int16_t slice_id)
 {
   auto &conf = util::Instance<NodeConfiguration>();
   return (uint16_t) (slice_id * conf.nr_nodes() * conf.g_nr_threads / g_tpcc_config.max_slice_id()) % conf.g_nr_threads;
 }
 
+int TpccSliceRouter::SliceToCoreId(int16_t slice_id)
+{
+  if (SliceCoreBalancer::g_enabled)
+    return util::Instance<SliceCoreBalancer>().SliceToCoreId(slice_id);
+  return StaticSliceToCoreId(slice_id);
+}
+
+void TpccSliceRouter::InitializeCoreBalancer()
+{
+  util::Instance<SliceCoreBalancer>().Initialize(g_tpcc_config.max_slice_id(), StaticSliceToCoreId);
+}
+
 }
@@ -31,6 +31,8 @@ class TpccSliceRouter {
  public:
   static int SliceToNodeId(int16_t slice_id);
   static int SliceToCoreId(int16_t slice_id);
+  // Start the SliceCoreBalancer from the static mapping.
+  static void InitializeCoreBalancer();
 };
 
 // Some tables doesn't have district_id, bohm need to partition them in a
@@ -61,6 +63,8 @@ struct Config {
   size_t max_supported_warehouse;
 
   bool shard_by_warehouse;
+  // Payment and OrderStatus look up 60% of their customers by last name.
+  bool customer_by_name;
 
   Config();
 
@@ -128,17 +132,22 @@ struct CustomerInfo : public Customer {
   using Value = sql::CustomerInfoValue;
 };
 
-#if 0
-
+// Only with -XTpccCustomerByName. Maintained by the SecondaryIndexManager.
 struct CustomerNameIdx {
   static constexpr auto kTable = TableType::CustomerNameIdx;
   static constexpr auto kIndexArgs = std::make_tuple(false);
   using IndexBackend = felis::MasstreeIndex;
   using Key = sql::CustomerNameIdxKey;
   using Value = sql::CustomerNameIdxValue;
-};
 
-#endif
+  using Primary = CustomerInfo;
+  static Key IndexKey(const Primary::Key &k, const Primary::Value &v) {
+    return Key::New(k.c_w_id, k.c_d_id, v.c_last.str(true), v.c_first.str(true));
+  }
+  static Value IndexValue(const Primary::Key &k, const Primary::Value &v) {
+    return Value::New(k.c_id);
+  }
+};
 
 struct District {
   static uint32_t HashKey(const felis::VarStrView &k) {
@@ -167,7 +176,8 @@ struct Item {
 
   static constexpr auto kTable = TableType::Item;
   static constexpr auto kIndexArgs = std::make_tuple(HashKey, 2 << 20, true);
-  using IndexBackend = felis::HashtableIndex;
+  // Loaded once and never grows, which is all the SwissTableIndex needs.
+  using IndexBackend = felis::SwissTableIndex;
   using Key = sql::ItemKey;
   using Value = sql::ItemValue;
 };
@@ -196,12 +206,21 @@ struct OOrder {
   using Value = sql::OOrderValue;
 };
 
+// Maintained by the SecondaryIndexManager, from the loaders and NewOrder.
 struct OOrderCIdIdx {
   static constexpr auto kTable = TableType::OOrderCIdIdx;
   static constexpr auto kIndexArgs = std::make_tuple(true);
   using IndexBackend = felis::MasstreeIndex;
   using Key = sql::OOrderCIdIdxKey;
   using Value = sql::OOrderCIdIdxValue;
+
+  using Primary = OOrder;
+  static Key IndexKey(const Primary::Key &k, const Primary::Value &v) {
+    return Key::New(k.o_w_id, k.o_d_id, v.o_c_id, k.o_id);
+  }
+  static Value IndexValue(const Primary::Key &k, const Primary::Value &v) {
+    return Value::New(0);
+  }
 };
 
 struct OrderLine {
@@ -268,6 +287,7 @@ class ClientBase {
   // static constexpr double kPaymentByName = 0.60;
 
   size_t nr_warehouses() const;
+  bool IsWarehouseLocal(int warehouse_id);
   uint PickWarehouse();
   uint PickDistrict();
 
@@ -288,6 +308,13 @@ class ClientBase {
 
   int GetItemId();
   int GetCustomerId();
+  // Through CustomerNameIdx. Like all txn inputs, this is generated in
+  // GenerateBenchmarks(), before the first epoch, so it sees the customers as
+  // they were loaded. The index only has the customers of our warehouses.
+  int GetCustomerIdByLastName(int warehouse_id, int district_id);
+  // For Payment and OrderStatus. With -XTpccCustomerByName, 60% of the
+  // customers in our warehouses are looked up by last name.
+  int PickCustomer(int warehouse_id, int district_id);
 
   size_t GetCustomerLastName(uint8_t *buf, int num);
   size_t GetCustomerLastName(char *buf, int num) {
@@ -450,7 +477,6 @@ SHARD_TABLE(Customer) {
     return g_tpcc_config.HashKeyToSliceId(key);
   }
 }
-/*
 SHARD_TABLE(CustomerNameIdx) {
   if (g_tpcc_config.shard_by_warehouse) {
     return g_tpcc_config.WarehouseToSliceId(key.c_w_id);
@@ -458,7 +484,6 @@ SHARD_TABLE(CustomerNameIdx) {
     return g_tpcc_config.HashKeyToSliceId(key);
   }
 }
-*/
 
 SHARD_TABLE(District) {
   if (g_tpcc_config.shard_by_warehouse) {
@@ -488,7 +513,8 @@ SHARD_TABLE(OOrderCIdIdx) {
   if (g_tpcc_config.shard_by_warehouse) {
     return g_tpcc_config.WarehouseToSliceId(key.o_w_id);
   } else {
-    return g_tpcc_config.HashKeyToSliceId(key);
+    // With the order it indexes, that's where the SecondaryIndexManager puts it.
+    return g_tpcc_config.HashKeyToSliceId(OOrder::Key::New(key.o_w_id, key.o_d_id, key.o_o_id));
   }
 }
 SHARD_TABLE(OrderLine) {
@@ -6,6 +6,7 @@
 #include "util/objects.h"
 #include "util/factory.h"
 #include "index.h"
+#include "secondary_index.h"
 #include "module.h"
 #include "gopp/gopp.h"
 #include "gopp/channels.h"
@@ -82,6 +83,12 @@ static void LoadTPCCDataSet()
     load_elapse++;
   }
   logger->info("loader done {} seconds", load_elapse);
+
+  // The loaders have only buffered the secondary index entries. The index rows
+  // come from the pool of the first core.
+  mem::ParallelPool::SetCurrentAffinity(0);
+  util::Instance<SecondaryIndexManager>().Flush();
+  mem::ParallelPool::SetCurrentAffinity(-1);
 }
 
 class TPCCModule : public Module<WorkloadModule> {
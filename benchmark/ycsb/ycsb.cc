@@ -1,6 +1,7 @@
 #include "ycsb.h"
 #include "index.h"
 #include "txn_cc.h"
+#include "task_sched.h"
 #include "pwv_graph.h"
 #include "util/os.h"
 
@@ -180,6 +181,33 @@ void RMWTxn::Run()
 
     auto aff = std::numeric_limits<uint64_t>::max();
     // auto aff = AffinityFromRows(bitmap, state->rows);
+    if (TaskSched::g_use_task_sched) {
+      // Same piece, but it parks on the rows instead of spinning.
+      root->AttachTask(
+          MakeContext(), 1,
+          [](auto ctx) -> PieceTask {
+            auto &[state, index_handle] = ctx;
+            auto sid = index_handle.serial_id();
+            for (int i = 0; i < kTotal - Client::g_extra_read - 1; i++) {
+              if (state->futures[i].has_callback())
+                co_await AwaitVersion(state->rows[i], sid);
+              state->futures[i].Invoke(state, index_handle);
+            }
+            if (Client::g_dependency) {
+              co_await AwaitFuture(&state->deps);
+            }
+            auto last = state->rows[kTotal - Client::g_extra_read - 1];
+            co_await AwaitVersion(last, sid);
+            WriteRow(index_handle(last));
+            for (auto i = kTotal - Client::g_extra_read; i < kTotal; i++) {
+              co_await AwaitVersion(state->rows[i], sid);
+              ReadRow(index_handle(state->rows[i]));
+            }
+          },
+          aff);
+      return;
+    }
+
     root->AttachRoutine(
         MakeContext(), 1,
         [](const auto &ctx) {
@@ -0,0 +1,122 @@
+// Replay per-epoch row weights through the placement policies in binpack.h and
+// report the makespan of each.
+//
+// Usage: binpack_benchmark [trace]
+//
+// The trace is written by the database with -XBinpackSplitting
+// -XBinpackTrace<path>. Without a trace, we generate skewed synthetic epochs.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+
+#include "binpack.h"
+
+using namespace felis;
+
+struct Epoch {
+  int nr_bins;
+  std::vector<PackItem> items;
+  std::vector<PackEdge> edges;
+};
+
+static std::vector<Epoch> LoadTrace(const char *path)
+{
+  std::vector<Epoch> epochs;
+  FILE *fp = fopen(path, "r");
+  if (fp == nullptr) {
+    perror(path);
+    exit(-1);
+  }
+
+  int nr_bins;
+  size_t nr_items, nr_edges;
+  while (fscanf(fp, " epoch %d %lu %lu", &nr_bins, &nr_items, &nr_edges) == 3) {
+    Epoch e;
+    e.nr_bins = nr_bins;
+    e.items.resize(nr_items);
+    for (auto &item: e.items) {
+      if (fscanf(fp, "%u", &item.weight) != 1) goto corrupted;
+    }
+    e.edges.resize(nr_edges);
+    for (auto &edge: e.edges) {
+      if (fscanf(fp, "%u %u %u", &edge.a, &edge.b, &edge.weight) != 3) goto corrupted;
+    }
+    epochs.push_back(std::move(e));
+  }
+  fclose(fp);
+  return epochs;
+
+corrupted:
+  fprintf(stderr, "%s: corrupted trace after %lu epochs\n", path, epochs.size());
+  fclose(fp);
+  exit(-1);
+}
+
+// Zipf-like weights: a few very hot rows and a long tail, plus transactions
+// touching random pairs of rows with a bias towards hot ones.
+static std::vector<Epoch> GenerateEpochs(int nr_epochs, int nr_bins, size_t nr_items)
+{
+  std::vector<Epoch> epochs;
+  std::mt19937 rand(0xCA4AC41);
+  for (int k = 0; k < nr_epochs; k++) {
+    Epoch e;
+    e.nr_bins = nr_bins;
+    e.items.resize(nr_items);
+    for (size_t i = 0; i < nr_items; i++) {
+      e.items[i].weight = 8 + 200 / (i + 1) + rand() % 64;
+    }
+    std::geometric_distribution<unsigned int> pick(8.0 / nr_items);
+    for (size_t i = 0; i < 4 * nr_items; i++) {
+      auto a = pick(rand) % nr_items, b = pick(rand) % nr_items;
+      if (a != b) e.edges.push_back(PackEdge{(unsigned int) a, (unsigned int) b, 1 + (unsigned int) rand() % 4});
+    }
+    epochs.push_back(std::move(e));
+  }
+  return epochs;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<Epoch> epochs;
+  if (argc > 1)
+    epochs = LoadTrace(argv[1]);
+  else
+    epochs = GenerateEpochs(50, 32, 1024);
+
+  KnapsackPackingPolicy::g_verbose = false;
+
+  printf("%lu epochs\n", epochs.size());
+  printf("%-10s %12s %12s %10s %14s %12s\n",
+         "policy", "makespan", "lower bound", "ratio", "cross-core", "time(us)");
+
+  for (auto name: {"knapsack", "ffd", "locality"}) {
+    std::unique_ptr<PackingPolicy> policy(PackingPolicy::Create(name));
+    size_t makespan = 0, lower_bound = 0, cross = 0, total_edges = 0;
+    double worst_ratio = 0;
+    long time_us = 0;
+
+    for (auto e: epochs) {
+      auto start = std::chrono::steady_clock::now();
+      policy->Pack(e.items, e.edges, e.nr_bins);
+      time_us += std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start).count();
+
+      auto m = PackingPolicy::Makespan(e.items, e.nr_bins);
+      auto lb = PackingPolicy::LowerBound(e.items, e.nr_bins);
+      makespan += m;
+      lower_bound += lb;
+      worst_ratio = std::max(worst_ratio, lb ? 1.0 * m / lb : 1.0);
+      cross += PackingPolicy::CrossBinWeight(e.items, e.edges);
+      for (auto &edge: e.edges) total_edges += edge.weight;
+    }
+
+    printf("%-10s %12lu %12lu %4.3f/%4.3f %7lu/%-6lu %12ld\n",
+           name, makespan, lower_bound,
+           lower_bound ? 1.0 * makespan / lower_bound : 1.0, worst_ratio,
+           cross, total_edges, time_us);
+  }
+  return 0;
+}
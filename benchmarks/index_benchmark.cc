@@ -0,0 +1,93 @@
+// Insert, hit and miss throughput of the SwissTableIndex against the
+// HashtableIndex, with the same keys and the same number of threads.
+//
+// Usage: index_benchmark [nr_keys] [nr_threads]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "index.h"
+#include "mem.h"
+#include "vhandle.h"
+
+using namespace felis;
+
+static std::vector<uint64_t> GenerateKeys(size_t nr_keys, uint64_t seed)
+{
+  std::vector<uint64_t> keys(nr_keys);
+  std::mt19937_64 rand(seed);
+  for (auto &k: keys) k = rand();
+  return keys;
+}
+
+// Runs f on each thread's share of the keys, and returns Mops/s.
+template <typename Func>
+static double RunOnThreads(int nr_threads, const std::vector<uint64_t> &keys, Func f)
+{
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < nr_threads; t++) {
+    threads.emplace_back(
+        [t, nr_threads, &keys, &f]() {
+          mem::ParallelPool::SetCurrentAffinity(t);
+          for (size_t i = t; i < keys.size(); i += nr_threads) {
+            VarStrView k(sizeof(uint64_t), (const uint8_t *) &keys[i]);
+            f(k);
+          }
+          mem::ParallelPool::SetCurrentAffinity(-1);
+        });
+  }
+  for (auto &th: threads) th.join();
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  return 1.0 * keys.size() / us;
+}
+
+template <typename IndexType>
+static void Measure(const char *name, int id, int nr_threads,
+                    const std::vector<uint64_t> &keys, const std::vector<uint64_t> &misses)
+{
+  auto index = std::make_unique<IndexType>(std::make_tuple(DefaultHash, keys.size(), false));
+  index->set_id(id);
+
+  auto insert = RunOnThreads(
+      nr_threads, keys, [&index](const VarStrView &k) { index->SearchOrCreate(k); });
+  auto hit = RunOnThreads(
+      nr_threads, keys,
+      [&index](const VarStrView &k) {
+        if (index->Search(k) == nullptr) std::abort();
+      });
+  auto miss = RunOnThreads(
+      nr_threads, misses,
+      [&index](const VarStrView &k) {
+        if (index->Search(k) != nullptr) std::abort();
+      });
+
+  printf("%-10s %12.2f %12.2f %12.2f\n", name, insert, hit, miss);
+}
+
+int main(int argc, char **argv)
+{
+  size_t nr_keys = argc > 1 ? std::atol(argv[1]) : (4 << 20);
+  int nr_threads = argc > 2 ? std::atoi(argv[2]) : 1;
+
+  mem::InitTotalNumberOfCores(nr_threads);
+  // Both tables keep all of their rows.
+  mem::InitSlab(2 * nr_keys * VHandle::kSize + (1ULL << 30));
+  VHandle::InitPool();
+
+  auto keys = GenerateKeys(nr_keys, 0xdeadbeef);
+  auto misses = GenerateKeys(nr_keys, 0xbadf00d);
+
+  printf("%lu keys, %d threads, Mops/s\n", nr_keys, nr_threads);
+  printf("%-10s %12s %12s %12s\n", "index", "insert", "hit", "miss");
+  Measure<HashtableIndex>("chained", 0, nr_threads, keys, misses);
+  Measure<SwissTableIndex>("swiss", 1, nr_threads, keys, misses);
+  return 0;
+}
@@ -0,0 +1,183 @@
+// Compare the ingest and pick cost of the per-core scheduling queues: the
+// binary heap with a chained hashtable that ConservativePriorityScheduler
+// uses, and the BucketQueue behind -XBucketQueue.
+//
+// Usage: sched_queue_benchmark [txn per epoch] [pieces per txn]
+//
+// It only needs the headers, so it also builds outside the tree:
+//
+//   g++ -std=c++20 -O2 -I. benchmarks/sched_queue_benchmark.cc -o sched_queue_benchmark
+//   ./sched_queue_benchmark 1000000 2
+//
+// Keys are serial ids of one epoch, ingested in a shuffled order like pieces
+// arriving from other cores, then drained in order.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "bucket_queue.h"
+
+using namespace felis;
+
+struct Value : public util::GenericListNode<Value> {
+  uint64_t payload;
+};
+
+struct Entry : public util::GenericListNode<Entry> {
+  util::GenericListNode<Value> values;
+  uint64_t key;
+};
+
+// Mirrors EpochExecutionDispatchService::AddToPriorityQueue() and
+// ConservativePriorityScheduler.
+class HeapQueue {
+  static constexpr size_t kHashTableSize = 100001;
+  struct HeapEntry {
+    uint64_t key;
+    Entry *ent;
+  };
+  static bool Greater(const HeapEntry &a, const HeapEntry &b) { return a.key > b.key; }
+
+  std::vector<util::GenericListNode<Entry>> ht;
+  std::vector<HeapEntry> q;
+  size_t len = 0;
+ public:
+  HeapQueue(size_t maxlen) : ht(kHashTableSize), q(maxlen) {
+    for (auto &hl: ht) hl.Initialize();
+  }
+
+  void Add(uint64_t key, Value *value, Entry *spare, bool &used) {
+    auto &hl = ht[(key >> 8) % kHashTableSize];
+    Entry *ent = nullptr;
+    for (auto it = hl.next; it != &hl; it = it->next) {
+      if (it->object()->key == key) {
+        ent = it->object();
+        break;
+      }
+    }
+    used = false;
+    if (ent == nullptr) {
+      ent = spare;
+      ent->Initialize();
+      ent->key = key;
+      ent->values.Initialize();
+      ent->InsertAfter(hl.prev);
+      used = true;
+    }
+    if (ent->values.empty()) {
+      q[len++] = {key, ent};
+      std::push_heap(q.begin(), q.begin() + len, Greater);
+    }
+    value->InsertAfter(ent->values.prev);
+  }
+
+  bool empty() const { return len == 0; }
+  Value *Pick() { return q[0].ent->values.next->object(); }
+  void Consume(Value *value) {
+    value->Remove();
+    auto top = q[0];
+    if (top.ent->values.empty()) {
+      std::pop_heap(q.begin(), q.begin() + len, Greater);
+      len--;
+      top.ent->Remove();
+    }
+  }
+};
+
+class BucketQueueAdapter {
+  std::vector<uint8_t> mem;
+  BucketQueue<Entry> bq;
+ public:
+  BucketQueueAdapter(size_t nr_buckets)
+      : mem(BucketQueue<Entry>::MemorySize(nr_buckets)) {
+    bq.Initialize(mem.data(), nr_buckets);
+  }
+
+  void Add(uint64_t key, Value *value, Entry *spare, bool &used) {
+    auto ent = bq.Find(key);
+    used = false;
+    if (ent == nullptr) {
+      ent = spare;
+      ent->Initialize();
+      ent->key = key;
+      ent->values.Initialize();
+      bq.Insert(ent);
+      used = true;
+    }
+    value->InsertAfter(ent->values.prev);
+  }
+
+  bool empty() const { return bq.empty(); }
+  Value *Pick() { return bq.Top()->values.next->object(); }
+  void Consume(Value *value) {
+    value->Remove();
+    auto top = bq.Top();
+    if (top->values.empty()) bq.Remove(top);
+  }
+};
+
+template <typename Queue>
+static void Run(const char *name, Queue &queue, const std::vector<uint64_t> &keys)
+{
+  std::vector<Value> values(keys.size());
+  std::vector<Entry> entries(keys.size());
+  size_t nr_entries = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < keys.size(); i++) {
+    bool used;
+    values[i].Initialize();
+    values[i].payload = keys[i];
+    queue.Add(keys[i], &values[i], &entries[nr_entries], used);
+    if (used) nr_entries++;
+  }
+  auto mid = std::chrono::steady_clock::now();
+
+  uint64_t last = 0, checksum = 0;
+  while (!queue.empty()) {
+    auto v = queue.Pick();
+    if (v->payload < last) {
+      fprintf(stderr, "%s: out of order %lu after %lu\n", name, v->payload, last);
+      exit(-1);
+    }
+    last = v->payload;
+    checksum += last;
+    queue.Consume(v);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  auto ns = [](auto d) { return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(); };
+  printf("%-8s %12.2f %12.2f %20lu\n", name,
+         1.0 * ns(mid - start) / keys.size(), 1.0 * ns(end - mid) / keys.size(), checksum);
+}
+
+int main(int argc, char **argv)
+{
+  size_t nr_txns = argc > 1 ? atol(argv[1]) : 100000;
+  size_t nr_pieces = argc > 2 ? atol(argv[2]) : 4;
+  static constexpr uint64_t kEpoch = 42, kNodeId = 1;
+
+  std::vector<uint64_t> keys;
+  for (size_t seq = 1; seq <= nr_txns; seq++) {
+    for (size_t p = 0; p < nr_pieces; p++)
+      keys.push_back(kEpoch << 32 | seq << 8 | kNodeId);
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(0xCA4AC41));
+
+  size_t nr_buckets = 1;
+  while (nr_buckets < nr_txns + 4096) nr_buckets <<= 1;
+
+  printf("%lu txns, %lu pieces\n", nr_txns, keys.size());
+  printf("%-8s %12s %12s %20s\n", "queue", "ingest(ns)", "pick(ns)", "checksum");
+  for (int round = 0; round < 3; round++) {
+    HeapQueue heap(keys.size());
+    Run("heap", heap, keys);
+    BucketQueueAdapter bucket(nr_buckets);
+    Run("bucket", bucket, keys);
+  }
+  return 0;
+}
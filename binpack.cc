@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+#include "binpack.h"
+
+namespace felis {
+
+PackingPolicy *PackingPolicy::Create(const std::string &name)
+{
+  if (name == "knapsack")
+    return new KnapsackPackingPolicy();
+  else if (name == "ffd")
+    return new FirstFitDecreasingPolicy();
+  else if (name == "locality")
+    return new LocalityAwarePackingPolicy();
+  return nullptr;
+}
+
+size_t PackingPolicy::Makespan(const std::vector<PackItem> &items, int nr_bins)
+{
+  std::vector<size_t> loads(nr_bins, 0);
+  for (auto &item: items) {
+    if (item.bin >= 0 && item.bin < nr_bins) loads[item.bin] += item.weight;
+  }
+  return loads.empty() ? 0 : *std::max_element(loads.begin(), loads.end());
+}
+
+size_t PackingPolicy::LowerBound(const std::vector<PackItem> &items, int nr_bins)
+{
+  size_t sum = 0, max_weight = 0;
+  for (auto &item: items) {
+    sum += item.weight;
+    max_weight = std::max<size_t>(max_weight, item.weight);
+  }
+  return std::max((sum + nr_bins - 1) / nr_bins, max_weight);
+}
+
+size_t PackingPolicy::CrossBinWeight(const std::vector<PackItem> &items,
+                                     const std::vector<PackEdge> &edges)
+{
+  size_t w = 0;
+  for (auto &e: edges) {
+    if (e.a >= items.size() || e.b >= items.size()) continue;
+    if (items[e.a].bin != items[e.b].bin) w += e.weight;
+  }
+  return w;
+}
+
+bool KnapsackPackingPolicy::g_verbose = true;
+
+void KnapsackPackingPolicy::Pack(std::vector<PackItem> &items, const std::vector<PackEdge> &,
+                                 int nr_bins)
+{
+  size_t sum = 0;
+  for (auto &item: items) {
+    item.bin = -1;
+    sum += item.weight;
+  }
+
+  int delta = 0;
+  for (int core = 0; core < nr_bins - 1; core++) {
+    const size_t hard_limit = sum / nr_bins;
+    delta = hard_limit + delta - FillBin(items, core, hard_limit + 1 + delta);
+  }
+
+  if (g_verbose) printf("Binpack left:");
+  for (auto &item: items) {
+    if (item.bin == -1) {
+      if (g_verbose) printf(" %u", item.weight);
+      item.bin = nr_bins - 1;
+    }
+  }
+  if (g_verbose) puts("");
+}
+
+size_t KnapsackPackingPolicy::FillBin(std::vector<PackItem> &items, int label, size_t limit)
+{
+  if (limit == 0) return 0;
+
+  std::vector<int> f(limit), pf(limit, 0);
+  std::vector<std::vector<bool>> trace(items.size());
+
+  for (auto i = 0U; i < items.size(); i++) {
+    if (items[i].bin != -1) continue;
+
+    trace[i].resize(limit);
+    auto wi = items[i].weight;
+    for (size_t w = 0; w < limit; w++) {
+      f[w] = pf[w];
+      if (w >= wi && pf[w - wi] + (int) wi > f[w]) {
+        f[w] = pf[w - wi] + (int) wi;
+        trace[i][w] = true;
+      }
+    }
+    std::swap(pf, f);
+  }
+
+  int maxcap = pf[limit - 1];
+  if (g_verbose) printf("Binpack max cap %d/%ld:", maxcap, limit);
+  auto w = limit - 1;
+  for (int i = items.size() - 1; i >= 0; i--) {
+    if (items[i].bin != -1) continue;
+
+    auto wi = items[i].weight;
+    if (trace[i][w]) {
+      if (g_verbose) printf(" %u", wi);
+      w -= wi;
+      items[i].bin = label;
+    }
+  }
+  if (g_verbose) puts("");
+
+  return maxcap;
+}
+
+std::vector<unsigned int> FirstFitDecreasingPolicy::SortedOrder(const std::vector<PackItem> &items) const
+{
+  std::vector<unsigned int> order(items.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&items](unsigned int a, unsigned int b) {
+                     return items[a].weight > items[b].weight;
+                   });
+  return order;
+}
+
+bool FirstFitDecreasingPolicy::TryFit(std::vector<PackItem> &items, const std::vector<unsigned int> &order,
+                                      int nr_bins, size_t capacity) const
+{
+  std::vector<size_t> loads(nr_bins, 0);
+  for (auto i: order) {
+    int b = 0;
+    while (b < nr_bins && loads[b] + items[i].weight > capacity) b++;
+    if (b == nr_bins) return false;
+    loads[b] += items[i].weight;
+    items[i].bin = b;
+  }
+  return true;
+}
+
+size_t FirstFitDecreasingPolicy::SearchCapacity(std::vector<PackItem> &items,
+                                                const std::vector<unsigned int> &order,
+                                                int nr_bins) const
+{
+  size_t sum = 0;
+  for (auto &item: items) sum += item.weight;
+
+  auto lo = LowerBound(items, nr_bins);
+  auto hi = std::max(lo, 2 * sum / nr_bins);
+
+  if (!TryFit(items, order, nr_bins, hi)) {
+    // Shouldn't happen. Fallback to longest processing time first.
+    std::vector<size_t> loads(nr_bins, 0);
+    for (auto i: order) {
+      auto b = std::min_element(loads.begin(), loads.end()) - loads.begin();
+      loads[b] += items[i].weight;
+      items[i].bin = b;
+    }
+    return *std::max_element(loads.begin(), loads.end());
+  }
+
+  for (int k = 0; k < kMaxIterations && lo < hi; k++) {
+    auto mid = (lo + hi) / 2;
+    if (TryFit(items, order, nr_bins, mid))
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  TryFit(items, order, nr_bins, hi);
+  return hi;
+}
+
+void FirstFitDecreasingPolicy::Pack(std::vector<PackItem> &items, const std::vector<PackEdge> &,
+                                    int nr_bins)
+{
+  if (items.empty()) return;
+  SearchCapacity(items, SortedOrder(items), nr_bins);
+}
+
+double LocalityAwarePackingPolicy::g_slack = 0.05;
+
+void LocalityAwarePackingPolicy::Pack(std::vector<PackItem> &items, const std::vector<PackEdge> &edges,
+                                      int nr_bins)
+{
+  if (items.empty()) return;
+
+  auto order = SortedOrder(items);
+  size_t capacity = SearchCapacity(items, order, nr_bins) * (1 + g_slack);
+
+  std::vector<std::vector<std::pair<unsigned int, unsigned int>>> adj(items.size());
+  for (auto &e: edges) {
+    if (e.a == e.b || e.a >= items.size() || e.b >= items.size()) continue;
+    adj[e.a].emplace_back(e.b, e.weight);
+    adj[e.b].emplace_back(e.a, e.weight);
+  }
+
+  for (auto &item: items) item.bin = -1;
+  std::vector<size_t> loads(nr_bins, 0), affinity(nr_bins);
+
+  for (auto i: order) {
+    std::fill(affinity.begin(), affinity.end(), 0);
+    for (auto [j, w]: adj[i]) {
+      if (items[j].bin >= 0) affinity[items[j].bin] += w;
+    }
+
+    int best = -1;
+    for (int b = 0; b < nr_bins; b++) {
+      if (loads[b] + items[i].weight > capacity) continue;
+      if (best == -1 || affinity[b] > affinity[best]
+          || (affinity[b] == affinity[best] && loads[b] < loads[best]))
+        best = b;
+    }
+    if (best == -1)
+      best = std::min_element(loads.begin(), loads.end()) - loads.begin();
+
+    loads[best] += items[i].weight;
+    items[i].bin = best;
+  }
+}
+
+}
@@ -0,0 +1,91 @@
+#ifndef BINPACK_H
+#define BINPACK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace felis {
+
+// Placement engine for split rows. ContentionManager hands over the weight
+// (number of on-demand splits) of each row that needs splitting, and the
+// policy assigns every row a core. Policies do not know about VHandle, so the
+// binpack_benchmark can replay recorded epochs without the rest of the
+// database.
+
+struct PackItem {
+  unsigned int weight;
+  int bin = -1;
+};
+
+// Two items are accessed by the same transaction. The more often this happens,
+// the more we want them on the same core, because otherwise one of the pieces
+// has to wait for the future value from the other core.
+struct PackEdge {
+  unsigned int a, b;
+  unsigned int weight;
+};
+
+class PackingPolicy {
+ public:
+  virtual ~PackingPolicy() {}
+  virtual std::string name() const = 0;
+  // Assign every item a bin in [0, nr_bins).
+  virtual void Pack(std::vector<PackItem> &items, const std::vector<PackEdge> &edges,
+                    int nr_bins) = 0;
+
+  // "knapsack", "ffd" or "locality". Returns nullptr for unknown names.
+  static PackingPolicy *Create(const std::string &name);
+
+  static size_t Makespan(const std::vector<PackItem> &items, int nr_bins);
+  static size_t LowerBound(const std::vector<PackItem> &items, int nr_bins);
+  // Total weight of edges whose endpoints sit on different bins.
+  static size_t CrossBinWeight(const std::vector<PackItem> &items,
+                               const std::vector<PackEdge> &edges);
+};
+
+// The original algorithm: fill bins one by one with a 0-1 knapsack up to
+// sum / nr_bins, and put the leftover into the last bin.
+class KnapsackPackingPolicy : public PackingPolicy {
+ public:
+  static bool g_verbose;
+  std::string name() const final override { return "knapsack"; }
+  void Pack(std::vector<PackItem> &items, const std::vector<PackEdge> &edges,
+            int nr_bins) final override;
+ private:
+  size_t FillBin(std::vector<PackItem> &items, int label, size_t limit);
+};
+
+// First-fit-decreasing. We binary search the smallest bin capacity FFD can
+// fit all items into (MULTIFIT), which bounds the makespan within 13/11 of the
+// optimal.
+class FirstFitDecreasingPolicy : public PackingPolicy {
+ public:
+  static constexpr int kMaxIterations = 8;
+  std::string name() const override { return "ffd"; }
+  void Pack(std::vector<PackItem> &items, const std::vector<PackEdge> &edges,
+            int nr_bins) override;
+ protected:
+  // Items sorted by decreasing weight.
+  std::vector<unsigned int> SortedOrder(const std::vector<PackItem> &items) const;
+  bool TryFit(std::vector<PackItem> &items, const std::vector<unsigned int> &order,
+              int nr_bins, size_t capacity) const;
+  size_t SearchCapacity(std::vector<PackItem> &items, const std::vector<unsigned int> &order,
+                        int nr_bins) const;
+};
+
+// Like FFD, but instead of the first bin that fits, choose the bin that
+// already holds the most co-accessed weight, as long as it stays within
+// g_slack of the FFD capacity.
+class LocalityAwarePackingPolicy : public FirstFitDecreasingPolicy {
+ public:
+  static double g_slack;
+  std::string name() const final override { return "locality"; }
+  void Pack(std::vector<PackItem> &items, const std::vector<PackEdge> &edges,
+            int nr_bins) final override;
+};
+
+}
+
+#endif /* BINPACK_H */
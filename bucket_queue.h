@@ -0,0 +1,107 @@
+// -*- mode: c++ -*-
+
+#ifndef BUCKET_QUEUE_H
+#define BUCKET_QUEUE_H
+
+#include <cstdint>
+#include <cstddef>
+#include "util/linklist.h"
+
+namespace felis {
+
+// Monotone bucket queue for scheduling keys. Serial ids within an epoch are
+// dense, so we index buckets by the in-epoch sequence number ((key >> 8) &
+// 0xFFFFFF) and keep a bitmap of non-empty buckets. Ingest is O(1) and picking
+// the minimum is amortized O(1), because the cursor only moves backwards when
+// a smaller key shows up.
+//
+// Entry must be a util::GenericListNode<Entry> with a uint64_t key. Keys in the
+// same bucket (different node id, or sequence numbers beyond the last bucket)
+// are kept sorted in the bucket's list.
+template <typename Entry>
+class BucketQueue {
+  using Header = util::GenericListNode<Entry>;
+
+  Header *buckets = nullptr;
+  uint64_t *bits = nullptr;
+  size_t nr_buckets = 0;
+  size_t cur = 0; // no non-empty bucket below cur
+  size_t len = 0;
+
+  void SetBit(size_t idx) { bits[idx / 64] |= 1ULL << (idx % 64); }
+  void ClearBit(size_t idx) { bits[idx / 64] &= ~(1ULL << (idx % 64)); }
+ public:
+  static size_t MemorySize(size_t nr_buckets) {
+    return nr_buckets * sizeof(Header) + (nr_buckets + 63) / 64 * sizeof(uint64_t);
+  }
+
+  // mem must have at least MemorySize(nr_buckets) bytes.
+  void Initialize(void *mem, size_t nr_buckets) {
+    this->nr_buckets = nr_buckets;
+    buckets = (Header *) mem;
+    bits = (uint64_t *) (buckets + nr_buckets);
+    for (size_t i = 0; i < nr_buckets; i++) buckets[i].Initialize();
+    for (size_t i = 0; i < (nr_buckets + 63) / 64; i++) bits[i] = 0;
+    cur = len = 0;
+  }
+
+  size_t BucketIndex(uint64_t key) const {
+    size_t idx = (key >> 8) & 0x00FFFFFF;
+    return idx < nr_buckets ? idx : nr_buckets - 1;
+  }
+
+  size_t size() const { return len; }
+  bool empty() const { return len == 0; }
+
+  Entry *Find(uint64_t key) {
+    auto &hl = buckets[BucketIndex(key)];
+    for (auto it = hl.next; it != &hl; it = it->next) {
+      if (it->object()->key == key) return it->object();
+      if (it->object()->key > key) break;
+    }
+    return nullptr;
+  }
+
+  void Insert(Entry *e) {
+    auto idx = BucketIndex(e->key);
+    auto &hl = buckets[idx];
+    auto pos = &hl;
+    while (pos->next != &hl && pos->next->object()->key < e->key) pos = pos->next;
+    e->InsertAfter(pos);
+    SetBit(idx);
+    if (idx < cur) cur = idx;
+    len++;
+  }
+
+  void Remove(Entry *e) {
+    auto idx = BucketIndex(e->key);
+    e->Remove();
+    if (buckets[idx].empty()) ClearBit(idx);
+    len--;
+  }
+
+  // Smallest key
+  Entry *Top() {
+    if (len == 0) return nullptr;
+    size_t w = cur / 64;
+    uint64_t word = bits[w] & (~0ULL << (cur % 64));
+    while (word == 0) word = bits[++w];
+    cur = w * 64 + __builtin_ctzll(word);
+    return buckets[cur].next->object();
+  }
+
+  // Largest key. Slower, only for work stealing.
+  Entry *Bottom() {
+    if (len == 0) return nullptr;
+    size_t w = (nr_buckets - 1) / 64;
+    while (bits[w] == 0) w--;
+    auto idx = w * 64 + 63 - __builtin_clzll(bits[w]);
+    return buckets[idx].prev->object();
+  }
+
+  void Reset() { cur = 0; }
+};
+
+}
+
+#endif /* BUCKET_QUEUE_H */
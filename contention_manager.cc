@@ -1,7 +1,10 @@
 #include <vector>
 #include <thread>
+#include <unordered_map>
+#include <map>
 
 #include "contention_manager.h"
+#include "hot_row_detector.h"
 #include "gc.h"
 #include "node_config.h"
 #include "opts.h"
@@ -19,6 +22,15 @@ struct VersionBuffer {
 static_assert(sizeof(VersionBuffer) % 64 == 0);
 
 size_t ContentionManager::g_prealloc_count = 256_K;
+bool ContentionManager::g_track_coaccess = false;
+
+struct ContentionManager::CoAccessTrace {
+  static constexpr size_t kMaxEdges = 64_K;
+  uint64_t last_sid;
+  VHandle *last_row;
+  size_t nr_edges;
+  std::pair<VHandle *, VHandle *> edges[kMaxEdges];
+};
 
 // Per-core buffer for each row. Each row needs a fixed size per core
 // buffer. This class represent all buffer for all rows for only one core.
@@ -162,7 +174,7 @@ void VersionBufferHandle::FlushIntoNoLock(VHandle *handle, uint64_t epoch_nr, un
 
 long VersionBufferHead::GetOrInstallBufferPos(ContentionManager *appender, VHandle *handle)
 {
-  long p = handle->buf_pos.load();
+  int p = handle->buf_pos.load();
   if (p != -1) return p;
   long new_pos = pos.load(std::memory_order_acquire);
   if (new_pos >= kMaxPos) {
@@ -255,9 +267,49 @@ ContentionManager::ContentionManager()
     al.pool = mem::Pool(mem::ContentionManagerPool, sizeof(VersionBufferHead), cap, i);
   }
   buffer_heads.fill(nullptr);
+
+  packer.reset(PackingPolicy::Create(Options::kBinpackPolicy.Get("knapsack")));
+  abort_if(packer == nullptr, "Unknown BinpackPolicy {}", Options::kBinpackPolicy.Get());
+
+  trace_file = nullptr;
+  if (Options::kBinpackTrace) {
+    trace_file = fopen(Options::kBinpackTrace.Get().c_str(), "w");
+    abort_if(trace_file == nullptr, "Cannot open {}", Options::kBinpackTrace.Get());
+  }
+
+  g_track_coaccess = Options::kBinpackSplitting
+                     && (packer->name() == "locality" || trace_file != nullptr);
+  coaccess.fill(nullptr);
+  if (g_track_coaccess) {
+    for (int i = 0; i < nr_threads; i++) {
+      coaccess[i] = (CoAccessTrace *) mem::AllocMemory(
+          mem::ContentionManagerPool, sizeof(CoAccessTrace), i / mem::kNrCorePerNode);
+      coaccess[i]->last_sid = 0;
+      coaccess[i]->last_row = nullptr;
+      coaccess[i]->nr_edges = 0;
+    }
+  }
+
   Reset();
 }
 
+ContentionManager::~ContentionManager()
+{
+  if (trace_file)
+    fclose(trace_file);
+}
+
+// Consecutive appends on the same core with the same sid come from the same
+// transaction. We only see rows that already have a buffer position.
+void ContentionManager::TrackCoAccess(VHandle *row, uint64_t sid)
+{
+  auto t = coaccess[go::Scheduler::CurrentThreadPoolId() - 1];
+  if (t->last_sid == sid && t->last_row != row && t->nr_edges < CoAccessTrace::kMaxEdges)
+    t->edges[t->nr_edges++] = {t->last_row, row};
+  t->last_sid = sid;
+  t->last_row = row;
+}
+
 VersionBufferHandle ContentionManager::GetOrInstall(VHandle *handle)
 {
   int core = go::Scheduler::CurrentThreadPoolId() - 1;
@@ -281,13 +333,18 @@ void ContentionManager::FinalizeFlush(uint64_t epoch_nr)
   }
 }
 
-void Binpack(VHandle **knapsacks, unsigned int nr_knapsack, int label, size_t limit);
-void PackLeftOver(VHandle **knapsacks, unsigned int nr_knapsack, int label);
-
 void ContentionManager::Reset()
 {
   auto nr_threads = NodeConfiguration::g_nr_threads;
   unsigned int sum = 0, nr_cleared = 0, nr_splitted = 0;
+  // Only split the rows HotRowDetector picked, if it's enabled. Without
+  // -XHotRowTopK the detector is never initialized, so don't look it up.
+  HotRowDetector *detector = HotRowDetector::g_enabled ? &util::Instance<HotRowDetector>() : nullptr;
+  auto should_split = [detector](VHandle *row) {
+    if (row->size - row->nr_updated() <= EpochClient::g_splitting_threshold)
+      return false;
+    return detector == nullptr || detector->IsHot(row);
+  };
 
   for (int core = 0; core < nr_threads; core++) {
     auto p = buffer_heads[core];
@@ -302,7 +359,7 @@ void ContentionManager::Reset()
 
         if (!Options::kOnDemandSplitting) continue;
 
-        if (row->size - row->nr_updated() <= EpochClient::g_splitting_threshold) continue;
+        if (!should_split(row)) continue;
         sum += row->nr_ondsplt;
         nr_splitted++;
       }
@@ -334,7 +391,7 @@ void ContentionManager::Reset()
 
       for (long i = 0; i < p->pos.load(std::memory_order_acquire); i++) {
         auto row = p->backrefs[i];
-        if (row->size - row->nr_updated() <= EpochClient::g_splitting_threshold) continue;
+        if (!should_split(row)) continue;
 
         row->cont_affinity = NodeConfiguration::g_nr_threads * (s + row->nr_ondsplt / 2) / sum;
         s += row->nr_ondsplt;
@@ -353,18 +410,21 @@ void ContentionManager::Reset()
 
   }
 
-  int delta = 0;
   if (Options::kBinpackSplitting && sum > 0) {
     // Exclude the Binpacking time
     EpochClient::g_workload_client->perf.End();
-    for (int core = 0; core < nr_threads - 1; core++) {
-      const size_t hard_limit = sum / nr_threads;
-      delta = hard_limit + delta - BinPack(knapsacks, nr_knapsacks, core, hard_limit + 1 + delta);
-    }
-    PackLeftOver(knapsacks, nr_knapsacks, nr_threads - 1);
+    Pack(knapsacks, nr_knapsacks);
     EpochClient::g_workload_client->perf.Start();
   }
 
+  if (g_track_coaccess) {
+    for (int core = 0; core < nr_threads; core++) {
+      coaccess[core]->last_sid = 0;
+      coaccess[core]->last_row = nullptr;
+      coaccess[core]->nr_edges = 0;
+    }
+  }
+
   for (int n = 0; n < nr_threads / mem::kNrCorePerNode; n++) {
     g_alloc[n].pos = 0;
   }
@@ -382,62 +442,77 @@ void ContentionManager::Reset()
   delete [] knapsacks;
 }
 
-size_t ContentionManager::BinPack(VHandle **knapsacks, unsigned int nr_knapsack, int label, size_t limit)
+void ContentionManager::Pack(VHandle **knapsacks, unsigned int nr_knapsack)
 {
-  if (limit == 0) return 0;
-
-  int *f = new int[limit];
-  int *pf = new int[limit];
-  auto *trace = new std::vector<bool>[nr_knapsack];
-  std::fill(pf, pf + limit, 0);
-
-  for (auto i = 0U; i < nr_knapsack; i++) {
-    if (knapsacks[i] == nullptr) continue;
-
-    trace[i].resize(limit);
-    auto wi = knapsacks[i]->nr_ondemand_split();
-    for (size_t w = 0; w < limit; w++) {
-      f[w] = pf[w];
-      if (w >= wi && pf[w - wi] + wi > f[w]) {
-        f[w] = pf[w - wi] + wi;
-        trace[i][w] = true;
-      }
-    }
-    std::swap(pf, f);
+  auto nr_threads = NodeConfiguration::g_nr_threads;
+  std::vector<PackItem> items(nr_knapsack);
+  for (unsigned int i = 0; i < nr_knapsack; i++) {
+    items[i].weight = knapsacks[i]->nr_ondemand_split();
   }
 
-  int maxcap = pf[limit - 1];
-  printf("Binpack max cap %d/%ld:", maxcap, limit);
-  auto w = limit - 1;
-  for (int i = nr_knapsack - 1; i >= 0; i--) {
-    if (knapsacks[i] == nullptr) continue;
+  std::vector<PackEdge> edges;
+  if (g_track_coaccess)
+    edges = CollectCoAccess(knapsacks, nr_knapsack);
 
-    auto wi = knapsacks[i]->nr_ondemand_split();
-    if (trace[i][w]) {
-      printf(" %d", wi);
-      w -= wi;
-      knapsacks[i]->cont_affinity = label;
-      knapsacks[i] = nullptr;
-    }
+  packer->Pack(items, edges, nr_threads);
+  for (unsigned int i = 0; i < nr_knapsack; i++) {
+    knapsacks[i]->cont_affinity = items[i].bin;
   }
-  puts("");
 
-  delete [] f;
-  delete [] pf;
-  delete [] trace;
-  return maxcap;
+  logger->info("Binpack {}: {} rows makespan {} lower bound {} cross-core {}/{} edges",
+               packer->name(), nr_knapsack,
+               PackingPolicy::Makespan(items, nr_threads),
+               PackingPolicy::LowerBound(items, nr_threads),
+               PackingPolicy::CrossBinWeight(items, edges), edges.size());
+
+  if (trace_file)
+    WriteTrace(items, edges);
 }
 
-void ContentionManager::PackLeftOver(VHandle **knapsacks, unsigned int nr_knapsack, int label)
+std::vector<PackEdge> ContentionManager::CollectCoAccess(VHandle **knapsacks, unsigned int nr_knapsack)
 {
-  printf("Binpack left:");
-  for (int i = 0; i < nr_knapsack; i++) {
-    if (knapsacks[i] != nullptr) {
-      printf(" %d", knapsacks[i]->nr_ondemand_split());
-      knapsacks[i]->cont_affinity = label;
+  std::unordered_map<VHandle *, unsigned int> idx;
+  for (unsigned int i = 0; i < nr_knapsack; i++) {
+    idx[knapsacks[i]] = i;
+  }
+
+  std::map<std::pair<unsigned int, unsigned int>, unsigned int> weights;
+  for (int core = 0; core < NodeConfiguration::g_nr_threads; core++) {
+    auto t = coaccess[core];
+    for (size_t i = 0; i < t->nr_edges; i++) {
+      auto ita = idx.find(t->edges[i].first);
+      auto itb = idx.find(t->edges[i].second);
+      if (ita == idx.end() || itb == idx.end()) continue;
+      auto a = std::min(ita->second, itb->second);
+      auto b = std::max(ita->second, itb->second);
+      weights[{a, b}]++;
     }
   }
-  puts("");
+
+  std::vector<PackEdge> edges;
+  for (auto &[k, w]: weights) {
+    edges.push_back(PackEdge{k.first, k.second, w});
+  }
+  return edges;
+}
+
+// Text format, read by benchmarks/binpack_benchmark.cc:
+//   epoch <nr_bins> <nr_items> <nr_edges>
+//   <weight> ... (one per item)
+//   <a> <b> <weight> (one line per edge)
+void ContentionManager::WriteTrace(const std::vector<PackItem> &items,
+                                   const std::vector<PackEdge> &edges)
+{
+  fprintf(trace_file, "epoch %d %lu %lu\n", NodeConfiguration::g_nr_threads,
+          items.size(), edges.size());
+  for (auto &item: items) {
+    fprintf(trace_file, "%u ", item.weight);
+  }
+  fputs("\n", trace_file);
+  for (auto &e: edges) {
+    fprintf(trace_file, "%u %u %u\n", e.a, e.b, e.weight);
+  }
+  fflush(trace_file);
 }
 
 }
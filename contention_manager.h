@@ -1,7 +1,10 @@
 #ifndef VHANDLE_BATCHAPPENDER_H
 #define VHANDLE_BATCHAPPENDER_H
 
+#include <memory>
+
 #include "vhandle.h"
+#include "binpack.h"
 
 namespace felis {
 
@@ -20,20 +23,33 @@ class ContentionManager {
   std::array<VersionBufferHead *, NodeConfiguration::kMaxNrThreads> buffer_heads;
   size_t est_split;
 
+  // Placement of split rows when -XBinpackSplitting is on.
+  std::unique_ptr<PackingPolicy> packer;
+  // Pairs of buffered rows appended by the same transaction, for the
+  // locality-aware packer.
+  struct CoAccessTrace;
+  std::array<CoAccessTrace *, NodeConfiguration::kMaxNrThreads> coaccess;
+  FILE *trace_file;
+
  public:
   ContentionManager();
+  ~ContentionManager();
   VersionBufferHandle GetOrInstall(VHandle *handle);
   void FinalizeFlush(uint64_t epoch_nr);
   void Reset();
   int GetRowContentionAffinity(VHandle *row) const;
 
+  void TrackCoAccess(VHandle *row, uint64_t sid);
+
   size_t estimated_splits() const { return est_split; }
 
   static size_t g_prealloc_count;
+  static bool g_track_coaccess;
 
  private:
-  static size_t BinPack(VHandle **knapsacks, unsigned int nr_knapsack, int label, size_t limit);
-  static void PackLeftOver(VHandle **knapsacks, unsigned int nr_knapsack, int label);
+  void Pack(VHandle **knapsacks, unsigned int nr_knapsack);
+  std::vector<PackEdge> CollectCoAccess(VHandle **knapsacks, unsigned int nr_knapsack);
+  void WriteTrace(const std::vector<PackItem> &items, const std::vector<PackEdge> &edges);
 };
 
 }
@@ -14,6 +14,7 @@ __thread felis::CoroSched *felis::coro_sched = nullptr;
 bool felis::CoroSched::g_use_coro_sched = false;
 bool felis::CoroSched::g_use_signal_future = false;
 size_t felis::CoroSched::g_ooo_buffer_size = 25;
+bool felis::CoroSched::g_adaptive = false;
 
 /** global list of per-core schedulers */
 static felis::CoroSched *coro_scheds[felis::NodeConfiguration::kMaxNrThreads] = {nullptr};
@@ -123,30 +124,56 @@ felis::CoroSched::CoroStack *felis::CoroSched::GetCoroStack()
   abort_if(free_corostack_list.empty(), "All CoroStack used up.");
   auto cs = free_corostack_list.front();
   free_corostack_list.pop_front();
+  if (!cs->resident) {
+    coro_stack_prepare(&cs->stack);
+    cs->resident = true;
+    nr_resident_stacks++;
+  }
+  nr_stacks_in_use++;
+  epoch_stats.max_stacks_in_use = std::max(epoch_stats.max_stacks_in_use, nr_stacks_in_use);
   return cs;
 }
 void felis::CoroSched::ReturnCoroStack(felis::CoroSched::CoroStack *cs)
 {
+  nr_stacks_in_use--;
   free_corostack_list.push_front(cs);
 }
 
+size_t felis::CoroSched::TrimStacks()
+{
+  // The free list is LIFO, so the stacks we need again are at the front.
+  size_t keep = std::max(kMinResidentStacks, epoch_stats.max_stacks_in_use);
+  size_t nr_released = 0;
+  for (auto cs: free_corostack_list) {
+    if (keep > 0) {
+      keep--;
+      continue;
+    }
+    if (!cs->resident) continue;
+    coro_stack_pool_release(&stack_pool, cs->stack_idx);
+    cs->resident = false;
+    nr_resident_stacks--;
+    nr_released++;
+  }
+  return nr_released;
+}
+
 felis::PieceRoutine *felis::CoroSched::GetNewPiece()
 {
   auto &zq = svc.queues[core_id]->zq;
   auto &q = svc.queues[core_id]->pq;
   auto &state = svc.queues[core_id]->state;
-  auto &priority_queue = *static_cast<ConservativePriorityScheduler *>(q.sched_pol);
+  auto &priority_queue = *q.sched_pol;
 
 retry_after_periodicIO:
 
   state.running = EpochExecutionDispatchService::State::kDeciding;
 
   // 1. try to run something from the zero queue
-  uint64_t zstart = zq.start;
-  if (zstart < zq.end) {
+  PieceRoutine *routine = zq.Front();
+  if (routine != nullptr) {
     state.running = EpochExecutionDispatchService::State::kRunning;
-    PieceRoutine *routine = zq.q[zstart];
-    zq.start = zstart + 1;
+    zq.Pop();
     CoroStack &me = *((CoroStack *) coro_get_co());
     me.sched_key = routine->sched_key;
     me.running_piece = routine;
@@ -167,7 +194,7 @@ retry_after_periodicIO:
 
   if (priority_queue.empty()
       && ooo_buffer_len == 0
-      && q.pending.end == q.pending.start) {
+      && q.pending.empty()) {
     state.running = EpochExecutionDispatchService::State::kSleeping;
   } else {
     state.running = EpochExecutionDispatchService::State::kRunning;
@@ -205,8 +232,8 @@ waiting_for_detached:
   // 4. try to run something from the OOO buffer
   auto waiting_coro = ooo_buffer[0];
   if (ooo_buffer_len > 0
-      && (ooo_buffer_len == g_ooo_buffer_size
-          || (priority_queue.empty() || priority_queue.q[0].key > waiting_coro->preempt_key))) {
+      && (ooo_buffer_len == ooo_window
+          || (priority_queue.empty() || priority_queue.TopKey() > waiting_coro->preempt_key))) {
     std::pop_heap(ooo_buffer, ooo_buffer + ooo_buffer_len, CoroStack::MinHeapCompare);
     ooo_buffer_len--;
     ShutdownAndSwitchTo(waiting_coro);
@@ -243,6 +270,7 @@ waiting_for_detached:
 
   // 8. If there are detached coroutines left, wait for it
   if (num_detached_coros > 0) {
+    epoch_stats.nr_idle_polls++;
     goto waiting_for_detached;
   }
 
@@ -257,7 +285,7 @@ bool felis::CoroSched::WaitForVHandleVal() {
   auto &zq = svc.queues[core_id]->zq;
   auto &q = svc.queues[core_id]->pq;
   auto &state = svc.queues[core_id]->state;
-  auto &priority_queue = *static_cast<ConservativePriorityScheduler *>(q.sched_pol);
+  auto &priority_queue = *q.sched_pol;
 
   // a coroutine cannot preempt when a previous coroutine paused to run you
   assert(paused_coro == nullptr);
@@ -275,20 +303,21 @@ bool felis::CoroSched::WaitForVHandleVal() {
     return false;
   }
 
-  abort_if(ooo_buffer_len == g_ooo_buffer_size, "OOO Window is full");
+  abort_if(ooo_buffer_len == ooo_window, "OOO Window is full");
+  epoch_stats.nr_preempts++;
 
   // add myself to the ooo buffer
   ooo_buffer[ooo_buffer_len] = &me;
   me.preempt_times++;
-  me.preempt_key = me.sched_key + kPreemptKeyThreshold * std::min(me.preempt_times, kMaxBackoff);
+  me.preempt_key = me.sched_key + preempt_key_threshold * std::min(me.preempt_times, kMaxBackoff);
   ooo_buffer_len++;
   std::push_heap(ooo_buffer, ooo_buffer + ooo_buffer_len, CoroStack::MinHeapCompare);
   CoroStack *candidate = ooo_buffer[0];
 
   // if there's nothing else to switch to, do not preempt
   if (ooo_buffer_len == 0  // ooo_buffer is empty
-      && (priority_queue.empty() || priority_queue.q[0].key > candidate->preempt_key)  // no new piece in priority queue
-      && zq.start >= zq.end  // zero queue is empty
+      && (priority_queue.empty() || priority_queue.TopKey() > candidate->preempt_key)  // no new piece in priority queue
+      && zq.Front() == nullptr  // zero queue is empty
       && ready_queue.IsEmpty()) {  // ready queue is empty
     return false;
   }
@@ -296,8 +325,7 @@ bool felis::CoroSched::WaitForVHandleVal() {
   // now find what to execute next
 
   // 1. check if there's something to run in the zero queue
-  uint64_t zstart = zq.start;
-  if (zstart < zq.end) {
+  if (zq.Front() != nullptr) {
     // preempt to a new coroutine to execute the zero queue piece
     cs_trace("core {} starting a new coroutine to run a zero queue piece", core_id);
     StartNewCoroutine();
@@ -307,7 +335,7 @@ bool felis::CoroSched::WaitForVHandleVal() {
   // 2. try to run something from the ready queue
   CoroStack *ready_candidate = ready_queue.Pop();
   if (ready_candidate != nullptr) {
-    if (ooo_buffer_len < g_ooo_buffer_size) {
+    if (ooo_buffer_len < ooo_window) {
       // if there is space in the OOO buffer, **preempt** myself to run the ready candidate
       num_detached_coros--;
       SwitchTo(ready_candidate);
@@ -322,17 +350,20 @@ bool felis::CoroSched::WaitForVHandleVal() {
     }
   }
 
+  if (ooo_buffer_len == ooo_window)
+    epoch_stats.nr_window_full++;
+
   // 3. resolve deadlock
-  if (ooo_buffer_len == g_ooo_buffer_size  // ooo_buffer is full
+  if (ooo_buffer_len == ooo_window  // ooo_buffer is full
       && candidate->preempt_times > kMaxBackoff  // has preempted max backoff times
-      && (candidate->sched_key > priority_queue.q[0].key  // the top of priority queue has smaller sched_key
-          || (candidate->sched_key == priority_queue.q[0].key  // the top of priority queue has the same sched_key
+      && (candidate->sched_key > priority_queue.TopKey()  // the top of priority queue has smaller sched_key
+          || (candidate->sched_key == priority_queue.TopKey()  // the top of priority queue has the same sched_key
               && candidate->running_piece->fv_signals > 0))) {  // but the waiting piece is a receiving piece
     // re-queue transactions that has larger sched_key than the top of the priority queue
     size_t new_ooo_buffer_size = 0;
     for (size_t i = 0; i < ooo_buffer_len; i++) {
       CoroStack *coro_to_reject = ooo_buffer[i];
-      if (coro_to_reject->sched_key >= priority_queue.q[0].key) {
+      if (coro_to_reject->sched_key >= priority_queue.TopKey()) {
         svc.AddToPriorityQueue(q, coro_to_reject->running_piece);
         ReturnCoroStack(coro_to_reject);
       } else {
@@ -341,17 +372,19 @@ bool felis::CoroSched::WaitForVHandleVal() {
       }
     }
     cs_trace("core {} re-queued {} routines", core_id, ooo_buffer_len - new_ooo_buffer_size);
+    epoch_stats.nr_requeued += ooo_buffer_len - new_ooo_buffer_size;
     ooo_buffer_len = new_ooo_buffer_size;
     std::make_heap(ooo_buffer, ooo_buffer + ooo_buffer_len);
   }
 
   // 4. check whether we should switch to a different waiting coroutine
   if (ooo_buffer_len > 0
-      && (ooo_buffer_len == g_ooo_buffer_size
-          || (priority_queue.empty() || priority_queue.q[0].key > candidate->preempt_key))) {
+      && (ooo_buffer_len == ooo_window
+          || (priority_queue.empty() || priority_queue.TopKey() > candidate->preempt_key))) {
     std::pop_heap(ooo_buffer, ooo_buffer + ooo_buffer_len, CoroStack::MinHeapCompare);
     ooo_buffer_len--;
     if (candidate == &me) {
+      epoch_stats.nr_wasted++;
       return false;
     } else {
       SwitchTo(candidate);
@@ -451,9 +484,14 @@ felis::CoroSched::CoroSched(uint64_t core_id)
   ready_queue{}
 {
   ooo_buffer = (CoroStack **) calloc(g_ooo_buffer_size, sizeof(CoroStack *));
+  ooo_window = g_adaptive ? std::min<size_t>(EpochExecutionDispatchService::kOutOfOrderWindow, g_ooo_buffer_size)
+                          : g_ooo_buffer_size;
+  coro_stack_pool_init(&stack_pool, kMaxNrCoroutine, kCoroutineStackSize, Options::kNoHugePage);
   for (int i = 0; i < kMaxNrCoroutine; i++) {
     auto coro_stack = (CoroStack *) malloc(sizeof(CoroStack));
-    coro_allocate_shared_stack(&coro_stack->stack, kCoroutineStackSize, Options::kNoHugePage, true);
+    coro_stack_pool_get(&stack_pool, i, &coro_stack->stack);
+    coro_stack->stack_idx = i;
+    coro_stack->resident = false;
     coro_stack->core_id = core_id;
     coro_stack->coroutine.is_finished = true;
     coro_reuse_coroutine(&coro_stack->coroutine, coro_get_co(), &coro_stack->stack, WorkerFunction, nullptr);
@@ -467,15 +505,55 @@ void felis::CoroSched::Reset()
   ready_queue.Reset();
 }
 
+void felis::CoroSched::Adapt()
+{
+  auto &s = epoch_stats;
+  if (s.nr_preempts == 0) return;
+
+  // Re-queueing throws away work, so the window is too large. Otherwise, if
+  // the window keeps filling up, we would rather keep more pieces in flight.
+  if (s.nr_requeued > 0)
+    ooo_window = std::max(kMinOOOWindow, ooo_window * 3 / 4);
+  else if (s.nr_window_full * 8 > s.nr_preempts)
+    ooo_window = std::min(g_ooo_buffer_size, ooo_window * 2);
+
+  // A preempted coroutine that gets picked again before its value is ready
+  // only spins. Back off further, and shorten the backoff if that rarely
+  // happens.
+  if (s.nr_wasted * 2 > s.nr_preempts)
+    preempt_key_threshold = std::min(kMaxPreemptKeyThreshold, preempt_key_threshold * 2);
+  else if (s.nr_wasted * 10 < s.nr_preempts)
+    preempt_key_threshold = std::max(kMinPreemptKeyThreshold, preempt_key_threshold * 3 / 4);
+}
+
+void felis::CoroSched::EndOfEpoch()
+{
+  fmt::memory_buffer buf;
+  for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
+    auto sched = coro_scheds[i];
+    if (sched == nullptr) continue;
+    auto &s = sched->epoch_stats;
+    auto nr_released = sched->TrimStacks();
+    fmt::format_to(buf, " {}:{}/{}/{}/{}/{}({},{}) stacks {}/{}(-{})",
+                   i, s.nr_preempts, s.nr_wasted, s.nr_window_full, s.nr_requeued, s.nr_idle_polls,
+                   sched->ooo_window, sched->preempt_key_threshold,
+                   s.max_stacks_in_use, sched->nr_resident_stacks, nr_released);
+    if (g_adaptive) sched->Adapt();
+    s = EpochStats();
+  }
+  logger->info("CoroSched preempts/wasted/full/requeued/idle(window,backoff) stacks max/resident(-released):{}",
+               std::string_view(buf.data(), buf.size()));
+}
+
 void felis::CoroSched::DumpStatus(bool halt)
 {
   auto &q = svc.queues[core_id]->pq;
-  auto &priority_queue = *static_cast<ConservativePriorityScheduler *>(q.sched_pol);
+  auto &priority_queue = *q.sched_pol;
   fmt::memory_buffer buf;
   fmt::format_to(buf, "Dumping state of CoroSched on core {}\n", core_id);
   fmt::format_to(buf, "num_detached_coros = {}\n", num_detached_coros);
   fmt::format_to(buf, "ooo_buffer_len = {}\n", ooo_buffer_len);
-  fmt::format_to(buf, "top of priority queue: sched_key = {}\n", priority_queue.q[0].key);
+  fmt::format_to(buf, "top of priority queue: sched_key = {}\n", priority_queue.TopKey());
   CoroStack &last_preempted_co = *ooo_buffer[ooo_buffer_len];
   fmt::format_to(buf, "last preempted: sched_key = {}, preempt_times = {}, preempt_key = {}\n",
                  last_preempted_co.sched_key, last_preempted_co.preempt_times, last_preempted_co.preempt_key);
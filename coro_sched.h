@@ -28,6 +28,8 @@ public:
     uint64_t preempt_key;  /*!< the sched key with backoff of the waiting coroutine */
     uint64_t preempt_times;  /*!< number of preempt called, used to calculated linear backoff */
     PieceRoutine *running_piece;
+    uint32_t stack_idx;  /*!< index into the CoroSched's stack pool */
+    bool resident;  /*!< stack has been touched since it was last released */
     static bool MinHeapCompare(CoroStack *a,  CoroStack *b);  /*!< compare function to build heap */
   };
 
@@ -67,18 +69,28 @@ public:
   /* Settings */
   static bool g_use_coro_sched;  /*!< if set use the coroutine scheduler instead of the normal ExecutionRoutine one */
   static bool g_use_signal_future;  /*!< if set use signal mechanism for future waits */
-  static size_t g_ooo_buffer_size;  /*!< size of the out of order execution window */
+  static size_t g_ooo_buffer_size;  /*!< size of the out of order execution window, the upper bound if adaptive */
+  static bool g_adaptive;  /*!< if set, adapt the window and the backoff step per core after each epoch */
 
 private:
   static constexpr size_t kMaxNrCoroutine = 10000;  /*!< number of coroutines allocated at initialization */
   static constexpr size_t kCoroutineStackSize = 64 * 1024;  /*!< min size of the coroutines' stack */
-  static constexpr uint64_t kPreemptKeyThreshold = 17000;  /*!< backoff step for preempted pieces */
+  static constexpr size_t kMinResidentStacks = 64;  /*!< stacks kept resident when trimming */
+  static constexpr uint64_t kPreemptKeyThreshold = 17000;  /*!< initial backoff step for preempted pieces */
   static constexpr uint64_t kMaxBackoff = 40;  /*!< max number of backoff steps for preempted pieces */
+
+  /* Bounds for the adaptive mode */
+  static constexpr size_t kMinOOOWindow = 4;
+  static constexpr uint64_t kMinPreemptKeyThreshold = 2000;
+  static constexpr uint64_t kMaxPreemptKeyThreshold = 1 << 20;
   static constexpr uint64_t kPeriodicIOInterval = 0x3F;  /*!< PeriodicIO event trigger interval */
 
   uint64_t core_id;  /*!< id of the core where this scheduler belongs to */
   bool is_running;  /*!< used to check whether StartCoroExec has overlapping calls */
-  std::list<CoroStack *> free_corostack_list;  /*!< list of pre-allocated but unused coroutines */
+  std::list<CoroStack *> free_corostack_list;  /*!< list of pre-allocated but unused coroutines, most recently used first */
+  struct coro_stack_pool stack_pool;  /*!< stacks are reserved, but only committed when used */
+  size_t nr_stacks_in_use = 0;
+  size_t nr_resident_stacks = 0;
   CoroStack **ooo_buffer;  /*!< out of order buffer, kept as a min heap */
   size_t ooo_buffer_len = 0;  /*!< number of ooo_buffer entry used */
   CoroStack *paused_coro = nullptr;  /*!< if set, means a coroutine paused itself to execute a ready queue piece */
@@ -89,9 +101,23 @@ private:
   ReadyQueue ready_queue;  /*!< list of detached coroutines that became ready using the signal mechanism */
   uint64_t num_detached_coros = 0;  /*!< keeps track of number of detached coroutines */
 
+  size_t ooo_window;  /*!< current size of the out of order window, <= g_ooo_buffer_size */
+  uint64_t preempt_key_threshold = kPreemptKeyThreshold;  /*!< current backoff step */
+
+  /** per-epoch counters, reported and cleared by EndOfEpoch() */
+  struct EpochStats {
+    uint64_t nr_preempts = 0;  /*!< calls to WaitForVHandleVal() */
+    uint64_t nr_wasted = 0;  /*!< preempts that came back to the caller, who keeps spinning */
+    uint64_t nr_window_full = 0;  /*!< preempts that found the window full */
+    uint64_t nr_requeued = 0;  /*!< coroutines re-queued to resolve a deadlock */
+    uint64_t nr_idle_polls = 0;  /*!< GetNewPiece() polls with only detached coroutines left */
+    size_t max_stacks_in_use = 0;  /*!< high watermark of coroutines in use */
+  } epoch_stats;
+
 public:
   static void Init();  /*!< Initializes CoroSched on a core. Must be called once before executing */
   static CoroSched *GetCoroSchedForCore(int core_id);  /*!< get a core's responsible coro_sched */
+  static void EndOfEpoch();  /*!< report per-core counters, adapt, and clear them. Cores must be idle */
 
   CoroSched() = delete;
   explicit CoroSched(uint64_t core_id);  /*!< Pre-allocates the coroutines */
@@ -112,6 +138,8 @@ private:
   CoroStack *GetCoroStack();  /*!< util to get a free coroutine from the free list */
   void ReturnCoroStack(CoroStack *cs);  /*!< util to return a coroutine to the free list */
   void Reset();  /*!< resets the coroutine scheduler before exiting */
+  void Adapt();  /*!< adjust ooo_window and preempt_key_threshold from epoch_stats */
+  size_t TrimStacks();  /*!< release the stacks that were not needed this epoch */
 
   /* Scheduler Calls - to be called within the coroutines */
   PieceRoutine *GetNewPiece();  /*!< try to get a new piece to run, scheduler may shut caller coroutine down */
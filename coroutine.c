@@ -20,6 +20,7 @@
   }
 
 void coro_default_exception_func(void);
+static void coro_init_stack_pointers(struct coro_shared_stack *stack);
 
 __thread struct coroutine *coro_glbl_tls_current_co = NULL;
 __thread struct coroutine *coro_glbl_tls_yield_co;
@@ -179,18 +180,80 @@ void coro_allocate_shared_stack(struct coro_shared_stack *stack, size_t size, bo
     }
   }
 
+  coro_init_stack_pointers(stack);
+  coro_stack_prepare(stack);
+}
+
+static void coro_init_stack_pointers(struct coro_shared_stack *stack)
+{
   stack->owner = NULL;
   uintptr_t aligned_ptr = (uintptr_t)(stack->size - sizeof(void *) * 2 +
       (uintptr_t)stack->ptr);
   aligned_ptr = (aligned_ptr >> 4) << 4; // aligned to 16 bytes
   stack->aligned_highptr = (void *)aligned_ptr;
   stack->aligned_ret_ptr = (void *)(aligned_ptr - sizeof(void *));
-  *((void **)(stack->aligned_ret_ptr)) =
-      (void *)(coro_default_exception_func);
   stack->aligned_limit =
       stack->size - sizeof(void *) * 2 - 16; // max cost of alignment
 }
 
+void coro_stack_prepare(struct coro_shared_stack *stack)
+{
+  *((void **)(stack->aligned_ret_ptr)) =
+      (void *)(coro_default_exception_func);
+}
+
+void coro_stack_pool_init(struct coro_stack_pool *pool, size_t nr_stacks,
+                          size_t size, bool enable_guard_page)
+{
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  size = (size + page_size - 1) & ~(page_size - 1);
+  if (size < page_size)
+    size = page_size;
+
+  pool->nr_stacks = nr_stacks;
+  pool->guard_size = enable_guard_page ? page_size : 0;
+  pool->stride = size + pool->guard_size;
+  // Reserve only. Pages are committed on first touch.
+  pool->base = mmap(NULL, pool->stride * nr_stacks, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (pool->base == MAP_FAILED) {
+    perror("coro_stack_pool_init");
+    abort();
+  }
+  // Huge pages would commit 2MB at a time, many stacks at once.
+  madvise(pool->base, pool->stride * nr_stacks, MADV_NOHUGEPAGE);
+
+  if (enable_guard_page) {
+    for (size_t i = 0; i < nr_stacks; i++) {
+      mprotect((uint8_t *) pool->base + i * pool->stride, page_size, PROT_NONE);
+    }
+  }
+}
+
+void coro_stack_pool_get(struct coro_stack_pool *pool, size_t idx,
+                         struct coro_shared_stack *stack)
+{
+  memset(stack, 0, sizeof(*stack));
+  stack->real_ptr = (uint8_t *) pool->base + idx * pool->stride;
+  stack->real_size = pool->stride;
+  stack->ptr = (uint8_t *) stack->real_ptr + pool->guard_size;
+  stack->size = pool->stride - pool->guard_size;
+  stack->guard_page_enabled = pool->guard_size > 0;
+  coro_init_stack_pointers(stack);
+}
+
+void coro_stack_pool_release(struct coro_stack_pool *pool, size_t idx)
+{
+  uint8_t *p = (uint8_t *) pool->base + idx * pool->stride + pool->guard_size;
+  madvise(p, pool->stride - pool->guard_size, MADV_DONTNEED);
+}
+
+void coro_stack_pool_destroy(struct coro_stack_pool *pool)
+{
+  munmap(pool->base, pool->stride * pool->nr_stacks);
+  pool->base = NULL;
+}
+
 void coro_destroy_shared_stack(struct coro_shared_stack *sstack)
 {
 	abort_if_c(sstack != NULL);
@@ -75,6 +75,48 @@ void coro_allocate_shared_stack(struct coro_shared_stack *stack, size_t size, bo
  */
 void coro_destroy_shared_stack(struct coro_shared_stack *sstack);
 
+/**
+ * A pool of equally sized stacks carved out of one reservation. Unlike
+ * coro_allocate_shared_stack(), nothing is locked or touched up front, so a
+ * stack only becomes resident when a coroutine runs on it, and it can be given
+ * back to the kernel with coro_stack_pool_release().
+ */
+struct coro_stack_pool {
+	void *base;
+	size_t nr_stacks;
+	size_t stride; /* stack size plus the guard page */
+	size_t guard_size;
+};
+
+/**
+ * Reserves nr_stacks stacks of at least size bytes.
+ *
+ * \param enable_guard_page Put a protected page below each stack.
+ */
+void coro_stack_pool_init(struct coro_stack_pool *pool, size_t nr_stacks,
+			  size_t size, bool enable_guard_page);
+
+/**
+ * Points stack to the idx-th stack of the pool. The stack memory is not
+ * touched, call coro_stack_prepare() before running a coroutine on it.
+ */
+void coro_stack_pool_get(struct coro_stack_pool *pool, size_t idx,
+			 struct coro_shared_stack *stack);
+
+/**
+ * Gives the pages of the idx-th stack back to the kernel. The stack can be
+ * used again after coro_stack_prepare().
+ */
+void coro_stack_pool_release(struct coro_stack_pool *pool, size_t idx);
+
+void coro_stack_pool_destroy(struct coro_stack_pool *pool);
+
+/**
+ * Writes the guard return address at the top of the stack. This touches the
+ * top page only.
+ */
+void coro_stack_prepare(struct coro_shared_stack *stack);
+
 /**
  * Coroutine function type.
  */
@@ -8,12 +8,17 @@
 #include "log.h"
 #include "vhandle.h"
 #include "contention_manager.h"
+#include "hot_row_detector.h"
+#include "repartition.h"
+#include "slice_balancer.h"
+#include "secondary_index.h"
 #include "threshold_autotune.h"
 #include "pwv_graph.h"
 
 #include "console.h"
 #include "mem.h"
 #include "gc.h"
+#include "hashtable_index_impl.h"
 #include "opts.h"
 #include "commit_buffer.h"
 
@@ -268,19 +273,6 @@ void CallTxnsWorker::Run()
 
   while (AllocStateTxnWorker::comp.load() != 0) _mm_pause();
 
-  // Collect buffer plans for all txns of this core
-  for (auto i = 0; i < pq->nr; i++) {
-    auto txn = pq->txns[i];
-    txn->ResetRoot();
-    std::invoke(mem_func, txn);
-    client->conf.CollectBufferPlan(txn->root_promise(),  cnt);
-  }
-
-  // Flush this core's buffer plan counters to the node's global buffer plan counters.
-  // Only the last node will successfully flush the node's global buffer plan counters to the network and sets
-  // node_finished to true.
-  bool node_finished = client->conf.FlushBufferPlan(client->per_core_cnts[t]);
-
   // Try to assign a default partition scheme if nothing has been
   // assigned. Because transactions are already round-robinned, there is no
   // imbalanced here.
@@ -292,29 +284,61 @@ void CallTxnsWorker::Run()
   }
   extra_offset %= client->core_limit;
 
+  // With streaming counters, we plan and issue a batch of txns at a time, so
+  // that other nodes can start on our pieces while we are still planning.
+  // Otherwise, the whole core is one batch.
+  size_t batch_size = NodeConfiguration::g_counter_batch;
+  if (batch_size == 0) batch_size = std::max<size_t>(pq->nr, 1);
+
   auto &transport = util::Impl<PromiseRoutineTransportService>();
-  for (size_t i = 0; i < pq->nr; i++) {
-    auto txn = pq->txns[i];
-    auto aff = t;
-
-    if (client->callback.phase == EpochPhase::Execute
-        && t >= client->core_limit) {
-      // auto avail_nr_zones = client->core_limit / mem::kNrCorePerNode;
-      // auto zone = t % avail_nr_zones;
-      aff = (i + extra_offset) % client->core_limit;
+  bool node_finished = false;
+  size_t nr_fused = 0;
+  size_t start = 0;
+  do {
+    size_t end = std::min<size_t>(start + batch_size, pq->nr);
+    if (start > 0) std::fill(cnt, cnt + cnt_len, 0);
+
+    // Collect buffer plans for this batch of txns
+    for (auto i = start; i < end; i++) {
+      auto txn = pq->txns[i];
+      txn->ResetRoot();
+      std::invoke(mem_func, txn);
+      if (BasePieceCollection::g_piece_fusion)
+        nr_fused += txn->root_promise()->Fuse();
+      client->conf.CollectBufferPlan(txn->root_promise(),  cnt);
     }
 
-    auto root = txn->root_promise();
-    root->AssignAffinity(aff);
-    root->Complete();
+    // Flush this core's buffer plan counters to the node's global buffer plan counters.
+    // Only the last node will successfully flush the node's global buffer plan counters to the network and sets
+    // node_finished to true.
+    node_finished |= client->conf.FlushBufferPlan(cnt, end == pq->nr);
 
-    // Doesn't seems to work that well, but just in case it works well for some
-    // workloads. For example, issuing takes a longer time.
-    if ((i & 0xFF) == 0) transport.PrefetchInbound();
-  }
+    for (size_t i = start; i < end; i++) {
+      auto txn = pq->txns[i];
+      auto aff = t;
+
+      if (client->callback.phase == EpochPhase::Execute
+          && t >= client->core_limit) {
+        // auto avail_nr_zones = client->core_limit / mem::kNrCorePerNode;
+        // auto zone = t % avail_nr_zones;
+        aff = (i + extra_offset) % client->core_limit;
+      }
+
+      auto root = txn->root_promise();
+      root->AssignAffinity(aff);
+      root->Complete();
+
+      // Doesn't seems to work that well, but just in case it works well for some
+      // workloads. For example, issuing takes a longer time.
+      if ((i & 0xFF) == 0) transport.PrefetchInbound();
+    }
+    start = end;
+  } while (start < pq->nr);
 
   auto core_id = go::Scheduler::CurrentThreadPoolId() - 1;
   logger->info("Core {} finished attaching promise routines for all txns.", core_id);
+  if (BasePieceCollection::g_piece_fusion)
+    logger->info("Core {} fused {} pieces", core_id, nr_fused);
 
   set_urgent(false);
 
@@ -337,6 +361,8 @@ void CallTxnsWorker::Run()
     VHandle::Quiescence();
     RowEntity::Quiescence();
 
+    // Everyone has left the last epoch, and its scans with it.
+    util::Instance<GC>().ReclaimVersions(util::Instance<EpochManager>().current_epoch_nr());
     mem::GetDataRegion().Quiescence();
   } else if (client->callback.phase == EpochPhase::Initialize) {
   } else if (client->callback.phase == EpochPhase::Insert) {
@@ -400,6 +426,11 @@ void EpochClient::InitializeEpoch()
   mgr.DoAdvance(this);
   auto epoch_nr = mgr.current_epoch_nr();
 
+  HashtableIndex::ReclaimRetired(epoch_nr);
+
+  if (Repartitioner::g_enabled)
+    util::Instance<Repartitioner>().OnEpochBegin(epoch_nr);
+
   util::Impl<PromiseAllocationService>().Reset();
 
   auto nr_threads = NodeConfiguration::g_nr_threads;
@@ -431,11 +462,19 @@ void EpochClient::OnInsertComplete()
   // GC must have been completed
   auto &gc = util::Instance<GC>();
   gc.PrintStats();
+  auto gc_stats = gc.CollectEpochStats(util::Instance<EpochManager>().current_epoch_nr());
+  gc.AdaptThreshold(gc_stats, callback.perf.duration_ms());
   gc.ClearStats();
   probes::EndOfPhase{util::Instance<EpochManager>().current_epoch_nr(), 0}();
 
   stats.insert_time_ms += callback.perf.duration_ms();
 
+  if (HotRowDetector::g_enabled)
+    util::Instance<HotRowDetector>().Clear();
+
+  // The txns of this epoch scan the indexes from Prepare() on.
+  util::Instance<SecondaryIndexManager>().Flush();
+
   callback.phase = EpochPhase::Initialize;
   CallTxns(
       util::Instance<EpochManager>().current_epoch_nr(),
@@ -450,13 +489,18 @@ void EpochClient::OnInitializeComplete()
 
   callback.phase = EpochPhase::Execute;
 
-  if (NodeConfiguration::g_data_migration && util::Instance<EpochManager>().current_epoch_nr() == 1) {
+  // The Repartitioner ships slices by itself.
+  if (NodeConfiguration::g_data_migration && !Repartitioner::g_enabled
+      && util::Instance<EpochManager>().current_epoch_nr() == 1) {
     logger->info("Starting data scanner thread");
     auto &peer = util::Instance<felis::NodeConfiguration>().config().row_shipper_peer;
     go::GetSchedulerFromPool(NodeConfiguration::g_nr_threads + 1)->WakeUp(
       new felis::RowScannerRoutine());
   }
 
+  if (HotRowDetector::g_enabled)
+    util::Instance<HotRowDetector>().Finalize();
+
   if (Options::kVHandleBatchAppend || Options::kOnDemandSplitting) {
     util::Instance<ContentionManager>().Reset();
   }
@@ -489,6 +533,10 @@ void EpochClient::OnExecuteComplete()
     fmt::format_to(buf, "{} ", c);
   }
   logger->info("Wait Counts {}", std::string_view(buf.begin(), buf.size()));
+  util::Impl<PromiseRoutineTransportService>().DumpStats();
+
+  if (CoroSched::g_use_coro_sched)
+    CoroSched::EndOfEpoch();
   if (Options::kCoreScaling && cur_epoch_nr > 1) {
     auto ctt_rate = ctt / callback.perf.duration_ms();
 
@@ -521,6 +569,11 @@ void EpochClient::OnExecuteComplete()
 
   probes::EndOfPhase{cur_epoch_nr, 2}();
 
+  if (Repartitioner::g_enabled)
+    util::Instance<Repartitioner>().OnEpochEnd(cur_epoch_nr);
+  if (SliceCoreBalancer::g_enabled)
+    util::Instance<SliceCoreBalancer>().OnEpochEnd(cur_epoch_nr);
+
   if (Options::kAutoTuneThreshold) {
     g_splitting_threshold = g_threshold_autotune.GetNextThreshold(
         g_splitting_threshold,
@@ -542,6 +595,20 @@ void EpochClient::OnExecuteComplete()
     mem::GetDataRegion().PrintUsageEachClass();
 
     if (Options::kOutputDir) {
+      json11::Json::array gc_result;
+      for (auto &e: util::Instance<GC>().epoch_stats_history()) {
+        gc_result.push_back(json11::Json::object {
+            {"epoch", static_cast<int>(e.epoch_nr)},
+            {"gc_every_epoch", static_cast<int>(e.gc_every_epoch)},
+            {"rows", static_cast<double>(e.nr_rows)},
+            {"versions", static_cast<double>(e.nr_versions)},
+            {"bytes", static_cast<double>(e.nr_bytes)},
+            {"time_us", static_cast<double>(e.gc_time_us)},
+            {"max_time_us", static_cast<double>(e.max_gc_time_us)},
+            {"stragglers", e.nr_stragglers},
+            {"mem_headroom", e.mem_headroom},
+          });
+      }
       json11::Json::object result {
         {"cpu", static_cast<int>(NodeConfiguration::g_nr_threads)},
         {"duration", static_cast<int>(perf.duration_ms())},
@@ -549,6 +616,7 @@ void EpochClient::OnExecuteComplete()
         {"insert_time", stats.insert_time_ms},
         {"initialize_time", stats.initialize_time_ms},
         {"execution_time", stats.execution_time_ms},
+        {"gc", gc_result},
       };
       auto node_name = util::Instance<NodeConfiguration>().config().name;
       time_t tm;
@@ -231,6 +231,7 @@ template <typename T> class GenericEpochObject;
 class EpochObject {
   friend class Epoch;
   friend class TcpNodeTransport;
+  friend class BaseTxn;
  protected:
   uint64_t epoch_nr;
   int node_id;
@@ -9,6 +9,9 @@
 
 #include "literals.h"
 
+#include <algorithm>
+#include <chrono>
+
 namespace felis {
 
 struct GarbageBlock : public util::GenericListNode<GarbageBlock> {
@@ -131,14 +134,74 @@ void GC::RemoveRow(VHandle *row, uint64_t gc_handle)
   return g_slabs[blk->alloc_core]->Remove(blk, idx);
 }
 
+void GC::FreeRow(VHandle *row)
+{
+  auto handle = row->gc_handle.load(std::memory_order_relaxed);
+  if (handle) RemoveRow(row, handle);
+
+  auto objects = row->versions + row->capacity;
+  for (unsigned int i = 0; i < row->size; i++) {
+    if ((objects[i] >> 32) == (kPendingValue >> 32))
+      continue;
+    auto p = (VarStr *) objects[i];
+    if (IsDataGarbage(row, p))
+      delete p;
+  }
+  if ((uint8_t *) row->versions - (uint8_t *) row != 64)
+    mem::GetDataRegion().Free(row->versions, row->alloc_by_regionid,
+                              2 * row->capacity * sizeof(uint64_t));
+  delete row;
+}
+
+void GC::RetireVersions(uint64_t *versions, int regionid, size_t len, uint64_t epoch_nr)
+{
+  // Nobody scans while we are loading.
+  if (epoch_nr == 0) {
+    mem::GetDataRegion().Free(versions, regionid, len);
+    return;
+  }
+  auto core_id = mem::ParallelPool::CurrentAffinity();
+  abort_if(core_id < 0 || core_id >= NodeConfiguration::kMaxNrThreads,
+           "Cannot retire version arrays on core {}", core_id);
+  retired_versions[core_id].push_back({versions, regionid, len, epoch_nr});
+}
+
+void GC::ReclaimVersions(uint64_t epoch_nr)
+{
+  auto core_id = mem::ParallelPool::CurrentAffinity();
+  if (core_id < 0 || core_id >= NodeConfiguration::kMaxNrThreads)
+    return;
+  auto &l = retired_versions[core_id];
+  auto it = std::partition(
+      l.begin(), l.end(),
+      [epoch_nr](const RetiredVersions &r) { return r.epoch_nr >= epoch_nr; });
+  for (auto p = it; p != l.end(); ++p)
+    mem::GetDataRegion().Free(p->versions, p->regionid, p->len);
+  l.erase(it, l.end());
+}
+
+size_t GC::nr_retired_versions() const
+{
+  size_t nr = 0;
+  for (auto &l: retired_versions) nr += l.size();
+  return nr;
+}
+
 unsigned int GC::g_gc_every_epoch = 0;
 bool GC::g_lazy = false;
+bool GC::g_adaptive = false;
+unsigned int GC::g_min_gc_every_epoch = 2;
+unsigned int GC::g_max_gc_every_epoch = GarbageBlockSlab::kNrQueue - 1;
+double GC::g_low_headroom = 0.2;
+double GC::g_high_headroom = 0.5;
 std::array<GarbageBlockSlab *, NodeConfiguration::kMaxNrThreads> GC::g_slabs;
 
 void GC::InitPool()
 {
   abort_if(g_gc_every_epoch >= GarbageBlockSlab::kNrQueue,
            "g_gc_every_epoch {} >= {}", g_gc_every_epoch, GarbageBlockSlab::kNrQueue);
+  abort_if(g_max_gc_every_epoch >= GarbageBlockSlab::kNrQueue,
+           "g_max_gc_every_epoch {} >= {}", g_max_gc_every_epoch, GarbageBlockSlab::kNrQueue);
 
   for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
     g_slabs[i] = new GarbageBlockSlab(i);
@@ -201,13 +264,21 @@ void GC::RunGC()
   auto cur_epoch_nr = util::Instance<EpochManager>().current_epoch_nr();
   int q_idx = (cur_epoch_nr + 1) % g_gc_every_epoch;
 
-  auto &s = stats[go::Scheduler::CurrentThreadPoolId() - 1];
+  auto core_id = go::Scheduler::CurrentThreadPoolId() - 1;
+  auto &s = stats[core_id];
+  auto &ts = table_stats[core_id];
+  auto start = std::chrono::steady_clock::now();
+  auto on_return = [&s, start]() {
+    auto end = std::chrono::steady_clock::now();
+    s.gc_time_us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+  };
 
   GarbageBlock *b = collect_head.load();
   while (true) {
     // logger->info("GC block {}", (void *) b);
     while (!b || !collect_head.compare_exchange_strong(b, b->next->object())) {
       if (!b) {
+        on_return();
         return;
       }
     }
@@ -224,10 +295,11 @@ void GC::RunGC()
       // abort_if((uint64_t) &b->rows[i] != b->rows[i]->gc_handle.load(),
       //          "gc_handle {:x} i {} blk {}", b->rows[i]->gc_handle.load(), i, (void *) b);
 
-      auto old = s.nr_bytes;
-      auto nr_processed = Process(b->rows[i], cur_epoch_nr, 16_K);
+      auto row = b->rows[i];
+      auto nr_processed = Process(row, cur_epoch_nr, 16_K);
+      ts[RowTableSlot(row)].nr_rows++;
       if (nr_processed < 16_K) {
-        b->rows[i]->gc_handle = 0;
+        row->gc_handle = 0;
         b->bitmap &= ~(1ULL << i);
         s.nr_rows++;
         continue;
@@ -246,6 +318,7 @@ void GC::RunGC()
 
         s.nr_rows++;
         s.straggler = true;
+        on_return();
         return;
       }
     }
@@ -296,12 +369,21 @@ size_t GC::Collect(VHandle *handle, uint64_t cur_epoch_nr, size_t limit)
     trace(TRACE_GC "BeforeGC on row {} {}, i {}", (void *) handle, handle->ToString(), i);
   }
 
+  auto core_id = go::Scheduler::CurrentThreadPoolId() - 1;
+  auto &s = stats[core_id];
+  auto &ts = table_stats[core_id][RowTableSlot(handle)];
+  auto old_nr_bytes = s.nr_bytes;
+
   for (auto j = 0; j < i; j++) {
     auto p = (VarStr *) objects[j];
     auto next = (VarStr *) objects[j + 1];
     FreeIfGarbage(handle, p, next);
   }
 
+  s.nr_versions += i;
+  ts.nr_versions += i;
+  ts.nr_bytes += s.nr_bytes - old_nr_bytes;
+
   std::move(objects + i, objects + handle->size, objects);
   std::move(versions + i, versions + handle->size, versions);
   handle->size -= i;
@@ -325,16 +407,122 @@ bool GC::IsDataGarbage(VHandle *row, VarStr *data)
   return true;
 }
 
+int GC::RowTableSlot(VHandle *row)
+{
+  auto rel_id = row->relation_id();
+  if (rel_id < 0 || rel_id >= kUntrackedTable)
+    return kUntrackedTable;
+  return rel_id;
+}
+
 void GC::PrintStats()
 {
   fmt::memory_buffer buf;
   for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
     auto &s = stats[i];
-    fmt::format_to(buf, " {}({}{})={}K",
+    fmt::format_to(buf, " {}({}{})={}K/{}v/{}us",
                    s.nr_rows, s.nr_blocks, s.straggler ? "*" : "",
-                   s.nr_bytes >> 10);
+                   s.nr_bytes >> 10, s.nr_versions, s.gc_time_us);
   }
   logger->info("GC: {}", std::string_view(buf.data(), buf.size()));
+
+  buf.clear();
+  for (int tbl = 0; tbl < kMaxNrTrackedTables; tbl++) {
+    TableStats sum{0, 0, 0};
+    for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
+      sum.nr_rows += table_stats[i][tbl].nr_rows;
+      sum.nr_versions += table_stats[i][tbl].nr_versions;
+      sum.nr_bytes += table_stats[i][tbl].nr_bytes;
+    }
+    if (sum.nr_rows == 0 && sum.nr_versions == 0)
+      continue;
+    if (tbl == kUntrackedTable)
+      fmt::format_to(buf, " ?:");
+    else
+      fmt::format_to(buf, " {}:", tbl);
+    fmt::format_to(buf, "{}r/{}v/{}K", sum.nr_rows, sum.nr_versions, sum.nr_bytes >> 10);
+  }
+  if (buf.size() > 0)
+    logger->info("GC per table: {}", std::string_view(buf.data(), buf.size()));
+}
+
+GC::EpochStats GC::CollectEpochStats(uint64_t epoch_nr)
+{
+  EpochStats e;
+  memset(&e, 0, sizeof(EpochStats));
+  e.epoch_nr = epoch_nr;
+  e.gc_every_epoch = g_gc_every_epoch;
+
+  for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
+    auto &s = stats[i];
+    e.nr_rows += s.nr_rows;
+    e.nr_versions += s.nr_versions;
+    e.nr_bytes += s.nr_bytes;
+    e.gc_time_us += s.gc_time_us;
+    e.max_gc_time_us = std::max(e.max_gc_time_us, s.gc_time_us);
+    if (s.straggler) e.nr_stragglers++;
+  }
+
+  auto cap = mem::SlabMemoryCapacity();
+  e.mem_headroom = cap == 0 ? 1.0 : 1.0 - double(mem::SlabMemoryUsed()) / cap;
+  history.push_back(e);
+  return e;
+}
+
+void GC::AdaptThreshold(const EpochStats &last, uint32_t phase_duration_ms)
+{
+  if (!g_adaptive || g_lazy)
+    return;
+
+  auto next = g_gc_every_epoch;
+  // GC runs in parallel on all cores at the end of the Insert phase, so the
+  // slowest core is what delays the phase.
+  double gc_ms = last.max_gc_time_us / 1000.0;
+  double gc_frac = phase_duration_ms == 0 ? 0 : gc_ms / phase_duration_ms;
+
+  if (last.mem_headroom < g_low_headroom) {
+    // Running out of memory. Collect twice as often.
+    next = std::max(g_min_gc_every_epoch, next / 2);
+  } else if (last.mem_headroom > g_high_headroom && (gc_frac > 0.1 || last.nr_stragglers > 0)) {
+    // Plenty of memory, but GC is showing up. Batch more epochs into one GC
+    // pass so that we scan each row fewer times.
+    next = std::min(g_max_gc_every_epoch, next + std::max(1U, next / 4));
+  }
+
+  if (next != g_gc_every_epoch) {
+    logger->info("GC: adapting g_gc_every_epoch {} -> {}, headroom {:.2f} gc {:.1f}ms/{}ms",
+                 g_gc_every_epoch, next, last.mem_headroom, gc_ms, phase_duration_ms);
+    ResizeQueues(next);
+  }
+}
+
+// Only call this at the epoch boundary! Rows in queue q were added at epoch e
+// with e % g_gc_every_epoch == q. Collecting a row earlier than planned is
+// always safe, because Collect() only frees versions that are older than the
+// current epoch, so we can simply fold the queues that no longer exist into
+// the remaining ones.
+void GC::ResizeQueues(unsigned int new_gc_every_epoch)
+{
+  auto old_gc_every_epoch = g_gc_every_epoch;
+  for (int core_id = 0; core_id < NodeConfiguration::g_nr_threads; core_id++) {
+    auto slab = g_slabs[core_id];
+    for (unsigned int q = new_gc_every_epoch; q < old_gc_every_epoch; q++) {
+      auto dst = q % new_gc_every_epoch;
+      while (!slab->full[q].empty()) {
+        auto blk = slab->full[q].next->object();
+        blk->Remove();
+        blk->q_idx = dst;
+        blk->InsertAfter(&slab->full[dst]);
+      }
+      while (!slab->half[q].empty()) {
+        auto blk = slab->half[q].next->object();
+        blk->Remove();
+        blk->q_idx = dst;
+        blk->InsertAfter(&slab->half[dst]);
+      }
+    }
+  }
+  g_gc_every_epoch = new_gc_every_epoch;
 }
 
 }
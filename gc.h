@@ -1,6 +1,8 @@
 #ifndef GC_H
 #define GC_H
 
+#include <vector>
+
 #include "util/objects.h"
 #include "mem.h"
 #include "node_config.h"
@@ -19,22 +21,79 @@ class GC {
   struct {
     int nr_rows, nr_blocks;
     size_t nr_bytes;
+    size_t nr_versions;
+    uint64_t gc_time_us;
     bool straggler;
-    uint32_t padding[11];
+    uint32_t padding[7];
   } stats[NodeConfiguration::kMaxNrThreads];
 
+  static_assert(sizeof(stats[0]) == 64);
+
+ public:
+  // Per-table breakdown. Relations beyond kUntrackedTable, or rows we don't
+  // know the relation of, end up in the last slot.
+  static constexpr int kMaxNrTrackedTables = 64;
+  static constexpr int kUntrackedTable = kMaxNrTrackedTables - 1;
+
+  struct TableStats {
+    size_t nr_rows;
+    size_t nr_versions;
+    size_t nr_bytes;
+  };
+
+  // Aggregated over all cores, one entry per epoch.
+  struct EpochStats {
+    uint64_t epoch_nr;
+    unsigned int gc_every_epoch;
+    size_t nr_rows, nr_versions, nr_bytes;
+    uint64_t gc_time_us;       // Sum of all cores
+    uint64_t max_gc_time_us;   // Slowest core
+    int nr_stragglers;
+    double mem_headroom;
+  };
+ private:
+  std::array<std::array<TableStats, kMaxNrTrackedTables>, NodeConfiguration::kMaxNrThreads> table_stats;
+
+  struct RetiredVersions {
+    uint64_t *versions;
+    int regionid;
+    size_t len;
+    uint64_t epoch_nr;
+  };
+  // Only touched by its own core.
+  std::array<std::vector<RetiredVersions>, NodeConfiguration::kMaxNrThreads> retired_versions;
+  std::vector<EpochStats> history;
+
  public:
   uint64_t AddRow(VHandle *row, uint64_t epoch_nr);
   void RemoveRow(VHandle *row, uint64_t gc_handle);
+  // Frees a row that was deleted from its index, with all of its versions.
+  void FreeRow(VHandle *row);
+  // A version array that a growing append swapped out. Lock free readers (see
+  // ShouldScanSkip()) may still be on it, so it waits for the epoch to end.
+  void RetireVersions(uint64_t *versions, int regionid, size_t len, uint64_t epoch_nr);
+  // Frees the version arrays this core retired before epoch_nr.
+  void ReclaimVersions(uint64_t epoch_nr);
+  size_t nr_retired_versions() const;
   void PrepareGCForAllCores();
   void RunGC();
   void PrintStats();
   void ClearStats() {
     for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
-      memset(&stats[i], 0, 64);
+      memset(&stats[i], 0, sizeof(stats[i]));
+      memset(table_stats[i].data(), 0, sizeof(table_stats[i]));
     }
   }
 
+  // Summarize this epoch's stats into history. Must be called before
+  // ClearStats().
+  EpochStats CollectEpochStats(uint64_t epoch_nr);
+  const std::vector<EpochStats> &epoch_stats_history() const { return history; }
+
+  // Adaptive major GC threshold. Looks at the memory headroom and the time we
+  // spent in GC during the last Insert phase, and adjusts g_gc_every_epoch.
+  void AdaptThreshold(const EpochStats &last, uint32_t phase_duration_ms);
+
   static void InitPool();
 
   static bool IsDataGarbage(VHandle *row, VarStr *data);
@@ -44,8 +103,18 @@ class GC {
 
   static unsigned int g_gc_every_epoch;
   static bool g_lazy;
+
+  static bool g_adaptive;
+  static unsigned int g_min_gc_every_epoch;
+  static unsigned int g_max_gc_every_epoch;
+  // Below this fraction of free memory, we collect more eagerly.
+  static double g_low_headroom;
+  // Above this fraction of free memory, we may collect lazier if GC is slow.
+  static double g_high_headroom;
  private:
   size_t Process(VHandle *handle, uint64_t cur_epoch_nr, size_t limit);
+  void ResizeQueues(unsigned int new_gc_every_epoch);
+  static int RowTableSlot(VHandle *row);
 };
 
 }
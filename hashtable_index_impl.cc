@@ -1,7 +1,13 @@
+#include <algorithm>
 #include <cstdlib>
+#include <vector>
 #include <sys/mman.h>
 
 #include "hashtable_index_impl.h"
+#include "epoch.h"
+#include "gc.h"
+#include "log.h"
+#include "util/locks.h"
 #include "xxHash/xxhash.h"
 
 namespace felis {
@@ -61,79 +67,168 @@ static thread_local ThreadInfo *local_ti = nullptr;
 
 VHandle *HashEntry::value() const
 {
-  return (VHandle *) ((uint8_t *) this - 96);
+  return (VHandle *) ((uint8_t *) this - kRowOffset);
 }
 
-static HashEntry *kNextForUninitialized = (HashEntry *) 0;
-static HashEntry *kNextForInitializing = (HashEntry *) 0xdeadbeef00000000;
-static HashEntry *kNextForEnd = (HashEntry *) 0xEDEDEDEDEDEDEDED;
+// Flags in the low bits of a link, HashEntry::next or a bucket head. Rows are
+// at least 32 bytes aligned.
+//
+// kDeleted on next means the entry itself is deleted. kFrozen means the link
+// will never change again, because the bucket is moving into the new array.
+static constexpr uintptr_t kDeleted = 1;
+static constexpr uintptr_t kFrozen = 2;
+static constexpr uintptr_t kFlagMask = 31;
+// Bucket heads only. The chain is being relinked into the new array, and
+// then it's there.
+static HashEntry * const kMoving = (HashEntry *) (4 | kFrozen);
+static HashEntry * const kMigrated = (HashEntry *) (8 | kFrozen);
+
+static inline HashEntry *Ptr(HashEntry *e) { return (HashEntry *) ((uintptr_t) e & ~kFlagMask); }
+static inline uintptr_t Flags(HashEntry *e) { return (uintptr_t) e & kFlagMask; }
+
+struct HashBuckets {
+  size_t nr;
+  std::atomic<HashEntry *> *heads;
+  // The larger array, while we resize into it.
+  std::atomic<HashBuckets *> next = nullptr;
+  std::atomic_size_t migrate_cursor = 0;
+  std::atomic_size_t nr_migrated = 0;
+  uint64_t rcu_epoch = 0;
+
+  HashBuckets(size_t nr) : nr(nr) {
+    // Instead pre-allocate the buckets from the beginning, we'll use fine
+    // on-demand paging. In this way, the insertion CPU will allocate the page
+    // from its local NUMA zone.
+    heads = (std::atomic<HashEntry *> *)
+            mmap(nullptr, length(), PROT_READ | PROT_WRITE,
+                 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    abort_if(heads == MAP_FAILED, "Cannot allocate {} hashtable buckets", nr);
+  }
+  ~HashBuckets() { munmap(heads, length()); }
+
+  size_t length() const { return util::Align(nr * sizeof(std::atomic<HashEntry *>), 4096); }
+};
+
+// Deleted rows and drained bucket arrays, waiting for their epoch to end.
+struct RetiredRow {
+  HashEntry *entry;
+  uint64_t rcu_epoch;
+};
+
+struct RetiredList {
+  util::SpinLock lock;
+  std::vector<RetiredRow> rows;
+};
+
+static std::array<util::CacheAligned<RetiredList>, NodeConfiguration::kMaxNrThreads + 1> g_retired;
+static util::SpinLock g_retired_buckets_lock;
+static std::vector<HashBuckets *> g_retired_buckets;
+
+static int CoreIndex()
+{
+  int idx = go::Scheduler::CurrentThreadPoolId() - 1;
+  if (idx < 0 || idx >= NodeConfiguration::kMaxNrThreads)
+    return NodeConfiguration::kMaxNrThreads;
+  return idx;
+}
+
+static uint64_t CurrentEpoch()
+{
+  return util::Instance<EpochManager>().current_epoch_nr();
+}
 
 HashtableIndex::HashtableIndex(std::tuple<HashFunc, size_t, bool> conf)
     : Table()
 {
   hash = std::get<0>(conf);
-  nr_buckets = std::get<1>(conf);
   enable_inline = std::get<2>(conf);
-
-  // Instead pre-allocate the table from the beginning, we'll use fine on-demand
-  // paging for the bucket. In this way, the insertion CPU will allocate the
-  // page from its local NUMA zone. As long as the hash function can generate
-  // NUMA friendly hash function, we can make sure all pages are accessed from
-  // local NUMA zone.
-  auto nrpg = ((nr_buckets * row_size() - 1) >> 12) + 1;
-  table = (uint8_t *)
-          mmap(nullptr, nrpg << 12, PROT_READ | PROT_WRITE,
-               MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-  printf("addr %p %p\n", table, table + (nrpg << 12));
+  buckets = new HashBuckets(std::get<1>(conf));
 }
 
-static constexpr size_t kOffset = 96;
-
-VHandle *HashtableIndex::SearchOrCreate(const VarStrView &k, bool *created)
+std::atomic<HashEntry *> *HashtableIndex::Locate(HashBuckets *b, uint32_t h)
 {
-  auto idx = hash(k) % nr_buckets;
-  HashEntry *first = (HashEntry *) (table + idx * row_size() + kOffset);
+  while (true) {
+    auto link = &b->heads[h % b->nr];
+    auto head = link->load(std::memory_order_acquire);
+    if (head == kMigrated) {
+      // next never changes once the bucket has migrated.
+      b = b->next.load(std::memory_order_acquire);
+    } else if (head == kMoving) {
+      _mm_pause();
+    } else {
+      return link;
+    }
+  }
+}
 
-  if (first->next == kNextForUninitialized) {
-    HashEntry *old = kNextForUninitialized;
-    if (first->next.compare_exchange_strong(old, kNextForInitializing)) {
-      first->key = HashEntry::Convert(k);
-      auto row = first->value();
-      new (row) SortedArrayVHandle();
-      row->capacity = 1;
-      first->next = kNextForEnd;
-      *created = true;
-      return row;
+// Walks the chain from pred for x, and unlinks the deleted entries on the
+// way. On return, curr is the entry of x, or nullptr if x isn't there. With
+// x being nullptr, walks the whole chain. Returns false if the chain is
+// frozen, or an unlink raced with someone else, the caller should start over.
+static bool FindInChain(std::atomic<HashEntry *> *pred, HashEntry *&curr, const HashEntry::Key *x)
+{
+  auto v = pred->load(std::memory_order_acquire);
+  if (Flags(v) & kFrozen) return false;
+  curr = v;
+  while (curr) {
+    auto next = curr->next.load(std::memory_order_acquire);
+    if (Flags(next) & kFrozen) return false;
+    if (Flags(next) & kDeleted) {
+      // A deleted entry's next never changes, so we always unlink it.
+      auto expected = curr;
+      if (!pred->compare_exchange_strong(expected, Ptr(next)))
+        return false;
+      curr = Ptr(next);
+      continue;
     }
+    if (x && curr->Compare(*x)) return true;
+    pred = &curr->next;
+    curr = next;
   }
-  while (first->next == kNextForInitializing) _mm_pause();
+  return true;
+}
 
-  HashEntry *p = first, *newentry = nullptr;
-  std::atomic<HashEntry *> *parent = nullptr;
-  auto x = HashEntry::Convert(k);
+VHandle *HashtableIndex::SearchOrCreate(const VarStrView &k, bool *created)
+{
+  auto h = hash(k);
+  auto x = HashEntry::Convert(k, h);
+  HashEntry *newentry = nullptr;
   VHandle *row = nullptr;
 
-  do {
-    while (p != kNextForEnd) {
-      if (p->Compare(x)) {
-        if (row) delete row;
-        *created = false;
-        return p->value();
+  while (true) {
+    auto link = Locate(buckets.load(std::memory_order_acquire), h);
+    auto head = link->load(std::memory_order_acquire);
+    HashEntry *p = nullptr;
+    if ((Flags(head) & kFrozen) || !FindInChain(link, p, &x)) {
+      _mm_pause();
+      continue;
+    }
+    if (p) {
+      if (row) {
+        newentry->FreeKey();
+        delete row;
       }
-      parent = &p->next;
-      p = parent->load();
+      *created = false;
+      return p->value();
     }
 
     if (newentry == nullptr) {
       row = NewRow();
       row->capacity = 1;
-      newentry = (HashEntry *) ((uint8_t *) row + 96);
-      newentry->key = x;
-      newentry->next = kNextForEnd;
+      newentry = HashEntry::OfRow(row);
+      newentry->InitKey(x);
     }
+    newentry->next.store(head, std::memory_order_relaxed);
 
-  } while (!parent->compare_exchange_strong(p, newentry));
+    // Insert at the head, never at the tail. MigrateBucket() relinks the
+    // entries in place, so a tail link we saw may be nullptr again, in the
+    // other half of the new array. A bucket head that moved never comes back.
+    if (link->compare_exchange_strong(head, newentry))
+      break;
+  }
   *created = true;
+  CountEntry(1);
+  HelpResize();
   return row;
 }
 
@@ -145,24 +240,232 @@ VHandle *HashtableIndex::SearchOrCreate(const VarStrView &k)
 
 VHandle *HashtableIndex::Search(const VarStrView &k)
 {
-  auto idx = hash(k) % nr_buckets;
-  auto p = (HashEntry *) (table + idx * row_size() + kOffset);
-  auto x = HashEntry::Convert(k);
-  unsigned int cnt = 0;
+  return Search(k, hash(k));
+}
+
+VHandle *HashtableIndex::Search(const VarStrView &k, uint32_t h)
+{
+  auto x = HashEntry::Convert(k, h);
+
+  while (true) {
+    auto link = Locate(buckets.load(std::memory_order_acquire), h);
+    auto head = link->load(std::memory_order_acquire);
+    if (head == kMoving || head == kMigrated) continue;
 
-  if (p->next == kNextForUninitialized) return nullptr;
+    for (auto p = Ptr(head); p;) {
+      auto next = p->next.load(std::memory_order_acquire);
+      if ((Flags(next) & kDeleted) == 0 && p->Compare(x))
+        return p->value();
+      p = Ptr(next);
+    }
+    // If the bucket started moving, we might have missed it.
+    auto now = link->load(std::memory_order_acquire);
+    if (now != kMoving && now != kMigrated)
+      return nullptr;
+  }
+}
 
-  while (p->next == kNextForInitializing) _mm_pause();
+void HashtableIndex::SearchBatch(const VarStrView *keys, size_t n, VHandle **rows)
+{
+  uint32_t h[kSearchBatch];
+  for (size_t base = 0; base < n; base += kSearchBatch) {
+    auto nr = std::min(n - base, kSearchBatch);
+    auto b = buckets.load(std::memory_order_acquire);
 
-  while (p != kNextForEnd) {
-    cnt++;
-    if (p->Compare(x)) {
-      // if (cnt > 1) printf("table id %d\n", relation_id()); std::abort();
-      return p->value();
+    // First the bucket heads, then the first entry of each chain. A migrated
+    // or moving head has no pointer in it, Search() sorts them out.
+    for (size_t i = 0; i < nr; i++) {
+      h[i] = hash(keys[base + i]);
+      __builtin_prefetch(&b->heads[h[i] % b->nr]);
     }
-    p = p->next.load();
+    for (size_t i = 0; i < nr; i++) {
+      auto p = Ptr(b->heads[h[i] % b->nr].load(std::memory_order_relaxed));
+      if (p) __builtin_prefetch(p);
+    }
+    for (size_t i = 0; i < nr; i++)
+      rows[base + i] = Search(keys[base + i], h[i]);
+  }
+}
+
+bool HashtableIndex::Delete(const VarStrView &k)
+{
+  abort_if(NodeConfiguration::g_data_migration,
+           "HashtableIndex cannot delete rows that may be shipped");
+  auto h = hash(k);
+  auto x = HashEntry::Convert(k, h);
+  HashEntry *p = nullptr;
+
+  while (true) {
+    auto link = Locate(buckets.load(std::memory_order_acquire), h);
+    if (!FindInChain(link, p, &x)) {
+      _mm_pause();
+      continue;
+    }
+    if (!p) return false;
+
+    auto next = p->next.load(std::memory_order_acquire);
+    if (Flags(next) != 0) continue;
+    if (p->next.compare_exchange_strong(next, (HashEntry *) ((uintptr_t) next | kDeleted)))
+      break;
+  }
+
+  // It can only be freed once it's off the chain. Walking the whole chain
+  // unlinks it on the way, or the bucket moves and MigrateBucket() drops it.
+  // Later inserts of x go before it, so we can't stop at x.
+  while (true) {
+    auto link = Locate(buckets.load(std::memory_order_acquire), h);
+    HashEntry *curr = nullptr;
+    if (FindInChain(link, curr, nullptr)) break;
+    _mm_pause();
+  }
+
+  auto &l = g_retired[CoreIndex()];
+  l.lock.Lock();
+  l.rows.push_back(RetiredRow{p, CurrentEpoch()});
+  l.lock.Unlock();
+
+  CountEntry(-1);
+  HelpResize();
+  return true;
+}
+
+size_t HashtableIndex::nr_buckets() const
+{
+  return buckets.load(std::memory_order_acquire)->nr;
+}
+
+void HashtableIndex::CountEntry(long delta)
+{
+  auto &c = counts[CoreIndex()];
+  c.nr.fetch_add(delta, std::memory_order_relaxed);
+  if (delta < 0 || ++c.nr_inserts % 1024 != 0)
+    return;
+
+  long total = 0;
+  for (auto &cnt: counts)
+    total += cnt.nr.load(std::memory_order_relaxed);
+  auto b = buckets.load(std::memory_order_acquire);
+  if (total > (long) (b->nr * kMaxLoadFactor))
+    StartResize(b);
+}
+
+void HashtableIndex::StartResize(HashBuckets *b)
+{
+  bool expected = false;
+  if (!resizing.compare_exchange_strong(expected, true))
+    return;
+  if (buckets.load() != b) {
+    resizing = false;
+    return;
+  }
+  auto nb = new HashBuckets(b->nr * 2);
+  logger->info("Table {} resizing from {} to {} buckets", id, b->nr, nb->nr);
+  b->next.store(nb, std::memory_order_release);
+}
+
+void HashtableIndex::HelpResize()
+{
+  auto b = buckets.load(std::memory_order_acquire);
+  auto nb = b->next.load(std::memory_order_acquire);
+  if (nb == nullptr) return;
+
+  auto start = b->migrate_cursor.fetch_add(kMigrateBatch);
+  if (start >= b->nr) return;
+  auto end = std::min(start + kMigrateBatch, b->nr);
+  for (auto i = start; i < end; i++)
+    MigrateBucket(b, nb, i);
+
+  if (b->nr_migrated.fetch_add(end - start) + end - start < b->nr)
+    return;
+
+  // We moved the last bucket. Stale lookups may still go through b, so we
+  // free it after the epoch.
+  buckets.store(nb, std::memory_order_release);
+  b->rcu_epoch = CurrentEpoch();
+  g_retired_buckets_lock.Lock();
+  g_retired_buckets.push_back(b);
+  g_retired_buckets_lock.Unlock();
+  resizing.store(false);
+  logger->info("Table {} resized to {} buckets", id, nb->nr);
+}
+
+void HashtableIndex::MigrateBucket(HashBuckets *b, HashBuckets *nb, size_t idx)
+{
+  auto head = &b->heads[idx];
+
+  // Freeze every link in the chain, from the head to the tail. After this,
+  // nobody inserts, deletes or unlinks in this bucket.
+  for (auto link = head; ;) {
+    auto v = link->load(std::memory_order_acquire);
+    while (!link->compare_exchange_weak(v, (HashEntry *) ((uintptr_t) v | kFrozen)));
+    auto p = Ptr(v);
+    if (p == nullptr) break;
+    link = &p->next;
+  }
+
+  // Lookups walking the old chain will see the head changed and start over.
+  auto first = Ptr(head->load(std::memory_order_relaxed));
+  head->store(kMoving, std::memory_order_release);
+
+  // Only this bucket feeds idx and idx + b->nr in the new array, so these two
+  // are ours until kMigrated.
+  HashEntry *lo = nullptr, *hi = nullptr;
+  for (auto p = first; p;) {
+    auto v = p->next.load(std::memory_order_relaxed);
+    // Deleted entries are already retired, just leave them behind.
+    if ((Flags(v) & kDeleted) == 0) {
+      auto &dst = (p->hash % nb->nr == idx) ? lo : hi;
+      p->next.store(dst, std::memory_order_relaxed);
+      dst = p;
+    }
+    p = Ptr(v);
+  }
+  nb->heads[idx].store(lo, std::memory_order_relaxed);
+  nb->heads[idx + b->nr].store(hi, std::memory_order_relaxed);
+  head->store(kMigrated, std::memory_order_release);
+}
+
+void HashtableIndex::ReclaimRetired(uint64_t epoch_nr)
+{
+  auto &gc = util::Instance<GC>();
+  size_t nr_freed = 0;
+  for (auto &l: g_retired) {
+    l.lock.Lock();
+    auto it = std::partition(
+        l.rows.begin(), l.rows.end(),
+        [epoch_nr](const RetiredRow &r) { return r.rcu_epoch >= epoch_nr; });
+    for (auto p = it; p != l.rows.end(); ++p) {
+      // The out of line copy of a long key goes with the row.
+      p->entry->FreeKey();
+      gc.FreeRow(p->entry->value());
+    }
+    nr_freed += l.rows.end() - it;
+    l.rows.erase(it, l.rows.end());
+    l.lock.Unlock();
+  }
+
+  g_retired_buckets_lock.Lock();
+  auto it = std::partition(
+      g_retired_buckets.begin(), g_retired_buckets.end(),
+      [epoch_nr](HashBuckets *b) { return b->rcu_epoch >= epoch_nr; });
+  for (auto p = it; p != g_retired_buckets.end(); ++p)
+    delete *p;
+  g_retired_buckets.erase(it, g_retired_buckets.end());
+  g_retired_buckets_lock.Unlock();
+
+  if (nr_freed > 0)
+    logger->info("Freed {} deleted hashtable rows", nr_freed);
+}
+
+size_t HashtableIndex::nr_retired_rows()
+{
+  size_t nr = 0;
+  for (auto &l: g_retired) {
+    l.lock.Lock();
+    nr += l.rows.size();
+    l.lock.Unlock();
   }
-  return nullptr;
+  return nr;
 }
 
 uint32_t DefaultHash(const VarStrView &k)
@@ -2,6 +2,7 @@
 #define HASHTABLE_INDEX_IMPL
 
 #include <cstdlib>
+#include <cstring>
 #include <immintrin.h>
 
 #include "index_common.h"
@@ -11,39 +12,133 @@ namespace felis {
 typedef uint32_t (*HashFunc)(const VarStrView &);
 
 struct HashEntry {
-  using Key = std::array<uint8_t, 16>;
-  Key key;
+  static constexpr size_t kInlineKeySize = 16;
+  static constexpr size_t kPrefixSize = 8;
+  // Where the entry is inside of its row.
+  static constexpr size_t kRowOffset = 96;
+
+  // A key we look for, and what we would keep inline for it.
+  struct Key {
+    std::array<uint8_t, kInlineKeySize> prefix;
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t hash;
+  };
+
+  // Keys up to kInlineKeySize bytes are here, zero padded. Longer keys keep
+  // their first kPrefixSize bytes here, followed by a pointer to a copy of the
+  // whole key.
+  std::array<uint8_t, kInlineKeySize> key;
+  // The low bits are flags, see hashtable_index_impl.cc.
   std::atomic<HashEntry *> next;
 
-  // TODO: we have not implemented delete yet
-  uint64_t rcu_epoch;
+  // Resizing can't hash the key again. For long keys, this is also the
+  // fingerprint we check before going out of line.
+  uint32_t hash;
+  uint32_t len;
 
-  static Key Convert(const VarStrView &k) {
+  static Key Convert(const VarStrView &k, uint32_t h) {
     Key x;
-    x.fill(0);
-    std::copy(k.data(), k.data() + k.length(), x.begin());
+    x.prefix.fill(0);
+    x.data = k.data();
+    x.len = k.length();
+    x.hash = h;
+    auto n = x.len <= kInlineKeySize ? x.len : kPrefixSize;
+    std::copy(k.data(), k.data() + n, x.prefix.begin());
     return x;
   }
 
-  bool Compare(const Key &x) {
-    return __builtin_memcmp(key.data(), x.data(), 16) == 0;
+  bool is_long_key() const { return len > kInlineKeySize; }
+  VarStr *long_key() const {
+    VarStr *p;
+    memcpy(&p, key.data() + kPrefixSize, sizeof(VarStr *));
+    return p;
+  }
+
+  void InitKey(const Key &x) {
+    key = x.prefix;
+    hash = x.hash;
+    len = x.len;
+    if (is_long_key()) {
+      auto p = VarStr::New(len);
+      std::copy(x.data, x.data + len, p->data());
+      memcpy(key.data() + kPrefixSize, &p, sizeof(VarStr *));
+    }
+  }
+
+  void FreeKey() {
+    if (is_long_key()) delete long_key();
+  }
+
+  bool Compare(const Key &x) const {
+    if (len != x.len) return false;
+    if (!is_long_key())
+      return __builtin_memcmp(key.data(), x.prefix.data(), kInlineKeySize) == 0;
+    return hash == x.hash
+        && __builtin_memcmp(key.data(), x.prefix.data(), kPrefixSize) == 0
+        && __builtin_memcmp(long_key()->data(), x.data, len) == 0;
   }
 
   VHandle *value() const;
+  static HashEntry *OfRow(VHandle *row) { return (HashEntry *) ((uint8_t *) row + kRowOffset); }
 };
 
 static_assert(sizeof(HashEntry) == 32);
 
+struct HashBuckets;
+
+// Chained hashtable. Every row has its HashEntry inside, and the buckets only
+// hold the heads of the chains, so that the bucket array can grow without
+// moving any row.
+//
+// Deletes are epoch based: a deleted row is unlinked right away, but only
+// freed at the beginning of a later epoch, when no one can be holding it.
+//
+// When the load factor goes over kMaxLoadFactor, we double the bucket
+// array. Inserts and deletes move a few buckets at a time into the new array,
+// and lookups check both arrays until the old one is drained. The old array is
+// freed at the beginning of a later epoch too.
 class HashtableIndex final : public Table {
+ public:
+  static constexpr size_t kMaxLoadFactor = 2;
+  // Buckets moved by each insert or delete while we resize.
+  static constexpr size_t kMigrateBatch = 64;
+  // Keys SearchBatch() prefetches for at a time.
+  static constexpr size_t kSearchBatch = 16;
+ private:
   HashFunc hash;
-  size_t nr_buckets;
-  uint8_t *table;
+  std::atomic<HashBuckets *> buckets;
+
+  // Entries, inserts minus deletes, counted on each core.
+  struct EntryCount {
+    std::atomic_long nr = 0;
+    unsigned int nr_inserts = 0;
+  };
+  std::array<util::CacheAligned<EntryCount>, NodeConfiguration::kMaxNrThreads + 1> counts;
+  std::atomic_bool resizing = false;
+
+  std::atomic<HashEntry *> *Locate(HashBuckets *b, uint32_t h);
+  VHandle *Search(const VarStrView &k, uint32_t h);
+  void CountEntry(long delta);
+  void StartResize(HashBuckets *b);
+  void HelpResize();
+  void MigrateBucket(HashBuckets *b, HashBuckets *nb, size_t idx);
  public:
   HashtableIndex(std::tuple<HashFunc, size_t, bool> conf);
 
   VHandle *SearchOrCreate(const VarStrView &k, bool *created) override;
   VHandle *SearchOrCreate(const VarStrView &k) override;
   VHandle *Search(const VarStrView &k) override;
+  void SearchBatch(const VarStrView *keys, size_t n, VHandle **rows) override;
+  bool Delete(const VarStrView &k) override;
+
+  /** Size of the bucket array that lookups start from. */
+  size_t nr_buckets() const;
+
+  /** Free the rows and bucket arrays retired before epoch_nr. No txn may be running. */
+  static void ReclaimRetired(uint64_t epoch_nr);
+  /** Deleted rows that ReclaimRetired() hasn't freed yet. */
+  static size_t nr_retired_rows();
 };
 
 uint32_t DefaultHash(const VarStrView &);
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+
+#include "hot_row_detector.h"
+#include "vhandle.h"
+#include "varstr.h"
+#include "log.h"
+#include "mem.h"
+
+namespace felis {
+
+bool HotRowDetector::g_enabled = false;
+size_t HotRowDetector::g_topk = 64;
+uint32_t HotRowDetector::g_min_count = 0;
+
+HotRowDetector::HotRowDetector()
+{
+  sketches.fill(nullptr);
+  hot_set.fill(0);
+  for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
+    auto numa_node = i / mem::kNrCorePerNode;
+    sketches[i] = (CoreSketch *) mem::AllocMemory(
+        mem::ContentionManagerPool, sizeof(CoreSketch), numa_node);
+    memset(sketches[i], 0, sizeof(CoreSketch));
+  }
+}
+
+void HotRowDetector::Clear()
+{
+  for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
+    memset(sketches[i], 0, sizeof(CoreSketch));
+  }
+  counting.store(true, std::memory_order_release);
+}
+
+void HotRowDetector::CountOnCore(int core_id, VHandle *row)
+{
+  auto s = sketches[core_id];
+  uint32_t est = std::numeric_limits<uint32_t>::max();
+  for (int d = 0; d < kDepth; d++) {
+    auto c = ++s->counters[d][Hash(row, d)];
+    est = std::min(est, c);
+  }
+
+  // The candidate cache is direct-mapped. A row only evicts the current
+  // candidate when its estimate is larger.
+  auto &cand = s->candidates[Hash(row, 0) % kNrCandidates];
+  if (cand.row == row) {
+    cand.estimate = est;
+  } else if (cand.row == nullptr || est > cand.estimate) {
+    cand.row = row;
+    cand.estimate = est;
+    cand.key_len = 0;
+  }
+}
+
+void HotRowDetector::RecordKey(VHandle *row, const VarStrView &key)
+{
+  if (!counting.load(std::memory_order_relaxed)) return;
+  auto s = sketches[go::Scheduler::CurrentThreadPoolId() - 1];
+  auto &cand = s->candidates[Hash(row, 0) % kNrCandidates];
+  if (cand.row != row || cand.key_len != 0) return;
+
+  auto len = std::min<size_t>(key.length(), kMaxKeyLen);
+  memcpy(cand.key, key.data(), len);
+  cand.key_len = len;
+}
+
+uint64_t HotRowDetector::GlobalEstimate(const VHandle *row) const
+{
+  uint64_t est = std::numeric_limits<uint64_t>::max();
+  for (int d = 0; d < kDepth; d++) {
+    uint64_t sum = 0;
+    auto h = Hash(row, d);
+    for (int i = 0; i < NodeConfiguration::g_nr_threads; i++)
+      sum += sketches[i]->counters[d][h];
+    est = std::min(est, sum);
+  }
+  return est;
+}
+
+void HotRowDetector::Finalize()
+{
+  counting.store(false, std::memory_order_release);
+
+  std::vector<HotRow> all;
+  for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
+    for (auto &cand: sketches[i]->candidates) {
+      if (cand.row == nullptr) continue;
+      HotRow r;
+      r.row = cand.row;
+      r.estimate = 0;
+      r.key_len = cand.key_len;
+      memcpy(r.key, cand.key, kMaxKeyLen);
+      all.push_back(r);
+    }
+  }
+
+  // The same row can be a candidate on multiple cores. Keep the one with a key.
+  std::sort(all.begin(), all.end(),
+            [](const HotRow &a, const HotRow &b) {
+              return a.row < b.row || (a.row == b.row && a.key_len > b.key_len);
+            });
+  all.erase(std::unique(all.begin(), all.end(),
+                        [](const HotRow &a, const HotRow &b) { return a.row == b.row; }),
+            all.end());
+  for (auto &r: all) {
+    r.estimate = GlobalEstimate(r.row);
+  }
+
+  auto k = std::min(std::min(g_topk, kMaxTopK), all.size());
+  std::partial_sort(all.begin(), all.begin() + k, all.end(),
+                    [](const HotRow &a, const HotRow &b) {
+                      return a.estimate > b.estimate;
+                    });
+  while (k > 0 && all[k - 1].estimate < g_min_count) k--;
+  all.resize(k);
+  hot_rows = std::move(all);
+
+  hot_set.fill(0);
+  for (size_t i = 0; i < hot_rows.size(); i++) {
+    auto h = Hash(hot_rows[i].row, 1) % kHotSetSize;
+    while (hot_set[h] != 0) h = (h + 1) % kHotSetSize;
+    hot_set[h] = i + 1;
+  }
+
+  PrintReport();
+}
+
+bool HotRowDetector::IsHot(const VHandle *row) const
+{
+  if (hot_rows.empty()) return false;
+  auto h = Hash(row, 1) % kHotSetSize;
+  while (hot_set[h] != 0) {
+    if (hot_rows[hot_set[h] - 1].row == row) return true;
+    h = (h + 1) % kHotSetSize;
+  }
+  return false;
+}
+
+void HotRowDetector::PrintReport()
+{
+  static constexpr size_t kNrReportPerTable = 5;
+  std::map<int, std::vector<const HotRow *>> per_table;
+  for (auto &r: hot_rows) {
+    per_table[r.row->relation_id()].push_back(&r);
+  }
+
+  logger->info("HotRowDetector: {} hot rows in {} tables", hot_rows.size(), per_table.size());
+  for (auto &[rel_id, rows]: per_table) {
+    fmt::memory_buffer buf;
+    for (size_t i = 0; i < rows.size() && i < kNrReportPerTable; i++) {
+      auto r = rows[i];
+      fmt::format_to(buf, " ");
+      if (r->key_len == 0) {
+        fmt::format_to(buf, "{}", (void *) r->row);
+      } else {
+        for (int j = 0; j < r->key_len; j++)
+          fmt::format_to(buf, "{:02x}", r->key[j]);
+      }
+      fmt::format_to(buf, "({})", r->estimate);
+    }
+    logger->info("  table {}: {} rows,{}", rel_id, rows.size(),
+                 std::string_view(buf.data(), buf.size()));
+  }
+}
+
+}
+
+namespace util {
+
+InstanceInit<felis::HotRowDetector>::InstanceInit()
+{
+  instance = new felis::HotRowDetector();
+}
+
+}
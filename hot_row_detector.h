@@ -0,0 +1,118 @@
+#ifndef HOT_ROW_DETECTOR_H
+#define HOT_ROW_DETECTOR_H
+
+#include <atomic>
+#include <array>
+#include <vector>
+
+#include "gopp/gopp.h"
+#include "node_config.h"
+#include "util/objects.h"
+
+namespace felis {
+
+class VHandle;
+class VarStrView;
+
+// Per-row contention detector. During the Initialize phase, every version
+// appended to a row is counted in a per-core count-min sketch keyed by the
+// VHandle pointer. Each core also keeps a small direct-mapped cache of its
+// heaviest rows as candidates. At the end of the Initialize phase, we merge
+// the candidates, estimate their global counts from all sketches and keep the
+// top-K as the hot set.
+//
+// The hot set is read-only until the next Finalize(). ContentionManager only
+// splits the hot rows, and the batch appender always buffers them in the next
+// epoch.
+class HotRowDetector {
+ public:
+  static constexpr int kDepth = 4;
+  static constexpr int kWidthShift = 14;
+  static constexpr size_t kWidth = 1 << kWidthShift;
+  static constexpr size_t kNrCandidates = 1024;
+  static constexpr size_t kMaxTopK = 1024;
+  static constexpr size_t kMaxKeyLen = 18;
+
+  struct Candidate {
+    VHandle *row;
+    uint32_t estimate;
+    uint16_t key_len; // 0 if we haven't seen the key yet
+    uint8_t key[kMaxKeyLen];
+  };
+  static_assert(sizeof(Candidate) == 32);
+
+  struct HotRow {
+    VHandle *row;
+    uint64_t estimate;
+    uint16_t key_len;
+    uint8_t key[kMaxKeyLen];
+  };
+
+ private:
+  struct CoreSketch {
+    uint32_t counters[kDepth][kWidth];
+    Candidate candidates[kNrCandidates];
+  };
+  std::array<CoreSketch *, NodeConfiguration::kMaxNrThreads> sketches;
+
+  std::vector<HotRow> hot_rows;
+  // Open addressing index into hot_rows, 0 means empty.
+  static constexpr size_t kHotSetSize = 4 * kMaxTopK;
+  std::array<uint16_t, kHotSetSize> hot_set;
+
+  std::atomic_bool counting = false;
+
+  static size_t Hash(const VHandle *row, int d) {
+    static constexpr uint64_t kSeeds[kDepth] = {
+      0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+      0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL,
+    };
+    return (((uintptr_t) row >> 6) * kSeeds[d]) >> (64 - kWidthShift);
+  }
+
+ public:
+  HotRowDetector();
+
+  static bool g_enabled;
+  static size_t g_topk;
+  // Rows below this estimate are never hot, no matter how few rows we saw.
+  static uint32_t g_min_count;
+
+  // Start counting. Called at the beginning of the Initialize phase.
+  void Clear();
+  // Stop counting and pick the hot set. Called at the end of the Initialize
+  // phase, before ContentionManager::Reset().
+  void Finalize();
+
+  void Count(VHandle *row) {
+    if (!counting.load(std::memory_order_relaxed)) return;
+    CountOnCore(go::Scheduler::CurrentThreadPoolId() - 1, row);
+  }
+  void CountOnCore(int core_id, VHandle *row);
+
+  // Record the key of a row if it is one of the candidates on this core. Only
+  // used for reporting.
+  void RecordKey(VHandle *row, const VarStrView &key);
+
+  bool IsHot(const VHandle *row) const;
+  size_t nr_hot_rows() const { return hot_rows.size(); }
+  const std::vector<HotRow> &all_hot_rows() const { return hot_rows; }
+
+  void PrintReport();
+ private:
+  uint64_t GlobalEstimate(const VHandle *row) const;
+};
+
+}
+
+namespace util {
+
+template <> struct InstanceInit<felis::HotRowDetector> {
+  static constexpr bool kHasInstance = true;
+  static inline felis::HotRowDetector *instance;
+  InstanceInit();
+};
+
+}
+
+#endif /* HOT_ROW_DETECTOR_H */
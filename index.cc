@@ -18,10 +18,13 @@ void InitVersion(felis::VHandle *handle, VarStr *obj = (VarStr *) kPendingValue)
 
 VHandle *Table::NewRow()
 {
+  VHandle *row;
   if (enable_inline)
-    return (VHandle *) VHandle::NewInline();
+    row = (VHandle *) VHandle::NewInline();
   else
-    return (VHandle *) VHandle::New();
+    row = (VHandle *) VHandle::New();
+  row->set_relation_id(id);
+  return row;
 }
 
 }
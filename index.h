@@ -4,5 +4,6 @@
 #include "index_common.h"
 #include "masstree_index_impl.h"
 #include "hashtable_index_impl.h"
+#include "swiss_index_impl.h"
 
 #endif /* INDEX_H */
@@ -100,6 +100,13 @@ class Table {
   virtual VHandle *SearchOrCreate(const VarStrView &k, bool *created) { return nullptr; }
   virtual VHandle *SearchOrCreate(const VarStrView &k) { return nullptr; }
   virtual VHandle *Search(const VarStrView &k) { return nullptr; }
+  // Looks up n keys at once. Backends can prefetch for all keys before they
+  // resolve any, so that the cache misses overlap.
+  virtual void SearchBatch(const VarStrView *keys, size_t n, VHandle **rows) {
+    for (size_t i = 0; i < n; i++) rows[i] = Search(keys[i]);
+  }
+  // Only the HashtableIndex supports deletes so far.
+  virtual bool Delete(const VarStrView &k) { return false; }
   virtual Table::Iterator *IndexSearchIterator(const VarStrView &start) {
     return nullptr;
   }
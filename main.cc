@@ -9,6 +9,8 @@
 #include "log.h"
 #include "epoch.h"
 #include "opts.h"
+#include "repartition.h"
+#include "slice_balancer.h"
 
 //extern std::atomic<uint64_t> tot_promise_routine_transported;
 //extern std::atomic<uint64_t> tot_promise_routine_received;
@@ -65,6 +67,17 @@ int main(int argc, char *argv[])
 
   NodeConfiguration::g_nr_threads = Options::kCpu.ToInt("4");
   NodeConfiguration::g_data_migration = Options::kDataMigration;
+  TcpNodeTransport::g_use_io_uring = Options::kIoUring;
+  TcpNodeTransport::g_use_shm = Options::kShmTransport;
+  if (Options::kStreamingCounters)
+    NodeConfiguration::g_counter_batch = Options::kStreamingCounters.ToLargeNumber();
+  if (Options::kRepartition) {
+    abort_if(!NodeConfiguration::g_data_migration,
+             "Repartition ships rows between nodes, it needs DataMigrationMode");
+    Repartitioner::g_enabled = true;
+    if (Options::kRepartitionThreshold)
+      Repartitioner::g_threshold = Options::kRepartitionThreshold.ToInt();
+  }
   if (Options::kEpochSize)
     EpochClient::g_txn_per_epoch = Options::kEpochSize.ToInt();
 
@@ -93,6 +106,8 @@ int main(int argc, char *argv[])
 
   // init tables from the workload module
   Module<WorkloadModule>::InitModule(workload_name);
+  abort_if(SliceCoreBalancer::g_enabled && !util::Instance<SliceCoreBalancer>().is_initialized(),
+           "SliceCoreBalance is not supported by workload {}", workload_name);
 
   auto client = EpochClient::g_workload_client;
   logger->info("Generating Benchmarks...");
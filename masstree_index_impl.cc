@@ -167,6 +167,75 @@ Table::Iterator *MasstreeIndex::IndexReverseIterator(const VarStrView &start)
   return IndexReverseIterator(start, VarStrView());
 }
 
+// Collects kScanBatch rows from the tree and prefetches them, then hands them
+// to the visitor. The keys are copied, the tree reuses its key buffer.
+class MasstreeScanner {
+  static constexpr size_t kKeyBufferSize = 1024;
+
+  VarStrView end;
+  bool reverse;
+  void *arg;
+  MasstreeIndex::ScanCallback cb;
+
+  int nr_rows = 0;
+  VHandle *rows[MasstreeIndex::kScanBatch];
+  uint16_t key_len[MasstreeIndex::kScanBatch];
+  uint16_t key_offset[MasstreeIndex::kScanBatch];
+  size_t key_buffer_used = 0;
+  uint8_t key_buffer[kKeyBufferSize];
+ public:
+  MasstreeScanner(const VarStrView &end, bool reverse, void *arg, MasstreeIndex::ScanCallback cb)
+      : end(end), reverse(reverse), arg(arg), cb(cb) {}
+
+  template <typename SS, typename K>
+  void visit_leaf(const SS &, const K &, threadinfo &) {}
+
+  bool visit_value(lcdf::Str key, VHandle *row, threadinfo &) {
+    VarStrView k(key.length(), (const uint8_t *) key.data());
+    if (reverse ? k < end : end < k) return false;
+    if (row == nullptr) return true;
+
+    if (key_buffer_used + key.length() > kKeyBufferSize) {
+      if (!Flush()) return false;
+      // Too long to batch at all.
+      if (key.length() > kKeyBufferSize) return cb(arg, k, row);
+    }
+    __builtin_prefetch(row);
+    std::copy(key.data(), key.data() + key.length(), key_buffer + key_buffer_used);
+    rows[nr_rows] = row;
+    key_len[nr_rows] = key.length();
+    key_offset[nr_rows] = key_buffer_used;
+    key_buffer_used += key.length();
+    if (++nr_rows == MasstreeIndex::kScanBatch)
+      return Flush();
+    return true;
+  }
+
+  bool Flush() {
+    for (int i = 0; i < nr_rows; i++) {
+      if (!cb(arg, VarStrView(key_len[i], key_buffer + key_offset[i]), rows[i])) {
+        nr_rows = 0;
+        return false;
+      }
+    }
+    nr_rows = 0;
+    key_buffer_used = 0;
+    return true;
+  }
+};
+
+void MasstreeIndex::ScanImpl(const VarStrView &start, const VarStrView &end, bool reverse,
+                             void *arg, ScanCallback cb)
+{
+  MasstreeScanner scanner(end, reverse, arg, cb);
+  lcdf::Str first(start.data(), start.length());
+  if (reverse)
+    get_map()->rscan(first, true, scanner, *GetThreadInfo());
+  else
+    get_map()->scan(first, true, scanner, *GetThreadInfo());
+  scanner.Flush();
+}
+
 void MasstreeIndex::ImmediateDelete(const VarStrView &k)
 {
   auto ti = GetThreadInfo();
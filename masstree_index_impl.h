@@ -3,6 +3,7 @@
 
 #include <cstdio>
 #include <atomic>
+#include <type_traits>
 
 #include "index_common.h"
 #include "log.h"
@@ -29,7 +30,20 @@ class MasstreeIndex final : public Table {
 
   template <typename Func>
   VHandle *SearchOrCreateImpl(const VarStrView &k, Func f);
+
+  using ScanCallback = bool (*)(void *, const VarStrView &, VHandle *);
+  void ScanImpl(const VarStrView &start, const VarStrView &end, bool reverse,
+                void *arg, ScanCallback cb);
+
+  template <typename Visitor>
+  static bool VisitRow(void *arg, const VarStrView &k, VHandle *row) {
+    return (*(std::remove_reference_t<Visitor> *) arg)(k, row);
+  }
  public:
+  // Rows the scans fetch from the tree and prefetch, before the visitor sees
+  // any of them.
+  static constexpr int kScanBatch = 8;
+
   static void ResetThreadInfo();
 
   MasstreeIndex(std::tuple<bool> conf) noexcept; // no configuration required
@@ -46,6 +60,19 @@ class MasstreeIndex final : public Table {
   Table::Iterator *IndexReverseIterator(const VarStrView &start, const VarStrView &end) override;
   Table::Iterator *IndexReverseIterator(const VarStrView &start) override;
 
+  // Calls visitor(key, row) on the rows from start to end, both inclusive,
+  // until it returns false. Unlike the iterators, nothing is allocated and
+  // there's no virtual call per row. The key is only valid during the call.
+  template <typename Visitor>
+  void Scan(const VarStrView &start, const VarStrView &end, Visitor &&visitor) {
+    ScanImpl(start, end, false, (void *) &visitor, VisitRow<Visitor>);
+  }
+  // From start down to end.
+  template <typename Visitor>
+  void ReverseScan(const VarStrView &start, const VarStrView &end, Visitor &&visitor) {
+    ScanImpl(start, end, true, (void *) &visitor, VisitRow<Visitor>);
+  }
+
   void ImmediateDelete(const VarStrView &k);
 };
 
@@ -193,6 +193,8 @@ struct SlabMemory {
   uint64_t page_size;
   util::SpinLock half_full_lock;
   util::GenericListNode<MetaSlab> half_full;
+  uint64_t nr_metaslabs;
+  std::atomic_ulong nr_used_metaslabs;
 
   bool Contains(void *ptr) {
     return ptr > p && ptr < p + data_len;
@@ -236,6 +238,8 @@ void InitSlab(size_t memsz)
           m.data_len = memsz;
 
           nr_metaslabs -= m.data_offset / SlabPool::kLargeSlabPageSize;
+          m.nr_metaslabs = nr_metaslabs;
+          m.nr_used_metaslabs = 0;
           m.pool = Pool(mem::GenericMemory, sizeof(MetaSlab), nr_metaslabs, m.p);
           m.pool.set_suppress_warning(true);
           m.half_full.Initialize();
@@ -249,6 +253,26 @@ void InitSlab(size_t memsz)
     t.join();
 }
 
+size_t SlabMemoryCapacity()
+{
+  size_t cap = 0;
+  auto nr_numa_nodes = ParallelAllocationPolicy::g_nr_cores / kNrCorePerNode;
+  for (int n = 0; n < nr_numa_nodes; n++) {
+    cap += g_slabmem[n].nr_metaslabs * SlabPool::kLargeSlabPageSize;
+  }
+  return cap;
+}
+
+size_t SlabMemoryUsed()
+{
+  size_t used = 0;
+  auto nr_numa_nodes = ParallelAllocationPolicy::g_nr_cores / kNrCorePerNode;
+  for (int n = 0; n < nr_numa_nodes; n++) {
+    used += g_slabmem[n].nr_used_metaslabs.load(std::memory_order_relaxed) * SlabPool::kLargeSlabPageSize;
+  }
+  return used;
+}
+
 static SlabMemory *FindSlabMemory(void *ptr, int default_numa_node)
 {
   auto n = default_numa_node;
@@ -270,6 +294,7 @@ MetaSlab *SlabMemory::NewMetaSlab()
   if (mp == nullptr)
     return nullptr;
   auto idx = (mp - p) / sizeof(MetaSlab);
+  nr_used_metaslabs.fetch_add(1, std::memory_order_relaxed);
   // printf("new metaslab idx %lu\n", idx);
   return new (mp) MetaSlab(p + data_offset + idx * SlabPool::kLargeSlabPageSize);
 }
@@ -278,6 +303,7 @@ void SlabMemory::DestroyMetaSlab(MetaSlab *metaslab)
 {
   metaslab->~MetaSlab();
   pool.Free(metaslab);
+  nr_used_metaslabs.fetch_sub(1, std::memory_order_relaxed);
 }
 
 void *SlabMemory::AllocSlab(bool large_slab, void *&data_ptr)
@@ -155,6 +155,11 @@ void InitTotalNumberOfCores(int nr_cores);
 
 void InitSlab(size_t mem);
 
+// Metaslab granularity usage of the slab memory, across all NUMA nodes. Racy,
+// only good for statistics and heuristics.
+size_t SlabMemoryCapacity();
+size_t SlabMemoryUsed();
+
 // SlabPool can take care of chunks <= 512_K or chunks <= 16_M. For chunks larger
 // than 512_K, SlabPool will ask for memory from the large metaslabs. These are
 // 64_M in page size.
@@ -15,6 +15,8 @@
 #include "gc.h"
 #include "vhandle_sync.h"
 #include "contention_manager.h"
+#include "hot_row_detector.h"
+#include "slice_balancer.h"
 #include "pwv_graph.h"
 
 #include "util/os.h"
@@ -23,6 +25,7 @@
 #include "gopp/channels.h"
 #include "literals.h"
 #include "coro_sched.h"
+#include "task_sched.h"
 
 namespace felis {
 
@@ -84,6 +87,13 @@ class AllocatorModule : public Module<CoreModule> {
     if (Options::kVHandleLockElision)
       VHandleSyncService::g_lock_elision = true;
 
+    // Partitioned execution relies on every piece running on its own core.
+    if (Options::kNoWorkStealing || Options::kVHandleLockElision || Options::kEnablePartition)
+      EpochExecutionDispatchService::g_work_stealing = false;
+
+    if (Options::kBucketQueue)
+      EpochExecutionDispatchService::g_bucket_queue = true;
+
     if (Options::kNrEpoch)
       EpochClient::g_max_epoch = Options::kNrEpoch.ToInt();
 
@@ -116,6 +126,27 @@ class AllocatorModule : public Module<CoreModule> {
     // Setup GC
     GC::g_gc_every_epoch = 2 + Options::kMajorGCThreshold.ToLargeNumber("600K") / EpochClient::g_txn_per_epoch;
     GC::g_lazy = Options::kMajorGCLazy;
+    GC::g_adaptive = Options::kAdaptiveGC;
+    if (Options::kGCLowHeadroom)
+      GC::g_low_headroom = Options::kGCLowHeadroom.ToInt() / 100.0;
+    if (Options::kGCHighHeadroom)
+      GC::g_high_headroom = Options::kGCHighHeadroom.ToInt() / 100.0;
+    abort_if(GC::g_low_headroom >= GC::g_high_headroom,
+             "GCLowHeadroom must be lower than GCHighHeadroom");
+
+    if (Options::kHotRowTopK) {
+      HotRowDetector::g_enabled = true;
+      HotRowDetector::g_topk = Options::kHotRowTopK.ToLargeNumber();
+      abort_if(HotRowDetector::g_topk > HotRowDetector::kMaxTopK,
+               "HotRowTopK cannot be larger than {}", HotRowDetector::kMaxTopK);
+      if (Options::kHotRowMinCount)
+        HotRowDetector::g_min_count = Options::kHotRowMinCount.ToLargeNumber();
+    }
+
+    if (Options::kSliceCoreBalance) {
+      SliceCoreBalancer::g_enabled = true;
+      SliceCoreBalancer::g_threshold = Options::kSliceCoreBalance.ToInt();
+    }
 
     // logger->info("setting up regions {}", i);
     tasks.emplace_back([]() { mem::GetDataRegion().InitPools(); });
@@ -134,6 +165,8 @@ class AllocatorModule : public Module<CoreModule> {
           util::InstanceInit<SimpleSync>();
           if (Options::kVHandleBatchAppend || Options::kOnDemandSplitting)
             util::InstanceInit<ContentionManager>();
+          if (HotRowDetector::g_enabled)
+            util::InstanceInit<HotRowDetector>();
         });
     for (auto &t: tasks) t.join();
 
@@ -213,9 +246,31 @@ class CoroutineModule : public Module<CoreModule> {
     if (Options::kCoroSchedSignalFuture)
       CoroSched::g_use_signal_future = true;
 
+    if (Options::kCoroSchedAdaptive) {
+      CoroSched::g_adaptive = true;
+      CoroSched::g_ooo_buffer_size = 256;
+    }
+
     if (Options::kOOOBufferSize)
       CoroSched::g_ooo_buffer_size = Options::kOOOBufferSize.ToInt();
 
+    if (Options::kUseTaskSched) {
+      abort_if(Options::kUseCoroutineScheduler, "Cannot use both CoroSched and TaskSched");
+      TaskSched::g_use_task_sched = true;
+    }
+
+    if (Options::kTaskSchedMaxParked)
+      TaskSched::g_max_parked = Options::kTaskSchedMaxParked.ToLargeNumber();
+
+    if (Options::kPieceFusion) {
+      // A fused routine runs its pieces back to back, while a stackless task
+      // needs a routine of its own to park.
+      abort_if(Options::kUseTaskSched, "PieceFusion does not work with TaskSched");
+      abort_if(Options::kEnablePWV || Options::kEnableGranola,
+               "PieceFusion does not work with PWV or Granola");
+      BasePieceCollection::g_piece_fusion = true;
+    }
+
     static CoroutineStackAllocator alloc;
     go::InitThreadPool(NodeConfiguration::g_nr_threads + 1, &alloc);
 
@@ -224,6 +279,8 @@ class CoroutineModule : public Module<CoreModule> {
       auto r = go::Make(
           [i]() {
             CoroSched::Init();
+            if (TaskSched::g_use_task_sched)
+              TaskSched::Init();
             util::Cpu info;
             info.set_affinity(i - 1);
             info.Pin();
@@ -178,6 +178,7 @@ bool LocalTransport::TryFlushForCore(int core_id)
 
 size_t NodeConfiguration::g_nr_threads = 8;
 bool NodeConfiguration::g_data_migration = false;
+size_t NodeConfiguration::g_counter_batch = 0;
 
 static NodeConfiguration::NodePeerConfig ParseNodePeerConfig(json11::Json json, std::string name)
 {
@@ -258,6 +259,9 @@ void NodeConfiguration::SetupNodeName(std::string name)
 void NodeConfiguration::ResetBufferPlan()
 {
   local_batch_completed = 0;
+  nr_counter_msgs = 0;
+  nr_counter_msgs_received.fill(0);
+  nr_counter_msgs_expected.fill(0);
   auto nr = PromiseRoutineTransportService::kPromiseMaxLevels * nr_nodes() * nr_nodes();
   std::fill(local_batch->counters,
             local_batch->counters + nr,
@@ -308,9 +312,10 @@ void NodeConfiguration::CollectBufferPlanImpl(PieceRoutine *routine, unsigned lo
   }
 }
 
-bool NodeConfiguration::FlushBufferPlan(unsigned long *per_core_cnts)
+bool NodeConfiguration::FlushBufferPlan(unsigned long *per_core_cnts, bool last)
 {
   constexpr auto max_level = PromiseRoutineTransportService::kPromiseMaxLevels;
+  bool empty = true;
   // adds this core's counter to this node's global counter
   // and update current nodes completion_object's counter for all PieceRoutines whose dst node is current node
   for (int i = 0; i < max_level; i++) {
@@ -322,6 +327,7 @@ bool NodeConfiguration::FlushBufferPlan(unsigned long *per_core_cnts)
         total_batch_counters[idx].fetch_add(counter);
 
         if (counter == 0) continue;
+        empty = false;
 
         if (dst + 1 == node_id()) {
           trace(TRACE_COMPLETION "Increment {} of pieces from local counters", counter);
@@ -331,30 +337,63 @@ bool NodeConfiguration::FlushBufferPlan(unsigned long *per_core_cnts)
     }
   }
 
+  if (g_counter_batch > 0) {
+    // Send this core's counters right away. Every core sends its last update,
+    // even if empty, and the last one of this node tells how many updates
+    // there were. Updates from different cores can be reordered on the wire,
+    // so the receiver counts them.
+    if (empty && !last)
+      return false;
+    nr_counter_msgs.fetch_add(1);
+    bool node_done = last && local_batch_completed.fetch_add(1) + 1 == g_nr_threads;
+
+    auto batch = (LocalBatch *) alloca(CounterMessageSize());
+    batch->magic = PieceRoutine::kUpdateBatchCounter;
+    batch->node_id = (ulong) node_id();
+    batch->nr_msgs = node_done ? nr_counter_msgs.load() : 0;
+    for (size_t idx = 0; idx < max_level * nr_nodes() * nr_nodes(); idx++) {
+      batch->counters[idx].store(per_core_cnts[idx], std::memory_order_relaxed);
+    }
+    SendBufferPlan(batch);
+    if (node_done)
+      logger->info("Streamed {} counter updates", batch->nr_msgs);
+    return node_done;
+  }
+
   // To ensure that only the last thread on this node sends counter flush to the network
   if (local_batch_completed.fetch_add(1) + 1 < g_nr_threads)
     return false;
 
   local_batch->node_id = (ulong) node_id();
+  local_batch->nr_msgs = 1;
   logger->info("Flushing buffer plan");
+  SendBufferPlan(local_batch);
+  logger->info("Done Flushing buffer plan on {}", node_id());
+  return true;
+}
 
+void NodeConfiguration::SendBufferPlan(LocalBatch *batch)
+{
   // Flush current node's global counter to network
   for (int id = 1; id <= nr_nodes(); id++) {
     if (id == node_id()) continue;
     auto out = outgoing[id];
-    out->WriteToNetwork(
-        local_batch,
-        16 + max_level * nr_nodes() * nr_nodes() * sizeof(unsigned long));
+    out->WriteToNetwork(batch, CounterMessageSize());
     out->DoFlush(false);
   }
+}
 
-  logger->info("Done Flushing buffer plan on {}", node_id());
-  return true;
+size_t NodeConfiguration::CounterMessageSize() const
+{
+  constexpr auto max_level = PromiseRoutineTransportService::kPromiseMaxLevels;
+  return sizeof(LocalBatch) + max_level * max_node_id * max_node_id * sizeof(unsigned long);
 }
 
-int NodeConfiguration::UpdateBatchCountersFromReceiver(unsigned long *data)
+int NodeConfiguration::UpdateBatchCountersFromReceiver(unsigned long *data, bool *node_done)
 {
   auto src_node_id = data[0];
+  auto nr_msgs = data[1];
+  auto counters = data + 2;
   constexpr auto max_level = PromiseRoutineTransportService::kPromiseMaxLevels;
   auto total_cnt = 0;
 
@@ -363,7 +402,7 @@ int NodeConfiguration::UpdateBatchCountersFromReceiver(unsigned long *data)
     for (int src = 0; src < nr_nodes(); src++) {
       for (int dst = 0; dst < nr_nodes(); dst++) {
         auto idx = BatchBufferIndex(i, src + 1, dst + 1);
-        auto cnt = data[1 + idx];
+        auto cnt = counters[idx];
         if (cnt == 0) continue;
 
         TotalBatchCounter(idx).fetch_add(cnt);
@@ -374,7 +413,8 @@ int NodeConfiguration::UpdateBatchCountersFromReceiver(unsigned long *data)
       }
     }
 
-    if (all_zero) continue;
+    // Streamed updates are too many to print.
+    if (all_zero || g_counter_batch > 0) continue;
 
     // Print out debugging information
     fmt::memory_buffer buffer;
@@ -382,7 +422,7 @@ int NodeConfiguration::UpdateBatchCountersFromReceiver(unsigned long *data)
     for (int src = 0; src < nr_nodes(); src++) {
       for (int dst = 0; dst < nr_nodes(); dst++) {
         auto idx = BatchBufferIndex(i, src + 1, dst + 1);
-        auto cnt = data[1 + idx];
+        auto cnt = counters[idx];
 
         fmt::format_to(buffer, " {}->{}={}({})", src + 1, dst + 1, cnt, TotalBatchCounter(idx).load());
       }
@@ -390,12 +430,23 @@ int NodeConfiguration::UpdateBatchCountersFromReceiver(unsigned long *data)
     logger->info("{}", std::string_view(buffer.begin(), buffer.size()));
   }
 
-  logger->info("total_cnt {} from {}, adjusting the completion counter",
-               total_cnt, src_node_id);
-  // We now have the counter. We need to adjust the completion count with the
-  // real counter.
-  EpochClient::g_workload_client->completion_object()->Complete(
-      EpochClient::kMaxPiecesPerPhase - total_cnt);
+  // Pieces from this update are coming. We keep the kMaxPiecesPerPhase we
+  // pretended for this node until its last update, so the completion cannot
+  // reach zero early.
+  auto completion = EpochClient::g_workload_client->completion_object();
+  if (total_cnt > 0)
+    completion->Increment(total_cnt);
+
+  nr_counter_msgs_received[src_node_id]++;
+  if (nr_msgs > 0)
+    nr_counter_msgs_expected[src_node_id] = nr_msgs;
+  *node_done = nr_counter_msgs_received[src_node_id] == nr_counter_msgs_expected[src_node_id];
+
+  if (*node_done) {
+    logger->info("Counters from {} complete in {} updates, adjusting the completion counter",
+                 src_node_id, nr_counter_msgs_expected[src_node_id]);
+    completion->Complete(EpochClient::kMaxPiecesPerPhase);
+  }
   return src_node_id;
 }
 
@@ -126,6 +126,12 @@ class NodeConfiguration {
   static size_t g_nr_threads;
   static constexpr size_t kMaxNrThreads = 32;
   static bool g_data_migration;
+  /**
+   * Stream the counters every this many txns on each core, so that cores start
+   * issuing before all txns are planned. 0 sends one counter update per node
+   * per phase.
+   */
+  static size_t g_counter_batch;
 
   struct NodePeerConfig {
     std::string host;
@@ -161,11 +167,12 @@ class NodeConfiguration {
    */
   void CollectBufferPlan(BasePieceCollection *root, unsigned long *cnts);
   /**
-   * Flush the per-core counter after updating all PieceRoutines on this core
+   * Flush the per-core counter after updating PieceRoutines on this core
    * @param per_core_cnts   This core's buffer plan counter.
-   * @return                Whether this core flushed counter to the network.
+   * @param last            Whether these are the last PieceRoutines on this core.
+   * @return                Whether this core flushed the last counter update of this node.
    */
-  bool FlushBufferPlan(unsigned long *per_core_cnts);
+  bool FlushBufferPlan(unsigned long *per_core_cnts, bool last = true);
   /**
    * Broadcasts start phase message to all other nodes.
    */
@@ -206,8 +213,16 @@ class NodeConfiguration {
     incoming[idx] = t;
   }
 
-  int UpdateBatchCountersFromReceiver(unsigned long *data);
+  /**
+   * Apply a counter update from another node.
+   * @param data        The update, after the magic number.
+   * @param node_done   Set if this was the last update from that node in this phase.
+   * @return            The node that sent it.
+   */
+  int UpdateBatchCountersFromReceiver(unsigned long *data, bool *node_done);
   size_t CalculateIncomingFromNode(int src);
+  /** Size of a counter update on the wire, including the magic number. */
+  size_t CounterMessageSize() const;
 
  private:
   std::array<util::Optional<NodeConfig>, kMaxNrNode> all_config;
@@ -227,9 +242,18 @@ class NodeConfiguration {
   struct LocalBatch {
     unsigned long magic;
     unsigned long node_id;
+    unsigned long nr_msgs;  /*!< only in the last update, how many updates in this phase */
     std::atomic_ulong counters[];
   } *local_batch;
   std::atomic_ulong local_batch_completed;
+  std::atomic_ulong nr_counter_msgs;  /*!< updates we sent in this phase */
+
+  // Updates from other nodes in this phase. Each is only touched by the
+  // ReceiverChannel of that node.
+  std::array<unsigned long, kMaxNrNode> nr_counter_msgs_received;
+  std::array<unsigned long, kMaxNrNode> nr_counter_msgs_expected;
+
+  void SendBufferPlan(LocalBatch *batch);
  private:
 
   /**
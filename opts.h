@@ -55,6 +55,16 @@ struct Options {
   static inline const auto kMem = Option("mem");
   static inline const auto kOutputDir = Option("OutputDir");
   static inline const auto kDataMigration = Option("DataMigrationMode", false);
+  // Send inter-node traffic through io_uring.
+  static inline const auto kIoUring = Option("IoUring", false);
+  // Nodes on the same host talk through shared memory instead of TCP.
+  static inline const auto kShmTransport = Option("ShmTransport", false);
+  // Plan, stream the counters and issue every this many txns on each core.
+  static inline const auto kStreamingCounters = Option("StreamingCounters");
+  // Move slices between nodes by load, at epoch boundaries. Needs DataMigrationMode.
+  static inline const auto kRepartition = Option("Repartition", false);
+  // A node gives away a slice when it is this many percent over the average.
+  static inline const auto kRepartitionThreshold = Option("RepartitionThreshold");
   static inline const auto kMaxNodeLimit = Option("MaxNodeLimit");
   static inline const auto kNoHugePage = Option("NoHugePage", false);
 
@@ -62,8 +72,16 @@ struct Options {
   static inline const auto kEpochSize = Option("EpochSize");
   static inline const auto kMajorGCThreshold = Option("MajorGCThreshold");
   static inline const auto kMajorGCLazy = Option("LazyMajorGC", false);
+  static inline const auto kAdaptiveGC = Option("AdaptiveGC", false);
+  // In percentage of the slab memory
+  static inline const auto kGCLowHeadroom = Option("GCLowHeadroom");
+  static inline const auto kGCHighHeadroom = Option("GCHighHeadroom");
   static inline const auto kEpochQueueLength = Option("EpochQueueLength");
   static inline const auto kVHandleLockElision = Option("VHandleLockElision", false);
+  // Idle cores steal pieces without affinity from busy cores during execution.
+  static inline const auto kNoWorkStealing = Option("NoWorkStealing", false);
+  // Bucket queue instead of heap + hashtable for the execution priority queue.
+  static inline const auto kBucketQueue = Option("BucketQueue", false);
   static inline const auto kVHandleBatchAppend = Option("VHandleBatchAppend", false);
   static inline const auto kEnablePartition = Option("EnablePartition", false);
   static inline const auto kBatchAppendAlloc = Option("BatchAppendAlloc");
@@ -75,12 +93,23 @@ struct Options {
   static inline const auto kAutoTuneThreshold = Option("AutoTuneThreshold", false);
 
   static inline const auto kBinpackSplitting = Option("BinpackSplitting", false);
+  // knapsack, ffd or locality. See binpack.h
+  static inline const auto kBinpackPolicy = Option("BinpackPolicy");
+  // Record the per-epoch row weights for binpack_benchmark.
+  static inline const auto kBinpackTrace = Option("BinpackTrace");
+  // Only split and batch append the top-K hot rows of the previous epoch.
+  static inline const auto kHotRowTopK = Option("HotRowTopK");
+  static inline const auto kHotRowMinCount = Option("HotRowMinCount");
+  // Remap slices to cores by measured load. The value is the imbalance
+  // threshold in percent over the average core.
+  static inline const auto kSliceCoreBalance = Option("SliceCoreBalance");
 
   static inline const auto kTpccWarehouses = Option("TpccWarehouses");
   static inline const auto kTpccHotWarehouseBitmap = Option("TpccHotWarehouseBitmap");
   static inline const auto kTpccHotWarehouseLoad = Option("TpccHotWarehouseLoad");
   static inline const auto kTpccHashShard = Option("TpccHashShard", false);
   static inline const auto kTpccReadOnlyDelayQuery = Option("TpccReadOnlyDelayQuery", false);
+  static inline const auto kTpccCustomerByName = Option("TpccCustomerByName", false);
 
   static inline const auto kYcsbContentionKey = Option("YcsbContentionKey");
   static inline const auto kYcsbSkewFactor = Option("YcsbSkewFactor");
@@ -98,6 +127,13 @@ struct Options {
   static inline const auto kUseCoroutineScheduler = Option("UseCoroSched", false);
   static inline const auto kCoroSchedSignalFuture = Option("CoroSchedSignalFuture", false);
   static inline const auto kOOOBufferSize = Option("OOOBufferSize");
+  // Adapt the OOO window (bounded by OOOBufferSize) and the backoff per core.
+  static inline const auto kCoroSchedAdaptive = Option("CoroSchedAdaptive", false);
+  // Stackless executor for pieces attached with AttachTask().
+  static inline const auto kUseTaskSched = Option("UseTaskSched", false);
+  static inline const auto kTaskSchedMaxParked = Option("TaskSchedMaxParked");
+  // Merge consecutive pieces of a txn that run on the same core.
+  static inline const auto kPieceFusion = Option("PieceFusion", false);
 
   static inline bool ParseExtentedOptions(std::string arg)
   {
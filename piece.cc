@@ -6,9 +6,12 @@
 #include <queue>
 #include "util/objects.h"
 #include "util/arch.h"
+#include "util/varint.h"
 #include "opts.h"
 #include "mem.h"
 #include "coro_sched.h"
+#include "task_sched.h"
+#include "slice_balancer.h"
 
 using util::Instance;
 using util::Impl;
@@ -31,7 +34,8 @@ PieceRoutine *PieceRoutine::CreateFromCapture(size_t capture_len)
   r->next = nullptr;
   r->fv_signals = 0;
   r->future_source_node_id = 0;
-  std::fill(r->__padding__, r->__padding__ + 8, 0);
+  std::fill(r->__padding__, r->__padding__ + 6, 0);
+  r->encode_capture = nullptr;
   return r;
 }
 
@@ -40,70 +44,162 @@ PieceRoutine::CreateFromPacket(uint8_t *p, size_t packet_len)
 {
   auto r = (PieceRoutine *) BasePieceCollection::Alloc(sizeof(PieceRoutine));
   auto result_len = r->DecodeNode(p, packet_len);
-  abort_if(result_len != packet_len,
+  // Packets are padded to 8 bytes
+  abort_if(result_len > packet_len || packet_len - result_len >= 8,
            "DecodeNode() consumes {} but passed in {} bytes",
            result_len, packet_len);
   return r;
 }
 
-size_t PieceRoutine::NodeSize() const
+// Wire format of a node. Fields that are mostly left at their defaults are
+// omitted, and the rest are varints:
+//
+//   flags, level, node_id: 1 byte each
+//   callback: 8 bytes
+//   sched_key: ZigZag of the delta to the parent's sched_key, if kWireSchedKey
+//   affinity, if kWireAffinity
+//   fv_signals and future_source_node_id: 1 byte each, if set
+//   PWV's RVPInfo: 2 bytes, if set
+//   capture_len, then the capture
+//   number of children, then the children, if kWireChildren
+enum : uint8_t {
+  kWireSchedKey = 1 << 0,
+  kWireAffinity = 1 << 1,
+  kWireSignals = 1 << 2,
+  kWireFutureSource = 1 << 3,
+  kWireRVP = 1 << 4,
+  kWireChildren = 1 << 5,
+};
+
+static constexpr size_t kWireFixedSize = 3 + sizeof(void (*)(PieceRoutine *));
+
+uint8_t PieceRoutine::WireFlags() const
 {
-  size_t s = util::Align(sizeof(PieceRoutine))
-             + util::Align(capture_len)
-             + 8;
+  uint8_t flags = 0;
+  if (sched_key != 0) flags |= kWireSchedKey;
+  if (affinity != std::numeric_limits<uint64_t>::max()) flags |= kWireAffinity;
+  if (fv_signals != 0) flags |= kWireSignals;
+  if (future_source_node_id != 0) flags |= kWireFutureSource;
+  if (__padding__[0] != 0 || __padding__[1] != 0) flags |= kWireRVP;
+  if (next && next->nr_handlers > 0) flags |= kWireChildren;
+  return flags;
+}
 
-  for (size_t i = 0; next && i < next->nr_handlers; i++) {
-    auto *child = next->routine(i);
-    s += child->NodeSize();
+size_t PieceRoutine::NodeSize(uint64_t parent_key) const
+{
+  auto flags = WireFlags();
+  auto capture_size = EncodedCaptureSize();
+  size_t s = kWireFixedSize;
+
+  if (flags & kWireSchedKey) s += util::VarintSize(util::ZigZag(sched_key - parent_key));
+  if (flags & kWireAffinity) s += util::VarintSize(affinity);
+  if (flags & kWireSignals) s++;
+  if (flags & kWireFutureSource) s++;
+  if (flags & kWireRVP) s += 2;
+  s += util::VarintSize(capture_size) + capture_size;
+
+  if (flags & kWireChildren) {
+    s += util::VarintSize(next->nr_handlers);
+    for (size_t i = 0; i < next->nr_handlers; i++) {
+      auto *child = next->routine(i);
+      s += child->NodeSize(sched_key);
+    }
   }
 
   return s;
 }
 
-uint8_t *PieceRoutine::EncodeNode(uint8_t *p)
+uint8_t *PieceRoutine::EncodeNode(uint8_t *p, uint64_t parent_key)
 {
-  memcpy(p, this, sizeof(PieceRoutine));
-  auto node = (PieceRoutine *) p;
-  p += util::Align(sizeof(PieceRoutine));
-
-  memcpy(p, capture_data, capture_len);
-  p += util::Align(capture_len);
-
-  size_t nr_children = next ? next->nr_handlers : 0;
-  memcpy(p, &nr_children, 8);
-  p += 8;
+  auto flags = WireFlags();
+  *p++ = flags;
+  *p++ = level;
+  *p++ = node_id;
+  memcpy(p, &callback, sizeof(callback));
+  p += sizeof(callback);
+
+  if (flags & kWireSchedKey) p = util::EncodeVarint(p, util::ZigZag(sched_key - parent_key));
+  if (flags & kWireAffinity) p = util::EncodeVarint(p, affinity);
+  if (flags & kWireSignals) *p++ = fv_signals;
+  if (flags & kWireFutureSource) *p++ = future_source_node_id;
+  if (flags & kWireRVP) {
+    memcpy(p, __padding__, 2);
+    p += 2;
+  }
 
-  for (size_t i = 0; next && i < next->nr_handlers; i++) {
-    auto *child = next->routine(i);
-    p = child->EncodeNode(p);
+  // Receiver always gets the encoding
+  size_t capture_size = EncodedCaptureSize();
+  p = util::EncodeVarint(p, capture_size);
+  if (encode_capture)
+    encode_capture(capture_data, p);
+  else
+    memcpy(p, capture_data, capture_len);
+  p += capture_size;
+
+  if (flags & kWireChildren) {
+    p = util::EncodeVarint(p, next->nr_handlers);
+    for (size_t i = 0; i < next->nr_handlers; i++) {
+      auto *child = next->routine(i);
+      p = child->EncodeNode(p, sched_key);
+    }
   }
   return p;
 }
 
-size_t PieceRoutine::DecodeNode(uint8_t *p, size_t len)
+size_t PieceRoutine::DecodeNode(uint8_t *p, size_t len, uint64_t parent_key)
 {
   uint8_t *orig_p = p;
-  size_t off = util::Align(sizeof(PieceRoutine));
-  memcpy(this, p, off);
-  p += off;
-
-  off = util::Align(capture_len);
-  capture_data = (uint8_t *) BasePieceCollection::Alloc(off);
-  memcpy(capture_data, p, off);
-  p += off;
-
+  uint8_t *end = p + len;
+  uint64_t v;
+  auto decode_varint =
+      [&p, end, &v]() {
+        p = util::DecodeVarint(p, end, &v);
+        abort_if(p == nullptr, "Corrupted piece packet");
+        return v;
+      };
+
+  abort_if(len < kWireFixedSize, "Piece packet is too short {}", len);
+  uint8_t flags = *p++;
+  level = *p++;
+  node_id = *p++;
+  memcpy(&callback, p, sizeof(callback));
+  p += sizeof(callback);
+
+  sched_key = 0;
+  affinity = std::numeric_limits<uint64_t>::max();
+  fv_signals = 0;
+  future_source_node_id = 0;
+  std::fill(__padding__, __padding__ + 6, 0);
+  encode_capture = nullptr;
   next = nullptr;
 
-  size_t nr_children = 0;
-  memcpy(&nr_children, p, 8);
-  p += 8;
+  if (flags & kWireSchedKey) sched_key = parent_key + util::UnZigZag(decode_varint());
+  if (flags & kWireAffinity) affinity = decode_varint();
+  abort_if(end - p < !!(flags & kWireSignals) + !!(flags & kWireFutureSource) + 2 * !!(flags & kWireRVP),
+           "Corrupted piece packet");
+  if (flags & kWireSignals) fv_signals = *p++;
+  if (flags & kWireFutureSource) future_source_node_id = *p++;
+  if (flags & kWireRVP) {
+    memcpy(__padding__, p, 2);
+    p += 2;
+  }
 
-  if (nr_children > 0) {
+  // Check before narrowing, so that a corrupted length can't wrap around.
+  uint64_t len64 = decode_varint();
+  abort_if(len64 > size_t(end - p), "Corrupted piece packet, capture_len {}", len64);
+  capture_len = len64;
+  capture_data = (uint8_t *) BasePieceCollection::Alloc(util::Align(capture_len));
+  memcpy(capture_data, p, capture_len);
+  p += capture_len;
+
+  if (flags & kWireChildren) {
+    size_t nr_children = decode_varint();
+    abort_if(nr_children > (end - p) / kWireFixedSize,
+             "Corrupted piece packet, {} children", nr_children);
     next = new BasePieceCollection(nr_children);
     for (int i = 0; i < nr_children; i++) {
       auto child = (PieceRoutine *) BasePieceCollection::Alloc(sizeof(PieceRoutine));
-      off = child->DecodeNode(p, len - (p - orig_p));
-      p += off;
+      p += child->DecodeNode(p, end - p, sched_key);
       next->Add(child);
     }
   }
@@ -111,6 +207,7 @@ size_t PieceRoutine::DecodeNode(uint8_t *p, size_t len)
 }
 
 size_t BasePieceCollection::g_nr_threads = 0;
+bool BasePieceCollection::g_piece_fusion = false;
 
 BasePieceCollection::BasePieceCollection(int limit)
     : limit(limit), nr_handlers(0), extra_handlers(nullptr)
@@ -153,6 +250,75 @@ void BasePieceCollection::AssignAffinity(uint64_t aff)
   }
 }
 
+// Capture of a fused routine is the array of the routines it absorbed.
+static void FusedPieceCallback(PieceRoutine *routine)
+{
+  auto subs = (PieceRoutine **) routine->capture_data;
+  auto nr_subs = routine->capture_len / sizeof(PieceRoutine *);
+  for (size_t i = 0; i < nr_subs; i++) {
+    subs[i]->callback(subs[i]);
+  }
+  // Fuse() runs before the buffer plan is collected, so the plan counts us
+  // once, and the executor reports that one completion.
+}
+
+static bool IsFusible(PieceRoutine *r)
+{
+  auto &conf = util::Instance<NodeConfiguration>();
+  // Affinity max() becomes the issuing core later. Other values at or beyond
+  // nr_threads are spread randomly, so two of them may not meet.
+  return (r->node_id == 0 || r->node_id == conf.node_id())
+      && (r->affinity == std::numeric_limits<uint64_t>::max()
+          || r->affinity < BasePieceCollection::g_nr_threads)
+      && r->next == nullptr && r->fv_signals == 0 && r->future_source_node_id == 0
+      && r->callback != FusedPieceCallback;
+}
+
+size_t BasePieceCollection::Fuse()
+{
+  int nr_out = 0;
+  size_t nr_fused = 0;
+  PieceRoutine *subs[kMaxFusedPieces];
+
+  for (int i = 0; i < nr_handlers;) {
+    auto first = routine(i);
+    int j = i + 1;
+    if (IsFusible(first)) {
+      while (j < nr_handlers && j - i < kMaxFusedPieces) {
+        auto r = routine(j);
+        if (!IsFusible(r) || r->node_id != first->node_id
+            || r->affinity != first->affinity || r->sched_key != first->sched_key)
+          break;
+        j++;
+      }
+    }
+
+    if (j - i == 1) {
+      routine(nr_out++) = first;
+      i = j;
+      continue;
+    }
+
+    // Read the group out before we overwrite slots in place.
+    int nr_subs = j - i;
+    for (int k = 0; k < nr_subs; k++) subs[k] = routine(i + k);
+
+    auto fused = PieceRoutine::CreateFromCapture(nr_subs * sizeof(PieceRoutine *));
+    memcpy(fused->capture_data, subs, nr_subs * sizeof(PieceRoutine *));
+    fused->callback = FusedPieceCallback;
+    fused->level = first->level;
+    fused->node_id = first->node_id;
+    fused->sched_key = first->sched_key;
+    fused->affinity = first->affinity;
+
+    routine(nr_out++) = fused;
+    nr_fused += nr_subs;
+    i = j;
+  }
+  nr_handlers = nr_out;
+  return nr_fused;
+}
+
 void BasePieceCollection::Add(PieceRoutine *child)
 {
   abort_if(nr_handlers >= limit,
@@ -188,6 +354,11 @@ void BasePieceCollection::ExecutionRoutine::Run()
     return;
   }
 
+  if (TaskSched::g_use_task_sched) {
+    task_sched->StartExec();
+    return;
+  }
+
   auto &svc = util::Impl<PromiseRoutineDispatchService>();
   auto &transport = util::Impl<PromiseRoutineTransportService>();
 
@@ -236,7 +407,13 @@ void BasePieceCollection::ExecutionRoutine::Run()
       if (rt->sched_key != 0)
         debug(TRACE_EXEC_ROUTINE "Run {} sid {}", (void *) rt, rt->sched_key);
 
-      rt->callback(rt);
+      if (SliceCoreBalancer::g_enabled) {
+        auto start = __rdtsc();
+        rt->callback(rt);
+        Instance<SliceCoreBalancer>().AddExecTime(core_id, __rdtsc() - start);
+      } else {
+        rt->callback(rt);
+      }
       svc.Complete(core_id);
     }
   } while (!give_up && svc.IsReady(core_id) && transport.PeriodicIO(core_id));
@@ -33,10 +33,18 @@ struct PieceRoutine {
 
   void (*callback)(PieceRoutine *);
 
-  size_t NodeSize() const;
-  uint8_t *EncodeNode(uint8_t *p);
+  /**
+   * Wire format, see piece.cc. Children encode their sched_key as a delta to
+   * the parent's, so parent_key is only non-zero in the recursion.
+   */
+  size_t NodeSize(uint64_t parent_key = 0) const;
+  uint8_t *EncodeNode(uint8_t *p, uint64_t parent_key = 0);
+  size_t EncodedCaptureSize() const {
+    return encode_capture ? encode_capture(capture_data, nullptr) : capture_len;
+  }
 
-  size_t DecodeNode(uint8_t *p, size_t len);
+  size_t DecodeNode(uint8_t *p, size_t len, uint64_t parent_key = 0);
+  uint8_t WireFlags() const;
 
   /**
    * Shujian: I believe this is never used.
@@ -48,7 +56,15 @@ struct PieceRoutine {
    */
   uint8_t fv_signals;
   uint8_t future_source_node_id;
-  uint8_t __padding__[14];
+  uint8_t __padding__[6];
+
+  /**
+   * Set if capture_data points to a live closure object instead of its
+   * encoding. Returns the encoded size, and encodes into buf if buf isn't
+   * nullptr. The closure is only encoded when the routine is shipped to
+   * another node.
+   */
+  size_t (*encode_capture)(const uint8_t *capture, uint8_t *buf);
 
   static PieceRoutine *CreateFromCapture(size_t capture_len);
   static PieceRoutine *CreateFromPacket(uint8_t *p, size_t packet_len);
@@ -73,7 +89,9 @@ class BasePieceCollection {
   PieceRoutine *inline_handlers[kInlineLimit];
  public:
   static size_t g_nr_threads;
+  static bool g_piece_fusion;  /*!< merge consecutive same-core pieces of a txn */
   static constexpr int kMaxHandlersLimit = 32 + kInlineLimit;
+  static constexpr int kMaxFusedPieces = 8;
 
   class ExecutionRoutine : public go::Routine {
    public:
@@ -104,6 +122,13 @@ class BasePieceCollection {
    * @param affinity
    */
   void AssignAffinity(uint64_t affinity);
+  /**
+   * Merges runs of consecutive PieceRoutines that will run on the same core
+   * with the same scheduling key into one PieceRoutine, which runs them in
+   * order. Must be called before the buffer plan is collected.
+   * @return number of PieceRoutines that were merged
+   */
+  size_t Fuse();
 
   static void *operator new(std::size_t size);
   static void *Alloc(size_t size);
@@ -155,6 +180,8 @@ class PromiseRoutineTransportService {
   virtual void PrefetchInbound() {};
   virtual void FinishCompletion(int level) {}
   virtual uint8_t GetNumberOfNodes() { return 0; }
+  /** Log and reset the send statistics, once per epoch. */
+  virtual void DumpStats() {}
 };
 
 class PromiseRoutineDispatchService {
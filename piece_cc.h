@@ -1,10 +1,27 @@
 #ifndef PIECE_CC_H
 #define PIECE_CC_H
 
+#include <type_traits>
+
 #include "piece.h"
+#include "piece_task.h"
+#include "sqltypes.h"
 
 namespace felis {
 
+// Closures opt in to stay live in the epoch brk. A copy of the closure has to
+// own everything its encoding would, because the routine may run or ship long
+// after the closure it was copied from is gone. sql::Tuple fields encode as
+// plain bytes, inline strings or nested objects, so a tuple qualifies unless it
+// needs a destructor, which the brk never runs. Index op contexts don't: their
+// key_data points into the stack of Prepare().
+template <typename Closure>
+struct LiveCapture : std::false_type {};
+
+template <typename ...Types>
+struct LiveCapture<sql::Tuple<Types...>>
+    : std::bool_constant<std::is_trivially_destructible_v<sql::Tuple<Types...>>> {};
+
 class PieceCollection : public BasePieceCollection {
  public:
   using BasePieceCollection::BasePieceCollection;
@@ -29,23 +46,88 @@ class PieceCollection : public BasePieceCollection {
 
     auto static_func =
         [](PieceRoutine *routine) {
+          if (IsLiveCapture<Closure>(routine)) {
+            native_func(*(const Closure *) routine->capture_data);
+            return;
+          }
           Closure capture;
           capture.DecodeFrom(routine->capture_data);
 
           native_func(capture);
         };
-    auto routine = PieceRoutine::CreateFromCapture(capture.EncodeSize());
+    return NewRoutine(capture, placement, static_func, affinity, signals, future_source_node_id);
+  }
+
+  /**
+   * Like AttachRoutine(), but func is a coroutine returning PieceTask, so it
+   * can co_await AwaitVersion() and AwaitFuture() (see task_sched.h). It takes
+   * the closure by value so that the coroutine frame owns it.
+   */
+  template <typename Func, typename Closure>
+  PieceRoutine *AttachTask(const Closure &capture, int placement, Func func,
+                           uint64_t affinity = std::numeric_limits<uint64_t>::max(),
+                           uint8_t signals = 0,
+                           uint8_t future_source_node_id = 0) {
+    constexpr PieceTask (*native_func)(Closure) = func;
+
+    auto static_func =
+        [](PieceRoutine *routine) {
+          if (IsLiveCapture<Closure>(routine)) {
+            PieceTask::RunFromPiece(native_func(*(const Closure *) routine->capture_data));
+            return;
+          }
+          Closure capture;
+          capture.DecodeFrom(routine->capture_data);
+
+          PieceTask::RunFromPiece(native_func(std::move(capture)));
+        };
+    return NewRoutine(capture, placement, static_func, affinity, signals, future_source_node_id);
+  }
+
+ private:
+  // Closures that opt in with LiveCapture are copied into the epoch brk as
+  // is. Pieces that stay on this node then never encode or decode them.
+  template <typename Closure>
+  static constexpr bool kCanKeepLiveCapture =
+      LiveCapture<Closure>::value && alignof(Closure) <= 8;
+
+  template <typename Closure>
+  static bool IsLiveCapture(PieceRoutine *routine) {
+    if constexpr (kCanKeepLiveCapture<Closure>) {
+      return routine->encode_capture != nullptr;
+    } else {
+      return false;
+    }
+  }
+
+  template <typename Closure>
+  static size_t EncodeLiveCapture(const uint8_t *capture, uint8_t *buf) {
+    auto c = (const Closure *) capture;
+    if (buf) c->EncodeTo(buf);
+    return c->EncodeSize();
+  }
+
+  template <typename Closure>
+  PieceRoutine *NewRoutine(const Closure &capture, int placement, void (*static_func)(PieceRoutine *),
+                           uint64_t affinity, uint8_t signals, uint8_t future_source_node_id) {
+    PieceRoutine *routine;
+    if constexpr (kCanKeepLiveCapture<Closure>) {
+      routine = PieceRoutine::CreateFromCapture(sizeof(Closure));
+      new (routine->capture_data) Closure(capture);
+      routine->encode_capture = EncodeLiveCapture<Closure>;
+    } else {
+      routine = PieceRoutine::CreateFromCapture(capture.EncodeSize());
+      capture.EncodeTo(routine->capture_data);
+    }
     routine->node_id = placement;
     routine->callback = static_func;
     routine->affinity = affinity;
     routine->fv_signals = signals; // TODO: Seperate signals to AttachFuture
     routine->future_source_node_id = future_source_node_id;
-    capture.EncodeTo(routine->capture_data);
 
     Add(routine);
     return routine;
   }
-  
 
 };
 
@@ -0,0 +1,112 @@
+// -*- mode: c++ -*-
+
+#ifndef PIECE_TASK_H
+#define PIECE_TASK_H
+
+#include <coroutine>
+#include <cstdlib>
+#include <cstddef>
+#include <utility>
+
+namespace felis {
+
+// Stackless piece body. A piece attached with PieceCollection::AttachTask()
+// returns a PieceTask, and waits on versions or futures with co_await instead
+// of spinning. The frame only holds the locals that live across co_await
+// points, usually a few hundred bytes, compared to the 64KB stack CoroSched
+// needs for each in-flight piece.
+//
+// A PieceTask can co_await another PieceTask. The callee resumes its caller
+// when it finishes, so the scheduler only needs the innermost suspended handle.
+class PieceTask {
+ public:
+  struct promise_type;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  // Per-thread free lists of frames. Tasks are created and destroyed on the
+  // same core, so we never need to lock.
+  class FramePool {
+    static constexpr size_t kClassSize = 64;
+    static constexpr size_t kNrClasses = 16;
+    struct FreeFrame {
+      FreeFrame *next;
+    };
+    static inline thread_local FreeFrame *free_frames[kNrClasses];
+
+    static size_t SizeClass(size_t size) { return (size + kClassSize - 1) / kClassSize; }
+   public:
+    static void *Alloc(size_t size) {
+      auto cls = SizeClass(size);
+      if (cls >= kNrClasses) return malloc(size);
+      auto f = free_frames[cls];
+      if (f == nullptr) return malloc(cls * kClassSize);
+      free_frames[cls] = f->next;
+      return f;
+    }
+    static void Free(void *p, size_t size) {
+      auto cls = SizeClass(size);
+      if (cls >= kNrClasses) {
+        free(p);
+        return;
+      }
+      auto f = (FreeFrame *) p;
+      f->next = free_frames[cls];
+      free_frames[cls] = f;
+    }
+  };
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(Handle h) noexcept {
+      auto caller = h.promise().caller;
+      return caller ? caller : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  struct promise_type {
+    std::coroutine_handle<> caller;
+
+    PieceTask get_return_object() { return PieceTask(Handle::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::abort(); }
+
+    static void *operator new(size_t size) { return FramePool::Alloc(size); }
+    static void operator delete(void *p, size_t size) { FramePool::Free(p, size); }
+  };
+
+  PieceTask() {}
+  explicit PieceTask(Handle h) : handle(h) {}
+  PieceTask(const PieceTask &rhs) = delete;
+  PieceTask(PieceTask &&rhs) : handle(std::exchange(rhs.handle, nullptr)) {}
+  PieceTask &operator=(PieceTask &&rhs) {
+    std::swap(handle, rhs.handle);
+    return *this;
+  }
+  ~PieceTask() { if (handle) handle.destroy(); }
+
+  // Called by the routine from PieceCollection::AttachTask(). On TaskSched the
+  // task may be parked and finish later; otherwise it runs to completion.
+  static void RunFromPiece(PieceTask &&task);
+
+  bool done() const { return !handle || handle.done(); }
+  Handle release() { return std::exchange(handle, nullptr); }
+
+  // co_await a sub-task: run it until its first suspension, and come back
+  // when it finishes.
+  bool await_ready() { return done(); }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+    handle.promise().caller = caller;
+    return handle;
+  }
+  void await_resume() {}
+
+ private:
+  Handle handle;
+};
+
+}
+
+#endif /* PIECE_TASK_H */
@@ -0,0 +1,177 @@
+#include <algorithm>
+
+#include "repartition.h"
+#include "epoch.h"
+#include "log.h"
+
+namespace felis {
+
+bool Repartitioner::g_enabled = false;
+int Repartitioner::g_threshold = 20;
+
+// Scans the slice that is moving away, and keeps shipping the rows that turn
+// dirty until the move takes effect.
+class SliceMoveRoutine : public go::Routine {
+  int slice;
+ public:
+  SliceMoveRoutine(int slice) : slice(slice) {}
+  void Run() final override;
+};
+
+void SliceMoveRoutine::Run()
+{
+  auto &rp = util::Instance<Repartitioner>();
+  PerfLog perf;
+  util::Instance<SliceManager>().ScanRow(slice);
+  perf.End();
+  perf.Show(fmt::format("[mig]Scanning slice {} takes", slice));
+
+  while (!rp.outgoing_stop.load(std::memory_order_acquire)) {
+    if (rp.outgoing->RunSend(false))
+      go::Scheduler::Current()->RunNext(go::Scheduler::NextReadyState);
+  }
+  rp.outgoing_done.store(true, std::memory_order_release);
+}
+
+Repartitioner::Repartitioner()
+{
+  route.fill(0);
+  slice_load.fill(0);
+  node_load.fill(0);
+}
+
+void Repartitioner::OnEpochEnd(uint64_t epoch_nr)
+{
+  auto &conf = util::Instance<NodeConfiguration>();
+  std::lock_guard _(lock);
+
+  // Everybody's report on the previous epoch has arrived during this one.
+  if (conf.nr_nodes() > 1 && epoch_nr > last_move_epoch + 1 && pending.empty())
+    Decide(epoch_nr);
+
+  uint64_t total = 0;
+  counters.Collect(slice_load.data());
+  for (auto &load: slice_load) {
+    total += load;
+    load >>= kLoadShift;
+  }
+  total = std::min<uint64_t>(total >> kLoadShift, (1 << 23) - 1);
+  node_load[conf.node_id()] = total;
+  util::Instance<SliceMappingTable>().AddRepartitionOp(false, total);
+}
+
+void Repartitioner::Decide(uint64_t epoch_nr)
+{
+  auto &conf = util::Instance<NodeConfiguration>();
+  int me = conf.node_id();
+  uint64_t total = 0;
+  int dst = 0;
+  for (int n = 1; n <= conf.nr_nodes(); n++) {
+    total += node_load[n];
+    if (n != me && (dst == 0 || node_load[n] < node_load[dst]))
+      dst = n;
+  }
+  auto avg = total / conf.nr_nodes();
+  if (node_load[me] * 100 <= avg * (100 + g_threshold))
+    return;
+
+  // Giving away more than half of the gap only swaps the roles.
+  auto budget = (node_load[me] - node_load[dst]) / 2;
+  int slice = -1;
+  for (int s = 0; s < kNrMaxSlices; s++) {
+    if (slice_load[s] == 0 || slice_load[s] > budget)
+      continue;
+    if (slice < 0 || slice_load[s] > slice_load[slice])
+      slice = s;
+  }
+  if (slice < 0)
+    return;
+
+  logger->info("[mig]Node load {} avg {}, moving slice {} (load {}) to node {} (load {})",
+               node_load[me], avg, slice, slice_load[slice], dst, node_load[dst]);
+  StartMove(slice, dst, epoch_nr);
+}
+
+void Repartitioner::StartMove(int slice, int dst, uint64_t epoch_nr)
+{
+  auto &conf = util::Instance<NodeConfiguration>();
+  auto &peer = conf.config(dst).row_shipper_peer;
+  outgoing = new RowShipment(peer.host, peer.port, true);
+  outgoing_stop = false;
+  outgoing_done = false;
+  util::Instance<SliceManager>().SetRowShipment(slice, outgoing);
+
+  // The other nodes see the op in the next epoch, and add kMoveDelay to that.
+  pending.push_back({slice, conf.node_id(), dst, epoch_nr + 1 + kMoveDelay});
+  util::Instance<SliceMappingTable>().AddRepartitionOp(true, slice | (dst << 8));
+
+  go::GetSchedulerFromPool(NodeConfiguration::g_nr_threads + 1)->WakeUp(
+      new SliceMoveRoutine(slice));
+}
+
+void Repartitioner::ReplayOp(int node_id, bool is_move, int payload)
+{
+  std::lock_guard _(lock);
+  if (!is_move) {
+    node_load[node_id] = payload;
+    return;
+  }
+
+  int slice = payload & 0xFF;
+  int dst = payload >> 8;
+  auto epoch_nr = util::Instance<EpochManager>().current_epoch_nr() + kMoveDelay;
+  logger->info("[mig]Node {} moves slice {} to node {} at epoch {}", node_id, slice, dst, epoch_nr);
+  pending.push_back({slice, node_id, dst, epoch_nr});
+}
+
+void Repartitioner::FinishOutgoing(const Move &m)
+{
+  PerfLog perf;
+  outgoing_stop.store(true, std::memory_order_release);
+  while (!outgoing_done.load(std::memory_order_acquire))
+    go::Scheduler::Current()->RunNext(go::Scheduler::NextReadyState);
+
+  // No txn is running, so whatever is dirty now is all that is left.
+  SliceScanner::MigrationApproachingEnd();
+  while (!outgoing->RunSend());
+
+  util::Instance<SliceManager>().SetRowShipment(m.slice, nullptr);
+  delete outgoing;
+  outgoing = nullptr;
+  perf.End();
+  perf.Show(fmt::format("[mig]Final shipment of slice {} takes", m.slice));
+}
+
+void Repartitioner::OnEpochBegin(uint64_t epoch_nr)
+{
+  int me = util::Instance<NodeConfiguration>().node_id();
+  std::vector<Move> due;
+  {
+    std::lock_guard _(lock);
+    auto it = std::partition(pending.begin(), pending.end(),
+                             [epoch_nr](const Move &m) { return m.epoch_nr > epoch_nr; });
+    due.assign(it, pending.end());
+    pending.erase(it, pending.end());
+    if (due.empty())
+      return;
+    last_move_epoch = epoch_nr;
+  }
+
+  // Outgoing first, otherwise two nodes swapping slices wait for each other.
+  for (auto &m: due) {
+    if (m.src == me) FinishOutgoing(m);
+  }
+  for (auto &m: due) {
+    if (m.dst == me) nr_incoming_expected++;
+  }
+  while (nr_incoming_received.load() < nr_incoming_expected)
+    go::Scheduler::Current()->RunNext(go::Scheduler::NextReadyState);
+
+  for (auto &m: due) {
+    route[m.slice] = m.dst;
+    logger->info("[mig]Slice {} moved from node {} to node {} at epoch {}",
+                 m.slice, m.src, m.dst, epoch_nr);
+  }
+}
+
+}
@@ -0,0 +1,100 @@
+// -*- mode: c++ -*-
+
+#ifndef REPARTITION_H
+#define REPARTITION_H
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "gopp/gopp.h"
+#include "node_config.h"
+#include "slice.h"
+#include "util/objects.h"
+
+namespace felis {
+
+// Online repartitioning. Moves slices between nodes at epoch boundaries, based
+// on the load each node measured on its own slices.
+//
+// Every index op counts as one unit of load on the slice it touches, on the
+// node that owns the slice. At the end of an epoch, each node broadcasts its
+// total through the slice mapping table. One epoch later, every node has
+// everybody's total, and a node that is more than g_threshold percent above
+// the average gives its hottest slice that fits half of the gap to the least
+// loaded node.
+//
+// A move is broadcast with the mapping table too, and takes effect kMoveDelay
+// epochs after that, on all nodes at the same epoch boundary. In between, the
+// old owner ships the rows of the slice with the live migration shipment, and
+// the final dirty rows at the boundary, before anyone runs txns on the new
+// routing table.
+class Repartitioner {
+ public:
+  static bool g_enabled;
+  static int g_threshold;
+
+  static constexpr int kMoveDelay = 2;
+  // Loads are reported in these many index ops, so that they fit into an op.
+  static constexpr int kLoadShift = 4;
+ private:
+  template <typename T> friend T &util::Instance() noexcept;
+  Repartitioner();
+
+  struct Move {
+    int slice;
+    int src;
+    int dst;
+    uint64_t epoch_nr;
+  };
+
+  using SliceCounters = std::array<uint64_t, kNrMaxSlices>;
+  // Index ops on each slice in the current epoch.
+  SliceOpCounters counters{kNrMaxSlices};
+
+  // Routing table. 0 means the router's default.
+  std::array<int8_t, kNrMaxSlices> route;
+
+  // Protects everything below. Ops from the other nodes are replayed on the
+  // thread that reads the mapping table.
+  std::mutex lock;
+  // From the last complete epoch, in kLoadShift units.
+  SliceCounters slice_load;
+  std::array<uint64_t, kMaxNrNode + 1> node_load;
+  std::vector<Move> pending;
+  // Loads reported before this epoch don't know about the last move.
+  uint64_t last_move_epoch = 0;
+
+  RowShipment *outgoing = nullptr;
+  std::atomic_bool outgoing_stop = false;
+  std::atomic_bool outgoing_done = false;
+
+  int nr_incoming_expected = 0;
+  std::atomic_int nr_incoming_received = 0;
+
+  friend class SliceMoveRoutine;
+  void Decide(uint64_t epoch_nr);
+  void StartMove(int slice, int dst, uint64_t epoch_nr);
+  void FinishOutgoing(const Move &m);
+ public:
+  void Count(int slice_id) { counters.Count(slice_id); }
+
+  int Route(int slice_id, int default_node) const {
+    if (slice_id < 0 || slice_id >= kNrMaxSlices || route[slice_id] == 0)
+      return default_node;
+    return route[slice_id];
+  }
+
+  // Called by the EpochClient, when no txn is running.
+  void OnEpochBegin(uint64_t epoch_nr);
+  void OnEpochEnd(uint64_t epoch_nr);
+
+  void ReplayOp(int node_id, bool is_move, int payload);
+  // A RowShipmentReceiver has reached the end of its shipment.
+  void OnShipmentReceived() { nr_incoming_received.fetch_add(1); }
+};
+
+}
+
+#endif
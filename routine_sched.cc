@@ -1,4 +1,5 @@
 #include <sys/time.h>
+#include <bit>
 
 #include "epoch.h"
 #include "routine_sched.h"
@@ -47,6 +48,41 @@ PriorityQueueValue *ConservativePriorityScheduler::Pick()
   return q[0].ent->values.next->object();
 }
 
+size_t ConservativePriorityScheduler::StealFromTail(PieceRoutine **routines, size_t n,
+                                                   bool (*stealable)(PieceRoutine *))
+{
+  // The largest key is one of the leaves, q[len / 2] to q[len - 1]. We stop at
+  // the first entry that still has unstealable values.
+  size_t nr = 0;
+  while (len > 1 && nr < n) {
+    auto pos = len / 2;
+    for (auto i = pos + 1; i < len; i++) {
+      if (q[i].key > q[pos].key) pos = i;
+    }
+    auto ent = q[pos].ent;
+    auto &values = ent->values;
+    for (auto it = values.next; it != &values && nr < n;) {
+      auto next = it->next;
+      auto value = it->object();
+      if (value->state == nullptr && stealable(value->routine)) {
+        it->Remove();
+        routines[nr++] = value->routine;
+      }
+      it = next;
+    }
+    if (!values.empty()) break;
+    // Move the last element into the hole. It has no children there, so it
+    // only needs to go up.
+    q[pos] = q[len - 1];
+    q[len - 1].ent = nullptr;
+    len--;
+    if (pos < len)
+      std::push_heap(q, q + pos + 1, Greater);
+    ent->Remove(); // from the hashtable
+  }
+  return nr;
+}
+
 void ConservativePriorityScheduler::Consume(PriorityQueueValue *node)
 {
   node->Remove();
@@ -59,6 +95,90 @@ void ConservativePriorityScheduler::Consume(PriorityQueueValue *node)
   }
 }
 
+BucketPriorityScheduler *BucketPriorityScheduler::New(size_t maxlen, int numa_node)
+{
+  size_t nr_buckets = 1;
+  while (nr_buckets < EpochClient::g_txn_per_epoch + kExtraBuckets) nr_buckets <<= 1;
+
+  auto sz = BucketQueue<PriorityQueueHashEntry>::MemorySize(nr_buckets);
+  auto p = (uint8_t *) mem::AllocMemory(
+      mem::EpochQueueItem, sizeof(BucketPriorityScheduler) + sz, numa_node);
+  auto sched = new (p) BucketPriorityScheduler();
+  sched->bq.Initialize(p + sizeof(BucketPriorityScheduler), nr_buckets);
+  return sched;
+}
+
+void BucketPriorityScheduler::IngestPending(PriorityQueueHashEntry *hent, PriorityQueueValue *value)
+{
+  abort_if(true, "BucketPriorityScheduler only supports IngestDirect()");
+}
+
+bool BucketPriorityScheduler::IngestDirect(uint64_t key, PriorityQueueValue *value, mem::Brk &brk)
+{
+  auto ent = bq.Find(key);
+  if (ent == nullptr) {
+    ent = (PriorityQueueHashEntry *) brk.Alloc(64);
+    ent->Initialize();
+    ent->key = key;
+    ent->values.Initialize();
+    bq.Insert(ent);
+    len++;
+  }
+  value->InsertAfter(ent->values.prev);
+  return true;
+}
+
+bool BucketPriorityScheduler::ShouldPickWaiting(const WaitState &ws)
+{
+  if (len == 0)
+    return true;
+  return bq.Top()->key > ws.preempt_key;
+}
+
+PriorityQueueValue *BucketPriorityScheduler::Pick()
+{
+  return bq.Top()->values.next->object();
+}
+
+void BucketPriorityScheduler::Consume(PriorityQueueValue *node)
+{
+  node->Remove();
+  auto top = bq.Top();
+  if (top->values.empty()) {
+    bq.Remove(top);
+    len--;
+  }
+}
+
+size_t BucketPriorityScheduler::StealFromTail(PieceRoutine **routines, size_t n,
+                                              bool (*stealable)(PieceRoutine *))
+{
+  size_t nr = 0;
+  while (len > 1 && nr < n) {
+    auto ent = bq.Bottom();
+    auto &values = ent->values;
+    for (auto it = values.next; it != &values && nr < n;) {
+      auto next = it->next;
+      auto value = it->object();
+      if (value->state == nullptr && stealable(value->routine)) {
+        it->Remove();
+        routines[nr++] = value->routine;
+      }
+      it = next;
+    }
+    if (!values.empty()) break;
+    bq.Remove(ent);
+    len--;
+  }
+  return nr;
+}
+
+void BucketPriorityScheduler::Reset()
+{
+  abort_if(len > 0, "Reset() called, but len {} > 0", len);
+  bq.Reset();
+}
+
 class PWVScheduler final : public PrioritySchedulingPolicy {
   PWVScheduler(void *p, size_t lmt)
       : brk(p, lmt) {
@@ -292,6 +412,8 @@ void PWVScheduler::Reset()
 }
 
 size_t EpochExecutionDispatchService::g_max_item = 20_M;
+bool EpochExecutionDispatchService::g_work_stealing = true;
+bool EpochExecutionDispatchService::g_bucket_queue = false;
 const size_t EpochExecutionDispatchService::kHashTableSize = 100001;
 
 EpochExecutionDispatchService::EpochExecutionDispatchService()
@@ -314,13 +436,15 @@ EpochExecutionDispatchService::EpochExecutionDispatchService()
     queue = qmem + offset_in_node;
 
     queue->zq.end = queue->zq.start = 0;
-    queue->zq.q = (PieceRoutine **)
+    queue->zq.q = (std::atomic<PieceRoutine *> *)
                  mem::AllocMemory(
                      mem::EpochQueuePromise,
                      max_item_percore * sizeof(PieceRoutine *),
                      numa_node);
     if (EpochClient::g_enable_pwv) {
       queue->pq.sched_pol = PWVScheduler::New(max_item_percore, numa_node);
+    } else if (g_bucket_queue) {
+      queue->pq.sched_pol = BucketPriorityScheduler::New(max_item_percore, numa_node);
     } else {
       queue->pq.sched_pol = ConservativePriorityScheduler::New(max_item_percore, numa_node);
     }
@@ -329,13 +453,14 @@ EpochExecutionDispatchService::EpochExecutionDispatchService()
                       mem::EpochQueueItem,
                       kHashTableSize * sizeof(PriorityQueueHashHeader),
                       numa_node);
-    queue->pq.pending.q = (PieceRoutine **)
+    queue->pq.pending.q = (std::atomic<PieceRoutine *> *)
                          mem::AllocMemory(
                              mem::EpochQueuePromise,
                              max_item_percore * sizeof(PieceRoutine *),
                              numa_node);
     queue->pq.pending.start = 0;
     queue->pq.pending.end = 0;
+    queue->pq.pending.capacity = max_item_percore;
 
     queue->pq.waiting.unique_preempts = 0; 
     queue->pq.waiting.len = 0;
@@ -350,9 +475,9 @@ EpochExecutionDispatchService::EpochExecutionDispatchService()
         brk_sz);
 
     new (&queue->state) State();
-    new (&queue->lock) util::SpinLock();
   }
   tot_bubbles = 0;
+  idle_cores = 0;
 }
 
 void EpochExecutionDispatchService::Reset()
@@ -370,51 +495,67 @@ void EpochExecutionDispatchService::Reset()
     q->pq.sched_pol->Reset();
   }
   tot_bubbles = 0;
+  idle_cores = 0;
+
+  if (!g_work_stealing) return;
+
+  fmt::memory_buffer buf;
+  ulong tot_stolen = 0;
+  for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
+    auto &s = queues[i]->state.steal_stats;
+    auto nr_stolen = s.nr_stolen.load();
+    if (s.nr_donated > 0 || nr_stolen > 0)
+      fmt::format_to(buf, " {}:+{}/-{}({})/idle {}",
+                     i, nr_stolen, s.nr_donated, s.nr_donations, s.nr_idle);
+    tot_stolen += nr_stolen;
+    s.nr_idle = s.nr_donations = s.nr_donated = 0;
+    s.nr_stolen = 0;
+  }
+  if (tot_stolen > 0)
+    logger->info("Work stealing: {} pieces stolen.{}", tot_stolen,
+                 std::string_view(buf.data(), buf.size()));
 }
 
 
 void EpochExecutionDispatchService::Add(int core_id, PieceRoutine **routines,
                                         size_t nr_routines)
 {
-  auto &lock = queues[core_id]->lock;
-  lock.Lock();
-
   auto &zq = queues[core_id]->zq;
   auto &pq = queues[core_id]->pq.pending;
-  size_t i = 0;
-
   auto max_item_percore = g_max_item / NodeConfiguration::g_nr_threads;
 
-again:
-  size_t zdelta = 0,
-           zend = zq.end.load(std::memory_order_acquire),
-         zlimit = max_item_percore;
-
-  size_t pdelta = 0,
-           pend = pq.end.load(std::memory_order_acquire),
-         plimit = max_item_percore
-                  - (pend - pq.start.load(std::memory_order_acquire));
+  // Count first, so that we reserve each buffer with a single fetch_add.
+  size_t nr_zero = 0;
+  for (size_t i = 0; i < nr_routines; i++) {
+    if (routines[i]->sched_key == 0) nr_zero++;
+  }
+  unsigned int nr_pending = nr_routines - nr_zero;
+
+  size_t zpos = 0;
+  unsigned int ppos = 0;
+  if (nr_zero > 0) {
+    zpos = zq.end.fetch_add(nr_zero, std::memory_order_relaxed);
+    abort_if(zpos + nr_zero > max_item_percore,
+             "Preallocation of DispatchService is too small. {} < {}", zpos + nr_zero, max_item_percore);
+  }
+  if (nr_pending > 0) {
+    ppos = pq.end.fetch_add(nr_pending, std::memory_order_relaxed);
+    // The ring is full, wait for the consumer to catch up.
+    while (ppos + nr_pending - pq.start.load(std::memory_order_acquire) > max_item_percore)
+      _mm_pause();
+  }
 
-  for (; i < nr_routines; i++) {
+  for (size_t i = 0; i < nr_routines; i++) {
     auto r = routines[i];
-    auto key = r->sched_key;
-
-    if (key == 0) {
-      auto pos = zend + zdelta++;
-      abort_if(pos >= zlimit,
-               "Preallocation of DispatchService is too small. {} < {}", pos, zlimit);
-      zq.q[pos] = r;
-    } else {
-      if (pdelta >= plimit) goto again;
-      auto pos = pend + pdelta++;
-      pq.q[pos % max_item_percore] = r;
-    }
+    if (r->sched_key == 0)
+      zq.q[zpos++].store(r, std::memory_order_release);
+    else
+      pq.q[ppos++ % max_item_percore].store(r, std::memory_order_release);
   }
-  if (zdelta)
-    zq.end.fetch_add(zdelta, std::memory_order_release);
-  if (pdelta)
-    pq.end.fetch_add(pdelta, std::memory_order_release);
-  lock.Unlock();
+
+  // Whoever checks IsRunning() after us must not miss these routines. Pairs
+  // with the State::running store in Peek().
+  std::atomic_thread_fence(std::memory_order_seq_cst);
   // util::Impl<VHandleSyncService>().Notify(1 << core_id);
 }
 
@@ -430,6 +571,9 @@ EpochExecutionDispatchService::AddToPriorityQueue(
   node->state = state;
   auto key = rt->sched_key;
 
+  if (q.sched_pol->IngestDirect(key, node, q.brk))
+    return;
+
   auto &hl = q.ht[Hash(key) % kHashTableSize];
   auto *ent = hl.next;
   while (ent != &hl) {
@@ -453,16 +597,18 @@ void
 EpochExecutionDispatchService::ProcessPending(PriorityQueue &q)
 {
   // this works because there's only one consumer modifying start
-  size_t pstart = q.pending.start.load(std::memory_order_acquire);
-  long plen = q.pending.end.load(std::memory_order_acquire) - pstart;
-
-  for (size_t i = 0; i < plen; i++) {
-    auto pos = pstart + i;
-    AddToPriorityQueue(q, q.pending.q[pos % (g_max_item / NodeConfiguration::g_nr_threads)]);
-    // AddToPriorityQueue(q, q.pending.q[pos]);
+  unsigned int pstart = q.pending.start.load(std::memory_order_relaxed);
+  unsigned int pos = pstart;
+  PieceRoutine *r;
+
+  // Stop at the first slot that is not published yet.
+  while ((r = q.pending.q[pos % q.pending.capacity].load(std::memory_order_acquire)) != nullptr) {
+    q.pending.q[pos % q.pending.capacity].store(nullptr, std::memory_order_relaxed);
+    AddToPriorityQueue(q, r);
+    pos++;
   }
-  if (plen) {
-    q.pending.start.fetch_add(plen);
+  if (pos != pstart) {
+    q.pending.start.store(pos, std::memory_order_release);
   }
 }
 
@@ -471,9 +617,8 @@ EpochExecutionDispatchService::Peek(int core_id, DispatchPeekListener &should_po
 {
   auto &zq = queues[core_id]->zq;
   auto &q = queues[core_id]->pq;
-  auto &lock = queues[core_id]->lock;
   auto &state = queues[core_id]->state;
-  uint64_t zstart = 0;
+  PieceRoutine *zr = nullptr;
 
   state.running = State::kDeciding;
 
@@ -485,13 +630,12 @@ EpochExecutionDispatchService::Peek(int core_id, DispatchPeekListener &should_po
 retry:
   // first check if anything is worth running in the zero queue
   // if so run that directly
-  zstart = zq.start.load(std::memory_order_acquire);
-  if (zstart < zq.end.load(std::memory_order_acquire)) {
+  zr = zq.Front();
+  if (zr != nullptr) {
     state.running = State::kRunning;
-    auto r = zq.q[zstart];
-    if (should_pop(r, nullptr)) {
-      zq.start.store(zstart + 1, std::memory_order_relaxed);
-      state.current_sched_key = r->sched_key;
+    if (should_pop(zr, nullptr)) {
+      zq.Pop();
+      state.current_sched_key = zr->sched_key;
       return true;
     }
     return false;  // why not checking the rest?
@@ -500,8 +644,7 @@ retry:
   // Setting state.running without poking around the data structure is very
   // important for performance. This let other thread create the co-routines
   // without spinning for State::kDeciding for a long time.
-  if (q.sched_pol->empty() && q.waiting.len == 0
-      && q.pending.end.load() == q.pending.start.load()) {
+  if (q.sched_pol->empty() && q.waiting.len == 0 && q.pending.empty()) {
     state.running = State::kSleeping;
   } else {
     state.running = State::kRunning;
@@ -511,6 +654,11 @@ retry:
   if (q.sched_pol->ShouldRetryBeforePick(&zq.start, &zq.end, &q.pending.start, &q.pending.end))
     goto retry;
 
+  if (g_work_stealing && q.sched_pol->length() > kStealMinBacklog
+      && (idle_cores.load(std::memory_order_relaxed) & ~(1ULL << core_id)) != 0) {
+    TryDonate(core_id);
+  }
+
   //auto &ws = q.waiting.states[q.waiting.off];
   auto &ws = q.waiting.states[0]; // min-heap entry is always at the front
   if (q.waiting.len > 0
@@ -565,9 +713,46 @@ retry:
           core_id, n, nr_bubbles);
     comp->Complete(n + nr_bubbles);
   }
+
+  if (g_work_stealing && state.running == State::kSleeping) {
+    state.steal_stats.nr_idle++;
+    idle_cores.fetch_or(1ULL << core_id);
+  }
   return false;
 }
 
+void EpochExecutionDispatchService::TryDonate(int core_id)
+{
+  auto idle = idle_cores.load(std::memory_order_acquire) & ~(1ULL << core_id);
+  if (idle == 0) return;
+
+  // Start looking from the next core, so that donors don't all pick the same
+  // idle core.
+  auto rotated = std::rotr(idle, core_id + 1);
+  int thief = (core_id + 1 + __builtin_ctzll(rotated)) % 64;
+
+  auto bit = 1ULL << thief;
+  if ((idle_cores.fetch_and(~bit) & bit) == 0)
+    return; // Another core has claimed it.
+
+  PieceRoutine *routines[kMaxStealBatch];
+  auto n = queues[core_id]->pq.sched_pol->StealFromTail(routines, kMaxStealBatch, IsStealable);
+  if (n == 0) {
+    idle_cores.fetch_or(bit);
+    return;
+  }
+
+  auto &stats = queues[core_id]->state.steal_stats;
+  stats.nr_donations++;
+  stats.nr_donated += n;
+  queues[thief]->state.steal_stats.nr_stolen.fetch_add(n);
+
+  Add(thief, routines, n);
+  if (!IsRunning(thief)) {
+    go::GetSchedulerFromPool(thief + 1)->WakeUp(new BasePieceCollection::ExecutionRoutine());
+  }
+}
+
 void EpochExecutionDispatchService::AddBubble()
 {
   tot_bubbles.fetch_add(1);
@@ -577,7 +762,6 @@ bool EpochExecutionDispatchService::Preempt(int core_id, BasePieceCollection::Ex
 {
 //  return false; // FIXME: Disable preemption from now
 
-  auto &lock = queues[core_id]->lock;
   bool can_preempt = true;
   auto &zq = queues[core_id]->zq;
   auto &q = queues[core_id]->pq;
@@ -646,15 +830,13 @@ int EpochExecutionDispatchService::TraceDependency(uint64_t key)
     if (q.end.load() > max_item_percore) logger->error("pending queue wraps around");
     abort_if(q.end.load() < q.start.load(), "WTF? pending queue underflows");
     for (auto i = q.start.load(); i < q.end.load(); i++) {
-      if (q.q[i % max_item_percore]->sched_key == key) {
+      auto r = q.q[i % max_item_percore].load();
+      if (r == nullptr) {
+        logger->error("pending slot {} of {} reserved but not published\n", i, core_id);
+      } else if (r->sched_key == key) {
         logger->error("found {} in the pending area of {}\n", key, core_id);
       }
     }
-    for (auto i = 0; i < q.start.load(); i++) {
-      if (q.q[i % max_item_percore]->sched_key == key) {
-        logger->error("found {} in the consumed pending area of {}\n", key, core_id);
-      }
-    }
 
     auto &hl = queues[core_id]->pq.ht[Hash(key) % kHashTableSize];
     auto ent = hl.next;
@@ -5,6 +5,7 @@
 #include "util/objects.h"
 #include "util/linklist.h"
 #include "node_config.h"
+#include "bucket_queue.h"
 
 namespace felis {
 
@@ -51,6 +52,7 @@ class PrioritySchedulingPolicy {
   virtual ~PrioritySchedulingPolicy() {}
 
   bool empty() { return len == 0; }
+  size_t length() const { return len; }
 
   // Before we try to schedule from this scheduling policy, should we double
   // check the zero queue?
@@ -66,11 +68,22 @@ class PrioritySchedulingPolicy {
   virtual void Consume(PriorityQueueValue *value) = 0;
 
   virtual void IngestPending(PriorityQueueHashEntry *hent, PriorityQueueValue *value) = 0;
+  // Policies that index keys by themselves skip the dispatch service's
+  // hashtable. Returns false if the policy wants IngestPending() instead.
+  virtual bool IngestDirect(uint64_t key, PriorityQueueValue *value, mem::Brk &brk) { return false; }
+  // The smallest key. Only valid for key ordered policies when not empty.
+  virtual uint64_t TopKey() { return 0; }
+
+  // Remove up to n routines accepted by stealable() from the low priority
+  // end, so that an idle core can run them. Returns how many are removed.
+  virtual size_t StealFromTail(PieceRoutine **routines, size_t n,
+                               bool (*stealable)(PieceRoutine *)) { return 0; }
 
   virtual void Reset() {}
 };
 
 class CoroSched;
+class TaskSched;
 
 class ConservativePriorityScheduler final : public PrioritySchedulingPolicy {
   friend CoroSched;
@@ -96,6 +109,9 @@ class ConservativePriorityScheduler final : public PrioritySchedulingPolicy {
    */
   void Consume(PriorityQueueValue *value) override;
   void IngestPending(PriorityQueueHashEntry *hent, PriorityQueueValue *value) override;
+  size_t StealFromTail(PieceRoutine **routines, size_t n,
+                       bool (*stealable)(PieceRoutine *)) override;
+  uint64_t TopKey() override { return q[0].key; }
   void Reset() override {
     abort_if(len > 0, "Reset() called, but len {} > 0", len);
   }
@@ -106,9 +122,35 @@ private:
   PriorityQueueHeapEntry q[];  /*!< The actual priority queue */
 };
 
+// Bucket queue indexed by the in-epoch sequence number. See bucket_queue.h.
+class BucketPriorityScheduler final : public PrioritySchedulingPolicy {
+  friend CoroSched;
+  ~BucketPriorityScheduler() {}
+
+  // Leave some room for workloads that bump the sequence number, e.g. TPC-C
+  // StockLevel.
+  static constexpr size_t kExtraBuckets = 4096;
+
+  bool ShouldPickWaiting(const WaitState &ws) override;
+  PriorityQueueValue *Pick() override;
+  void Consume(PriorityQueueValue *value) override;
+  void IngestPending(PriorityQueueHashEntry *hent, PriorityQueueValue *value) override;
+  bool IngestDirect(uint64_t key, PriorityQueueValue *value, mem::Brk &brk) override;
+  size_t StealFromTail(PieceRoutine **routines, size_t n,
+                       bool (*stealable)(PieceRoutine *)) override;
+  uint64_t TopKey() override { return len > 0 ? bq.Top()->key : 0; }
+  void Reset() override;
+
+ public:
+  static BucketPriorityScheduler *New(size_t maxlen, int numa_node);
+ private:
+  BucketQueue<PriorityQueueHashEntry> bq;
+};
+
 // For scheduling transactions during execution
 class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
   friend CoroSched;
+  friend TaskSched;
   template <typename T> friend T &util::Instance() noexcept;
   EpochExecutionDispatchService();
 
@@ -118,24 +160,52 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
     ulong completed;
     CompleteCounter() : completed(0) {}
   };
+
+  struct StealStats {
+    ulong nr_idle = 0; /*!< times this core ran out of pieces */
+    ulong nr_donations = 0; /*!< times this core handed pieces to an idle core */
+    ulong nr_donated = 0; /*!< pieces handed to idle cores */
+    std::atomic_ulong nr_stolen = 0; /*!< pieces received from other cores */
+  };
  public:
   static unsigned int Hash(uint64_t key) { return key >> 8; }
   static constexpr int kOutOfOrderWindow = 25;
+
+  // Work stealing. Only cores with a backlog larger than kStealMinBacklog hand
+  // out at most kMaxStealBatch pieces at a time.
+  static constexpr size_t kStealMinBacklog = 64;
+  static constexpr size_t kMaxStealBatch = 32;
+  static bool g_work_stealing;
+  static bool g_bucket_queue;
   static constexpr int keyThreshold = 17000;
   static constexpr uint64_t max_backoff = 40;
 
   using PriorityQueueHashHeader = util::GenericListNode<PriorityQueueHashEntry>;
  private:
+  // The pending buffer and the zero queue are multi-producer single-consumer.
+  // Producers reserve a batch of slots with a single fetch_add on end, and
+  // publish each slot by storing a non-null pointer into it, so they never wait
+  // for each other or for the consumer. The consumer only moves past published
+  // slots, and clears them after use. Slots start zero-filled by mmap.
+
+  /** A wrapping buffer of PieceRoutine ptrs */
+  struct PendingBuffer {
+    std::atomic<PieceRoutine *> *q;
+    std::atomic_uint start;
+    std::atomic_uint end; /*!< Reserved by producers, may not be published yet. */
+    unsigned int capacity;
+
+    bool empty() const {
+      return q[start.load(std::memory_order_relaxed) % capacity].load(std::memory_order_acquire) == nullptr;
+    }
+  };
+
   // This is not a normal priority queue because lots of priorities are
   // duplicates! Therefore, we use a hashtable to deduplicate them.
   struct PriorityQueue {
     PrioritySchedulingPolicy *sched_pol;  /*!< This is where the actual priority queue locates */
     PriorityQueueHashHeader *ht; /*!< Hashtable. First item is a sentinel */
-    struct {
-      PieceRoutine **q;
-      std::atomic_uint start;
-      std::atomic_uint end;
-    } pending; /*!< Pending inserts into the heap and the hashtable */
+    PendingBuffer pending; /*!< Pending inserts into the heap and the hashtable */
 
     struct {
       // Min-heap
@@ -149,9 +219,21 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
 
   /** A none wrapping buffer of PieceRoutine ptrs */
   struct ZeroQueue {
-    PieceRoutine **q;
-    std::atomic_ulong end;
+    std::atomic<PieceRoutine *> *q;
+    std::atomic_ulong end; /*!< Reserved by producers, may not be published yet. */
     std::atomic_ulong start;
+
+    // The first published routine, or nullptr. Only the consumer calls these.
+    PieceRoutine *Front() const {
+      auto pos = start.load(std::memory_order_relaxed);
+      if (pos >= end.load(std::memory_order_acquire)) return nullptr;
+      return q[pos].load(std::memory_order_acquire);
+    }
+    void Pop() {
+      auto pos = start.load(std::memory_order_relaxed);
+      q[pos].store(nullptr, std::memory_order_relaxed);
+      start.store(pos + 1, std::memory_order_release);
+    }
   };
 
   struct State {
@@ -164,13 +246,14 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
     static constexpr int kDeciding = -1;
     std::atomic_int running;
 
+    StealStats steal_stats;
+
     State() : current_sched_key(0), ts(0), running(kSleeping) {}
   };
 
   struct Queue {
     PriorityQueue pq;
     ZeroQueue zq;
-    util::SpinLock lock;
     State state;
   };
  public:
@@ -182,6 +265,8 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
 
   std::array<Queue *, kMaxNrThreads> queues;
   std::atomic_ulong tot_bubbles;
+  std::atomic_ulong idle_cores; /*!< bitmap of cores that ran out of pieces */
+  static_assert(kMaxNrThreads <= 64);
 
  private:
   /**
@@ -197,6 +282,15 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
    * @param q
    */
   void ProcessPending(PriorityQueue &q);
+  /**
+   * If there is an idle core, move some stealable PieceRoutines from the tail
+   * of this core's priority queue to it.
+   * @param core_id
+   */
+  void TryDonate(int core_id);
+  static bool IsStealable(PieceRoutine *r) {
+    return r->affinity >= NodeConfiguration::g_nr_threads;
+  }
 
  public:
   /**
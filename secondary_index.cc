@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstring>
+
+#include "secondary_index.h"
+#include "epoch.h"
+#include "txn.h"
+#include "gopp/gopp.h"
+#include "log.h"
+
+namespace felis {
+
+static int PendingIndex()
+{
+  int idx = go::Scheduler::CurrentThreadPoolId() - 1;
+  if (idx < 0 || idx >= NodeConfiguration::kMaxNrThreads)
+    return NodeConfiguration::kMaxNrThreads;
+  return idx;
+}
+
+void SecondaryIndexManager::Add(int primary, const void *k, const void *v, uint64_t sid)
+{
+  if (sid != 0 && (EpochClient::g_enable_granola || EpochClient::g_enable_pwv)) {
+    for (auto &idx: indexes[primary]) {
+      Entry e{idx.table, 0, sid};
+      idx.derive(k, v, &e.key, &e.value, &e.slice_id);
+      Apply(e);
+    }
+    return;
+  }
+
+  auto &p = pending[PendingIndex()];
+  p.lock.Lock();
+  for (auto &idx: indexes[primary]) {
+    Entry e{idx.table, 0, sid};
+    idx.derive(k, v, &e.key, &e.value, &e.slice_id);
+    p.entries.push_back(e);
+  }
+  p.lock.Unlock();
+}
+
+void SecondaryIndexManager::Apply(const Entry &e)
+{
+  bool created = false;
+  auto row = util::Instance<TableManager>().GetTable(e.table)->SearchOrCreate(e.key->ToView(), &created);
+  if (created && NodeConfiguration::g_data_migration)
+    util::Instance<SliceManager>().OnNewRow(e.slice_id, e.table, e.key, row);
+  else
+    delete e.key;
+
+  if (e.sid == 0) {
+    // Loaded data, the first report wins.
+    if (created)
+      InitVersion(row, e.value);
+    else
+      delete e.value;
+    return;
+  }
+
+  auto epoch_nr = e.sid >> 32;
+  if (EpochClient::g_enable_granola || EpochClient::g_enable_pwv) {
+    // Same as the inserts of the txn itself.
+    BaseTxn::BaseTxnRow r(e.sid, epoch_nr, row);
+    r.AppendNewVersion();
+    r.WriteVarStr(e.value);
+  } else {
+    row->AppendNewVersion(e.sid, epoch_nr);
+    row->WriteWithVersion(e.sid, e.value, epoch_nr);
+  }
+}
+
+void SecondaryIndexManager::Flush()
+{
+  std::vector<Entry> entries;
+  for (auto &p: pending) {
+    p.lock.Lock();
+    entries.insert(entries.end(), p.entries.begin(), p.entries.end());
+    p.entries.clear();
+    p.lock.Unlock();
+  }
+  if (entries.empty()) return;
+
+  PerfLog perf;
+  // Same order as the tree, so that consecutive inserts share the path. The
+  // versions of a key are appended in order.
+  std::sort(
+      entries.begin(), entries.end(),
+      [](const Entry &a, const Entry &b) {
+        if (a.table != b.table) return a.table < b.table;
+        auto c = memcmp(a.key->data(), b.key->data(), std::min(a.key->length(), b.key->length()));
+        if (c != 0) return c < 0;
+        if (a.key->length() != b.key->length()) return a.key->length() < b.key->length();
+        return a.sid < b.sid;
+      });
+
+  for (auto &e: entries) Apply(e);
+  perf.End();
+  perf.Show(fmt::format("Applying {} secondary index entries takes", entries.size()));
+}
+
+}
@@ -0,0 +1,113 @@
+// -*- mode: c++ -*-
+
+#ifndef SECONDARY_INDEX_H
+#define SECONDARY_INDEX_H
+
+#include <array>
+#include <vector>
+
+#include "index_common.h"
+#include "node_config.h"
+#include "slice.h"
+#include "util/arch.h"
+#include "util/locks.h"
+#include "util/objects.h"
+
+namespace felis {
+
+// Secondary indexes, declared on their table specs. Besides kTable, kIndexArgs,
+// IndexBackend, Key and Value, an index spec has
+//
+//   using Primary = ...; // the table spec it indexes
+//   static Key IndexKey(const Primary::Key &, const Primary::Value &);
+//   static Value IndexValue(const Primary::Key &, const Primary::Value &);
+//
+// Inserts into the primary table are reported with OnInsert(), by the loaders
+// and by the txns in PrepareInsert(). The index entries are buffered on each
+// core. Flush() applies them in key order, so that the index inserts walk the
+// tree in order instead of jumping around. The loaders' entries become version
+// 0 of the index rows. The EpochClient flushes the txns' entries once the
+// Insert phase is done, before any Prepare() scans, and each entry becomes a
+// version of its index row at the sid of the txn that inserted it. So a txn
+// sees the entries of the earlier txns in the same epoch, and ShouldScanSkip()
+// hides the later ones. Under Granola and PWV, the txns run all their phases
+// at once, so their entries are applied right away.
+//
+// The entries are kept on the node that reports them, so an index has to be
+// sharded like its primary table. Entries are only ever added, so the indexed
+// columns should never change.
+class SecondaryIndexManager {
+  template <typename T> friend T &util::Instance() noexcept;
+  SecondaryIndexManager() {}
+
+  // Typed Primary::Key and Primary::Value in, encoded index key and value, and
+  // the slice of the index key out.
+  using DeriveFunc = void (*)(const void *, const void *, VarStr **, VarStr **, int16_t *);
+  struct Index {
+    int table;
+    DeriveFunc derive;
+  };
+  // Indexes of each primary table.
+  std::array<std::vector<Index>, TableManager::kMaxNrRelations> indexes;
+
+  struct Entry {
+    int table;
+    int16_t slice_id;
+    uint64_t sid; // 0 for the loaded data.
+    VarStr *key;
+    VarStr *value;
+  };
+  struct PendingEntries {
+    util::SpinLock lock;
+    std::vector<Entry> entries;
+  };
+  std::array<util::CacheAligned<PendingEntries>, NodeConfiguration::kMaxNrThreads + 1> pending;
+
+  template <typename IndexSpec>
+  static void Derive(const void *pk, const void *pv, VarStr **key, VarStr **value,
+                     int16_t *slice_id) {
+    using Primary = typename IndexSpec::Primary;
+    auto &k = *(const typename Primary::Key *) pk;
+    auto &v = *(const typename Primary::Value *) pv;
+    auto index_key = IndexSpec::IndexKey(k, v);
+    *slice_id = util::Instance<SliceLocator<IndexSpec>>().Locate(index_key);
+    *key = index_key.Encode();
+    *value = IndexSpec::IndexValue(k, v).Encode();
+  }
+
+  void Add(int primary, const void *k, const void *v, uint64_t sid);
+  static void Apply(const Entry &e);
+ public:
+  // Creates the index tables, and starts maintaining them.
+  template <typename IndexSpec, typename ...IndexSpecs>
+  void Create() {
+    util::Instance<TableManager>().Create<IndexSpec>();
+    indexes[static_cast<int>(IndexSpec::Primary::kTable)].push_back(
+        {static_cast<int>(IndexSpec::kTable), Derive<IndexSpec>});
+
+    if constexpr(sizeof...(IndexSpecs) > 0) Create<IndexSpecs...>();
+  }
+
+  bool HasIndex(int primary) const { return !indexes[primary].empty(); }
+
+  // A loader inserted a row with this key and value into TableSpec.
+  template <typename TableSpec>
+  void OnInsert(const typename TableSpec::Key &k, const typename TableSpec::Value &v) {
+    OnInsert<TableSpec>(0, k, v);
+  }
+
+  // Txn sid inserted a row with this key and value into TableSpec.
+  template <typename TableSpec>
+  void OnInsert(uint64_t sid, const typename TableSpec::Key &k, const typename TableSpec::Value &v) {
+    int primary = static_cast<int>(TableSpec::kTable);
+    if (HasIndex(primary)) Add(primary, &k, &v, sid);
+  }
+
+  // Applies what all cores have buffered. Called once the loaders are done,
+  // and by the EpochClient after each Insert phase.
+  void Flush();
+};
+
+}
+
+#endif
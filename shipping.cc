@@ -8,6 +8,7 @@
 #include "slice.h"
 #include "masstree_index_impl.h"
 #include "epoch.h"
+#include "repartition.h"
 
 namespace felis {
 
@@ -217,23 +218,6 @@ void BaseShipment::SendIOVec(struct iovec *vec, int nr_vec)
   }
 }
 
-void BaseShipment::ReceiveACK()
-{
-  uint64_t done = 0;
-  ssize_t res = 0;
-  int disabled = 0;
-
-  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &disabled, 4);
-
-  res = send(fd, &done, 8, 0);
-  if (res != 8) goto error;
-
-  res = recv(fd, &done, 1, MSG_WAITALL);
-error:
-  abort_if(res == 0, "EOF from the receiver side?");
-  abort_if(res < 0, "Error receiving ack from the reciver side... errno={}", errno);
-}
-
 void RowShipmentReceiver::Run()
 {
 // clear the affinity
@@ -317,9 +301,13 @@ void RowShipmentReceiver::Run()
                 InitVersion(handle, v);
               }
 
-              RowEntity *entity = new felis::RowEntity(rel_id, k, handle, slice_id);
-
-              // TODO: add row to its slice
+              if (Repartitioner::g_enabled) {
+                // Add the row to its slice, so that it can move on again.
+                util::Instance<SliceManager>().OnShippedRow(slice_id, rel_id, k, handle);
+              } else {
+                RowEntity *entity = new felis::RowEntity(rel_id, k, handle, slice_id);
+                // TODO: add row to its slice
+              }
 
             }
             uint8_t done = 0;
@@ -342,9 +330,13 @@ void RowShipmentReceiver::Run()
 
   perf.End();
   perf.Show("[mig]RowShipment processing takes");
-  logger->info("[mig]processed {} RowEntities, speed {} row/s", count, count * 1000 / perf.duration_ms());
+  logger->info("[mig]processed {} RowEntities, speed {} row/s {:.1f} MB/s", count,
+               count * 1000 / perf.duration_ms(),
+               nr_bytes / 1024.0 / 1024.0 * 1000 / perf.duration_ms());
   sock->Close();
 
+  if (Repartitioner::g_enabled)
+    util::Instance<Repartitioner>().OnShipmentReceived();
 }
 
 void RowScannerRoutine::Run()
@@ -386,6 +378,11 @@ void RowScannerRoutine::Run()
   }
   perf_ship.End();
   perf_ship.Show("[mig]Shipping row takes");
+  if (perf_ship.duration_ms() > 0) {
+    logger->info("[mig]Shipping speed {} row/s {:.1f} MB/s",
+                 g_objects_shipped * 1000 / perf_ship.duration_ms(),
+                 g_bytes_sent / 1024.0 / 1024.0 * 1000 / perf_ship.duration_ms());
+  }
 
   slicer.ScanShippingHandle();
 }
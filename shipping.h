@@ -2,8 +2,7 @@
 #define SHIPPING_H_
 
 #include <atomic>
-#include <mutex>
-#include <list>
+#include <vector>
 #include <climits>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -92,19 +91,20 @@ class SliceScanner {
 // Class for sending IOVec.
 class BaseShipment {
  public:
-  static constexpr int kSendBatch = 32 * IOV_MAX;
+  /**
+   * Rows are copied into a buffer of this size and written with one system
+   * call. Also the input buffer size on the receiver.
+   */
+  static constexpr size_t kSendBufferSize = 4 << 20;
  protected:
   sockaddr_in addr;
   int fd;
   bool connected;
   bool finished;
-  std::mutex lock;
 
   void SendIOVec(struct iovec *vec, int nr_vec);
-  void ReceiveACK();
 
   bool has_finished() const { return finished; }
-  std::mutex &mutex() { return lock; }
  public:
   BaseShipment(int fd) : fd(fd), connected(true), finished(false) {}
   BaseShipment(std::string host, unsigned int port, bool defer_connect = false);
@@ -128,65 +128,127 @@ static std::atomic_ullong g_bytes_sent = 0;
  *
  * Shipment is a queue of Entity, waiting to be sent.
  * Calling it "Shipment Queue" would be easier to understand.
+ *
+ * Each thread adds to a queue of its own, so cores marking rows dirty do not
+ * contend with each other. RunSend() takes a whole queue at a time, copies the
+ * rows into one contiguous buffer, and writes it out. There is no round trip
+ * with the receiver, the TCP window is the only flow control.
  */
 template <typename T>
 class Shipment : public BaseShipment {
- protected:
-  std::list<T *> queue;
+  static constexpr int kMaxNrQueues = NodeConfiguration::kMaxNrThreads + 3;
+  static constexpr int kMaxIOVecPerObject = 8;
+
+  struct Queue {
+    util::SpinLock lock;
+    std::vector<T *> objs;
+  };
+  util::CacheAligned<Queue> queues[kMaxNrQueues];
+
+  // Taken from the queues, but not sent yet. Only used by RunSend().
+  std::vector<T *> sending;
+  size_t sending_pos = 0;
+  uint8_t *buffer = nullptr;
+  size_t buffer_len = 0;
+
+  static int QueueIndex() {
+    // Threads outside of the pool share the last queue.
+    int tid = go::Scheduler::CurrentThreadPoolId();
+    return (tid < 0 || tid >= kMaxNrQueues - 1) ? kMaxNrQueues - 1 : tid;
+  }
+
+  void TakeQueues() {
+    for (auto &q: queues) {
+      q.lock.Lock();
+      sending.insert(sending.end(), q.objs.begin(), q.objs.end());
+      q.objs.clear();
+      q.lock.Unlock();
+    }
+  }
+
+  void FlushBuffer() {
+    struct iovec vec = {buffer, buffer_len};
+    SendIOVec(&vec, 1);
+    g_bytes_sent.fetch_add(buffer_len);
+    buffer_len = 0;
+  }
+
+  // EncodeIOVec() marks the object as sent, so once encoded, it has to go out.
+  // Returns whether we wrote to the socket.
+  bool Append(T *obj) {
+    struct iovec vec[kMaxIOVecPerObject + 1];
+    int n = obj->EncodeIOVec(&vec[1], kMaxIOVecPerObject);
+    abort_if(n == 0, "Cannot encode object into {} iovecs", kMaxIOVecPerObject);
+    vec[0].iov_base = &obj->encoded_len;
+    vec[0].iov_len = 8;
+
+    bool flushed = false;
+    auto len = 8 + obj->encoded_len;
+    if (buffer_len > 0 && buffer_len + len > kSendBufferSize) {
+      FlushBuffer();
+      flushed = true;
+    }
+    if (len > kSendBufferSize) {
+      SendIOVec(vec, n + 1);
+      g_bytes_sent.fetch_add(len);
+      return true;
+    }
+    for (int i = 0; i <= n; i++) {
+      memcpy(buffer + buffer_len, vec[i].iov_base, vec[i].iov_len);
+      buffer_len += vec[i].iov_len;
+    }
+    return flushed;
+  }
  public:
   using BaseShipment::BaseShipment;
+  ~Shipment() { free(buffer); }
 
   void AddObject(T *object) {
-    std::lock_guard _(lock);
-    queue.push_front(object);
+    auto &q = queues[QueueIndex()];
+    q.lock.Lock();
+    q.objs.push_back(object);
+    q.lock.Unlock();
   }
 
-  bool RunSend() {
-    T *obj[kSendBatch];
-    int nr_obj = 0;
-    struct iovec vec[IOV_MAX];
-    {
-      std::lock_guard _(lock);
-      while (nr_obj < kSendBatch && !queue.empty()) {
-        obj[nr_obj++] = queue.back();
-        queue.pop_back();
-      }
-      if (nr_obj == 0) {
-        finished = true;
-        close(fd);
-        SliceScanner::MigrationEnd();
+  /**
+   * Send up to one buffer of objects.
+   * @return true if there was nothing left to send. Unless close_when_done is false,
+   * the shipment is then closed.
+   */
+  bool RunSend(bool close_when_done = true) {
+    if (sending_pos == sending.size()) {
+      sending.clear();
+      sending_pos = 0;
+      TakeQueues();
+    }
+    if (sending.empty()) {
+      if (buffer_len > 0)
+        FlushBuffer();
+      if (!close_when_done)
         return true;
-      }
+      finished = true;
+      close(fd);
+      SliceScanner::MigrationEnd();
+      return true;
     }
 
-    int i = 0;
-    int cur_iov = 0;
-    int enabled = 1;
-    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &enabled, 4);
+    if (buffer == nullptr)
+      buffer = (uint8_t *) malloc(kSendBufferSize);
 
-    while (i < nr_obj) {
-      if (obj[i]->ShouldSkip()) {
+    // Stop once a buffer has been written out, the rest waits for the next
+    // call so that the caller can check for convergence.
+    bool flushed = false;
+    while (sending_pos < sending.size() && !flushed) {
+      auto obj = sending[sending_pos++];
+      if (obj->ShouldSkip()) {
         g_objects_skipped.fetch_add(1);
-        i++;
-        continue;
-      }
-      int n = 0;
-      if (cur_iov == IOV_MAX
-          || (n = obj[i]->EncodeIOVec(&vec[cur_iov + 1], IOV_MAX - cur_iov - 1)) == 0) {
-        SendIOVec(vec, cur_iov);
-        cur_iov = 0;
         continue;
       }
-      vec[cur_iov].iov_len = 8;
-      vec[cur_iov].iov_base = &obj[i]->encoded_len;
-
-      cur_iov += n + 1;
-      g_bytes_sent.fetch_add(obj[i]->encoded_len);
+      flushed = Append(obj);
       g_objects_shipped.fetch_add(1);
-      i++;
     }
-    SendIOVec(vec, cur_iov);
-    ReceiveACK();
+    if (!flushed && buffer_len > 0)
+      FlushBuffer();
     return false;
   }
 };
@@ -204,39 +266,33 @@ template <typename T>
 class ShipmentReceiver : public go::Routine {
  protected:
   go::TcpSocket *sock;
+  // Reused for every object, instead of a malloc() each.
+  std::vector<uint8_t> buffer;
+  uint64_t nr_bytes = 0;
  public:
   ShipmentReceiver(go::TcpSocket *sock) : sock(sock) {}
 
   bool Receive(T *shipment) {
     auto *in = sock->input_channel();
-    auto *out = sock->output_channel();
 
- again:
     uint64_t psz;
     if (!in->Read(&psz, 8)) {
       return false;
     }
 
-    if (psz == 0) {
-      uint8_t done = 0;
-      out->Write(&done, 1);
-      out->Flush();
-
-      goto again;
-    }
-    auto buffer = (uint8_t *) malloc(psz);
-    if (!in->Read(buffer, psz)) {
+    if (buffer.size() < psz)
+      buffer.resize(psz);
+    if (!in->Read(buffer.data(), psz)) {
       logger->critical("Unexpected EOF while reading {} bytes", psz);
       std::abort();
     }
+    nr_bytes += 8 + psz;
 
     struct iovec vec = {
-      .iov_base = buffer,
+      .iov_base = buffer.data(),
       .iov_len = psz,
     };
     shipment->DecodeIOVec(&vec);
-
-    free(buffer);
     return true;
   }
 };
@@ -262,6 +318,10 @@ class ObjectSliceScanner : public SliceScanner {
       : SliceScanner(slice), ship(shipment) {}
 
   Shipment<T> *shipment() { return ship; }
+  void set_shipment(Shipment<T> *shipment) {
+    ship = shipment;
+    ResetCursor();
+  }
 
   void AddObject(T *object) {
     if (ship) {
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm_ring.h"
+
+namespace felis {
+
+ShmRing::~ShmRing()
+{
+  if (hdr) munmap(hdr, map_len);
+}
+
+bool ShmRing::Map(int fd, size_t len)
+{
+  void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  if (p == MAP_FAILED) return false;
+  hdr = (Header *) p;
+  data = (uint8_t *) p + sizeof(Header);
+  map_len = len;
+  return true;
+}
+
+ShmRing *ShmRing::Create(std::string name, size_t capacity)
+{
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    errno = EINVAL;
+    return nullptr;
+  }
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    // From a previous run that did not exit cleanly.
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  }
+  if (fd < 0) return nullptr;
+
+  size_t len = sizeof(Header) + capacity;
+  auto ring = new ShmRing();
+  if (ftruncate(fd, len) < 0 || !ring->Map(fd, len)) {
+    int err = errno;
+    close(fd);
+    shm_unlink(name.c_str());
+    delete ring;
+    errno = err;
+    return nullptr;
+  }
+  close(fd);
+
+  ring->capacity = capacity;
+  ring->hdr->capacity = capacity;
+  ring->hdr->head.store(0, std::memory_order_relaxed);
+  ring->hdr->tail.store(0, std::memory_order_relaxed);
+  // The receiver checks the magic last.
+  __atomic_store_n(&ring->hdr->magic, kMagic, __ATOMIC_RELEASE);
+  return ring;
+}
+
+ShmRing *ShmRing::Open(std::string name)
+{
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return nullptr;
+  }
+  if ((size_t) st.st_size <= sizeof(Header)) {
+    close(fd);
+    errno = EINVAL;
+    return nullptr;
+  }
+
+  auto ring = new ShmRing();
+  if (!ring->Map(fd, st.st_size)) {
+    int err = errno;
+    close(fd);
+    delete ring;
+    errno = err;
+    return nullptr;
+  }
+  close(fd);
+
+  if (__atomic_load_n(&ring->hdr->magic, __ATOMIC_ACQUIRE) != kMagic
+      || ring->hdr->capacity + sizeof(Header) != (size_t) st.st_size) {
+    delete ring;
+    errno = EINVAL;
+    return nullptr;
+  }
+  ring->capacity = ring->hdr->capacity;
+  shm_unlink(name.c_str());
+  return ring;
+}
+
+size_t ShmRing::Write(const void *src, size_t cnt)
+{
+  auto tail = hdr->tail.load(std::memory_order_relaxed);
+  auto head = hdr->head.load(std::memory_order_acquire);
+  cnt = std::min(cnt, capacity - (tail - head));
+
+  size_t off = tail & (capacity - 1);
+  size_t first = std::min(cnt, capacity - off);
+  memcpy(data + off, src, first);
+  memcpy(data, (const uint8_t *) src + first, cnt - first);
+
+  hdr->tail.store(tail + cnt, std::memory_order_release);
+  return cnt;
+}
+
+size_t ShmRing::Peek(void *dst, size_t cnt) const
+{
+  auto head = hdr->head.load(std::memory_order_relaxed);
+  auto tail = hdr->tail.load(std::memory_order_acquire);
+  cnt = std::min(cnt, tail - head);
+
+  size_t off = head & (capacity - 1);
+  size_t first = std::min(cnt, capacity - off);
+  memcpy(dst, data + off, first);
+  memcpy((uint8_t *) dst + first, data, cnt - first);
+  return cnt;
+}
+
+void ShmRing::Skip(size_t cnt)
+{
+  auto head = hdr->head.load(std::memory_order_relaxed);
+  assert(cnt <= hdr->tail.load(std::memory_order_acquire) - head);
+  hdr->head.store(head + cnt, std::memory_order_release);
+}
+
+}
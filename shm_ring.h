@@ -0,0 +1,63 @@
+// -*- mode: c++ -*-
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace felis {
+
+// Single producer, single consumer byte ring in a POSIX shared memory segment,
+// so that nodes on the same host do not go through the kernel network stack.
+//
+// The sender creates the segment, and the receiver opens it by name. Once
+// both sides have it mapped, the receiver unlinks the name. Neither side
+// blocks: Write() and Peek() return what they could do, and callers poll.
+class ShmRing {
+  static constexpr uint64_t kMagic = 0x464C5348524E4731;  // "FLSHRNG1"
+
+  struct Header {
+    uint64_t magic;
+    uint64_t capacity;
+    alignas(64) std::atomic_uint64_t head;  /*!< consumed up to, written by the receiver */
+    alignas(64) std::atomic_uint64_t tail;  /*!< produced up to, written by the sender */
+  };
+
+  Header *hdr = nullptr;
+  uint8_t *data = nullptr;
+  size_t capacity = 0;
+  size_t map_len = 0;
+
+  ShmRing() {}
+  bool Map(int fd, size_t len);
+
+ public:
+  ShmRing(const ShmRing &rhs) = delete;
+  ~ShmRing();
+
+  /**
+   * Create a segment with capacity bytes, which must be a power of 2. A
+   * segment left over with the same name is replaced. Returns nullptr and
+   * sets errno on failure.
+   */
+  static ShmRing *Create(std::string name, size_t capacity);
+  /** Open and unlink a segment that Create() made. nullptr on failure. */
+  static ShmRing *Open(std::string name);
+
+  /** Producer. Copies as much as there is room for, returns the bytes copied. */
+  size_t Write(const void *src, size_t cnt);
+
+  /** Consumer. Copies up to cnt bytes without consuming them. */
+  size_t Peek(void *dst, size_t cnt) const;
+  /** Consumer. Consume cnt bytes, which must be available. */
+  void Skip(size_t cnt);
+
+  size_t ring_capacity() const { return capacity; }
+};
+
+}
+
+#endif
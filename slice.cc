@@ -1,4 +1,5 @@
 #include "slice.h"
+#include "repartition.h"
 
 namespace felis {
 
@@ -59,6 +60,32 @@ void SliceManager::ScanShippingHandle() {
   }
 }
 
+SliceOpCounters::SliceOpCounters(size_t nr_slices)
+    : nr_slices(nr_slices)
+{
+  auto len = util::Align(nr_slices * sizeof(uint64_t), CACHE_LINE_SIZE);
+  for (auto &c: counters) {
+    c = (uint64_t *) aligned_alloc(CACHE_LINE_SIZE, len);
+    memset(c, 0, len);
+  }
+}
+
+SliceOpCounters::~SliceOpCounters()
+{
+  for (auto c: counters) free(c);
+}
+
+void SliceOpCounters::Collect(uint64_t *sums)
+{
+  std::fill(sums, sums + nr_slices, 0);
+  for (auto c: counters) {
+    for (size_t s = 0; s < nr_slices; s++) {
+      sums[s] += c[s];
+      c[s] = 0;
+    }
+  }
+}
+
 SliceMappingTable::SliceMappingTable() {
   std::fill_n(node_compress, kMaxNrNode, -1);
 }
@@ -84,26 +111,34 @@ void SliceMappingTable::SetEntry(int slice_id, bool owned, SliceOwnerType type,
 
   slice_owners[node_compress[node_id]].owned[type][slice_id] = owned;
 
-  if (broadcast) {
-    int op = 0;
-    assert(0 <= node_id && node_id < (1 << 6));
-    assert(0 <= slice_id && slice_id < (1 << 23));
-    op |= node_id;
-    op <<= 2;
-    op |= type;
-    op <<= 1;
-    op |= owned;
-    op <<= 23;
-    op |= slice_id;
-    broadcast_buffer.push_back(op);
-  }
+  if (broadcast)
+    broadcast_buffer.push_back(EncodeOp(node_id, type, owned, slice_id));
+}
+
+int SliceMappingTable::EncodeOp(int node_id, int type, bool owned, int payload)
+{
+  int op = 0;
+  assert(0 <= node_id && node_id < (1 << 6));
+  assert(0 <= payload && payload < (1 << 23));
+  op |= node_id;
+  op <<= 2;
+  op |= type;
+  op <<= 1;
+  op |= owned;
+  op <<= 23;
+  op |= payload;
+  return op;
 }
 
 void SliceMappingTable::ReplayUpdate(int op) {
   int slice_id = op & ((1 << 23) - 1);
   bool owned = (op >> 23) & 1;
-  SliceOwnerType type = static_cast<SliceOwnerType>((op >> 24) & 3);
   int node_id = (op >> 26);
+  if (((op >> 24) & 3) == kRepartitionOp) {
+    util::Instance<Repartitioner>().ReplayOp(node_id, owned, slice_id);
+    return;
+  }
+  SliceOwnerType type = static_cast<SliceOwnerType>((op >> 24) & 3);
   logger->info("Replaying [ node_id={}, owned={}, type={}, slice={} ]", node_id, owned, type, slice_id);
   SetEntry(slice_id, owned, type, node_id, false);  // Apply with no circular broadcast
 }
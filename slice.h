@@ -89,6 +89,15 @@ class SliceManager {
     OnNewRow(slice_id, new felis::RowEntity(table, kstr, handle, slice_id));
   }
 
+  // A row from a RowShipment. If it used to live here, it still has its entity.
+  void OnShippedRow(int slice_id, int table, VarStr *kstr, VHandle *handle) {
+    if (handle->row_entity) {
+      delete kstr;
+      return;
+    }
+    OnNewRow(slice_id, table, kstr, handle);
+  }
+
   void OnUpdateRow(VHandle *handle) {
     if (!NodeConfiguration::g_data_migration) return;
 
@@ -100,6 +109,17 @@ class SliceManager {
 
   // only the slices which (shipment != nullptr) will be scanned
   void ScanAllRow() { ScanAll(row_slice_scanners); }
+
+  // Start shipping one slice, or stop with nullptr. No txn may be running.
+  void SetRowShipment(int i, RowShipment *shipment) {
+    row_slice_scanners[i]->set_shipment(shipment);
+  }
+  // A scanning session of its own for one slice.
+  void ScanRow(int i) {
+    SliceScanner::ScannerBegin();
+    row_slice_scanners[i]->Scan();
+    SliceScanner::ScannerEnd();
+  }
   void ScanShippingHandle();
 
  private:
@@ -137,6 +157,29 @@ class SliceManager {
   }
 };
 
+// Index ops on each slice, counted on each core without sharing cache lines,
+// and summed up at the end of an epoch.
+class SliceOpCounters {
+  size_t nr_slices;
+  // One row for each core and one for the threads outside of the pool.
+  std::array<uint64_t *, NodeConfiguration::kMaxNrThreads + 1> counters;
+ public:
+  SliceOpCounters(size_t nr_slices);
+  SliceOpCounters(const SliceOpCounters &rhs) = delete;
+  ~SliceOpCounters();
+
+  void Count(int slice_id) {
+    if (slice_id < 0 || slice_id >= nr_slices) return;
+    int tid = go::Scheduler::CurrentThreadPoolId() - 1;
+    if (tid < 0 || tid >= NodeConfiguration::kMaxNrThreads)
+      tid = NodeConfiguration::kMaxNrThreads;
+    counters[tid][slice_id]++;
+  }
+
+  // Sum up into sums[nr_slices] and start over. No txn may be running.
+  void Collect(uint64_t *sums);
+};
+
 enum SliceOwnerType {
   PrimaryOwner, IndexOwner, DataOwner, NumOwnerTypes
 };
@@ -151,6 +194,7 @@ class SliceMappingTable {
   int nr_nodes;
   std::atomic<int> next_node;
 
+  static int EncodeOp(int node_id, int type, bool owned, int payload);
  protected:
   void SetEntry(int slice_id, bool owned, SliceOwnerType type = IndexOwner,
                 int node = -1, bool broadcast = true);
@@ -158,12 +202,19 @@ class SliceMappingTable {
   // TODO: does this need to be locked?
   std::vector<int> broadcast_buffer;
 
+  // Ops of this type carry a Repartitioner message instead of a slice entry.
+  static constexpr int kRepartitionOp = NumOwnerTypes;
+
   SliceMappingTable();
   void InitNode(int node_id);
   int LocateNodeLookup(int slice_id, SliceOwnerType = IndexOwner);
   std::vector<int> LocateNodeInsert(int slice_id, SliceOwnerType type = IndexOwner);
 
   void ReplayUpdate(int op);
+  void AddRepartitionOp(bool is_move, int payload) {
+    broadcast_buffer.push_back(
+        EncodeOp(util::Instance<NodeConfiguration>().node_id(), kRepartitionOp, is_move, payload));
+  }
   void AddEntry(int slice_id, SliceOwnerType type = IndexOwner, int node = -1,
                 bool broadcast = true) {
     SetEntry(slice_id, true, type, node, broadcast);
@@ -0,0 +1,80 @@
+#include <algorithm>
+
+#include "slice_balancer.h"
+#include "log.h"
+
+namespace felis {
+
+bool SliceCoreBalancer::g_enabled = false;
+int SliceCoreBalancer::g_threshold = 20;
+
+void SliceCoreBalancer::Initialize(size_t nr_slices, int (*default_core)(int16_t))
+{
+  this->nr_slices = nr_slices;
+  ops = new SliceOpCounters(nr_slices);
+  slice_core.resize(nr_slices);
+  slice_load.resize(nr_slices, 0);
+  for (size_t s = 0; s < nr_slices; s++)
+    slice_core[s] = default_core(s);
+}
+
+void SliceCoreBalancer::OnEpochEnd(uint64_t epoch_nr)
+{
+  auto nr_threads = NodeConfiguration::g_nr_threads;
+  std::vector<uint64_t> slice_ops(nr_slices);
+  ops->Collect(slice_ops.data());
+
+  std::vector<uint64_t> core_ops(nr_threads, 0);
+  for (size_t s = 0; s < nr_slices; s++)
+    core_ops[slice_core[s]] += slice_ops[s];
+
+  std::vector<uint64_t> core_load(nr_threads, 0);
+  for (size_t s = 0; s < nr_slices; s++) {
+    auto c = slice_core[s];
+    uint64_t cur = 0;
+    if (core_ops[c] > 0)
+      cur = (double) core_time[c].cycles * slice_ops[s] / core_ops[c];
+    slice_load[s] = (slice_load[s] * (kDecay - 1) + cur) / kDecay;
+    core_load[c] += slice_load[s];
+  }
+  for (int c = 0; c < nr_threads; c++)
+    core_time[c].cycles = 0;
+
+  uint64_t avg = 0;
+  for (auto l: core_load) avg += l;
+  avg /= nr_threads;
+
+  fmt::memory_buffer buf;
+  int nr_moves = 0;
+  while (nr_moves < kMaxMovesPerEpoch) {
+    auto hi = std::max_element(core_load.begin(), core_load.end()) - core_load.begin();
+    auto lo = std::min_element(core_load.begin(), core_load.end()) - core_load.begin();
+    if (core_load[hi] * 100 <= avg * (100 + g_threshold))
+      break;
+
+    // Moving more than half of the gap only swaps the roles.
+    auto budget = (core_load[hi] - core_load[lo]) / 2;
+    int slice = -1;
+    for (size_t s = 0; s < nr_slices; s++) {
+      if (slice_core[s] != hi || slice_load[s] == 0 || slice_load[s] > budget)
+        continue;
+      if (slice < 0 || slice_load[s] > slice_load[slice])
+        slice = s;
+    }
+    if (slice < 0)
+      break;
+
+    slice_core[slice] = lo;
+    core_load[hi] -= slice_load[slice];
+    core_load[lo] += slice_load[slice];
+    fmt::format_to(buf, "{}:{}->{} ", slice, hi, lo);
+    nr_moves++;
+  }
+
+  if (nr_moves > 0) {
+    logger->info("Epoch {} remapped slices to cores {}",
+                 epoch_nr, std::string_view(buf.begin(), buf.size()));
+  }
+}
+
+}
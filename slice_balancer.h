@@ -0,0 +1,67 @@
+// -*- mode: c++ -*-
+
+#ifndef SLICE_BALANCER_H
+#define SLICE_BALANCER_H
+
+#include <array>
+#include <vector>
+
+#include "node_config.h"
+#include "slice.h"
+#include "util/objects.h"
+
+namespace felis {
+
+// Maps slices to cores inside of a node, and remaps them when the cores are
+// out of balance. Unlike the LocalityManager, which only plans the contended
+// rows of one epoch, the mapping here stays until the next remap.
+//
+// Each core measures the cycles it spends running pieces. The cycles of a
+// core are split among its slices by the number of index ops on each slice,
+// and we keep a moving average over epochs as the load of a slice. At the end
+// of an epoch, if the busiest core is more than g_threshold percent above the
+// average, slices move from the busiest core to the idlest, up to
+// kMaxMovesPerEpoch at a time.
+//
+// Since the routers place the index ops, the pieces and hence new rows and
+// grown version arrays by core, all of them follow the new mapping from the
+// next epoch on.
+class SliceCoreBalancer {
+ public:
+  static bool g_enabled;
+  static int g_threshold;
+
+  static constexpr int kMaxMovesPerEpoch = 4;
+  // Weight of the history in the moving average, as in (kDecay - 1) / kDecay.
+  static constexpr int kDecay = 4;
+ private:
+  template <typename T> friend T &util::Instance() noexcept;
+  SliceCoreBalancer() {}
+
+  struct CoreTime {
+    uint64_t cycles = 0;
+  };
+  std::array<util::CacheAligned<CoreTime>, NodeConfiguration::kMaxNrThreads> core_time;
+
+  size_t nr_slices = 0;
+  SliceOpCounters *ops = nullptr;
+  std::vector<int16_t> slice_core;
+  std::vector<uint64_t> slice_load;
+ public:
+  /** default_core gives the initial mapping, usually the router's static one. */
+  void Initialize(size_t nr_slices, int (*default_core)(int16_t));
+  /** Workloads whose routers don't go through SliceToCoreId() never call Initialize(). */
+  bool is_initialized() const { return ops != nullptr; }
+
+  void Count(int slice_id) { ops->Count(slice_id); }
+  void AddExecTime(int core_id, uint64_t cycles) { core_time[core_id].cycles += cycles; }
+
+  int SliceToCoreId(int16_t slice_id) const { return slice_core[slice_id]; }
+
+  // Called by the EpochClient, when no txn is running.
+  void OnEpochEnd(uint64_t epoch_nr);
+};
+
+}
+
+#endif
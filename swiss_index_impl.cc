@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <atomic>
+#include <sys/mman.h>
+
+#include "swiss_index_impl.h"
+#include "log.h"
+
+namespace felis {
+
+static void *AllocOnDemand(size_t length)
+{
+  // Like the HashtableIndex buckets, pages are only backed when an insert
+  // touches them, from the NUMA zone of the inserting core.
+  length = util::Align(length, 4096);
+  void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  abort_if(p == MAP_FAILED, "Cannot allocate {} bytes for a SwissTableIndex", length);
+  return p;
+}
+
+static inline uint32_t MatchByte(__m128i group, uint8_t b)
+{
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(b)));
+}
+
+SwissTableIndex::SwissTableIndex(std::tuple<HashFunc, size_t, bool> conf)
+    : Table()
+{
+  hash = std::get<0>(conf);
+  enable_inline = std::get<2>(conf);
+
+  auto nr_slots = std::get<1>(conf) * kMaxLoadDenominator / kMaxLoadNumerator;
+  nr_groups = 1;
+  while (nr_groups * kGroupSize < nr_slots) nr_groups <<= 1;
+
+  ctrl = (uint8_t *) AllocOnDemand(capacity());
+  slots = (VHandle **) AllocOnDemand(capacity() * sizeof(VHandle *));
+}
+
+__m128i SwissTableIndex::LoadGroup(size_t g) const
+{
+  auto group = _mm_load_si128((const __m128i *) (ctrl + g * kGroupSize));
+  // The slots we read next are published before their control bytes.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return group;
+}
+
+VHandle *SwissTableIndex::SearchOrCreate(const VarStrView &k, bool *created)
+{
+  auto h = Hash(k);
+  auto x = HashEntry::Convert(k, h);
+  auto tag = Tag(h);
+  VHandle *row = nullptr;
+
+  size_t g = GroupOf(h);
+  for (size_t i = 0; i < nr_groups;) {
+    auto group = LoadGroup(g);
+    for (auto m = MatchByte(group, tag); m; m &= m - 1) {
+      auto p = slots[g * kGroupSize + __builtin_ctz(m)];
+      if (HashEntry::OfRow(p)->Compare(x)) {
+        if (row) {
+          HashEntry::OfRow(row)->FreeKey();
+          delete row;
+        }
+        *created = false;
+        return p;
+      }
+    }
+    // The busy slot could be our key.
+    if (MatchByte(group, kBusy)) {
+      _mm_pause();
+      continue;
+    }
+    auto empty = MatchByte(group, kEmpty);
+    if (empty == 0) {
+      g = NextGroup(g, ++i);
+      continue;
+    }
+
+    if (row == nullptr) {
+      row = NewRow();
+      row->capacity = 1;
+      HashEntry::OfRow(row)->InitKey(x);
+    }
+
+    auto idx = g * kGroupSize + __builtin_ctz(empty);
+    uint8_t expected = kEmpty;
+    std::atomic_ref<uint8_t> c(ctrl[idx]);
+    if (!c.compare_exchange_strong(expected, kBusy))
+      continue;
+    slots[idx] = row;
+    c.store(tag, std::memory_order_release);
+    *created = true;
+    return row;
+  }
+  logger->critical("SwissTableIndex of table {} is full, {} slots", id, capacity());
+  std::abort();
+}
+
+VHandle *SwissTableIndex::SearchOrCreate(const VarStrView &k)
+{
+  bool unused = false;
+  return SearchOrCreate(k, &unused);
+}
+
+VHandle *SwissTableIndex::Search(const VarStrView &k)
+{
+  return Search(k, Hash(k));
+}
+
+VHandle *SwissTableIndex::Search(const VarStrView &k, uint32_t h)
+{
+  auto x = HashEntry::Convert(k, h);
+  auto tag = Tag(h);
+
+  size_t g = GroupOf(h);
+  for (size_t i = 0; i < nr_groups;) {
+    auto group = LoadGroup(g);
+    for (auto m = MatchByte(group, tag); m; m &= m - 1) {
+      auto p = slots[g * kGroupSize + __builtin_ctz(m)];
+      if (HashEntry::OfRow(p)->Compare(x))
+        return p;
+    }
+    if (MatchByte(group, kBusy)) {
+      _mm_pause();
+      continue;
+    }
+    if (MatchByte(group, kEmpty))
+      return nullptr;
+    g = NextGroup(g, ++i);
+  }
+  return nullptr;
+}
+
+void SwissTableIndex::SearchBatch(const VarStrView *keys, size_t n, VHandle **rows)
+{
+  uint32_t h[kSearchBatch];
+  for (size_t base = 0; base < n; base += kSearchBatch) {
+    auto nr = std::min(n - base, kSearchBatch);
+    // Control bytes and slots of the first group each key probes.
+    for (size_t i = 0; i < nr; i++) {
+      h[i] = Hash(keys[base + i]);
+      auto g = GroupOf(h[i]);
+      __builtin_prefetch(ctrl + g * kGroupSize);
+      __builtin_prefetch(slots + g * kGroupSize);
+      __builtin_prefetch(slots + g * kGroupSize + kGroupSize / 2);
+    }
+    for (size_t i = 0; i < nr; i++)
+      rows[base + i] = Search(keys[base + i], h[i]);
+  }
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef SWISS_INDEX_IMPL_H
+#define SWISS_INDEX_IMPL_H
+
+#include <emmintrin.h>
+
+#include "hashtable_index_impl.h"
+
+namespace felis {
+
+// Open addressing hashtable, probed kGroupSize slots at a time with SSE2, like
+// the Swiss tables. Every slot has a control byte, which is kEmpty, kBusy
+// while an insert fills the slot, or a 7-bit tag from the hash. A lookup
+// compares the tag against a whole group of control bytes at once, and only
+// reads the rows that match. There are no chains to chase.
+//
+// Keys live in the HashEntry of each row, as in the HashtableIndex. The table
+// does not grow: it's sized for the number of rows in the configuration, and
+// it aborts when it's full. Rows are never deleted.
+class SwissTableIndex final : public Table {
+ public:
+  static constexpr size_t kGroupSize = 16;
+  // At most 7/8 full with the configured number of rows.
+  static constexpr size_t kMaxLoadNumerator = 7;
+  static constexpr size_t kMaxLoadDenominator = 8;
+
+  // Fresh pages are zero, so the table is empty without touching them.
+  static constexpr uint8_t kEmpty = 0;
+  static constexpr uint8_t kBusy = 1;
+
+  // Keys SearchBatch() prefetches for at a time.
+  static constexpr size_t kSearchBatch = 16;
+ private:
+  HashFunc hash;
+  size_t nr_groups;
+  uint8_t *ctrl;
+  VHandle **slots;
+
+  // The hash functions of the table specs are made for the modulo of the
+  // HashtableIndex. Item ids, for example, are spread evenly, but their low 7
+  // bits would be the tag, and 128 ids in a row would share one group. So we
+  // mix every bit into the tag and the group, like the murmur3 finalizer.
+  uint32_t Hash(const VarStrView &k) const {
+    auto h = hash(k);
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+  }
+  static uint8_t Tag(uint32_t h) { return 0x80 | (h & 0x7F); }
+  size_t GroupOf(uint32_t h) const { return (h >> 7) & (nr_groups - 1); }
+  // Triangular probing, visits every group once when nr_groups is a power of 2.
+  size_t NextGroup(size_t g, size_t i) const { return (g + i) & (nr_groups - 1); }
+  __m128i LoadGroup(size_t g) const;
+  VHandle *Search(const VarStrView &k, uint32_t h);
+ public:
+  SwissTableIndex(std::tuple<HashFunc, size_t, bool> conf);
+
+  VHandle *SearchOrCreate(const VarStrView &k, bool *created) override;
+  VHandle *SearchOrCreate(const VarStrView &k) override;
+  VHandle *Search(const VarStrView &k) override;
+  void SearchBatch(const VarStrView *keys, size_t n, VHandle **rows) override;
+
+  size_t capacity() const { return nr_groups * kGroupSize; }
+};
+
+}
+
+#endif
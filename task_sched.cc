@@ -0,0 +1,283 @@
+#include <algorithm>
+
+#include "task_sched.h"
+
+#include "gopp/gopp.h"
+#include "log.h"
+#include "opts.h"
+#include "txn.h"
+
+namespace felis {
+
+__thread TaskSched *task_sched = nullptr;
+
+bool TaskSched::g_use_task_sched = false;
+size_t TaskSched::g_max_parked = 1 << 20;
+
+static TaskSched *task_scheds[NodeConfiguration::kMaxNrThreads] = {nullptr};
+
+void TaskSched::Init()
+{
+  auto core_id = go::Scheduler::CurrentThreadPoolId() - 1;
+  logger->info("Initializing TaskSched on core {}", core_id);
+  task_sched = new TaskSched(core_id);
+  task_scheds[core_id] = task_sched;
+}
+
+TaskSched *TaskSched::GetTaskSchedForCore(int core_id)
+{
+  assert(core_id < NodeConfiguration::kMaxNrThreads);
+  assert(task_scheds[core_id]);
+  return task_scheds[core_id];
+}
+
+TaskSched::TaskSched(uint64_t core_id)
+    : core_id(core_id),
+      svc(dynamic_cast<EpochExecutionDispatchService &>(util::Impl<PromiseRoutineDispatchService>())),
+      transport(util::Impl<PromiseRoutineTransportService>())
+{
+  parked.reserve(4096);
+}
+
+bool TaskSched::ParkedTask::IsReady() const
+{
+  if (addr)
+    return !IsPendingValue(*addr);
+  return future->ready.load(std::memory_order_acquire);
+}
+
+void TaskSched::StartExec()
+{
+  abort_if(is_running, "StartExec is called before a previous call returns");
+  is_running = true;
+
+  cs_trace("TaskSched on core {} is starting to run, {} parked", core_id, parked.size());
+  PieceRoutine *routine;
+  while ((routine = GetNewPiece())) {
+    RunPiece(routine);
+  }
+
+  is_running = false;
+}
+
+void TaskSched::RunPiece(PieceRoutine *routine)
+{
+  current.routine = routine;
+  current.root = nullptr;
+  current.parked = false;
+
+  routine->callback(routine);
+
+  bool parked_now = current.parked;
+  current = Context();
+  if (!parked_now)
+    svc.Complete(core_id);
+}
+
+void TaskSched::Spawn(PieceTask &&task)
+{
+  abort_if(current.routine == nullptr || current.root, "Spawn() outside of a piece");
+  auto h = task.release();
+  current.root = h;
+  nr_tasks++;
+
+  h.resume();
+  if (h.done()) {
+    h.destroy();
+    current.root = nullptr;
+    return;
+  }
+  abort_if(!current.parked, "Task on core {} suspended without co_await on a version or future", core_id);
+}
+
+void TaskSched::Park(std::coroutine_handle<> leaf, volatile uintptr_t *addr, BaseFutureValue *future)
+{
+  parked.push_back(ParkedTask{current.routine->sched_key, current.routine, current.root, leaf, addr, future});
+  current.parked = true;
+  nr_suspends++;
+  max_nr_parked = std::max(max_nr_parked, parked.size());
+}
+
+void TaskSched::Resume(size_t idx)
+{
+  auto t = parked[idx];
+  parked[idx] = parked.back();
+  parked.pop_back();
+
+  auto saved = current;
+  current.routine = t.routine;
+  current.root = t.root;
+  current.parked = false;
+
+  t.leaf.resume();
+  if (t.root.done()) {
+    t.root.destroy();
+    svc.Complete(core_id);
+  } else {
+    abort_if(!current.parked, "Task on core {} suspended without co_await on a version or future", core_id);
+  }
+  current = saved;
+}
+
+bool TaskSched::ResumeReady(bool all)
+{
+  bool resumed = false;
+  size_t nr = all ? parked.size() : std::min(kPollBatch, parked.size());
+  if (poll_pos >= parked.size()) poll_pos = 0;
+
+  // Resume() swaps the last one into idx, so we don't advance in that case.
+  for (size_t i = 0; i < nr && !parked.empty(); i++) {
+    if (poll_pos >= parked.size()) poll_pos = 0;
+    if (parked[poll_pos].IsReady()) {
+      Resume(poll_pos);
+      resumed = true;
+    } else {
+      poll_pos++;
+    }
+  }
+  return resumed;
+}
+
+bool TaskSched::ShouldStartNewPiece()
+{
+  if (parked.size() < g_max_parked)
+    return true;
+
+  // The window is full. A parked task can only wait for smaller serial ids, so
+  // a new piece below the largest parked key could be what they wait for.
+  uint64_t max_key = 0;
+  for (auto &t: parked) max_key = std::max(max_key, t.sched_key);
+  return svc.queues[core_id]->pq.sched_pol->TopKey() < max_key;
+}
+
+PieceRoutine *TaskSched::GetNewPiece()
+{
+  auto &zq = svc.queues[core_id]->zq;
+  auto &q = svc.queues[core_id]->pq;
+  auto &state = svc.queues[core_id]->state;
+  auto &priority_queue = *q.sched_pol;
+
+retry:
+  state.running = EpochExecutionDispatchService::State::kDeciding;
+
+  // 1. try to run something from the zero queue
+  PieceRoutine *routine = zq.Front();
+  if (routine != nullptr) {
+    state.running = EpochExecutionDispatchService::State::kRunning;
+    zq.Pop();
+    return routine;
+  }
+
+  // Let the CallTxnsWorker finish first. Parked tasks stay parked.
+  if (!svc.IsReady((int) core_id)) {
+    state.running = EpochExecutionDispatchService::State::kSleeping;
+    return nullptr;
+  }
+
+  if (priority_queue.empty() && parked.empty() && q.pending.empty()) {
+    state.running = EpochExecutionDispatchService::State::kSleeping;
+  } else {
+    state.running = EpochExecutionDispatchService::State::kRunning;
+  }
+
+  svc.ProcessPending(q);
+
+  periodic_counter++;
+  if ((periodic_counter & kPeriodicIOInterval) == 0) {
+    transport.PeriodicIO(core_id);
+  }
+
+  // 2. resume parked tasks that are ready
+  if (ResumeReady(false))
+    goto retry;
+
+  // 3. try to run something from the priority queue
+  if (!priority_queue.empty() && ShouldStartNewPiece()) {
+    auto node = priority_queue.Pick();
+    routine = node->routine;
+    priority_queue.Consume(node);
+    return routine;
+  }
+
+  // 4. nothing new, update the completion counter then
+  auto &local_comp = state.complete_counter;
+  auto num_local_completed = local_comp.completed;
+  local_comp.completed = 0;
+  if (num_local_completed > 0) {
+    EpochClient::g_workload_client->completion_object()->Complete(num_local_completed);
+  }
+
+  if (transport.PeriodicIO((int) core_id))
+    goto retry;
+
+  // 5. only parked tasks left, wait for them
+  if (!parked.empty()) {
+    if (!ResumeReady(true))
+      _mm_pause();
+    goto retry;
+  }
+
+  return nullptr;
+}
+
+bool TaskSched::WaitInline()
+{
+  if (in_inline_wait || parked.empty())
+    return false;
+
+  in_inline_wait = true;
+  bool resumed = ResumeReady(false);
+  in_inline_wait = false;
+  return resumed;
+}
+
+void TaskSched::DumpStatus()
+{
+  fmt::memory_buffer buf;
+  fmt::format_to(buf, "Dumping state of TaskSched on core {}\n", core_id);
+  fmt::format_to(buf, "tasks {} suspends {} parked {} (max {})\n",
+                 nr_tasks, nr_suspends, parked.size(), max_nr_parked);
+  for (size_t i = 0; i < parked.size() && i < 16; i++) {
+    auto &t = parked[i];
+    fmt::format_to(buf, "  sched_key = {} waiting on {} ready {}\n",
+                   t.sched_key, t.addr ? (void *) t.addr : (void *) t.future, t.IsReady());
+  }
+  logger->info("{}", std::string_view(buf.data(), buf.size()));
+}
+
+bool FutureAwaiter::await_ready()
+{
+  return future->ready.load(std::memory_order_acquire);
+}
+
+bool FutureAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+  if (task_sched == nullptr || !task_sched->in_task()) {
+    future->Wait();
+    return false;
+  }
+  task_sched->Park(h, nullptr, future);
+  return true;
+}
+
+void FutureAwaiter::await_resume()
+{
+  // Same as the end of BaseFutureValue::Wait()
+  future->ready = false;
+}
+
+void PieceTask::RunFromPiece(PieceTask &&task)
+{
+  if (task_sched != nullptr && task_sched->can_spawn()) {
+    task_sched->Spawn(std::move(task));
+    return;
+  }
+
+  // Awaiters wait in place outside of TaskSched, so one resume is enough.
+  auto h = task.release();
+  h.resume();
+  abort_if(!h.done(), "PieceTask did not finish outside of TaskSched");
+  h.destroy();
+}
+
+}
@@ -0,0 +1,141 @@
+// -*- mode: c++ -*-
+
+#ifndef TASK_SCHED_H
+#define TASK_SCHED_H
+
+#include <vector>
+
+#include "routine_sched.h"
+#include "piece_task.h"
+#include "vhandle.h"
+
+namespace felis {
+
+class TaskSched;
+class BaseFutureValue;
+
+extern __thread TaskSched *task_sched;  /*!< this core's scheduler, nullptr if not enabled */
+
+// Executor for stackless pieces. Like CoroSched it takes over the
+// ExecutionRoutine, but a piece waiting on a version or a future does not keep
+// a stack. Its frame is parked here, and we go on with the next piece. Parked
+// tasks are resumed once the value they wait for shows up.
+//
+// Pieces attached with AttachRoutine() still run here. They cannot suspend, so
+// their waits spin, and drive the parked tasks through WaitInline() while
+// spinning.
+class TaskSched {
+ public:
+  /* Settings */
+  static bool g_use_task_sched;  /*!< use TaskSched instead of the ExecutionRoutine loop */
+  static size_t g_max_parked;  /*!< soft limit of parked tasks per core */
+
+ private:
+  static constexpr uint64_t kPeriodicIOInterval = 0x3F;
+  static constexpr size_t kPollBatch = 32;  /*!< parked tasks to check before picking a new piece */
+
+  struct ParkedTask {
+    uint64_t sched_key;
+    PieceRoutine *routine;
+    PieceTask::Handle root;  /*!< the task created for the piece */
+    std::coroutine_handle<> leaf;  /*!< where to resume, can be a nested task */
+    volatile uintptr_t *addr;  /*!< waiting for a version, or */
+    BaseFutureValue *future;  /*!< waiting for a future */
+
+    bool IsReady() const;
+  };
+
+  /** the piece we are running right now */
+  struct Context {
+    PieceRoutine *routine = nullptr;
+    PieceTask::Handle root;
+    bool parked = false;
+  };
+
+  uint64_t core_id;
+  bool is_running = false;
+  bool in_inline_wait = false;
+  EpochExecutionDispatchService &svc;
+  PromiseRoutineTransportService &transport;
+  uint64_t periodic_counter = 0;
+
+  Context current;
+  std::vector<ParkedTask> parked;
+  size_t poll_pos = 0;
+
+  /* Stats */
+  uint64_t nr_tasks = 0;
+  uint64_t nr_suspends = 0;
+  size_t max_nr_parked = 0;
+
+ public:
+  static void Init();  /*!< per-core initialization */
+  static TaskSched *GetTaskSchedForCore(int core_id);
+  static bool IsPendingValue(uintptr_t val) { return (val >> 32) == (kPendingValue >> 32); }
+
+  TaskSched() = delete;
+  explicit TaskSched(uint64_t core_id);
+
+  void StartExec();  /*!< entry point, called by the ExecutionRoutine */
+
+  /** Run the task of the current piece. Called by routines from AttachTask(). */
+  void Spawn(PieceTask &&task);
+  /** Are we inside a task, so that co_await can park it? */
+  bool in_task() const { return current.root != nullptr; }
+  bool can_spawn() const { return current.routine != nullptr && current.root == nullptr; }
+  void Park(std::coroutine_handle<> leaf, volatile uintptr_t *addr, BaseFutureValue *future);
+
+  /** Resume ready parked tasks from a spinning wait. Returns true if any ran. */
+  bool WaitInline();
+
+  void DumpStatus();
+
+ private:
+  PieceRoutine *GetNewPiece();
+  void RunPiece(PieceRoutine *routine);
+  bool ResumeReady(bool all);
+  void Resume(size_t idx);
+  bool ShouldStartNewPiece();
+};
+
+struct VersionAwaiter {
+  VHandle *row;
+  uint64_t sid;
+  volatile uintptr_t *addr;
+
+  bool await_ready() { return addr == nullptr || !TaskSched::IsPendingValue(*addr); }
+  bool await_suspend(std::coroutine_handle<> h) {
+    if (task_sched == nullptr || !task_sched->in_task()) {
+      // Not running on TaskSched, wait like ReadWithVersion() does.
+      row->ReadWithVersion(sid);
+      return false;
+    }
+    task_sched->Park(h, addr, nullptr);
+    return true;
+  }
+  VarStr *await_resume() { return addr ? (VarStr *) *addr : nullptr; }
+};
+
+struct FutureAwaiter {
+  BaseFutureValue *future;
+
+  bool await_ready();
+  bool await_suspend(std::coroutine_handle<> h);
+  void await_resume();
+};
+
+/** co_await version of VHandle::ReadWithVersion() */
+inline VersionAwaiter AwaitVersion(VHandle *row, uint64_t sid)
+{
+  return VersionAwaiter{row, sid, row->ValueAddress(sid)};
+}
+
+/** co_await version of BaseFutureValue::Wait() */
+inline FutureAwaiter AwaitFuture(BaseFutureValue *future)
+{
+  return FutureAwaiter{future};
+}
+
+}
+
+#endif /* TASK_SCHED_H */
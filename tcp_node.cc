@@ -9,18 +9,47 @@
 #include "epoch.h"
 #include "log.h"
 #include <iostream>
+#include <chrono>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "txn_cc.h"
+#include "uring.h"
+#include "shm_ring.h"
+#include "util/varint.h"
 
 namespace felis {
 namespace tcp {
 
 static constexpr size_t kTcpBufferSize = 1 * 1024 * 1024;
-static __thread uint8_t send_channel_buffer[kTcpBufferSize];
 static __thread uint8_t recv_channel_buffer[kTcpBufferSize];
 
+// Pieces are appended into per-thread buffers. Flushing hands these buffers
+// to the kernel directly with one sendmsg() for all threads, instead of
+// copying them into the go::TcpOutputChannel buffer first. All writes to the
+// socket go through here, so the TcpOutputChannel is never used.
+//
+// We never wait for the socket to drain. The peer reads it in PeriodicIO(),
+// on worker threads that may be sending to us at the same time. Whatever the
+// kernel doesn't take goes to the backlog, later writes queue behind it, and
+// DoFlush() keeps pushing it out.
+//
+// With TcpNodeTransport::g_use_io_uring, sendmsg() is submitted through a
+// per-thread io_uring instead, so that PeriodicIO() can flush to all nodes in
+// one system call.
+//
+// With TcpNodeTransport::g_use_shm, a peer on the same host gets a shared
+// memory ring. Everything after the handshake is copied into the ring
+// instead of the socket, in the same order, so the receiver parses the same
+// stream.
 class SendChannel : public Flushable<SendChannel>, public OutgoingTraffic {
-  go::TcpOutputChannel *out;
-  go::BufferChannel *flusher_channel;
+  int fd;
+  ShmRing *ring = nullptr;
+  util::SpinLock write_lock;
+
+  // Protected by write_lock. Bytes from backlog_start on are not sent yet.
+  std::vector<uint8_t> backlog;
+  size_t backlog_start = 0;
 
   struct Channel {
     uint8_t *mem;
@@ -30,23 +59,32 @@ class SendChannel : public Flushable<SendChannel>, public OutgoingTraffic {
     std::atomic_bool dirty;
   };
 
-  // We need to create a per-thread, long-running flusher go::Routine.
-  class FlusherRoutine : public go::Routine {
-    go::BufferChannel *flusher_channel;
-    go::TcpOutputChannel *out;
-   public:
-    FlusherRoutine(go::BufferChannel *chn, go::TcpOutputChannel *out)
-        : flusher_channel(chn), out(out) {
-      // set_urgent(true);
-    }
-    void Run() final override;
-  };
-
   util::CacheAligned<Channel> channels[NodeConfiguration::kMaxNrThreads + 1];
 
+  // Protected by write_lock
+  struct Stats {
+    uint64_t bytes = 0;
+    uint64_t nr_flushes = 0;
+    uint64_t nr_syscalls = 0;
+    uint64_t flush_ns = 0;
+    uint64_t max_flush_ns = 0;
+    uint64_t max_backlog = 0;
+  } stats;
+
+  void WriteVectors(struct iovec *iov, int iovcnt);
+  /** Sends what the kernel takes right away, and skips it in iov. With write_lock held. */
+  size_t TrySend(struct iovec *&iov, int &iovcnt);
+  /** Like TrySend(), for the shared memory ring. */
+  size_t CopyToRing(struct iovec *&iov, int &iovcnt);
+  void QueueBacklog(struct iovec *iov, int iovcnt);  /*!< with write_lock held */
+  bool DrainBacklog();  /*!< with write_lock held, true if nothing is left */
+  void AddFlushStats(size_t bytes, std::chrono::steady_clock::time_point start_time);
+
  public:
   static constexpr size_t kPerThreadBuffer = 16 << 10;
   SendChannel(go::TcpSocket *sock, int dst_node);
+  /** Switch from the socket to ring. Everything written before goes to the socket. */
+  void AttachRing(ShmRing *ring);
   void *Alloc(size_t sz);
   void Finish(size_t sz);
   long PendingFlush(int core_id);
@@ -61,6 +99,8 @@ class SendChannel : public Flushable<SendChannel>, public OutgoingTraffic {
     channels[tid].flusher_start = flush_start;
   }
   bool PushRelease(int thr, unsigned int start, unsigned int end);
+  /** Flush all threads. Hides Flushable::Flush() to gather them into one write. */
+  void Flush();
   void DoFlush(bool async = false) final override;
   bool TryLock(int i) {
     bool locked = false;
@@ -71,13 +111,21 @@ class SendChannel : public Flushable<SendChannel>, public OutgoingTraffic {
   }
 
   void WriteToNetwork(void *data, size_t cnt) final override {
-    out->Write(data, cnt);
-    out->Flush(true);
+    struct iovec iov = {data, cnt};
+    WriteVectors(&iov, 1);
   }
+
+  size_t DumpStats();  /*!< returns the bytes sent since last time */
+
+  /**
+   * io_uring only. Flush the buffer of thread tid on all chns with one
+   * submission, instead of one system call per channel.
+   */
+  static void FlushThreadBatched(SendChannel **chns, int nr_chns, int tid);
 };
 
 SendChannel::SendChannel(go::TcpSocket *sock, int dst_node)
-    : out(sock->output_channel())
+    : fd(sock->fd)
 {
   this->dst_node = dst_node;
   auto buffer =
@@ -90,8 +138,15 @@ SendChannel::SendChannel(go::TcpSocket *sock, int dst_node)
     chn.lock = false;
     chn.dirty = false;
   }
-  flusher_channel = new go::BufferChannel(512);
-  go::GetSchedulerFromPool(0)->WakeUp(new FlusherRoutine(flusher_channel, out));
+}
+
+void SendChannel::AttachRing(ShmRing *ring)
+{
+  // Only the handshake is written before, and the peer reads it right away.
+  write_lock.Lock();
+  while (!DrainBacklog()) _mm_pause();
+  this->ring = ring;
+  write_lock.Unlock();
 }
 
 void *SendChannel::Alloc(size_t sz)
@@ -122,16 +177,244 @@ void SendChannel::Finish(size_t sz)
                           std::memory_order_release);
 }
 
+static __thread IoUring *send_ring = nullptr;
+
+static IoUring *GetSendRing()
+{
+  if (send_ring == nullptr) {
+    send_ring = new IoUring();
+    int rs = send_ring->Init(kMaxNrNode);
+    abort_if(rs < 0, "Cannot setup io_uring: {}", strerror(-rs));
+  }
+  return send_ring;
+}
+
+// The ring has room for a send to every node, but a full one shouldn't crash
+// us: submit what is prepared, and the kernel makes room.
+static io_uring_sqe *GetSendSqe(IoUring *ring)
+{
+  io_uring_sqe *sqe;
+  while ((sqe = ring->GetSqe()) == nullptr)
+    ring->Submit();
+  return sqe;
+}
+
+// Wait for nr completions, and hand them to f.
+template <typename F>
+static void WaitSendRing(IoUring *ring, unsigned nr, F f)
+{
+  while (true) {
+    nr -= ring->ForEachCompletion(f);
+    if (nr == 0) break;
+    ring->Submit(nr);
+  }
+}
+
+// Skip what the kernel took, which can be a partial iovec.
+static void SkipSent(struct iovec *&iov, int &iovcnt, size_t sent)
+{
+  while (iovcnt > 0 && sent >= iov->iov_len) {
+    sent -= iov->iov_len;
+    iov++;
+    iovcnt--;
+  }
+  if (iovcnt > 0) {
+    iov->iov_base = (uint8_t *) iov->iov_base + sent;
+    iov->iov_len -= sent;
+  }
+}
+
+size_t SendChannel::TrySend(struct iovec *&iov, int &iovcnt)
+{
+  if (ring)
+    return CopyToRing(iov, iovcnt);
+
+  size_t sent = 0;
+  while (iovcnt > 0) {
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    long rs;
+    if (TcpNodeTransport::g_use_io_uring) {
+      auto ring = GetSendRing();
+      ring->PrepSendMsg(GetSendSqe(ring), fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT, 0);
+      ring->Submit(1);
+      WaitSendRing(ring, 1, [&rs](uint64_t, int res) { rs = res; });
+    } else {
+      rs = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (rs < 0) rs = -errno;
+    }
+    stats.nr_syscalls++;
+
+    if (rs < 0) {
+      if (rs == -EINTR) continue;
+      if (rs == -EAGAIN || rs == -EWOULDBLOCK) break;
+      abort_if(true, "Cannot send to node {}: {}", dst_node, strerror(-rs));
+    }
+    sent += rs;
+    SkipSent(iov, iovcnt, rs);
+  }
+  return sent;
+}
+
+void SendChannel::QueueBacklog(struct iovec *iov, int iovcnt)
+{
+  // Drop what was sent before the backlog grows again.
+  if (backlog_start > 0 && backlog_start >= backlog.size() / 2) {
+    backlog.erase(backlog.begin(), backlog.begin() + backlog_start);
+    backlog_start = 0;
+  }
+  for (int i = 0; i < iovcnt; i++) {
+    auto p = (uint8_t *) iov[i].iov_base;
+    backlog.insert(backlog.end(), p, p + iov[i].iov_len);
+  }
+  stats.max_backlog = std::max<uint64_t>(stats.max_backlog, backlog.size() - backlog_start);
+}
+
+bool SendChannel::DrainBacklog()
+{
+  if (backlog_start == backlog.size())
+    return true;
+  struct iovec iov = {backlog.data() + backlog_start, backlog.size() - backlog_start};
+  auto p = &iov;
+  int iovcnt = 1;
+  backlog_start += TrySend(p, iovcnt);
+  if (iovcnt > 0)
+    return false;
+  backlog.clear();
+  backlog_start = 0;
+  return true;
+}
+
+size_t SendChannel::CopyToRing(struct iovec *&iov, int &iovcnt)
+{
+  // A full ring is a full socket buffer. The receiver is the peer's
+  // PeriodicIO(), so we leave the rest to the backlog instead of waiting.
+  size_t copied = 0;
+  while (iovcnt > 0) {
+    auto n = ring->Write(iov->iov_base, iov->iov_len);
+    copied += n;
+    SkipSent(iov, iovcnt, n);
+    if (n == 0) break;
+  }
+  return copied;
+}
+
+void SendChannel::AddFlushStats(size_t bytes, std::chrono::steady_clock::time_point start_time)
+{
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start_time).count();
+  stats.bytes += bytes;
+  stats.nr_flushes++;
+  stats.flush_ns += ns;
+  stats.max_flush_ns = std::max(stats.max_flush_ns, ns);
+}
+
+void SendChannel::WriteVectors(struct iovec *iov, int iovcnt)
+{
+  auto start_time = std::chrono::steady_clock::now();
+  size_t bytes = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    bytes += iov[i].iov_len;
+  }
+
+  write_lock.Lock();
+  // Nothing may overtake the backlog.
+  if (DrainBacklog())
+    TrySend(iov, iovcnt);
+  if (iovcnt > 0)
+    QueueBacklog(iov, iovcnt);
+  AddFlushStats(bytes, start_time);
+  write_lock.Unlock();
+}
+
+void SendChannel::FlushThreadBatched(SendChannel **chns, int nr_chns, int tid)
+{
+  struct {
+    SendChannel *chn;
+    struct iovec iov;
+    struct msghdr msg;
+    int res;
+  } pending[kMaxNrNode];
+  int nr_pending = 0;
+  auto ring = GetSendRing();
+  auto start_time = std::chrono::steady_clock::now();
+
+  // The sends are MSG_DONTWAIT, so the kernel completes them while we submit,
+  // and we never hold the locks while waiting for a peer. A channel someone
+  // else is writing to is left for the next round.
+  for (int i = 0; i < nr_chns; i++) {
+    auto chn = chns[i];
+    if (chn->ring) {
+      // No system call to batch.
+      chn->TryFlushForThread(tid);
+      continue;
+    }
+    if (!chn->TryLock(tid)) continue;
+    if (!chn->write_lock.TryLock()) {
+      chn->Unlock(tid);
+      continue;
+    }
+    auto [start, end] = chn->GetFlushRange(tid);
+    chn->UpdateFlushStart(tid, end);
+    if (end == start) {
+      chn->write_lock.Unlock();
+      chn->Unlock(tid);
+      continue;
+    }
+
+    auto &p = pending[nr_pending];
+    p.chn = chn;
+    p.iov = {chn->channels[tid].mem + start, end - start};
+    p.msg = {};
+    p.msg.msg_iov = &p.iov;
+    p.msg.msg_iovlen = 1;
+
+    if (!chn->DrainBacklog()) {
+      // Can't overtake the backlog, queue behind it.
+      chn->QueueBacklog(&p.iov, 1);
+      chn->AddFlushStats(p.iov.iov_len, start_time);
+      chn->write_lock.Unlock();
+      chn->Unlock(tid);
+      continue;
+    }
+    ring->PrepSendMsg(GetSendSqe(ring), chn->fd, &p.msg, MSG_NOSIGNAL | MSG_DONTWAIT, nr_pending);
+    nr_pending++;
+  }
+  if (nr_pending == 0) return;
+
+  ring->Submit(nr_pending);
+  WaitSendRing(ring, nr_pending, [&pending](uint64_t idx, int res) { pending[idx].res = res; });
+
+  for (int i = 0; i < nr_pending; i++) {
+    auto &p = pending[i];
+    size_t len = p.iov.iov_len;
+    auto iov = &p.iov;
+    int iovcnt = 1;
+    p.chn->stats.nr_syscalls++;
+    abort_if(p.res < 0 && p.res != -EAGAIN && p.res != -EWOULDBLOCK && p.res != -EINTR,
+             "Cannot send to node {}: {}", p.chn->dst_node, strerror(-p.res));
+    if (p.res > 0)
+      SkipSent(iov, iovcnt, p.res);
+    // Short, the peer isn't reading fast enough. DoFlush() sends the rest.
+    if (iovcnt > 0)
+      p.chn->QueueBacklog(iov, iovcnt);
+    p.chn->AddFlushStats(len, start_time);
+    p.chn->write_lock.Unlock();
+    p.chn->Unlock(tid);
+  }
+}
+
+// We keep holding the lock of tid while writing. Otherwise, Alloc() on that
+// thread could wrap around and overwrite the range before it is sent or
+// copied into the backlog.
 bool SendChannel::PushRelease(int tid, unsigned int start, unsigned int end)
 {
-  
-  auto mem = channels[tid].mem;
   if (end - start > 0) {
-    void *buf = send_channel_buffer;
-    memcpy(buf, mem + start, end - start);
+    struct iovec iov = {channels[tid].mem + start, end - start};
+    WriteVectors(&iov, 1);
     channels[tid].dirty.store(true, std::memory_order_release);
     Unlock(tid);
-    WriteToNetwork(buf, end - start);
     return true;
   } else {
     Unlock(tid);
@@ -139,33 +422,58 @@ bool SendChannel::PushRelease(int tid, unsigned int start, unsigned int end)
   }
 }
 
-void SendChannel::DoFlush(bool async)
+void SendChannel::Flush()
 {
-  if (async) {
-    out->Flush(true);
-    return;
+  std::bitset<NodeConfiguration::kMaxNrThreads + 1> flushed;
+  auto nr_threads = NodeConfiguration::g_nr_threads + 1;
+  struct iovec iov[NodeConfiguration::kMaxNrThreads + 1];
+  int locked[NodeConfiguration::kMaxNrThreads + 1];
+
+  while (flushed.count() < nr_threads) {
+    int nr_locked = 0, iovcnt = 0;
+    for (int i = 0; i < nr_threads; i++) {
+      if (flushed[i] || !TryLock(i)) continue;
+      auto [start, end] = GetFlushRange(i);
+      UpdateFlushStart(i, end);
+      if (end > start)
+        iov[iovcnt++] = {channels[i].mem + start, end - start};
+      locked[nr_locked++] = i;
+      flushed.set(i);
+    }
+    if (iovcnt > 0)
+      WriteVectors(iov, iovcnt);
+    for (int i = 0; i < nr_locked; i++) {
+      Unlock(locked[i]);
+    }
   }
+}
 
-  int core_id = go::Scheduler::CurrentThreadPoolId() - 1;
-  auto &chn = channels[core_id];
-
-  uint8_t signal = 0;
-  logger->info("SendChannel signaling flusher {}", dst_node);
-  flusher_channel->Write(&signal, 1);
+void SendChannel::DoFlush(bool async)
+{
+  write_lock.Lock();
+  bool done = DrainBacklog();
+  write_lock.Unlock();
 
+  // Callers come back until the backlog is out.
+  if (async || !done) return;
   for (int i = 0; i <= NodeConfiguration::g_nr_threads; i++) {
     channels[i].dirty = false;
   }
 }
 
-void SendChannel::FlusherRoutine::Run()
+size_t SendChannel::DumpStats()
 {
-  while (true) {
-    uint8_t signal = 0;
-    flusher_channel->Read(&signal, 1);
-    out->Flush();
-    logger->info("FlusherRoutine done flushing SendChannel, next round");
-  }
+  write_lock.Lock();
+  auto s = stats;
+  stats = Stats();
+  write_lock.Unlock();
+
+  if (s.nr_flushes == 0) return 0;
+  logger->info("Sent to node {}: {} bytes in {} flushes, {} syscalls, "
+               "flush latency avg {}us max {}us, backlog max {} bytes",
+               dst_node, s.bytes, s.nr_flushes, s.nr_syscalls,
+               s.flush_ns / s.nr_flushes / 1000, s.max_flush_ns / 1000, s.max_backlog);
+  return s.bytes;
 }
 
 long SendChannel::PendingFlush(int core_id)
@@ -191,24 +499,56 @@ void NodeRowShipmentReceiverRoutine::Run()
   server->Listen();
 
   while (true) {
-    auto *client_sock = server->Accept(8192, 1024);
+    // Rows come in large batches, read them with few system calls.
+    auto *client_sock = server->Accept(BaseShipment::kSendBufferSize, 1024);
     auto receiver = new RowShipmentReceiver(client_sock);
     go::Scheduler::Current()->WakeUp(receiver);
   }
 }
 
+// Where a ReceiverChannel reads the stream from.
+class InputStream {
+ public:
+  virtual ~InputStream() {}
+  virtual void BeginPeek() {}
+  virtual void EndPeek() {}
+  virtual size_t Peek(void *data, size_t cnt) = 0;
+  virtual void Skip(size_t cnt) = 0;
+  /** Pull in what has arrived, so that the next Poll() has it. */
+  virtual void Prefetch() {}
+};
+
+class SocketInputStream final : public InputStream {
+  go::TcpInputChannel *in;
+ public:
+  SocketInputStream(go::TcpSocket *sock) : in(sock->input_channel()) {}
+  void BeginPeek() override { in->BeginPeek(); }
+  void EndPeek() override { in->EndPeek(); }
+  size_t Peek(void *data, size_t cnt) override { return in->Peek(data, cnt); }
+  void Skip(size_t cnt) override { in->Skip(cnt); }
+  void Prefetch() override { in->OpportunisticReadFromNetwork(); }
+};
+
+class ShmInputStream final : public InputStream {
+  ShmRing *ring;
+ public:
+  ShmInputStream(ShmRing *ring) : ring(ring) {}
+  size_t Peek(void *data, size_t cnt) override { return ring->Peek(data, cnt); }
+  void Skip(size_t cnt) override { ring->Skip(cnt); }
+};
+
 class ReceiverChannel : public IncomingTraffic {
   friend class felis::TcpNodeTransport;
   static constexpr auto kMaxMappingTableBuffer = 1024;
-  go::TcpInputChannel *in;
+  InputStream *in;
   // We don't use the tcp socket lock, we use our own lock
   std::atomic_bool lock;
   felis::TcpNodeTransport *transport;
   std::atomic_long nr_left;
   bool warned_during_poll = false;
  public:
-  ReceiverChannel(go::TcpSocket *sock, felis::TcpNodeTransport *transport)
-      : IncomingTraffic(), in(sock->input_channel()), transport(transport) {
+  ReceiverChannel(go::TcpSocket *sock, InputStream *in, felis::TcpNodeTransport *transport)
+      : IncomingTraffic(), in(in), transport(transport) {
     sock->OmitReadLock();
     sock->OmitWriteLock();
     lock = false;
@@ -301,21 +641,19 @@ size_t ReceiverChannel::PollRoutines(PieceRoutine **routines, size_t cnt)
       break;
     } else if (header == PieceRoutine::kUpdateBatchCounter) {
       auto &conf = util::Instance<NodeConfiguration>();
-      constexpr auto max_level = PromiseRoutineTransportService::kPromiseMaxLevels;
-      auto nr_nodes = conf.nr_nodes();
-      auto buffer_size = 8 + max_level * nr_nodes * nr_nodes * sizeof(ulong);
-      auto buflen = 8 + buffer_size;
+      auto buflen = conf.CounterMessageSize();
       auto buf = recv_channel_buffer;
 
       if (in->Peek(buf, buflen) < buflen) {
         break;
       }
 
-      src_node_id = util::Instance<NodeConfiguration>().
-                    UpdateBatchCountersFromReceiver((unsigned long *) (buf + 8));
+      bool node_done = false;
+      src_node_id = conf.UpdateBatchCountersFromReceiver((unsigned long *) (buf + 8), &node_done);
       in->Skip(buflen);
 
-      transport->OnCounterReceived();
+      if (node_done)
+        transport->OnCounterReceived();
       //TODO: put the magic number somewhere consistent
     } else if ((header & 0xFFFF000000000000) == ((uint64_t)1<<55) ){ // Lets use the upper 2 bytes of the header as a flag
       
@@ -325,17 +663,18 @@ size_t ReceiverChannel::PollRoutines(PieceRoutine **routines, size_t cnt)
       if (in->Peek(buf, buflen) < buflen) {
         break;
       }
-      uint64_t epoch_nr;
-      int node_id;
-      uint64_t offset;
-      memcpy(&epoch_nr, buf+8, 8);
-      memcpy(&offset, buf+16, 8);
-      memcpy(&node_id, buf+24, 4);
+      uint64_t epoch_nr, offset, node_id;
+      auto p = buf + 8, end = buf + buflen;
+      p = util::DecodeVarint(p, end, &epoch_nr);
+      if (p) p = util::DecodeVarint(p, end, &offset);
+      if (p) p = util::DecodeVarint(p, end, &node_id);
+      abort_if(p == nullptr, "Corrupted future value packet");
+      offset = util::UnZigZag(offset);
 
       // Get the pointer to the local future value object
       BaseFutureValue* localFuture = (BaseFutureValue *) util::Instance<EpochManager>().ptr(epoch_nr,node_id,offset);
 
-      ((FutureValue<int32_t> *)localFuture)->DecodeFrom(buf+28); //TODO, don't assume type, decode from should be a virtual function
+      ((FutureValue<int32_t> *)localFuture)->DecodeFrom(p); //TODO, don't assume type, decode from should be a virtual function
       localFuture->SetReady (); //TODO: can we just use Signal() here?
       in->Skip(buflen);
       future_processed++;
@@ -395,6 +734,15 @@ bool ReceiverChannel::PollMappingTable()
   return true;
 }
 
+// Same as the socket buffer on the receiving side.
+static constexpr size_t kShmRingSize = 128 << 20;
+
+// Named after the receiver's port, which is unique on this host.
+static std::string ShmRingName(uint16_t dst_port, int src_node)
+{
+  return fmt::format("/felis-{}-from-{}", dst_port, src_node);
+}
+
 class NodeServerRoutine : public go::Routine {
   friend class felis::TcpNodeTransport;
   felis::TcpNodeTransport *transport;
@@ -434,13 +782,31 @@ void NodeServerRoutine::Run()
     }
 
     logger->info("Connecting worker peer on node {}", config->id);
-    go::TcpSocket *remote_sock = new go::TcpSocket(1024, 512 << 20);
+    // SendChannel writes to the fd directly, we don't need an output buffer.
+    go::TcpSocket *remote_sock = new go::TcpSocket(1024, 1024);
     auto &peer = config->worker_peer;
     bool rs = remote_sock->Connect(peer.host, peer.port);
     abort_if(!rs, "Cannot connect to {}:{}", peer.host, peer.port);
     transport->outgoing_socks[config->id] = remote_sock;
-    transport->outgoing_channels[config->id] = new SendChannel(remote_sock, config->id);
-    conf.RegisterOutgoing(config->id, transport->outgoing_channels[config->id]);
+    auto chn = new SendChannel(remote_sock, config->id);
+    if (TcpNodeTransport::g_use_shm) {
+      // Tell the peer who we are, and whether the rest comes through a ring.
+      bool same_host = peer.host == node_conf.worker_peer.host;
+      uint32_t hello[2] = {(uint32_t) conf.node_id(), same_host};
+      ShmRing *ring = nullptr;
+      if (same_host) {
+        ring = ShmRing::Create(ShmRingName(peer.port, conf.node_id()), kShmRingSize);
+        abort_if(ring == nullptr, "Cannot create shared memory ring to node {}: {}",
+                 config->id, strerror(errno));
+      }
+      chn->WriteToNetwork(hello, sizeof(hello));
+      if (ring) {
+        logger->info("Node {} is on this host, sending through shared memory", config->id);
+        chn->AttachRing(ring);
+      }
+    }
+    transport->outgoing_channels[config->id] = chn;
+    conf.RegisterOutgoing(config->id, chn);
   }
 
   // Now we can begining to accept. Each client sock is a source for our Promise.
@@ -455,7 +821,23 @@ void NodeServerRoutine::Run()
     logger->info("New worker peer connection");
     transport->incoming_socks[i - 1] = client_sock;
 
-    auto chn = new ReceiverChannel(client_sock, transport);
+    InputStream *in = nullptr;
+    if (TcpNodeTransport::g_use_shm) {
+      uint32_t hello[2];
+      abort_if(!client_sock->input_channel()->Read(hello, sizeof(hello)),
+               "Worker peer closed before the handshake");
+      if (hello[1]) {
+        auto ring = ShmRing::Open(ShmRingName(node_conf.worker_peer.port, hello[0]));
+        abort_if(ring == nullptr, "Cannot open shared memory ring from node {}: {}",
+                 hello[0], strerror(errno));
+        logger->info("Node {} is on this host, receiving through shared memory", hello[0]);
+        in = new ShmInputStream(ring);
+      }
+    }
+    if (in == nullptr)
+      in = new SocketInputStream(client_sock);
+
+    auto chn = new ReceiverChannel(client_sock, in, transport);
     logger->info("Incoming connection {}", (void *) chn);
     transport->incoming_connection[i - 1] = chn;
     conf.RegisterIncoming(i - 1, chn);
@@ -465,8 +847,16 @@ void NodeServerRoutine::Run()
 
 }
 
+bool TcpNodeTransport::g_use_io_uring = false;
+bool TcpNodeTransport::g_use_shm = false;
+
 TcpNodeTransport::TcpNodeTransport()
 {
+  if (g_use_io_uring) {
+    IoUring probe;
+    int rs = probe.Init(4);
+    abort_if(rs < 0, "IoUring is on, but the kernel does not support it: {}", strerror(-rs));
+  }
   if (NodeConfiguration::g_data_migration) {
     auto &peer = node_config().config().row_shipper_peer;
     go::GetSchedulerFromPool(node_config().g_nr_threads + 1)->WakeUp(
@@ -502,11 +892,13 @@ void TcpNodeTransport::TransportPromiseRoutine(PieceRoutine *routine)
 
   if (src_node != dst_node) {
     auto out = outgoing_channels.at(dst_node);
-    uint64_t buffer_size = routine->NodeSize();
+    // The receiver expects the packets to be 8 bytes aligned.
+    uint64_t buffer_size = util::Align(routine->NodeSize(), 8);
     auto *buffer = (uint8_t *) out->Alloc(8 + buffer_size);
 
     memcpy(buffer, &buffer_size, 8);
-    routine->EncodeNode(buffer + 8);
+    auto end = routine->EncodeNode(buffer + 8);
+    memset(end, 0, buffer + 8 + buffer_size - end);
     out->Finish(8 + buffer_size);
   } else {
     ltp.TransportPromiseRoutine(routine);
@@ -514,6 +906,33 @@ void TcpNodeTransport::TransportPromiseRoutine(PieceRoutine *routine)
   meta.AddRoute(dst_node);
 }
 
+// A future value packet is the 8 bytes header, then the epoch number, offset
+// (ZigZag, it can be negative) and node id of the future as varints, then the
+// value.
+void TcpNodeTransport::SendFutureValue(tcp::SendChannel *out, BaseFutureValue *val,
+                                       const EpochObject &epoch_info)
+{
+  auto fv = (FutureValue<int32_t> *) val; //TODO remove cast
+  size_t buffer_size = 8
+                       + util::VarintSize(epoch_info.epoch_nr)
+                       + util::VarintSize(util::ZigZag(epoch_info.offset))
+                       + util::VarintSize(epoch_info.node_id)
+                       + fv->EncodeSize();
+
+  uint8_t *buffer = (uint8_t *) out->Alloc(buffer_size);
+
+  uint64_t header = buffer_size - 8 + ((uint64_t)1<<55); // 2^56 is our flag
+  memcpy(buffer, &header, 8);
+
+  auto p = buffer + 8;
+  p = util::EncodeVarint(p, epoch_info.epoch_nr);
+  p = util::EncodeVarint(p, util::ZigZag(epoch_info.offset));
+  p = util::EncodeVarint(p, epoch_info.node_id);
+  fv->EncodeTo(p);
+
+  out->Finish(buffer_size);
+}
+
 void TcpNodeTransport::TransportFutureValue(BaseFutureValue *val)
 {
   auto &conf = node_config();
@@ -525,28 +944,7 @@ void TcpNodeTransport::TransportFutureValue(BaseFutureValue *val)
       continue;
     }
 
-    auto out = outgoing_channels.at(node);
-    // Fill in the correct buffer_size
-    size_t buffer_size = ((FutureValue<int32_t> *)val)->EncodeSize(); //TODO remove cast here as well
-    buffer_size += 3 * sizeof(uint64_t); //header, epoch, offset
-    buffer_size += sizeof(int); //node id
-    //the buffer is 28 bytes, plus the size of the encoded future value, which for now is always 4 bytes, for 32 total
-
-
-    uint8_t *buffer = (uint8_t *) out->Alloc(buffer_size);
-
-    uint64_t header = buffer_size - 8 + ((uint64_t)1<<55); // 2^56 is our flag
-
-    GenericEpochObject<BaseFutureValue> epoch_info = val->ConvertToEpochObject();
-
-    memcpy(buffer,&header,8);
-    memcpy(buffer+8,&(epoch_info.epoch_nr),8);
-    memcpy(buffer+16,&(epoch_info.offset),8);
-    memcpy(buffer+24,&(epoch_info.node_id),4);
-
-    ((FutureValue<int32_t> *)val)->EncodeTo(buffer+28); //TODO remove cast
-
-    out->Finish(buffer_size);
+    SendFutureValue(outgoing_channels.at(node), val, val->ConvertToEpochObject());
   }
 }
 
@@ -561,28 +959,7 @@ void TcpNodeTransport::TransportDistributedFutureValue(BaseFutureValue *val, int
       continue;
     }
 
-    auto out = outgoing_channels.at(node);
-    // Fill in the correct buffer_size
-    size_t buffer_size = ((FutureValue<int32_t> *)val)->EncodeSize(); //TODO remove cast here as well
-    buffer_size += 3 * sizeof(uint64_t); //header, epoch, offset
-    buffer_size += sizeof(int); //node id
-    //the buffer is 28 bytes, plus the size of the encoded future value, which for now is always 4 bytes, for 32 total
-
-
-    uint8_t *buffer = (uint8_t *) out->Alloc(buffer_size);
-
-    uint64_t header = buffer_size - 8 + ((uint64_t)1<<55); // 2^56 is our flag
-
-    GenericEpochObject<BaseFutureValue> epoch_info = val->ConvertDistributedEpochObject(origin_node);
-
-    memcpy(buffer,&header,8);
-    memcpy(buffer+8,&(epoch_info.epoch_nr),8);
-    memcpy(buffer+16,&(epoch_info.offset),8);
-    memcpy(buffer+24,&(epoch_info.node_id),4);
-
-    ((FutureValue<int32_t> *)val)->EncodeTo(buffer+28); //TODO remove cast
-
-    out->Finish(buffer_size);
+    SendFutureValue(outgoing_channels.at(node), val, val->ConvertDistributedEpochObject(origin_node));
   }
 }
 
@@ -617,17 +994,30 @@ bool TcpNodeTransport::PeriodicIO(int core)
   auto &conf = node_config();
 
   bool cont_io = false;
-  for (int i = 1; i <= conf.nr_nodes(); i++) {
-    if (i == conf.node_id()) continue;
-    auto chn = outgoing_channels.at(i);
-    if (core == -1) {
-      chn->Flush();
-    } else {
+  if (g_use_io_uring && core != -1) {
+    tcp::SendChannel *chns[kMaxNrNode];
+    int nr_chns = 0;
+    for (int i = 1; i <= conf.nr_nodes(); i++) {
+      if (i == conf.node_id()) continue;
+      chns[nr_chns++] = outgoing_channels.at(i);
+    }
+    tcp::SendChannel::FlushThreadBatched(chns, nr_chns, core + 1);
+    for (int i = 0; i < nr_chns; i++) {
+      chns[i]->DoFlush(true);
+    }
+  } else {
+    for (int i = 1; i <= conf.nr_nodes(); i++) {
+      if (i == conf.node_id()) continue;
+      auto chn = outgoing_channels.at(i);
+      if (core == -1) {
+        chn->Flush();
+      } else {
 
-      auto [success, did_flush] = chn->TryFlushForThread(core + 1);
+        auto [success, did_flush] = chn->TryFlushForThread(core + 1);
 
-      // We need to flush no matter what.
-      chn->DoFlush(true);
+        // We need to flush no matter what.
+        chn->DoFlush(true);
+      }
     }
   }
 
@@ -659,13 +1049,27 @@ bool TcpNodeTransport::PeriodicIO(int core)
   return cont_io;
 }
 
+void TcpNodeTransport::DumpStats()
+{
+  auto &conf = node_config();
+  size_t bytes = 0;
+  for (int i = 1; i <= conf.nr_nodes(); i++) {
+    if (i == conf.node_id()) continue;
+    bytes += outgoing_channels.at(i)->DumpStats();
+  }
+  if (bytes > 0) {
+    logger->info("Sent {} bytes, {:.1f} bytes per txn", bytes,
+                 double(bytes) / EpochClient::g_txn_per_epoch);
+  }
+}
+
 void TcpNodeTransport::PrefetchInbound()
 {
   auto &conf = node_config();
   for (int i = 0; i < conf.nr_nodes() - 1; i++) {
     auto recv = incoming_connection.at(i);
     if (!recv->TryLock()) continue;
-    recv->in->OpportunisticReadFromNetwork();
+    recv->in->Prefetch();
     recv->Unlock();
   }
 }
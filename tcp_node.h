@@ -7,6 +7,9 @@
 #include "gopp/channels.h"
 
 namespace felis {
+
+class EpochObject;
+
 namespace tcp {
 class NodeServerRoutine;
 class ReceiverChannel;
@@ -32,7 +35,12 @@ class TcpNodeTransport : public PromiseRoutineTransportService {
    */
   LocalTransport ltp;
   std::atomic_int counters = 0;
+
+  void SendFutureValue(tcp::SendChannel *out, BaseFutureValue *val, const EpochObject &epoch_info);
  public:
+  static bool g_use_io_uring;  /*!< send through io_uring instead of sendmsg() */
+  static bool g_use_shm;  /*!< shared memory rings for nodes on the same host */
+
   TcpNodeTransport();
 
   /**
@@ -46,10 +54,12 @@ class TcpNodeTransport : public PromiseRoutineTransportService {
   void FinishCompletion(int level) final override;
   bool PeriodicIO(int core) final override;
   void PrefetchInbound() final override;
+  void DumpStats() final override;
   uint8_t GetNumberOfNodes() final override {
     return node_config().nr_nodes();
   }
 
+  /** Called when all counter updates from a node have arrived. */
   void OnCounterReceived();
 };
 
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "binpack.h"
+
+using namespace felis;
+
+static std::vector<PackItem> MakeItems(std::initializer_list<unsigned int> weights)
+{
+  std::vector<PackItem> items;
+  for (auto w: weights) items.push_back(PackItem{w});
+  return items;
+}
+
+TEST(BinPackTest, AllPoliciesAssignEveryItem)
+{
+  KnapsackPackingPolicy::g_verbose = false;
+  for (auto name: {"knapsack", "ffd", "locality"}) {
+    std::unique_ptr<PackingPolicy> policy(PackingPolicy::Create(name));
+    ASSERT_NE(policy, nullptr);
+    auto items = MakeItems({9, 7, 6, 5, 5, 4, 3, 2, 2, 1});
+    policy->Pack(items, {}, 4);
+    for (auto &item: items) {
+      EXPECT_GE(item.bin, 0);
+      EXPECT_LT(item.bin, 4);
+    }
+  }
+  EXPECT_EQ(PackingPolicy::Create("nonexistent"), nullptr);
+}
+
+TEST(BinPackTest, FirstFitDecreasingMakespan)
+{
+  FirstFitDecreasingPolicy ffd;
+  auto items = MakeItems({8, 7, 6, 5, 4, 3, 2, 1});
+  ffd.Pack(items, {}, 4);
+  EXPECT_EQ(PackingPolicy::LowerBound(items, 4), 9);
+  EXPECT_EQ(PackingPolicy::Makespan(items, 4), 9);
+}
+
+TEST(BinPackTest, LocalityKeepsCoAccessedRowsTogether)
+{
+  LocalityAwarePackingPolicy locality;
+  auto items = MakeItems({4, 4, 4, 4});
+  std::vector<PackEdge> edges = {{0, 1, 10}, {2, 3, 10}};
+  locality.Pack(items, edges, 2);
+  EXPECT_EQ(items[0].bin, items[1].bin);
+  EXPECT_EQ(items[2].bin, items[3].bin);
+  EXPECT_EQ(PackingPolicy::CrossBinWeight(items, edges), 0);
+  EXPECT_EQ(PackingPolicy::Makespan(items, 2), 8);
+}
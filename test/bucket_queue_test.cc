@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "bucket_queue.h"
+
+using namespace felis;
+
+struct TestEntry : public util::GenericListNode<TestEntry> {
+  uint64_t key;
+};
+
+class BucketQueueTest : public testing::Test {
+ protected:
+  static constexpr size_t kNrBuckets = 256;
+  std::vector<uint8_t> mem;
+  BucketQueue<TestEntry> bq;
+
+  void SetUp() override {
+    mem.resize(BucketQueue<TestEntry>::MemorySize(kNrBuckets));
+    bq.Initialize(mem.data(), kNrBuckets);
+  }
+
+  static uint64_t Key(uint64_t seq, uint64_t node = 1) { return 7ULL << 32 | seq << 8 | node; }
+};
+
+TEST_F(BucketQueueTest, PopsInKeyOrder)
+{
+  std::vector<TestEntry> entries(200);
+  for (size_t i = 0; i < entries.size(); i++) {
+    entries[i].Initialize();
+    entries[i].key = Key(i + 1, i % 3 + 1);
+  }
+  auto shuffled = entries;
+  std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+  for (auto &e: shuffled) bq.Insert(&e);
+
+  EXPECT_EQ(bq.size(), entries.size());
+  uint64_t last = 0;
+  while (!bq.empty()) {
+    auto top = bq.Top();
+    EXPECT_GT(top->key, last);
+    last = top->key;
+    bq.Remove(top);
+  }
+}
+
+TEST_F(BucketQueueTest, SmallerKeyMovesCursorBack)
+{
+  TestEntry a, b, c;
+  a.Initialize(); a.key = Key(50);
+  b.Initialize(); b.key = Key(10);
+  c.Initialize(); c.key = Key(30);
+
+  bq.Insert(&a);
+  EXPECT_EQ(bq.Top(), &a);
+  bq.Insert(&b);
+  EXPECT_EQ(bq.Top(), &b);
+  bq.Remove(&b);
+  bq.Insert(&c);
+  EXPECT_EQ(bq.Top(), &c);
+  EXPECT_EQ(bq.Bottom(), &a);
+  EXPECT_EQ(bq.Find(Key(30)), &c);
+  EXPECT_EQ(bq.Find(Key(31)), nullptr);
+}
+
+TEST_F(BucketQueueTest, OverflowBucketStaysSorted)
+{
+  // Sequence numbers beyond the last bucket share it.
+  std::vector<TestEntry> entries(4);
+  uint64_t seqs[] = {1000, 300, 700, 255};
+  for (int i = 0; i < 4; i++) {
+    entries[i].Initialize();
+    entries[i].key = Key(seqs[i]);
+    bq.Insert(&entries[i]);
+  }
+  EXPECT_EQ(bq.Top()->key, Key(255));
+  bq.Remove(bq.Top());
+  EXPECT_EQ(bq.Top()->key, Key(300));
+  EXPECT_EQ(bq.Bottom()->key, Key(1000));
+  EXPECT_EQ(bq.Find(Key(700)), &entries[2]);
+}
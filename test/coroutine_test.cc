@@ -98,3 +98,27 @@ TEST(CoroutineSymmetricSwitchTest, Test)
 }
 
 
+
+TEST(CoroutineStackPoolTest, Test)
+{
+    coro_thread_init(nullptr);
+    coro_stack_pool pool;
+    coro_stack_pool_init(&pool, 1024, 64 * 1024, true);
+
+    // Run on a stack in the middle of the pool, release it, and run again.
+    coro_shared_stack stack;
+    coro_stack_pool_get(&pool, 513, &stack);
+    EXPECT_EQ(stack.size, 64 * 1024);
+    EXPECT_EQ((uint8_t *) stack.ptr, (uint8_t *) pool.base + 513 * pool.stride + pool.guard_size);
+
+    for (int round = 0; round < 2; round++) {
+        intptr_t x = 0;
+        coro_stack_prepare(&stack);
+        coroutine *co = coro_create(coro_get_co(), &stack, coro_test_func2, &x);
+        while (!co->is_finished) coro_resume(co);
+        EXPECT_EQ(x, 100);
+        free(co);
+        coro_stack_pool_release(&pool, 513);
+    }
+    coro_stack_pool_destroy(&pool);
+}
@@ -0,0 +1,98 @@
+// -*- c++ -*-
+
+#ifndef TEST_DBTEST_UTIL_H
+#define TEST_DBTEST_UTIL_H
+
+#include "console.h"
+#include "epoch.h"
+#include "log.h"
+#include "mem.h"
+#include "node_config.h"
+#include "vhandle.h"
+#include "vhandle_sync.h"
+
+// The tests in dbtest share one process, and these can only be set up once.
+
+namespace felis {
+
+static constexpr int kTestNrThreads = 4;
+
+inline void InitTestLogger()
+{
+  if (!logger) InitializeLogger("dbtest");
+}
+
+// A single node, configured the way the controller would.
+inline void ConfigureSingleNode()
+{
+  static bool configured = false;
+  if (configured) return;
+  configured = true;
+  InitTestLogger();
+
+  json11::Json peer = json11::Json::object({{"host", "127.0.0.1"}, {"port", 0}});
+  util::Instance<Console>().HandleJsonAPI(json11::Json::object({
+        {"type", "status_change"},
+        {"status", "configuring"},
+        {"nodes", json11::Json::array({
+              json11::Json::object({
+                  {"name", "host1"},
+                  {"worker", peer},
+                  {"index_shipper", peer},
+                  {"row_shipper", peer},
+                }),
+            })},
+      }));
+  NodeConfiguration::g_nr_threads = 2;
+  util::Instance<NodeConfiguration>().SetupNodeName("host1");
+}
+
+// Rows for the indexes, VarStrs up to 128 bytes and version arrays, allocated
+// from kTestNrThreads cores. Threads must call
+// mem::ParallelPool::SetCurrentAffinity() before they insert.
+inline void InitRowPool()
+{
+  static bool initialized = false;
+  if (initialized) return;
+  initialized = true;
+  InitTestLogger();
+
+  // InitSlab() splits the memory by NUMA node, so we need at least one.
+  mem::InitTotalNumberOfCores(mem::kNrCorePerNode);
+  mem::InitSlab(1ULL << 30);
+  VHandle::InitPool();
+
+  auto &region = mem::GetDataRegion();
+  for (size_t sz = 32; sz <= 128; sz *= 2)
+    region.set_pool_capacity(sz, 256 << 10);
+  // Version arrays of rows with up to 256 versions.
+  for (size_t sz = 256; sz <= 4096; sz *= 2)
+    region.set_pool_capacity(sz, 4 << 10);
+  region.InitPools();
+}
+
+// Only the epoch number, for the code that retires memory by epoch.
+inline void InitEpochManager()
+{
+  static bool initialized = false;
+  if (initialized) return;
+  initialized = true;
+  ConfigureSingleNode();
+
+  util::InstanceInit<EpochManager>();
+}
+
+// For InitVersion() on the rows.
+inline void InitVersionSync()
+{
+  static bool initialized = false;
+  if (initialized) return;
+  initialized = true;
+  ConfigureSingleNode();
+
+  util::InstanceInit<SpinnerSlot>();
+}
+
+}
+
+#endif
@@ -0,0 +1,367 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "index.h"
+#include "test/dbtest_util.h"
+
+namespace felis {
+
+namespace {
+
+std::unique_ptr<HashtableIndex> NewIndex(size_t nr_buckets, HashFunc hash = DefaultHash)
+{
+  auto index = std::make_unique<HashtableIndex>(std::make_tuple(hash, nr_buckets, false));
+  index->set_id(0);
+  return index;
+}
+
+std::vector<uint64_t> GenerateKeys(size_t nr_keys, uint64_t seed = 0xdeadbeef)
+{
+  std::vector<uint64_t> keys(nr_keys);
+  std::mt19937_64 rand(seed);
+  for (auto &k: keys) k = rand();
+  return keys;
+}
+
+VarStrView KeyView(const uint64_t &k)
+{
+  return VarStrView(sizeof(uint64_t), (const uint8_t *) &k);
+}
+
+VarStrView KeyView(const std::string &k)
+{
+  return VarStrView(k.length(), (const uint8_t *) k.data());
+}
+
+// Longer than HashEntry::kInlineKeySize, all with the same prefix, so that
+// only the out of line copy tells them apart.
+std::vector<std::string> GenerateLongKeys(size_t nr_keys)
+{
+  std::vector<std::string> keys;
+  std::mt19937 rand(0xdeadbeef);
+  for (size_t i = 0; i < nr_keys; i++) {
+    auto len = HashEntry::kInlineKeySize + 1 + rand() % 48;
+    std::string k(len, 'x');
+    auto id = std::to_string(i);
+    std::copy(id.begin(), id.end(), k.end() - id.length());
+    keys.push_back(k);
+  }
+  return keys;
+}
+
+// Every key in the same chain, with the same hash.
+uint32_t CollidingHash(const VarStrView &k)
+{
+  return 0;
+}
+
+template <typename Func>
+void RunOnThreads(int nr_threads, Func f)
+{
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nr_threads; t++) {
+    threads.emplace_back(
+        [t, &f]() {
+          mem::ParallelPool::SetCurrentAffinity(t);
+          f(t);
+          mem::ParallelPool::SetCurrentAffinity(-1);
+        });
+  }
+  for (auto &th: threads) th.join();
+}
+
+class HashtableIndexTest : public testing::Test {
+ public:
+  void SetUp() final override {
+    InitRowPool();
+    InitEpochManager();
+  }
+  void TearDown() final override {
+    // Freeing rows needs a core.
+    RunOnThreads(1, [](int t) { HashtableIndex::ReclaimRetired(std::numeric_limits<uint64_t>::max()); });
+  }
+};
+
+}
+
+// Every thread inserts every key, each in its own order, so most inserts race
+// with another insert of the same key, and the table doubles many times.
+TEST_F(HashtableIndexTest, ConcurrentInsertCreatesOnce)
+{
+  auto index = NewIndex(64);
+  auto keys = GenerateKeys(1 << 16);
+  std::vector<std::vector<VHandle *>> rows(kTestNrThreads, std::vector<VHandle *>(keys.size()));
+  std::vector<std::atomic_int> nr_created(keys.size());
+
+  RunOnThreads(
+      kTestNrThreads,
+      [&](int t) {
+        std::vector<size_t> order(keys.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937(t));
+        for (auto i: order) {
+          bool created = false;
+          rows[t][i] = index->SearchOrCreate(KeyView(keys[i]), &created);
+          if (created) nr_created[i].fetch_add(1);
+        }
+      });
+
+  EXPECT_GT(index->nr_buckets(), 64u);
+  std::unordered_set<VHandle *> distinct;
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(nr_created[i].load(), 1) << "key " << i;
+    for (int t = 1; t < kTestNrThreads; t++)
+      ASSERT_EQ(rows[t][i], rows[0][i]) << "key " << i;
+    ASSERT_EQ(index->Search(KeyView(keys[i])), rows[0][i]) << "key " << i;
+    distinct.insert(rows[0][i]);
+  }
+  EXPECT_EQ(distinct.size(), keys.size());
+}
+
+// Half of the threads look up the keys inserted up front, while the other half
+// insert enough keys to double the table under them.
+TEST_F(HashtableIndexTest, SearchDuringResize)
+{
+  auto index = NewIndex(64);
+  auto keys = GenerateKeys(1 << 17);
+  auto nr_loaded = keys.size() / 4;
+  std::vector<VHandle *> rows(keys.size());
+
+  RunOnThreads(
+      kTestNrThreads,
+      [&](int t) {
+        for (size_t i = t; i < nr_loaded; i += kTestNrThreads)
+          rows[i] = index->SearchOrCreate(KeyView(keys[i]));
+      });
+  auto nr_buckets = index->nr_buckets();
+
+  constexpr int kNrInserters = kTestNrThreads / 2;
+  std::atomic_int nr_inserting = kNrInserters;
+  std::atomic_long nr_mismatches = 0;
+  RunOnThreads(
+      kTestNrThreads,
+      [&](int t) {
+        if (t < kNrInserters) {
+          for (size_t i = nr_loaded + t; i < keys.size(); i += kNrInserters)
+            rows[i] = index->SearchOrCreate(KeyView(keys[i]));
+          nr_inserting.fetch_sub(1);
+          return;
+        }
+        // Keep looking until the inserters are done, at least once.
+        do {
+          for (size_t i = t - kNrInserters; i < nr_loaded; i += kTestNrThreads - kNrInserters) {
+            if (index->Search(KeyView(keys[i])) != rows[i])
+              nr_mismatches.fetch_add(1);
+          }
+        } while (nr_inserting.load() > 0);
+      });
+
+  EXPECT_EQ(nr_mismatches.load(), 0);
+  EXPECT_GT(index->nr_buckets(), nr_buckets);
+
+  std::unordered_set<VHandle *> distinct;
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(index->Search(KeyView(keys[i])), rows[i]) << "key " << i;
+    distinct.insert(rows[i]);
+  }
+  EXPECT_EQ(distinct.size(), keys.size());
+
+  for (auto k: GenerateKeys(1024, 0xbadf00d))
+    EXPECT_EQ(index->Search(KeyView(k)), nullptr);
+}
+
+// Same as ConcurrentInsertCreatesOnce, with keys that are stored out of
+// line. The threads that lose a race free the key they copied.
+TEST_F(HashtableIndexTest, ConcurrentInsertLongKeys)
+{
+  auto index = NewIndex(64);
+  auto keys = GenerateLongKeys(1 << 14);
+  std::vector<std::vector<VHandle *>> rows(kTestNrThreads, std::vector<VHandle *>(keys.size()));
+  std::vector<std::atomic_int> nr_created(keys.size());
+
+  RunOnThreads(
+      kTestNrThreads,
+      [&](int t) {
+        std::vector<size_t> order(keys.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937(t));
+        for (auto i: order) {
+          bool created = false;
+          rows[t][i] = index->SearchOrCreate(KeyView(keys[i]), &created);
+          if (created) nr_created[i].fetch_add(1);
+        }
+      });
+
+  std::unordered_set<VHandle *> distinct;
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(nr_created[i].load(), 1) << keys[i];
+    for (int t = 1; t < kTestNrThreads; t++)
+      ASSERT_EQ(rows[t][i], rows[0][i]) << keys[i];
+    ASSERT_EQ(index->Search(KeyView(keys[i])), rows[0][i]) << keys[i];
+
+    auto e = HashEntry::OfRow(rows[0][i]);
+    ASSERT_TRUE(e->is_long_key());
+    EXPECT_EQ(std::string((const char *) e->long_key()->data(), e->long_key()->length()), keys[i]);
+    distinct.insert(rows[0][i]);
+  }
+  EXPECT_EQ(distinct.size(), keys.size());
+
+  // Same prefix and length as a key we have, but not the same key.
+  for (auto k: keys) {
+    k[HashEntry::kPrefixSize] = 'y';
+    EXPECT_EQ(index->Search(KeyView(k)), nullptr) << k;
+  }
+}
+
+// With one chain, every lookup compares against keys that only differ after
+// the prefix, or only in their length.
+TEST_F(HashtableIndexTest, CollidingKeys)
+{
+  auto index = NewIndex(64, CollidingHash);
+  std::vector<std::string> keys;
+  const size_t lens[] = {HashEntry::kPrefixSize, HashEntry::kInlineKeySize - 1, HashEntry::kInlineKeySize,
+                         HashEntry::kInlineKeySize + 1, 4 * HashEntry::kInlineKeySize};
+  for (auto len: lens) {
+    for (char c = 'a'; c <= 'z'; c++) {
+      // All 'x' is what we look up below, and should not find.
+      if (c == 'x') continue;
+      std::string k(len, 'x');
+      k.back() = c;
+      keys.push_back(k);
+    }
+  }
+  // Zero padded, these would be the same as an inline key.
+  keys.push_back(std::string(HashEntry::kInlineKeySize - 1, 'x') + std::string(1, '\0'));
+  keys.push_back(std::string(HashEntry::kInlineKeySize, 'x') + std::string(1, '\0'));
+
+  std::vector<VHandle *> rows;
+  RunOnThreads(
+      1,
+      [&](int t) {
+        for (auto &k: keys) {
+          bool created = false;
+          rows.push_back(index->SearchOrCreate(KeyView(k), &created));
+          EXPECT_TRUE(created) << k;
+        }
+        for (size_t i = 0; i < keys.size(); i++) {
+          bool created = true;
+          EXPECT_EQ(index->SearchOrCreate(KeyView(keys[i]), &created), rows[i]) << keys[i];
+          EXPECT_FALSE(created) << keys[i];
+        }
+      });
+  for (size_t i = 0; i < keys.size(); i++)
+    EXPECT_EQ(index->Search(KeyView(keys[i])), rows[i]) << keys[i];
+  EXPECT_EQ(std::unordered_set<VHandle *>(rows.begin(), rows.end()).size(), keys.size());
+  for (auto len: lens)
+    EXPECT_EQ(index->Search(KeyView(std::string(len, 'x'))), nullptr) << len;
+  EXPECT_EQ(index->Search(KeyView(std::string(HashEntry::kInlineKeySize + 2, 'x'))), nullptr);
+}
+
+// Two threads race to delete every other key that was loaded up front, and
+// check its neighbor is still there after each delete. The other two insert
+// enough new keys to double the table under them.
+TEST_F(HashtableIndexTest, ConcurrentDeleteInsertResize)
+{
+  auto index = NewIndex(64);
+  auto keys = GenerateKeys(1 << 16);
+  auto nr_loaded = keys.size() / 2;
+  std::vector<VHandle *> rows(keys.size());
+  std::vector<std::atomic_int> nr_deleted(nr_loaded);
+
+  RunOnThreads(
+      kTestNrThreads,
+      [&](int t) {
+        for (size_t i = t; i < nr_loaded; i += kTestNrThreads)
+          rows[i] = index->SearchOrCreate(KeyView(keys[i]));
+      });
+  auto nr_buckets = index->nr_buckets();
+  ASSERT_EQ(HashtableIndex::nr_retired_rows(), 0u);
+
+  constexpr int kNrInserters = kTestNrThreads / 2;
+  std::atomic_long nr_mismatches = 0;
+  RunOnThreads(
+      kTestNrThreads,
+      [&](int t) {
+        if (t < kNrInserters) {
+          for (size_t i = nr_loaded + t; i < keys.size(); i += kNrInserters)
+            rows[i] = index->SearchOrCreate(KeyView(keys[i]));
+          return;
+        }
+        std::vector<size_t> order;
+        for (size_t i = 0; i < nr_loaded; i += 2) order.push_back(i);
+        std::shuffle(order.begin(), order.end(), std::mt19937(t));
+        for (auto i: order) {
+          if (index->Delete(KeyView(keys[i])))
+            nr_deleted[i].fetch_add(1);
+          if (index->Search(KeyView(keys[i + 1])) != rows[i + 1])
+            nr_mismatches.fetch_add(1);
+        }
+      });
+
+  EXPECT_EQ(nr_mismatches.load(), 0);
+  EXPECT_GT(index->nr_buckets(), nr_buckets);
+  EXPECT_EQ(HashtableIndex::nr_retired_rows(), nr_loaded / 2);
+
+  std::unordered_set<VHandle *> distinct;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (i < nr_loaded && i % 2 == 0) {
+      ASSERT_EQ(nr_deleted[i].load(), 1) << "key " << i;
+      ASSERT_EQ(index->Search(KeyView(keys[i])), nullptr) << "key " << i;
+      continue;
+    }
+    ASSERT_EQ(index->Search(KeyView(keys[i])), rows[i]) << "key " << i;
+    distinct.insert(rows[i]);
+  }
+  EXPECT_EQ(distinct.size(), keys.size() - nr_loaded / 2);
+
+  // A deleted key can be inserted again, as a new row.
+  RunOnThreads(
+      1,
+      [&](int t) {
+        bool created = false;
+        auto row = index->SearchOrCreate(KeyView(keys[0]), &created);
+        EXPECT_TRUE(created);
+        EXPECT_NE(row, rows[0]);
+        EXPECT_EQ(index->Search(KeyView(keys[0])), row);
+        EXPECT_FALSE(index->Delete(KeyView(keys[2])));
+      });
+}
+
+// Rows deleted in an epoch, long keys and all, stay around until a later
+// epoch begins.
+TEST_F(HashtableIndexTest, ReclaimRetiredWaitsForEpoch)
+{
+  auto index = NewIndex(64);
+  auto keys = GenerateLongKeys(64);
+  auto epoch_nr = util::Instance<EpochManager>().current_epoch_nr();
+  std::vector<VHandle *> rows;
+
+  RunOnThreads(
+      1,
+      [&](int t) {
+        for (auto &k: keys) rows.push_back(index->SearchOrCreate(KeyView(k)));
+        for (auto &k: keys) EXPECT_TRUE(index->Delete(KeyView(k))) << k;
+        EXPECT_EQ(HashtableIndex::nr_retired_rows(), keys.size());
+
+        HashtableIndex::ReclaimRetired(epoch_nr);
+        ASSERT_EQ(HashtableIndex::nr_retired_rows(), keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+          auto e = HashEntry::OfRow(rows[i]);
+          EXPECT_EQ(std::string((const char *) e->long_key()->data(), e->long_key()->length()), keys[i]);
+          EXPECT_EQ(index->Search(KeyView(keys[i])), nullptr) << keys[i];
+        }
+
+        HashtableIndex::ReclaimRetired(epoch_nr + 1);
+        EXPECT_EQ(HashtableIndex::nr_retired_rows(), 0u);
+      });
+}
+
+}
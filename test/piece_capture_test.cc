@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "piece_cc.h"
+#include "txn.h"
+#include "test/dbtest_util.h"
+
+namespace felis {
+
+namespace {
+
+using IndexOpContext = BaseTxn::BaseTxnIndexOpContext;
+
+constexpr int kNrKeys = 4;
+std::vector<std::string> g_keys;
+
+std::string KeyOf(int i)
+{
+  return "warehouse " + std::to_string(i) + " district " + std::to_string(i * 7);
+}
+
+// Like Txn::TxnIndexOpWithNodeBitmap() in Prepare(): the keys live on the
+// stack of the caller, and the context only points to them.
+__attribute__((noinline)) PieceRoutine *AttachIndexOp(PieceCollection *root)
+{
+  char keys[kNrKeys][64];
+  IndexOpContext ctx;
+  ctx.handle = BaseTxn::BaseTxnHandle((1ULL << 32) + 5, 1);
+  ctx.state = EpochObject(1, 1, 0);
+  ctx.keys_bitmap = (1 << kNrKeys) - 1;
+  ctx.slices_bitmap = ctx.rels_bitmap = 0;
+  ctx.node_id = ctx.src_node_id = 1;
+  for (int i = 0; i < kNrKeys; i++) {
+    auto k = KeyOf(i);
+    memcpy(keys[i], k.data(), k.length());
+    ctx.key_len[i] = k.length();
+    ctx.key_data[i] = (const uint8_t *) keys[i];
+  }
+  return root->AttachRoutine(
+      ctx, 1,
+      [](const IndexOpContext &ctx) {
+        for (int i = 0; i < __builtin_popcount(ctx.keys_bitmap); i++)
+          g_keys.emplace_back((const char *) ctx.key_data[i], ctx.key_len[i]);
+      });
+}
+
+// Prepare() of the next transactions in the batch.
+__attribute__((noinline)) void ClobberStack()
+{
+  volatile char buf[8192];
+  for (size_t i = 0; i < sizeof(buf); i++) buf[i] = 'z';
+}
+
+class PieceCaptureTest : public testing::Test {
+ public:
+  void SetUp() final override {
+    ConfigureSingleNode();
+    g_keys.clear();
+  }
+};
+
+void ExpectKeys()
+{
+  ASSERT_EQ(g_keys.size(), kNrKeys);
+  for (int i = 0; i < kNrKeys; i++) EXPECT_EQ(g_keys[i], KeyOf(i));
+}
+
+}
+
+static_assert(!LiveCapture<IndexOpContext>::value);
+static_assert(LiveCapture<sql::Tuple<int, VHandle *>>::value);
+
+TEST_F(PieceCaptureTest, IndexOpRunsAfterPrepare)
+{
+  auto root = new PieceCollection();
+  auto r = AttachIndexOp(root);
+  ClobberStack();
+
+  r->callback(r);
+  ExpectKeys();
+}
+
+TEST_F(PieceCaptureTest, IndexOpShipsAfterPrepare)
+{
+  auto root = new PieceCollection();
+  auto r = AttachIndexOp(root);
+  ClobberStack();
+
+  std::vector<uint8_t> buf(r->NodeSize());
+  auto end = r->EncodeNode(buf.data());
+  ASSERT_LE(end - buf.data(), buf.size());
+  ClobberStack();
+
+  auto received = PieceRoutine::CreateFromPacket(buf.data(), util::Align(end - buf.data(), 8));
+  buf.assign(buf.size(), 0);
+  received->callback(received);
+  ExpectKeys();
+}
+
+}
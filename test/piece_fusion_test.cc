@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include <numeric>
+#include <vector>
+
+#include "node_config.h"
+#include "piece.h"
+#include "test/dbtest_util.h"
+
+namespace felis {
+
+namespace {
+
+std::vector<int> g_ran;
+
+PieceRoutine *NewPiece(int tag, uint64_t affinity)
+{
+  auto r = PieceRoutine::CreateFromCapture(sizeof(int));
+  memcpy(r->capture_data, &tag, sizeof(int));
+  r->node_id = 0;
+  r->affinity = affinity;
+  r->callback = [](PieceRoutine *r) {
+    int tag;
+    memcpy(&tag, r->capture_data, sizeof(int));
+    g_ran.push_back(tag);
+  };
+  return r;
+}
+
+class PieceFusionTest : public testing::Test {
+ public:
+  void SetUp() final override {
+    ConfigureSingleNode();
+    BasePieceCollection::g_piece_fusion = true;
+    g_ran.clear();
+  }
+  void TearDown() final override {
+    BasePieceCollection::g_piece_fusion = false;
+  }
+};
+
+}
+
+// Same order as CallTxnsWorker: fuse, collect the buffer plan, then run every
+// routine once and report one completion for each, like the executor does.
+TEST_F(PieceFusionTest, CompletionsMatchBufferPlan)
+{
+  auto &conf = util::Instance<NodeConfiguration>();
+  auto root = new BasePieceCollection();
+  int tag = 0;
+  for (int i = 0; i < 3; i++) root->Add(NewPiece(tag++, 0));
+  for (int i = 0; i < 2; i++) root->Add(NewPiece(tag++, 1));
+  root->Add(NewPiece(tag++, 0));
+  for (int i = 0; i < BasePieceCollection::kMaxFusedPieces + 2; i++)
+    root->Add(NewPiece(tag++, 1));
+
+  EXPECT_EQ(root->Fuse(), 3 + 2 + BasePieceCollection::kMaxFusedPieces + 2);
+  // 3, 2 and 1 pieces, then kMaxFusedPieces and the remaining 2.
+  EXPECT_EQ(root->nr_routines(), 5);
+
+  std::vector<unsigned long> cnts(PromiseRoutineTransportService::kPromiseMaxLevels, 0);
+  conf.CollectBufferPlan(root, cnts.data());
+  auto planned = std::accumulate(cnts.begin(), cnts.end(), 0UL);
+
+  unsigned long completed = 0;
+  for (size_t i = 0; i < root->nr_routines(); i++) {
+    auto r = root->routine(i);
+    r->callback(r);
+    completed++;
+  }
+  EXPECT_EQ(completed, planned);
+
+  // Every absorbed piece ran exactly once, in the order it was issued.
+  ASSERT_EQ(g_ran.size(), tag);
+  for (int i = 0; i < tag; i++) EXPECT_EQ(g_ran[i], i);
+}
+
+TEST_F(PieceFusionTest, NothingToFuse)
+{
+  auto &conf = util::Instance<NodeConfiguration>();
+  auto root = new BasePieceCollection();
+  for (int i = 0; i < 4; i++) root->Add(NewPiece(i, i % 2));
+
+  EXPECT_EQ(root->Fuse(), 0);
+  EXPECT_EQ(root->nr_routines(), 4);
+
+  std::vector<unsigned long> cnts(PromiseRoutineTransportService::kPromiseMaxLevels, 0);
+  conf.CollectBufferPlan(root, cnts.data());
+  EXPECT_EQ(std::accumulate(cnts.begin(), cnts.end(), 0UL), 4);
+}
+
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "piece_task.h"
+
+using namespace felis;
+
+// Suspends until flag is set, and records the handle to resume, the way
+// TaskSched parks a task.
+struct FlagAwaiter {
+  bool &flag;
+  std::coroutine_handle<> &parked;
+
+  bool await_ready() { return flag; }
+  void await_suspend(std::coroutine_handle<> h) { parked = h; }
+  void await_resume() {}
+};
+
+static PieceTask Leaf(bool &flag, std::coroutine_handle<> &parked, std::vector<int> &trace)
+{
+  trace.push_back(1);
+  co_await FlagAwaiter{flag, parked};
+  trace.push_back(2);
+}
+
+static PieceTask Root(bool &flag, std::coroutine_handle<> &parked, std::vector<int> &trace)
+{
+  trace.push_back(0);
+  co_await Leaf(flag, parked, trace);
+  trace.push_back(3);
+}
+
+TEST(PieceTaskTest, NestedTaskResumesCaller)
+{
+  bool flag = false;
+  std::coroutine_handle<> parked;
+  std::vector<int> trace;
+
+  auto task = Root(flag, parked, trace);
+  EXPECT_TRUE(trace.empty()); // lazily started
+
+  auto h = task.release();
+  h.resume();
+  EXPECT_EQ(trace, std::vector<int>({0, 1}));
+  EXPECT_FALSE(h.done());
+  ASSERT_TRUE(parked);
+
+  // Resuming the innermost handle finishes both.
+  flag = true;
+  parked.resume();
+  EXPECT_EQ(trace, std::vector<int>({0, 1, 2, 3}));
+  EXPECT_TRUE(h.done());
+  h.destroy();
+}
+
+TEST(PieceTaskTest, ReadyAwaiterDoesNotSuspend)
+{
+  bool flag = true;
+  std::coroutine_handle<> parked;
+  std::vector<int> trace;
+
+  auto task = Root(flag, parked, trace);
+  auto h = task.release();
+  h.resume();
+  EXPECT_TRUE(h.done());
+  EXPECT_FALSE(parked);
+  h.destroy();
+}
+
+TEST(PieceTaskTest, FramesAreRecycled)
+{
+  bool flag = true;
+  std::coroutine_handle<> parked;
+  std::vector<int> trace;
+
+  void *first = nullptr;
+  for (int i = 0; i < 4; i++) {
+    auto task = Root(flag, parked, trace);
+    auto h = task.release();
+    if (i == 0)
+      first = h.address();
+    else
+      EXPECT_EQ(h.address(), first);
+    h.resume();
+    h.destroy();
+  }
+}
@@ -0,0 +1,229 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "index.h"
+#include "secondary_index.h"
+#include "test/dbtest_util.h"
+
+namespace felis {
+
+namespace {
+
+// Big endian, so that the encoded keys sort like the numbers.
+struct U32Pair {
+  uint32_t hi, lo;
+
+  std::string Bytes() const {
+    uint32_t be[] = {__builtin_bswap32(hi), __builtin_bswap32(lo)};
+    return std::string((const char *) be, sizeof(be));
+  }
+  VarStr *Encode() const {
+    auto b = Bytes();
+    auto s = VarStr::New(b.length());
+    memcpy(s->data(), b.data(), b.length());
+    return s;
+  }
+  static U32Pair Decode(const uint8_t *p) {
+    uint32_t be[2];
+    memcpy(be, p, sizeof(be));
+    return U32Pair{__builtin_bswap32(be[0]), __builtin_bswap32(be[1])};
+  }
+};
+
+struct Person {
+  uint32_t group;
+  uint32_t age;
+};
+
+// Records the keys in the order Flush() inserts them.
+class RecordingIndex final : public Table {
+  std::map<std::string, VHandle *> rows;
+ public:
+  std::vector<std::string> applied;
+
+  RecordingIndex(std::tuple<> conf) : Table() {}
+
+  VHandle *SearchOrCreate(const VarStrView &k, bool *created) override {
+    std::string key((const char *) k.data(), k.length());
+    applied.push_back(key);
+    auto &row = rows[key];
+    *created = (row == nullptr);
+    if (*created) row = NewRow();
+    return row;
+  }
+  VHandle *SearchOrCreate(const VarStrView &k) override {
+    bool unused = false;
+    return SearchOrCreate(k, &unused);
+  }
+  VHandle *Search(const VarStrView &k) override {
+    auto it = rows.find(std::string((const char *) k.data(), k.length()));
+    return it == rows.end() ? nullptr : it->second;
+  }
+  size_t size() const { return rows.size(); }
+};
+
+// Primary table, keyed by id. It's never created, only reported.
+struct People {
+  static constexpr int kTable = TableManager::kMaxNrRelations - 2;
+  using Key = uint32_t;
+  using Value = Person;
+};
+
+// (group, id) -> (age, id)
+struct PeopleByGroup {
+  static constexpr int kTable = TableManager::kMaxNrRelations - 1;
+  static constexpr auto kIndexArgs = std::make_tuple();
+  using IndexBackend = RecordingIndex;
+  using Key = U32Pair;
+  using Value = U32Pair;
+
+  using Primary = People;
+  static Key IndexKey(const Primary::Key &k, const Primary::Value &v) {
+    return Key{v.group, k};
+  }
+  static Value IndexValue(const Primary::Key &k, const Primary::Value &v) {
+    return Value{v.age, k};
+  }
+};
+
+}
+
+SHARD_TABLE(PeopleByGroup) { return 0; }
+
+namespace {
+
+Person PersonOf(uint32_t id)
+{
+  return Person{id * 2654435761U % 97, id % 80};
+}
+
+class SecondaryIndexTest : public testing::Test {
+ public:
+  void SetUp() final override {
+    InitRowPool();
+    InitVersionSync();
+
+    static bool created = false;
+    if (!created) {
+      util::Instance<SecondaryIndexManager>().Create<PeopleByGroup>();
+      created = true;
+    }
+  }
+};
+
+}
+
+// Each loader thread reports an overlapping range of people, in its own order.
+// Flush() has to insert every index entry once, in key order.
+TEST_F(SecondaryIndexTest, FlushSortsAndDeduplicates)
+{
+  auto &mgr = util::Instance<SecondaryIndexManager>();
+  auto &index = util::Instance<TableManager>().Get<PeopleByGroup>();
+  constexpr uint32_t kNrPerThread = 4096;
+  constexpr uint32_t kNrPeople = (kTestNrThreads + 1) * kNrPerThread / 2;
+
+  ASSERT_TRUE(mgr.HasIndex(People::kTable));
+  ASSERT_FALSE(mgr.HasIndex(PeopleByGroup::kTable));
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kTestNrThreads; t++) {
+    threads.emplace_back(
+        [t, &mgr]() {
+          // The entries are VarStrs.
+          mem::ParallelPool::SetCurrentAffinity(t);
+          std::vector<uint32_t> ids;
+          for (uint32_t i = 0; i < kNrPerThread; i++) ids.push_back(t * kNrPerThread / 2 + i);
+          std::shuffle(ids.begin(), ids.end(), std::mt19937(t));
+          for (auto id: ids)
+            mgr.OnInsert<People>(id, PersonOf(id));
+          mem::ParallelPool::SetCurrentAffinity(-1);
+        });
+  }
+  for (auto &th: threads) th.join();
+  EXPECT_EQ(index.size(), 0u);
+
+  mem::ParallelPool::SetCurrentAffinity(0);
+  mgr.Flush();
+  mem::ParallelPool::SetCurrentAffinity(-1);
+
+  // Every report is inserted, the duplicates after the first one are found.
+  EXPECT_EQ(index.applied.size(), kTestNrThreads * kNrPerThread);
+  EXPECT_TRUE(std::is_sorted(index.applied.begin(), index.applied.end()));
+  EXPECT_EQ(index.size(), kNrPeople);
+
+  for (uint32_t id = 0; id < kNrPeople; id++) {
+    auto p = PersonOf(id);
+    auto k = U32Pair{p.group, id}.Bytes();
+    auto row = index.Search(VarStrView(k.length(), (const uint8_t *) k.data()));
+    ASSERT_NE(row, nullptr) << id;
+    auto v = row->ReadExactVersion(0);
+    ASSERT_EQ(v->length(), 2 * sizeof(uint32_t));
+    auto value = U32Pair::Decode(v->data());
+    EXPECT_EQ(value.hi, p.age) << id;
+    EXPECT_EQ(value.lo, id) << id;
+  }
+
+  // Nothing is left for the next Flush().
+  index.applied.clear();
+  mgr.Flush();
+  EXPECT_TRUE(index.applied.empty());
+}
+
+// Like NewOrder: the txns report their inserts from the Insert phase, and each
+// index entry becomes a version at the sid of its txn.
+TEST_F(SecondaryIndexTest, FlushVersionsTxnInserts)
+{
+  auto &mgr = util::Instance<SecondaryIndexManager>();
+  auto &index = util::Instance<TableManager>().Get<PeopleByGroup>();
+  constexpr uint32_t kNrPerThread = 1024;
+  constexpr uint32_t kFirstId = 1 << 20;
+  auto nr_rows = index.size();
+  auto SidOf = [](uint32_t id) { return (1ULL << 32) | ((id - kFirstId + 1) << 8) | 1; };
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kTestNrThreads; t++) {
+    threads.emplace_back(
+        [t, &mgr, SidOf]() {
+          mem::ParallelPool::SetCurrentAffinity(t);
+          for (uint32_t i = 0; i < kNrPerThread; i++) {
+            uint32_t id = kFirstId + i * kTestNrThreads + t;
+            mgr.OnInsert<People>(SidOf(id), id, PersonOf(id));
+          }
+          mem::ParallelPool::SetCurrentAffinity(-1);
+        });
+  }
+  for (auto &th: threads) th.join();
+  EXPECT_EQ(index.size(), nr_rows);
+
+  mem::ParallelPool::SetCurrentAffinity(0);
+  mgr.Flush();
+  mem::ParallelPool::SetCurrentAffinity(-1);
+  EXPECT_EQ(index.size(), nr_rows + kTestNrThreads * kNrPerThread);
+
+  for (uint32_t id = kFirstId; id < kFirstId + kTestNrThreads * kNrPerThread; id++) {
+    auto p = PersonOf(id);
+    auto sid = SidOf(id);
+    auto k = U32Pair{p.group, id}.Bytes();
+    auto row = index.Search(VarStrView(k.length(), (const uint8_t *) k.data()));
+    ASSERT_NE(row, nullptr) << id;
+    ASSERT_EQ(row->nr_versions(), 1u) << id;
+    EXPECT_EQ(row->first_version(), sid) << id;
+
+    // Visible to the later txns of the epoch only.
+    EXPECT_TRUE(row->ShouldScanSkip(sid)) << id;
+    EXPECT_FALSE(row->ShouldScanSkip(sid + 1)) << id;
+    auto v = row->ReadWithVersion(sid + 1);
+    ASSERT_NE(v, nullptr) << id;
+    auto value = U32Pair::Decode(v->data());
+    EXPECT_EQ(value.hi, p.age) << id;
+    EXPECT_EQ(value.lo, id) << id;
+  }
+}
+
+}
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shm_ring.h"
+
+using namespace felis;
+
+static std::string TestRingName(const char *tag)
+{
+  return "/felis-test-" + std::to_string(getpid()) + "-" + tag;
+}
+
+TEST(ShmRingTest, OpenSeesWhatCreateWrites)
+{
+  auto name = TestRingName("open");
+  auto tx = ShmRing::Create(name, 4096);
+  ASSERT_NE(tx, nullptr);
+  auto rx = ShmRing::Open(name);
+  ASSERT_NE(rx, nullptr);
+  EXPECT_EQ(rx->ring_capacity(), 4096);
+
+  // Open() unlinks the name.
+  EXPECT_EQ(ShmRing::Open(name), nullptr);
+
+  const char msg[] = "hello";
+  EXPECT_EQ(tx->Write(msg, sizeof(msg)), sizeof(msg));
+
+  char buf[16] = {};
+  // Peek does not consume.
+  EXPECT_EQ(rx->Peek(buf, 3), 3);
+  EXPECT_EQ(rx->Peek(buf, sizeof(buf)), sizeof(msg));
+  EXPECT_STREQ(buf, msg);
+  rx->Skip(sizeof(msg));
+  EXPECT_EQ(rx->Peek(buf, sizeof(buf)), 0);
+
+  delete rx;
+  delete tx;
+}
+
+TEST(ShmRingTest, CapacityMustBePowerOfTwo)
+{
+  EXPECT_EQ(ShmRing::Create(TestRingName("cap"), 3000), nullptr);
+}
+
+TEST(ShmRingTest, FullRingAndWrapAround)
+{
+  auto name = TestRingName("wrap");
+  auto tx = ShmRing::Create(name, 64);
+  auto rx = ShmRing::Open(name);
+  ASSERT_NE(rx, nullptr);
+
+  uint8_t in[100], out[100];
+  for (int i = 0; i < 100; i++) in[i] = i;
+
+  EXPECT_EQ(tx->Write(in, 100), 64);
+  EXPECT_EQ(tx->Write(in, 1), 0);
+
+  rx->Skip(40);
+  // 40 bytes of room, and the write crosses the end of the ring.
+  EXPECT_EQ(tx->Write(in + 64, 36), 36);
+  EXPECT_EQ(rx->Peek(out, 100), 60);
+  for (int i = 0; i < 60; i++) EXPECT_EQ(out[i], 40 + i);
+
+  delete rx;
+  delete tx;
+}
+
+TEST(ShmRingTest, ProducerConsumerThreads)
+{
+  auto name = TestRingName("threads");
+  auto tx = ShmRing::Create(name, 1 << 12);
+  auto rx = ShmRing::Open(name);
+  ASSERT_NE(rx, nullptr);
+
+  constexpr uint64_t kTotal = 1 << 16;
+  std::thread producer([tx]() {
+    uint64_t next = 0;
+    std::vector<uint64_t> chunk;
+    while (next < kTotal) {
+      // Odd sized chunks, so that values straddle the end of the ring.
+      chunk.clear();
+      for (int i = 0; i < 37 && next + i < kTotal; i++) chunk.push_back(next + i);
+      auto p = (const uint8_t *) chunk.data();
+      size_t len = chunk.size() * 8;
+      while (len > 0) {
+        auto n = tx->Write(p, len);
+        p += n;
+        len -= n;
+      }
+      next += chunk.size();
+    }
+  });
+
+  uint64_t expect = 0;
+  while (expect < kTotal) {
+    uint64_t v;
+    if (rx->Peek(&v, 8) < 8) continue;
+    ASSERT_EQ(v, expect);
+    rx->Skip(8);
+    expect++;
+  }
+  producer.join();
+
+  delete rx;
+  delete tx;
+}
@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "index.h"
+#include "test/dbtest_util.h"
+
+namespace felis {
+
+namespace {
+
+class SwissTableIndexTest : public testing::Test {
+ public:
+  void SetUp() final override {
+    InitRowPool();
+  }
+};
+
+std::unique_ptr<SwissTableIndex> NewIndex(size_t nr_rows, HashFunc hash = DefaultHash)
+{
+  auto index = std::make_unique<SwissTableIndex>(std::make_tuple(hash, nr_rows, false));
+  index->set_id(0);
+  return index;
+}
+
+VarStrView KeyView(const std::string &k)
+{
+  return VarStrView(k.length(), (const uint8_t *) k.data());
+}
+
+std::vector<std::string> GenerateKeys(size_t nr_keys, size_t first = 0, const std::string &prefix = "key")
+{
+  std::vector<std::string> keys;
+  for (size_t i = first; i < first + nr_keys; i++) keys.push_back(prefix + std::to_string(i));
+  return keys;
+}
+
+template <typename Func>
+void RunOnThreads(int nr_threads, Func f)
+{
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nr_threads; t++) {
+    threads.emplace_back(
+        [t, &f]() {
+          mem::ParallelPool::SetCurrentAffinity(t);
+          f(t);
+          mem::ParallelPool::SetCurrentAffinity(-1);
+        });
+  }
+  for (auto &th: threads) th.join();
+}
+
+// Every key has the same tag and starts in the same group.
+uint32_t CollidingHash(const VarStrView &k)
+{
+  return 0;
+}
+
+// Like the Item ids: sequential, and the low 7 bits change the fastest.
+uint32_t SequentialHash(const VarStrView &k)
+{
+  // Past the "key" prefix.
+  return std::stoul(std::string((const char *) k.data() + 3, k.length() - 3));
+}
+
+}
+
+TEST_F(SwissTableIndexTest, Capacity)
+{
+  for (size_t nr_rows: {1, 15, 16, 1000, 100000}) {
+    auto index = NewIndex(nr_rows);
+    auto cap = index->capacity();
+    EXPECT_EQ(cap % SwissTableIndex::kGroupSize, 0u);
+    EXPECT_EQ(__builtin_popcountll(cap / SwissTableIndex::kGroupSize), 1) << cap;
+    EXPECT_GE(cap * SwissTableIndex::kMaxLoadNumerator,
+              nr_rows * SwissTableIndex::kMaxLoadDenominator) << nr_rows;
+  }
+}
+
+// With one tag and one home group, the keys spill over several groups, and
+// every tag matches, so only the key comparison tells the rows apart.
+TEST_F(SwissTableIndexTest, ProbeFullGroups)
+{
+  auto keys = GenerateKeys(5 * SwissTableIndex::kGroupSize + 3);
+  auto index = NewIndex(keys.size(), CollidingHash);
+
+  std::vector<VHandle *> rows;
+  RunOnThreads(
+      1,
+      [&](int t) {
+        for (auto &k: keys) {
+          bool created = false;
+          rows.push_back(index->SearchOrCreate(KeyView(k), &created));
+          EXPECT_TRUE(created) << k;
+        }
+        for (size_t i = 0; i < keys.size(); i++) {
+          bool created = true;
+          EXPECT_EQ(index->SearchOrCreate(KeyView(keys[i]), &created), rows[i]) << keys[i];
+          EXPECT_FALSE(created) << keys[i];
+        }
+      });
+  for (size_t i = 0; i < keys.size(); i++)
+    EXPECT_EQ(index->Search(KeyView(keys[i])), rows[i]) << keys[i];
+  EXPECT_EQ(std::unordered_set<VHandle *>(rows.begin(), rows.end()).size(), keys.size());
+
+  for (auto &k: GenerateKeys(64, keys.size()))
+    EXPECT_EQ(index->Search(KeyView(k)), nullptr) << k;
+}
+
+// Several threads insert the same keys, in different orders, until the table
+// holds as many rows as it was sized for.
+TEST_F(SwissTableIndexTest, ConcurrentInsertToCapacity)
+{
+  auto keys = GenerateKeys(1 << 16);
+  auto index = NewIndex(keys.size(), SequentialHash);
+  std::vector<std::vector<VHandle *>> rows(kTestNrThreads, std::vector<VHandle *>(keys.size()));
+  std::vector<std::atomic_int> nr_created(keys.size());
+
+  RunOnThreads(
+      kTestNrThreads,
+      [&](int t) {
+        std::vector<size_t> order(keys.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937(t));
+        for (auto i: order) {
+          bool created = false;
+          rows[t][i] = index->SearchOrCreate(KeyView(keys[i]), &created);
+          if (created) nr_created[i].fetch_add(1);
+        }
+      });
+
+  std::unordered_set<VHandle *> distinct;
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(nr_created[i].load(), 1) << keys[i];
+    for (int t = 1; t < kTestNrThreads; t++)
+      ASSERT_EQ(rows[t][i], rows[0][i]) << keys[i];
+    distinct.insert(rows[0][i]);
+  }
+  EXPECT_EQ(distinct.size(), keys.size());
+
+  std::vector<VarStrView> views;
+  for (auto &k: keys) views.push_back(KeyView(k));
+  std::vector<VHandle *> found(keys.size());
+  index->SearchBatch(views.data(), views.size(), found.data());
+  EXPECT_EQ(found, rows[0]);
+
+  for (auto &k: GenerateKeys(1024, keys.size()))
+    EXPECT_EQ(index->Search(KeyView(k)), nullptr) << k;
+}
+
+TEST_F(SwissTableIndexTest, LongKeys)
+{
+  auto keys = GenerateKeys(1000, 0, std::string(4 * HashEntry::kInlineKeySize, 'x'));
+  auto index = NewIndex(keys.size());
+
+  std::vector<VHandle *> rows;
+  RunOnThreads(1, [&](int t) { for (auto &k: keys) rows.push_back(index->SearchOrCreate(KeyView(k))); });
+  for (size_t i = 0; i < keys.size(); i++)
+    EXPECT_EQ(index->Search(KeyView(keys[i])), rows[i]) << keys[i];
+  EXPECT_EQ(index->Search(KeyView(std::string(4 * HashEntry::kInlineKeySize, 'x'))), nullptr);
+}
+
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+
+#include "uring.h"
+
+using namespace felis;
+
+// A connected pair of TCP sockets over loopback.
+struct LoopbackPair {
+  int client = -1, server = -1;
+
+  LoopbackPair() {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (sockaddr *) &addr, len) < 0 || listen(listener, 1) < 0
+        || getsockname(listener, (sockaddr *) &addr, &len) < 0) {
+      close(listener);
+      return;
+    }
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client, (sockaddr *) &addr, len) == 0)
+      server = accept(listener, nullptr, nullptr);
+    close(listener);
+  }
+  ~LoopbackPair() {
+    if (client >= 0) close(client);
+    if (server >= 0) close(server);
+  }
+
+  std::string ReadAll(size_t len) {
+    std::string s(len, '\0');
+    size_t off = 0;
+    while (off < len) {
+      auto rs = read(server, s.data() + off, len - off);
+      if (rs <= 0) break;
+      off += rs;
+    }
+    s.resize(off);
+    return s;
+  }
+};
+
+class IoUringTest : public testing::Test {
+ protected:
+  IoUring ring;
+
+  void SetUp() override {
+    int rs = ring.Init(8);
+    if (rs < 0)
+      GTEST_SKIP() << "io_uring is not available: " << strerror(-rs);
+  }
+
+  // Wait for nr completions.
+  template <typename F>
+  void Wait(unsigned nr, F f) {
+    while (true) {
+      nr -= ring.ForEachCompletion(f);
+      if (nr == 0) break;
+      ring.Submit(nr);
+    }
+  }
+};
+
+TEST_F(IoUringTest, SendMsgGathersVectors)
+{
+  LoopbackPair conn;
+  ASSERT_GE(conn.server, 0);
+
+  std::string a = "piece", b = "-", c = "routine";
+  iovec iov[3] = {{a.data(), a.size()}, {b.data(), b.size()}, {c.data(), c.size()}};
+  msghdr msg = {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 3;
+
+  auto sqe = ring.GetSqe();
+  ASSERT_NE(sqe, nullptr);
+  ring.PrepSendMsg(sqe, conn.client, &msg, MSG_NOSIGNAL | MSG_WAITALL, 42);
+  EXPECT_EQ(ring.Submit(1), 1);
+
+  int res = -1;
+  uint64_t data = 0;
+  Wait(1, [&](uint64_t user_data, int r) { data = user_data; res = r; });
+  EXPECT_EQ(data, 42);
+  EXPECT_EQ(res, 13);
+  EXPECT_EQ(conn.ReadAll(13), "piece-routine");
+}
+
+TEST_F(IoUringTest, BatchedSubmission)
+{
+  LoopbackPair conns[3];
+  std::string payloads[3] = {"node1", "node2", "node3"};
+  iovec iov[3];
+  msghdr msg[3];
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_GE(conns[i].server, 0);
+    iov[i] = {payloads[i].data(), payloads[i].size()};
+    msg[i] = {};
+    msg[i].msg_iov = &iov[i];
+    msg[i].msg_iovlen = 1;
+    ring.PrepSendMsg(ring.GetSqe(), conns[i].client, &msg[i], MSG_NOSIGNAL, i);
+  }
+  EXPECT_EQ(ring.Submit(3), 3);
+
+  int res[3] = {-1, -1, -1};
+  Wait(3, [&](uint64_t idx, int r) { res[idx] = r; });
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(res[i], 5);
+    EXPECT_EQ(conns[i].ReadAll(5), payloads[i]);
+  }
+}
+
+TEST_F(IoUringTest, FullSubmissionQueue)
+{
+  // Init(8) gives exactly 8 entries
+  for (int i = 0; i < 8; i++) {
+    EXPECT_NE(ring.GetSqe(), nullptr);
+  }
+  EXPECT_EQ(ring.GetSqe(), nullptr);
+}
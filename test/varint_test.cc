@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "util/varint.h"
+
+TEST(VarintTest, Boundaries)
+{
+  uint64_t values[] = {0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 1ULL << 32,
+                       std::numeric_limits<uint64_t>::max()};
+  for (auto v: values) {
+    uint8_t buf[util::kMaxVarintSize];
+    auto end = util::EncodeVarint(buf, v);
+    EXPECT_EQ(end - buf, util::VarintSize(v));
+
+    uint64_t decoded = 0;
+    EXPECT_EQ(util::DecodeVarint((const uint8_t *) buf, end, &decoded), end);
+    EXPECT_EQ(decoded, v);
+  }
+  EXPECT_EQ(util::VarintSize(0x7F), 1);
+  EXPECT_EQ(util::VarintSize(0x80), 2);
+  EXPECT_EQ(util::VarintSize(std::numeric_limits<uint64_t>::max()), util::kMaxVarintSize);
+}
+
+TEST(VarintTest, ZigZagKeepsSmallDeltasSmall)
+{
+  int64_t values[] = {0, -1, 1, -64, 63, std::numeric_limits<int64_t>::min(),
+                      std::numeric_limits<int64_t>::max()};
+  for (auto v: values) {
+    EXPECT_EQ(util::UnZigZag(util::ZigZag(v)), v);
+  }
+  EXPECT_EQ(util::VarintSize(util::ZigZag(-64)), 1);
+  EXPECT_EQ(util::VarintSize(util::ZigZag(63)), 1);
+}
+
+// Encode random records of mixed widths back to back, like a packet, and decode
+// them again.
+TEST(VarintTest, FuzzRoundTrip)
+{
+  std::mt19937_64 rand(0xCA9ACA1);
+  for (int round = 0; round < 1000; round++) {
+    std::vector<uint64_t> values(rand() % 64);
+    for (auto &v: values) {
+      v = rand() >> (rand() % 64);
+    }
+
+    std::vector<uint8_t> buf(values.size() * util::kMaxVarintSize);
+    auto p = buf.data();
+    for (auto v: values) {
+      if (v & 1)
+        p = util::EncodeVarint(p, util::ZigZag(-int64_t(v >> 1)));
+      else
+        p = util::EncodeVarint(p, v);
+    }
+    const uint8_t *end = p;
+
+    const uint8_t *q = buf.data();
+    for (auto v: values) {
+      uint64_t decoded;
+      q = util::DecodeVarint(q, end, &decoded);
+      ASSERT_NE(q, nullptr);
+      if (v & 1)
+        EXPECT_EQ(util::UnZigZag(decoded), -int64_t(v >> 1));
+      else
+        EXPECT_EQ(decoded, v);
+    }
+    EXPECT_EQ(q, end);
+  }
+}
+
+// Decoding garbage must stop at the end of the buffer, and never accept more
+// than kMaxVarintSize bytes.
+TEST(VarintTest, FuzzGarbage)
+{
+  std::mt19937 rand(7);
+  for (int round = 0; round < 10000; round++) {
+    std::vector<uint8_t> buf(rand() % 16);
+    for (auto &b: buf) {
+      // Mostly continuation bytes, so we hit the truncated cases.
+      b = rand() % 8 ? (rand() | 0x80) : rand();
+    }
+    const uint8_t *p = buf.data(), *end = buf.data() + buf.size();
+    while (p != nullptr && p < end) {
+      uint64_t v;
+      auto next = util::DecodeVarint(p, end, &v);
+      if (next) {
+        EXPECT_LE(next, end);
+        EXPECT_LE(next - p, util::kMaxVarintSize);
+      }
+      p = next;
+    }
+  }
+}
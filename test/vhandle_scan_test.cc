@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "vhandle.h"
+#include "gc.h"
+#include "test/dbtest_util.h"
+
+namespace felis {
+
+namespace {
+
+constexpr uint64_t kEpochNr = 1;
+constexpr uint64_t kFirstSid = kEpochNr << 32;
+// Grows the version array from the inline one up to 256 versions.
+constexpr int kNrVersions = 200;
+
+class VHandleScanTest : public testing::Test {
+ public:
+  void SetUp() final override {
+    InitRowPool();
+  }
+};
+
+// Reuses whatever the appender just freed, so that a reader left on a freed
+// version array sees garbage.
+void ChurnDataRegion()
+{
+  auto &region = mem::GetDataRegion();
+  for (size_t sz = 128; sz <= 4096; sz *= 2) {
+    auto p = region.Alloc(sz);
+    memset(p, 0, sz);
+    region.Free(p, mem::ParallelPool::CurrentAffinity(), sz);
+  }
+}
+
+}
+
+// One thread keeps appending, which swaps the version array every time it
+// grows, while the others scan without the lock. The first version never
+// changes, so every scan has to agree on it.
+TEST_F(VHandleScanTest, ConcurrentAppendScan)
+{
+  auto &gc = util::Instance<GC>();
+  std::atomic_bool done = false;
+  std::atomic_long nr_wrong = 0;
+  std::vector<std::thread> threads;
+
+  mem::ParallelPool::SetCurrentAffinity(0);
+  auto row = (VHandle *) VHandle::New();
+  row->AppendNewVersion(kFirstSid, kEpochNr);
+
+  for (int t = 1; t < kTestNrThreads; t++) {
+    threads.emplace_back(
+        [row, &done, &nr_wrong]() {
+          while (!done.load(std::memory_order_acquire)) {
+            if (!row->ShouldScanSkip(kFirstSid) || row->ShouldScanSkip(kFirstSid + 1))
+              nr_wrong.fetch_add(1);
+          }
+        });
+  }
+
+  for (int i = 1; i < kNrVersions; i++) {
+    row->AppendNewVersion(kFirstSid + i, kEpochNr);
+    ChurnDataRegion();
+  }
+  done = true;
+  for (auto &th: threads) th.join();
+
+  EXPECT_EQ(nr_wrong.load(), 0);
+  ASSERT_EQ(row->nr_versions(), kNrVersions);
+  EXPECT_EQ(row->first_version(), kFirstSid);
+  EXPECT_EQ(row->last_version(), kFirstSid + kNrVersions - 1);
+
+  // 8 up to 128 versions, the inline array isn't freed.
+  EXPECT_EQ(gc.nr_retired_versions(), 5u);
+  gc.ReclaimVersions(kEpochNr);
+  EXPECT_EQ(gc.nr_retired_versions(), 5u);
+  gc.ReclaimVersions(kEpochNr + 1);
+  EXPECT_EQ(gc.nr_retired_versions(), 0u);
+
+  gc.FreeRow(row);
+  mem::ParallelPool::SetCurrentAffinity(-1);
+}
+
+}
@@ -1,10 +1,15 @@
 #include "txn.h"
 #include "index.h"
 #include "util/objects.h"
+#include "util/varint.h"
 #include "literals.h"
 #include "gc.h"
 #include "commit_buffer.h"
 #include "coro_sched.h"
+#include "task_sched.h"
+#include "hot_row_detector.h"
+#include "repartition.h"
+#include "slice_balancer.h"
 
 namespace felis {
 
@@ -90,6 +95,9 @@ int64_t BaseTxn::UpdateForKeyAffinity(int node, VHandle *row)
     if (row->contention_affinity() == -1 || (node != 0 && conf.node_id() != node))
       goto nosplit;
 
+    if (HotRowDetector::g_enabled && !util::Instance<HotRowDetector>().IsHot(row))
+      goto nosplit;
+
     auto client = EpochClient::g_workload_client;
     auto commit_buffer = client->commit_buffer;
 
@@ -131,75 +139,170 @@ BaseTxn::BaseTxnIndexOpContext::BaseTxnIndexOpContext(
       });
 }
 
+static uint64_t SerialIdDelta(uint64_t sid, uint64_t epoch_nr)
+{
+  return util::ZigZag(int64_t(sid - (epoch_nr << 32)));
+}
+
 size_t BaseTxn::BaseTxnIndexOpContext::EncodeSize() const
 {
-    size_t sum = 0;
-    int nr_keys = __builtin_popcount(keys_bitmap);
-    for (auto i = 0; i < nr_keys; i++) {
-      sum += 2 + key_len[i];
-    }
-    sum += __builtin_popcount(slices_bitmap) * sizeof(uint16_t);
-    sum += __builtin_popcount(rels_bitmap) * sizeof(int16_t);
-    return kHeaderSize + sum;
+  size_t sum = util::VarintSize(handle.epoch_nr)
+               + util::VarintSize(SerialIdDelta(handle.sid, handle.epoch_nr))
+               + util::VarintSize(util::ZigZag(int64_t(state.epoch_nr - handle.epoch_nr)))
+               + util::VarintSize(state.node_id)
+               + util::VarintSize(util::ZigZag(state.offset))
+               + util::VarintSize(keys_bitmap)
+               + util::VarintSize(slices_bitmap)
+               + util::VarintSize(rels_bitmap)
+               + util::VarintSize(node_id)
+               + util::VarintSize(src_node_id);
+  int nr_keys = __builtin_popcount(keys_bitmap);
+  int nr_slices = __builtin_popcount(slices_bitmap);
+  int nr_rels = __builtin_popcount(rels_bitmap);
+
+  for (auto i = 0; i < nr_keys; i++) {
+    sum += util::VarintSize(key_len[i]) + key_len[i];
+  }
+  for (auto i = 0; i < nr_slices; i++) {
+    sum += util::VarintSize(util::ZigZag(slice_ids[i]));
+  }
+  for (auto i = 0; i < nr_rels; i++) {
+    sum += util::VarintSize(util::ZigZag(relation_ids[i]));
+  }
+  return sum;
 }
 
 uint8_t *BaseTxn::BaseTxnIndexOpContext::EncodeTo(uint8_t *buf) const
 {
-  memcpy(buf, this, kHeaderSize);
-  uint8_t *p = buf + kHeaderSize;
+  uint8_t *p = buf;
+  p = util::EncodeVarint(p, handle.epoch_nr);
+  p = util::EncodeVarint(p, SerialIdDelta(handle.sid, handle.epoch_nr));
+  p = util::EncodeVarint(p, util::ZigZag(int64_t(state.epoch_nr - handle.epoch_nr)));
+  p = util::EncodeVarint(p, state.node_id);
+  p = util::EncodeVarint(p, util::ZigZag(state.offset));
+  p = util::EncodeVarint(p, keys_bitmap);
+  p = util::EncodeVarint(p, slices_bitmap);
+  p = util::EncodeVarint(p, rels_bitmap);
+  p = util::EncodeVarint(p, node_id);
+  p = util::EncodeVarint(p, src_node_id);
+
   int nr_keys = __builtin_popcount(keys_bitmap);
   int nr_slices = __builtin_popcount(slices_bitmap);
   int nr_rels = __builtin_popcount(rels_bitmap);
 
   for (auto i = 0; i < nr_keys; i++) {
-    memcpy(p, &key_len[i], 2);
-    memcpy(p + 2, key_data[i], key_len[i]);
-    p += 2 + key_len[i];
+    p = util::EncodeVarint(p, key_len[i]);
+    memcpy(p, key_data[i], key_len[i]);
+    p += key_len[i];
+  }
+  for (auto i = 0; i < nr_slices; i++) {
+    p = util::EncodeVarint(p, util::ZigZag(slice_ids[i]));
+  }
+  for (auto i = 0; i < nr_rels; i++) {
+    p = util::EncodeVarint(p, util::ZigZag(relation_ids[i]));
   }
 
-  memcpy(p, slice_ids, nr_slices * sizeof(int16_t));
-  p += nr_slices * sizeof(int16_t);
-
-  memcpy(p, relation_ids, nr_rels * sizeof(int16_t));
-  p += nr_rels * sizeof(int16_t);
+  return p;
+}
 
+// The closure is already in the packet, the length was checked when the piece
+// was decoded.
+static const uint8_t *DecodeContextVarint(const uint8_t *p, uint64_t *v)
+{
+  p = util::DecodeVarint(p, p + util::kMaxVarintSize, v);
+  abort_if(p == nullptr, "Corrupted index op context");
   return p;
 }
 
 const uint8_t *BaseTxn::BaseTxnIndexOpContext::DecodeFrom(const uint8_t *buf)
 {
-  memcpy(this, buf, kHeaderSize);
+  const uint8_t *p = buf;
+  uint64_t v;
+
+  p = DecodeContextVarint(p, &handle.epoch_nr);
+  p = DecodeContextVarint(p, &v);
+  handle.sid = (handle.epoch_nr << 32) + util::UnZigZag(v);
+  p = DecodeContextVarint(p, &v);
+  state.epoch_nr = handle.epoch_nr + util::UnZigZag(v);
+  p = DecodeContextVarint(p, &v);
+  state.node_id = v;
+  p = DecodeContextVarint(p, &v);
+  state.offset = util::UnZigZag(v);
+  p = DecodeContextVarint(p, &v);
+  keys_bitmap = v;
+  p = DecodeContextVarint(p, &v);
+  slices_bitmap = v;
+  p = DecodeContextVarint(p, &v);
+  rels_bitmap = v;
+  p = DecodeContextVarint(p, &v);
+  node_id = v;
+  p = DecodeContextVarint(p, &v);
+  src_node_id = v;
 
-  const uint8_t *p = buf + kHeaderSize;
   int nr_keys = __builtin_popcount(keys_bitmap);
   int nr_slices = __builtin_popcount(slices_bitmap);
   int nr_rels = __builtin_popcount(rels_bitmap);
 
   for (auto i = 0; i < nr_keys; i++) {
-    memcpy(&key_len[i], p, 2);
-    key_data[i] = (uint8_t *) p + 2;
-    p += 2 + key_len[i];
+    p = DecodeContextVarint(p, &v);
+    key_len[i] = v;
+    key_data[i] = p;
+    p += key_len[i];
+  }
+  for (auto i = 0; i < nr_slices; i++) {
+    p = DecodeContextVarint(p, &v);
+    slice_ids[i] = util::UnZigZag(v);
+  }
+  for (auto i = 0; i < nr_rels; i++) {
+    p = DecodeContextVarint(p, &v);
+    relation_ids[i] = util::UnZigZag(v);
   }
 
-  memcpy(slice_ids, p, nr_slices * sizeof(int16_t));
-  p += nr_slices * sizeof(int16_t);
+  return p;
+}
 
-  memcpy(relation_ids, p, nr_rels * sizeof(int16_t));
-  p += nr_rels * sizeof(int16_t);
+static bool IsPointLookup(const BaseTxn::BaseTxnIndexOpContext &ctx, int idx)
+{
+  return ctx.slice_ids[idx] >= 0 || ctx.slice_ids[idx] == kReadOnlySliceId;
+}
 
-  return p;
+void BaseTxn::BaseTxnIndexOpLookupBatch(const BaseTxnIndexOpContext &ctx, VHandle **rows)
+{
+  auto &mgr = util::Instance<TableManager>();
+  int nr_keys = __builtin_popcount(ctx.keys_bitmap);
+  VarStrView keys[BaseTxnIndexOpContext::kMaxPackedKeys];
+
+  // Consecutive point lookups on the same table go in one batch.
+  for (int i = 0; i < nr_keys;) {
+    if (!IsPointLookup(ctx, i)) {
+      rows[i++] = nullptr;
+      continue;
+    }
+    int j = i;
+    for (; j < nr_keys && IsPointLookup(ctx, j) && ctx.relation_ids[j] == ctx.relation_ids[i]; j++)
+      keys[j] = VarStrView(ctx.key_len[j], ctx.key_data[j]);
+    mgr.GetTable(ctx.relation_ids[i])->SearchBatch(keys + i, j - i, rows + i);
+    i = j;
+  }
 }
 
-BaseTxn::LookupRowResult BaseTxn::BaseTxnIndexOpLookup(const BaseTxnIndexOpContext &ctx, int idx)
+BaseTxn::LookupRowResult BaseTxn::BaseTxnIndexOpLookup(const BaseTxnIndexOpContext &ctx, int idx,
+                                                       VHandle * const *rows)
 {
   auto tbl = util::Instance<TableManager>().GetTable(ctx.relation_ids[idx]);
   BaseTxn::LookupRowResult result;
   result.fill(nullptr);
 
-  if (ctx.slice_ids[idx] >= 0 || ctx.slice_ids[idx] == kReadOnlySliceId) {
+  if (IsPointLookup(ctx, idx)) {
     VarStrView key(ctx.key_len[idx], ctx.key_data[idx]);
-    auto handle = tbl->Search(key);
+    auto handle = rows ? rows[idx] : tbl->Search(key);
     result[0] = handle;
+    if (Repartitioner::g_enabled)
+      util::Instance<Repartitioner>().Count(ctx.slice_ids[idx]);
+    if (SliceCoreBalancer::g_enabled)
+      util::Instance<SliceCoreBalancer>().Count(ctx.slice_ids[idx]);
+    if (HotRowDetector::g_enabled && handle)
+      util::Instance<HotRowDetector>().RecordKey(handle, key);
   } else if (ctx.slice_ids[idx] == -1) {
     VarStrView range_start(ctx.key_len[idx], ctx.key_data[idx]);
     VarStrView range_end(ctx.key_len[idx + 1], ctx.key_data[idx + 1]);
@@ -235,6 +338,10 @@ VHandle *BaseTxn::BaseTxnIndexOpInsert(const BaseTxnIndexOpContext &ctx, int idx
   VarStrView key(ctx.key_len[idx], ctx.key_data[idx]);
   bool created = false;
   VHandle *result = tbl->SearchOrCreate(key, &created);
+  if (Repartitioner::g_enabled)
+    util::Instance<Repartitioner>().Count(ctx.slice_ids[idx]);
+  if (SliceCoreBalancer::g_enabled)
+    util::Instance<SliceCoreBalancer>().Count(ctx.slice_ids[idx]);
 
   if (created) {
     VarStr *kstr = VarStr::New(ctx.key_len[idx]);
@@ -271,6 +378,9 @@ void BaseFutureValue::Wait()
     bool preempted;
     if (Options::kUseCoroutineScheduler) {
       preempted = coro_sched->WaitForFutureValue(this);
+    } else if (TaskSched::g_use_task_sched) {
+      task_sched->WaitInline();
+      preempted = false;
     } else {
       preempted = ((BasePieceCollection::ExecutionRoutine *) routine)->Preempt(0, 0);
     }
@@ -109,6 +109,7 @@ class BaseTxn {
   };
 
   class BaseTxnHandle {
+    friend class BaseTxn;
    protected:
     uint64_t sid;
     uint64_t epoch_nr;
@@ -157,12 +158,9 @@ class BaseTxn {
       }
     }
 
-    // We don't need to worry about padding because TxnHandle is perfectly padded.
-    // We also need to send three bitmaps.
-    static constexpr size_t kHeaderSize =
-        sizeof(BaseTxnHandle) + sizeof(EpochObject)
-        + sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint16_t) * 2;
-
+    // On the wire, the header fields are varints. The serial id is a delta to
+    // the start of its epoch, and the key lengths, slice ids and relation ids
+    // that follow are varints too.
     BaseTxnIndexOpContext(BaseTxnHandle handle, EpochObject state,
                       uint16_t keys_bitmap, VarStr **keys,
                       uint16_t slices_bitmap, int16_t *slice_ids,
@@ -179,13 +177,20 @@ class BaseTxn {
   static constexpr size_t kMaxRangeScanKeys = 32;
   using LookupRowResult = std::array<VHandle *, kMaxRangeScanKeys>;
 
-  static LookupRowResult BaseTxnIndexOpLookup(const BaseTxnIndexOpContext &ctx, int idx);
+  // Point lookups of a context, all at once through Table::SearchBatch().
+  // Range lookups are left as nullptr.
+  static void BaseTxnIndexOpLookupBatch(const BaseTxnIndexOpContext &ctx, VHandle **rows);
+  // rows is from BaseTxnIndexOpLookupBatch(). Without it, we search here.
+  static LookupRowResult BaseTxnIndexOpLookup(const BaseTxnIndexOpContext &ctx, int idx,
+                                              VHandle * const *rows = nullptr);
   static VHandle *BaseTxnIndexOpInsert(const BaseTxnIndexOpContext &ctx, int idx);
 };
 
 class BaseFutureValue {
   friend class TcpNodeTransport;
   friend class CoroSched;
+  friend class TaskSched;
+  friend struct FutureAwaiter;
  public:
   static constexpr uint8_t kMaxSubscription = 6;
  protected:
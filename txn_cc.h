@@ -402,10 +402,11 @@ class Txn : public BaseTxn {
               completion.handle = ctx.handle;
               completion.state = State(ctx.state);
 
+              typename IndexOp::Batch batch(ctx);
               TxnIndexOpContext::ForEachWithBitmap(
                   ctx.keys_bitmap,
-                  [&ctx, &completion](int j, int i) {
-                    auto op = IndexOp(ctx, j);
+                  [&ctx, &completion, &batch](int j, int i) {
+                    auto op = IndexOp(ctx, j, batch);
                     completion(i, op.result);
                   });
             },
@@ -419,10 +420,11 @@ class Txn : public BaseTxn {
         completion.handle = TxnHandle(op_ctx.handle);
         completion.state = State(op_ctx.state);
 
+        typename IndexOp::Batch batch(op_ctx);
         TxnIndexOpContext::ForEachWithBitmap(
             op_ctx.keys_bitmap,
-            [&op_ctx, &completion](int j, int i) {
-              auto op = IndexOp(op_ctx, j);
+            [&op_ctx, &completion, &batch](int j, int i) {
+              auto op = IndexOp(op_ctx, j, batch);
               completion(i, op.result);
             });
       }
@@ -444,17 +446,26 @@ class Txn : public BaseTxn {
   }
 
  public:
+  // Each IndexOp has a Batch, made once for the whole context before the
+  // per-key ops.
   struct TxnIndexLookupOpImpl {
     using ResultType = LookupRowResult;
+    struct Batch {
+      VHandle *rows[BaseTxnIndexOpContext::kMaxPackedKeys];
+      Batch(const BaseTxnIndexOpContext &ctx) { BaseTxnIndexOpLookupBatch(ctx, rows); }
+    };
     LookupRowResult result;
-    TxnIndexLookupOpImpl(const BaseTxnIndexOpContext &ctx, int idx) {
-      result = BaseTxnIndexOpLookup(ctx, idx);
+    TxnIndexLookupOpImpl(const BaseTxnIndexOpContext &ctx, int idx, const Batch &batch) {
+      result = BaseTxnIndexOpLookup(ctx, idx, batch.rows);
     }
   };
   struct TxnIndexInsertOpImpl {
     using ResultType = VHandle *;
+    struct Batch {
+      Batch(const BaseTxnIndexOpContext &ctx) {}
+    };
     VHandle *result;
-    TxnIndexInsertOpImpl(const BaseTxnIndexOpContext &ctx, int idx) {
+    TxnIndexInsertOpImpl(const BaseTxnIndexOpContext &ctx, int idx, const Batch &batch) {
       result = BaseTxnIndexOpInsert(ctx, idx);
     }
   };
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+namespace felis {
+
+static int SysSetup(unsigned entries, io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int SysEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+IoUring::~IoUring()
+{
+  if (sqes) munmap(sqes, sqes_len);
+  if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+  if (sq_ptr) munmap(sq_ptr, sq_len);
+  if (ring_fd >= 0) close(ring_fd);
+}
+
+int IoUring::Init(unsigned entries)
+{
+  io_uring_params p;
+  memset(&p, 0, sizeof(io_uring_params));
+
+  int fd = SysSetup(entries, &p);
+  if (fd < 0) return -errno;
+
+  sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_len = cq_len = std::max(sq_len, cq_len);
+  }
+
+  sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) goto fail;
+
+  if (single_mmap) {
+    cq_ptr = sq_ptr;
+  } else {
+    cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) goto fail;
+  }
+
+  sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+  sqes = (io_uring_sqe *) mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) goto fail;
+
+  sq_head = (unsigned *) ((uint8_t *) sq_ptr + p.sq_off.head);
+  sq_tail = (unsigned *) ((uint8_t *) sq_ptr + p.sq_off.tail);
+  sq_mask = (unsigned *) ((uint8_t *) sq_ptr + p.sq_off.ring_mask);
+  sq_array = (unsigned *) ((uint8_t *) sq_ptr + p.sq_off.array);
+
+  cq_head = (unsigned *) ((uint8_t *) cq_ptr + p.cq_off.head);
+  cq_tail = (unsigned *) ((uint8_t *) cq_ptr + p.cq_off.tail);
+  cq_mask = (unsigned *) ((uint8_t *) cq_ptr + p.cq_off.ring_mask);
+  cqes = (io_uring_cqe *) ((uint8_t *) cq_ptr + p.cq_off.cqes);
+
+  ring_fd = fd;
+  nr_entries = p.sq_entries;
+  return 0;
+
+fail:
+  int err = -errno;
+  if (sqes == MAP_FAILED) sqes = nullptr;
+  if (cq_ptr == MAP_FAILED) cq_ptr = nullptr;
+  if (sq_ptr == MAP_FAILED) sq_ptr = nullptr;
+  if (sqes) munmap(sqes, sqes_len);
+  if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+  if (sq_ptr) munmap(sq_ptr, sq_len);
+  sqes = nullptr;
+  cq_ptr = sq_ptr = nullptr;
+  close(fd);
+  return err;
+}
+
+io_uring_sqe *IoUring::GetSqe()
+{
+  unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *sq_tail + nr_prepared;
+  if (tail - head >= nr_entries)
+    return nullptr;
+
+  auto idx = tail & *sq_mask;
+  auto sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(io_uring_sqe));
+  sq_array[idx] = idx;
+  nr_prepared++;
+  return sqe;
+}
+
+void IoUring::PrepSendMsg(io_uring_sqe *sqe, int fd, const msghdr *msg, unsigned flags, uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) msg;
+  sqe->len = 1;
+  sqe->msg_flags = flags;
+  sqe->user_data = user_data;
+}
+
+int IoUring::Submit(unsigned wait_nr)
+{
+  unsigned to_submit = nr_prepared;
+  __atomic_store_n(sq_tail, *sq_tail + nr_prepared, __ATOMIC_RELEASE);
+  nr_prepared = 0;
+
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int rs;
+  // The kernel only fails with EINTR if nothing was submitted. Once anything
+  // is submitted, it returns without waiting for all wait_nr completions.
+  do {
+    rs = SysEnter(ring_fd, to_submit, wait_nr, flags);
+  } while (rs < 0 && errno == EINTR);
+  return rs < 0 ? -errno : rs;
+}
+
+}
@@ -0,0 +1,73 @@
+// -*- mode: c++ -*-
+
+#ifndef URING_H
+#define URING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+namespace felis {
+
+// Minimal io_uring ring over the raw system calls, so that we don't depend on
+// liburing. One ring is only used by one thread.
+class IoUring {
+  int ring_fd = -1;
+  unsigned nr_entries = 0;
+
+  void *sq_ptr = nullptr;
+  size_t sq_len = 0;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  io_uring_sqe *sqes = nullptr;
+  size_t sqes_len = 0;
+  unsigned nr_prepared = 0;  /*!< SQEs handed out but not submitted yet */
+
+  void *cq_ptr = nullptr;
+  size_t cq_len = 0;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  io_uring_cqe *cqes;
+
+ public:
+  IoUring() {}
+  IoUring(const IoUring &rhs) = delete;
+  ~IoUring();
+
+  /** Returns -errno if the kernel doesn't give us a ring. */
+  int Init(unsigned entries);
+  bool is_initialized() const { return ring_fd >= 0; }
+
+  /** nullptr if the submission queue is full. */
+  io_uring_sqe *GetSqe();
+  void PrepSendMsg(io_uring_sqe *sqe, int fd, const msghdr *msg, unsigned flags, uint64_t user_data);
+
+  /**
+   * Submit all prepared SQEs, and wait for wait_nr completions. The wait can
+   * end early on a signal, so callers check what ForEachCompletion() finds and
+   * call Submit() again if needed. Returns the number submitted, or -errno.
+   */
+  int Submit(unsigned wait_nr = 0);
+
+  /** Calls f(user_data, res) on every available completion. */
+  template <typename F>
+  unsigned ForEachCompletion(F f) {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    unsigned nr = 0;
+    for (; head != tail; head++, nr++) {
+      auto cqe = &cqes[head & *cq_mask];
+      f(cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return nr;
+  }
+};
+
+}
+
+#endif
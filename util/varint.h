@@ -0,0 +1,69 @@
+// -*- c++ -*-
+#ifndef UTIL_VARINT_H
+#define UTIL_VARINT_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace util {
+
+// LEB128 variable length integers for the wire format. Small values, like
+// node ids, key lengths and deltas between serial ids, take one or two bytes.
+
+static constexpr size_t kMaxVarintSize = 10;
+
+static inline size_t VarintSize(uint64_t v)
+{
+  size_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static inline uint8_t *EncodeVarint(uint8_t *p, uint64_t v)
+{
+  while (v >= 0x80) {
+    *p++ = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+// Returns nullptr if the varint is truncated by end, or is too long.
+static inline const uint8_t *DecodeVarint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    uint64_t b = *p++;
+    result |= (b & 0x7F) << shift;
+    if ((b & 0x80) == 0) {
+      *v = result;
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+static inline uint8_t *DecodeVarint(uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+  return (uint8_t *) DecodeVarint((const uint8_t *) p, end, v);
+}
+
+// Signed values, like deltas, go through ZigZag first so that small negative
+// numbers stay small.
+static inline uint64_t ZigZag(int64_t v)
+{
+  return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t v)
+{
+  return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+}
+
+#endif
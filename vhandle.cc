@@ -12,6 +12,7 @@
 
 #include "opts.h"
 #include "contention_manager.h"
+#include "hot_row_detector.h"
 
 #include "literals.h"
 
@@ -46,7 +47,15 @@ SortedArrayVHandle::SortedArrayVHandle()
 
 bool SortedArrayVHandle::ShouldScanSkip(uint64_t sid)
 {
-  auto epoch_of_txn = sid >> 32;
+  // Only a growing append swaps the version array, and the old one stays
+  // around until the epoch ends. If it's the same array after we read, the
+  // first version we read was there. Other writers only move real versions
+  // around, so we read either the old or the new one.
+  auto p = __atomic_load_n(&versions, __ATOMIC_ACQUIRE);
+  auto first = __atomic_load_n(&p[0], __ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&versions, __ATOMIC_RELAXED) == p)
+    return first >= sid;
+
   util::MCSSpinLock::QNode qnode;
   lock.Acquire(&qnode);
   bool skip = (first_version() >= sid);
@@ -54,11 +63,8 @@ bool SortedArrayVHandle::ShouldScanSkip(uint64_t sid)
   return skip;
 }
 
-static uint64_t *EnlargePair64Array(SortedArrayVHandle *row,
-                                    uint64_t *old_p, unsigned int old_cap, int old_regionid,
-                                    unsigned int new_cap)
+static uint64_t *EnlargePair64Array(uint64_t *old_p, unsigned int old_cap, unsigned int new_cap)
 {
-  const size_t old_len = old_cap * sizeof(uint64_t);
   const size_t new_len = new_cap * sizeof(uint64_t);
 
   auto new_p = (uint64_t *) mem::GetDataRegion().Alloc(2 * new_len);
@@ -69,8 +75,6 @@ static uint64_t *EnlargePair64Array(SortedArrayVHandle *row,
   std::copy(old_p, old_p + old_cap, new_p);
   // memcpy((uint8_t *) new_p + new_len, (uint8_t *) old_p + old_len, old_cap * sizeof(uint64_t));
   std::copy(old_p + old_cap, old_p + 2 * old_cap, new_p + new_cap);
-  if ((uint8_t *) old_p - (uint8_t *) row != 64)
-    mem::GetDataRegion().Free(old_p, old_regionid, 2 * old_len);
   return new_p;
 }
 
@@ -99,7 +103,8 @@ void SortedArrayVHandle::IncreaseSize(int delta, uint64_t epoch_nr)
   if (unlikely(size > capacity)) {
     auto current_regionid = mem::ParallelPool::CurrentAffinity();
     auto new_cap = std::max(8U, 1U << (32 - __builtin_clz((unsigned int) size)));
-    auto new_versions = EnlargePair64Array(this, versions, capacity, alloc_by_regionid, new_cap);
+    auto old_versions = versions;
+    auto new_versions = EnlargePair64Array(old_versions, capacity, new_cap);
 
     probes::VHandleExpand{(void *) this, capacity, new_cap}();
 
@@ -114,7 +119,10 @@ void SortedArrayVHandle::IncreaseSize(int delta, uint64_t epoch_nr)
     }
     */
 
-    versions = new_versions;
+    // ShouldScanSkip() reads the new array without the lock.
+    __atomic_store_n(&versions, new_versions, __ATOMIC_RELEASE);
+    if ((uint8_t *) old_versions - (uint8_t *) this != 64)
+      gc.RetireVersions(old_versions, alloc_by_regionid, 2 * capacity * sizeof(uint64_t), epoch_nr);
     capacity = new_cap;
     alloc_by_regionid = current_regionid;
   }
@@ -201,14 +209,29 @@ void SortedArrayVHandle::AppendNewVersion(uint64_t sid, uint64_t epoch_nr, int o
     util::MCSSpinLock::QNode qnode;
     VersionBufferHandle handle;
 
+    bool hot = true;
+
     if (sid == 0) goto slowpath;
+    if (HotRowDetector::g_enabled) {
+      auto &detector = util::Instance<HotRowDetector>();
+      detector.Count((VHandle *) this);
+      hot = detector.IsHot((VHandle *) this);
+    }
+    if (ContentionManager::g_track_coaccess && buf_pos.load(std::memory_order_relaxed) != -1)
+      util::Instance<ContentionManager>().TrackCoAccess((VHandle *) this, sid);
+
     if (Options::kVHandleBatchAppend) {
+      // With the hot row detector, hot rows of the last epoch go to the buffer
+      // directly. Other rows only use the buffer once they have grown past the
+      // splitting threshold.
       if (buf_pos.load(std::memory_order_acquire) == -1
-          && size - cur_start < EpochClient::g_splitting_threshold
-          && lock.TryLock(&qnode)) {
-        AppendNewVersionNoLock(sid, epoch_nr, ondemand_split_weight);
-        lock.Unlock(&qnode);
-        return;
+          && size - cur_start < EpochClient::g_splitting_threshold) {
+        if (!hot) goto slowpath;
+        if (!HotRowDetector::g_enabled && lock.TryLock(&qnode)) {
+          AppendNewVersionNoLock(sid, epoch_nr, ondemand_split_weight);
+          lock.Unlock(&qnode);
+          return;
+        }
       }
 
       handle = util::Instance<ContentionManager>().GetOrInstall((VHandle *) this);
@@ -218,7 +241,7 @@ void SortedArrayVHandle::AppendNewVersion(uint64_t sid, uint64_t epoch_nr, int o
       }
     } else if (Options::kOnDemandSplitting) {
       // Even if batch append is off, we still create a buf_pos for splitting.
-      if (buf_pos.load(std::memory_order_acquire) == -1
+      if (hot && buf_pos.load(std::memory_order_acquire) == -1
           && size - cur_start >= EpochClient::g_splitting_threshold)
         util::Instance<ContentionManager>().GetOrInstall((VHandle *) this);
     }
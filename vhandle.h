@@ -55,6 +55,7 @@ class SortedArrayVHandle : public BaseVHandle {
   friend class VersionBufferHandle;
   friend class ContentionManager;
   friend class HashtableIndex;
+  friend class SwissTableIndex;
 
   util::MCSSpinLock lock;
   uint8_t alloc_by_regionid;
@@ -72,7 +73,8 @@ class SortedArrayVHandle : public BaseVHandle {
   // [0, capacity - 1] stores version number, [capacity, 2 * capacity - 1] stores ptr to data
   uint64_t *versions;
   util::OwnPtr<RowEntity> row_entity;
-  std::atomic_long buf_pos = -1;
+  std::atomic_int buf_pos = -1;
+  int16_t rel_id = -1; // Set by Table::NewRow(), only used for statistics.
   std::atomic<uint64_t> gc_handle = 0;
 
   SortedArrayVHandle();
@@ -92,6 +94,11 @@ class SortedArrayVHandle : public BaseVHandle {
   bool ShouldScanSkip(uint64_t sid);
   void AppendNewVersion(uint64_t sid, uint64_t epoch_nr, int ondemand_split_weight = 0);
   VarStr *ReadWithVersion(uint64_t sid);
+  // Where ReadWithVersion() would read from, without waiting. For co_await.
+  volatile uintptr_t *ValueAddress(uint64_t sid) {
+    int pos;
+    return WithVersion(sid, pos);
+  }
   VarStr *ReadExactVersion(unsigned int version_idx);
   bool WriteWithVersion(uint64_t sid, VarStr *obj, uint64_t epoch_nr);
   bool WriteExactVersion(unsigned int version_idx, VarStr *obj, uint64_t epoch_nr);
@@ -138,6 +145,8 @@ class SortedArrayVHandle : public BaseVHandle {
   uint8_t region_id() const { return alloc_by_regionid; }
   uint8_t object_coreid() const { return this_coreid; }
   int8_t contention_affinity() const { return cont_affinity; }
+  int relation_id() const { return rel_id; }
+  void set_relation_id(int id) { rel_id = id; }
  private:
   void AppendNewVersionNoLock(uint64_t sid, uint64_t epoch_nr, int ondemand_split_weight);
   unsigned int AbsorbNewVersionNoLock(unsigned int end, unsigned int extra_shift);
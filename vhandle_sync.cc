@@ -6,6 +6,7 @@
 #include "log.h"
 #include "opts.h"
 #include "coro_sched.h"
+#include "task_sched.h"
 
 namespace felis {
 
@@ -138,6 +139,9 @@ bool SpinnerSlot::Spin(uint64_t sid, uint64_t ver, ulong &wait_cnt, volatile uin
       if (CoroSched::g_use_coro_sched) {
         coro_sched->DumpStatus();
       }
+      if (TaskSched::g_use_task_sched) {
+        task_sched->DumpStatus();
+      }
       int dep = dispatch.TraceDependency(ver);
       logger->error("Deadlock on core {}? {} (using {}) waiting for {} ({}) node ({}), ptr {}",
                     core_id, sid, (void *) routine, ver, dep, ver & 0xFF, (void *)ptr);
@@ -155,6 +159,10 @@ bool SpinnerSlot::Spin(uint64_t sid, uint64_t ver, ulong &wait_cnt, volatile uin
       bool preempted;
       if (Options::kUseCoroutineScheduler) {
         preempted = coro_sched->WaitForVHandleVal();
+      } else if (TaskSched::g_use_task_sched) {
+        // Parked tasks might be the ones we wait for. We keep spinning though.
+        task_sched->WaitInline();
+        preempted = false;
       } else {
         preempted = ((BasePieceCollection::ExecutionRoutine *) routine)->Preempt(sid, ver);
       }
@@ -212,6 +220,9 @@ void SimpleSync::WaitForData(volatile uintptr_t *addr, uint64_t sid, uint64_t ve
       if (CoroSched::g_use_coro_sched) {
         coro_sched->DumpStatus();
       }
+      if (TaskSched::g_use_task_sched) {
+        task_sched->DumpStatus();
+      }
       int dep = dispatch.TraceDependency(ver);
       printf("Deadlock on core %d? %lu (using %p) waiting for %lu (%d) node (%lu)\n",
              core_id, sid, routine, ver, dep, ver & 0xFF);
@@ -227,6 +238,10 @@ void SimpleSync::WaitForData(volatile uintptr_t *addr, uint64_t sid, uint64_t ve
       bool preempted;
       if (Options::kUseCoroutineScheduler) {
         preempted = coro_sched->WaitForVHandleVal();
+      } else if (TaskSched::g_use_task_sched) {
+        // Parked tasks might be the ones we wait for. We keep spinning though.
+        task_sched->WaitInline();
+        preempted = false;
       } else {
         preempted = ((BasePieceCollection::ExecutionRoutine *) routine)->Preempt(sid, ver);
       }